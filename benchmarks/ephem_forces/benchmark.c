@@ -0,0 +1,266 @@
+// Timings of the ephemeris model, in isolation and end to end, on fixed
+// pseudo-random main-belt workloads so that runs are comparable across
+// releases and machines.
+//
+//   ./benchmark [-n 1,100,10000,100000] [-t min_seconds] [-d days]
+//
+// Needs linux_p1550p2650.430 and sb431-n16s.bsp in the working directory
+// ("make run" links them from examples/ephem_forces).  Each result is one
+// JSON object per line on stdout:
+//
+//   bench       jpl_calc, spk_calc, forces, store or integrate
+//   frame       barycentric or geocentric (forces, store, integrate)
+//   N           number of test particles
+//   bodies      point-mass perturbers per particle
+//   calls       timed calls
+//   seconds     wall time of the calls
+//   ns_per_call
+//   ns_per_particle_body   forces only
+//   ns_per_particle_day    store and integrate: per particle per day propagated
+//   evals_per_s            lookups/s, force evaluations/s, or particle samples/s
+//   peak_rss_kb            peak resident set of the process so far
+//
+// store is the cost of buffering the output of integration_function,
+// the difference between it and integration_function_stream with a
+// callback that does nothing.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // clock_gettime, M_PI with -std=c99
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "rebound.h"
+#include "reboundx.h"
+#include "spk.h"
+#include "planets.h"
+
+static const char* planets_file = "linux_p1550p2650.430";
+static const char* asteroids_file = "sb431-n16s.bsp";
+
+static const double jd0 = 2458849.5;    // 2020 Jan 1
+static const double G = 0.295912208285591100E-03;
+static const double c_au = 173.144632674;
+static const int N_bodies = 11 + 16;
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static long peak_rss_kb(void){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// xorshift64*, so the workloads do not depend on the C library's rand().
+static uint64_t rng_state;
+
+static void rng_seed(const uint64_t seed){
+    rng_state = seed ? seed : 1;
+}
+
+static double rng_uniform(void){
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state*0x2545F4914F6CDD1DULL) >> 11)*(1.0/9007199254740992.0);
+}
+
+// N main-belt particles on near-circular orbits, 6 doubles each.
+static double* workload(const int N){
+    double* const state = malloc(6*(size_t)N*sizeof(double));
+    rng_seed(42);
+    for (int i=0; i<N; i++){
+        const double a = 2.1 + 1.2*rng_uniform();
+        const double l = 2.*M_PI*rng_uniform();
+        const double inc = 0.2*(rng_uniform() - 0.5);
+        const double v = sqrt(G/a);
+        double* const s = &state[6*i];
+        s[0] = a*cos(l);
+        s[1] = a*sin(l)*cos(inc);
+        s[2] = a*sin(l)*sin(inc);
+        s[3] = -v*sin(l);
+        s[4] = v*cos(l)*cos(inc);
+        s[5] = v*cos(l)*sin(inc);
+    }
+    return state;
+}
+
+static void report(const char* const bench, const char* const frame, const int N, const int bodies, const long calls, const double seconds, const char* const per_name, const double per, const double evals_per_s){
+    printf("{\"bench\": \"%s\"", bench);
+    if (frame != NULL){
+        printf(", \"frame\": \"%s\"", frame);
+    }
+    printf(", \"N\": %d, \"bodies\": %d, \"calls\": %ld, \"seconds\": %.6f, \"ns_per_call\": %.3f", N, bodies, calls, seconds, 1e9*seconds/calls);
+    if (per_name != NULL){
+        printf(", \"%s\": %.4f", per_name, per);
+    }
+    printf(", \"evals_per_s\": %.6g, \"peak_rss_kb\": %ld}\n", evals_per_s, peak_rss_kb());
+    fflush(stdout);
+}
+
+// Lookups spread over a year, as a long propagation makes them.
+static void bench_jpl(const double min_seconds){
+    struct _jpl_s* const pl = jpl_init(planets_file);
+    if (pl == NULL){
+        fprintf(stderr, "benchmark: could not load %s\n", planets_file);
+        return;
+    }
+    struct mpos_s pos;
+    long calls = 0;
+    const double t0 = now();
+    double t1 = t0;
+    while (t1 - t0 < min_seconds){
+        for (int k=0; k<1000; k++){
+            jpl_calc(pl, &pos, jd0 + 365.25*(k/1000.), PLAN_EAR, PLAN_BAR);
+        }
+        calls += 1000;
+        t1 = now();
+    }
+    report("jpl_calc", NULL, 1, 1, calls, t1 - t0, NULL, 0., calls/(t1 - t0));
+    jpl_free(pl);
+}
+
+static void bench_spk(const double min_seconds){
+    struct spk_s* const pl = spk_init(asteroids_file);
+    if (pl == NULL){
+        fprintf(stderr, "benchmark: could not load %s\n", asteroids_file);
+        return;
+    }
+    struct mpos_s pos;
+    long calls = 0;
+    const double t0 = now();
+    double t1 = t0;
+    while (t1 - t0 < min_seconds){
+        for (int k=0; k<1000; k++){
+            spk_calc(pl, k % 16, jd0 + 365.25*(k/1000.), &pos);
+        }
+        calls += 1000;
+        t1 = now();
+    }
+    report("spk_calc", NULL, 1, 1, calls, t1 - t0, NULL, 0., calls/(t1 - t0));
+    spk_free(pl);
+}
+
+// The force alone, called at the epochs IAS15 uses: 8 sub-steps of a one
+// day step, evaluated 3 times each, then the next step.
+static void bench_forces(const int N, const int geocentric, const double min_seconds){
+    static const double h[8] = {0.0, 0.0562625605369221, 0.180240691736892, 0.352624717113170, 0.547153626330555, 0.734210177215411, 0.885320946839096, 0.977520613561288};
+
+    struct reb_simulation* const r = reb_create_simulation();
+    r->G = G;
+    r->t = jd0;
+    struct rebx_extras* const rebx = rebx_attach(r);
+    struct rebx_force* const f = rebx_load_force(rebx, "ephemeris_forces");
+    rebx_set_param_int(rebx, &f->ap, "geocentric", geocentric);
+    rebx_set_param_int(rebx, &f->ap, "N_ephem", 11);
+    rebx_set_param_int(rebx, &f->ap, "N_ast", 16);
+    rebx_set_param_double(rebx, &f->ap, "c", c_au);
+
+    double* const state = workload(N);
+    for (int i=0; i<N; i++){
+        struct reb_particle p = {0};
+        p.x = state[6*i+0]; p.y = state[6*i+1]; p.z = state[6*i+2];
+        p.vx = state[6*i+3]; p.vy = state[6*i+4]; p.vz = state[6*i+5];
+        reb_add(r, p);
+    }
+    free(state);
+
+    long calls = 0;
+    const double t0 = now();
+    double t1 = t0;
+    for (int step=0; t1 - t0 < min_seconds; step++){
+        for (int it=0; it<3; it++){
+            for (int k=0; k<8; k++){
+                r->t = jd0 + step + h[k];
+                f->update_accelerations(r, f, r->particles, N);
+            }
+        }
+        calls += 24;
+        t1 = now();
+    }
+    const double s = t1 - t0;
+    report("forces", geocentric ? "geocentric" : "barycentric", N, N_bodies, calls, s, "ns_per_particle_body", 1e9*s/((double)calls*N*N_bodies), calls/s);
+
+    reb_free_simulation(r);     // before rebx_free, its cleanup still uses the extras
+    rebx_free(rebx);
+}
+
+static int discard(void* const data, const int n_samples, const int n_particles, const double* const t, const double* const state){
+    (void)data; (void)n_samples; (void)n_particles; (void)t; (void)state;
+    return 1;
+}
+
+// integration_function end to end, and the part of it spent buffering.
+static void bench_integrate(const int N, const int geocentric, const double days){
+    const char* const frame = geocentric ? "geocentric" : "barycentric";
+    double* const state = workload(N);
+
+    double t0 = now();
+    timestate ts = {0};
+    if (!integration_function(jd0, 1.0, days, geocentric, N, state, &ts)){
+        fprintf(stderr, "benchmark: integration_function failed for N = %d\n", N);
+        free(state);
+        return;
+    }
+    const double s_full = now() - t0;
+    const long samples = (long)ts.n_out*N;
+    report("integrate", frame, N, N_bodies, 1, s_full, "ns_per_particle_day", 1e9*s_full/(N*days), samples/s_full);
+    free(ts.t);
+    free(ts.state);
+
+    t0 = now();
+    integration_function_stream(jd0, 1.0, days, geocentric, N, state, discard, NULL);
+    const double s_stream = now() - t0;
+    const double s_store = s_full > s_stream ? s_full - s_stream : 0.;
+    report("store", frame, N, N_bodies, 1, s_store, "ns_per_particle_day", 1e9*s_store/(N*days), s_store > 0. ? samples/s_store : 0.);
+
+    free(state);
+}
+
+int main(int argc, char* argv[]){
+    int sizes[16] = {1, 100, 10000, 100000};
+    int n_sizes = 4;
+    double min_seconds = 0.5;
+    double days = 10.;
+
+    for (int i=1; i<argc; i++){
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc){
+            n_sizes = 0;
+            for (char* tok = strtok(argv[++i], ","); tok != NULL && n_sizes < 16; tok = strtok(NULL, ",")){
+                sizes[n_sizes++] = atoi(tok);
+            }
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i+1 < argc){
+            min_seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i+1 < argc){
+            days = atof(argv[++i]);
+        }
+        else{
+            fprintf(stderr, "usage: %s [-n N1,N2,...] [-t min_seconds] [-d days]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_jpl(min_seconds);
+    bench_spk(min_seconds);
+    for (int geocentric=0; geocentric<2; geocentric++){
+        for (int k=0; k<n_sizes; k++){
+            bench_forces(sizes[k], geocentric, min_seconds);
+        }
+    }
+    for (int geocentric=0; geocentric<2; geocentric++){
+        for (int k=0; k<n_sizes; k++){
+            bench_integrate(sizes[k], geocentric, days);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+// Write the part of the DE430 and asteroid kernels covering a span of
+// julian days to one native file, for rebx_ephemeris_load_native.
+//
+//   ./convert_ephem <planets> <asteroids|-> <out> <jd_begin> <jd_end> [n_asteroids]
+//
+// e.g. ./convert_ephem linux_p1550p2650.430 sb431-n16s.bsp ephem.rebx 2458000.5 2462000.5
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "rebound.h"
+#include "reboundx.h"
+
+int main(int argc, char* argv[]){
+
+    if(argc < 6){
+	fprintf(stderr, "usage: %s planets asteroids|- out jd_begin jd_end [n_asteroids]\n", argv[0]);
+	return 1;
+    }
+
+    const char* asteroids = strcmp(argv[2], "-") == 0 ? NULL : argv[2];
+    const double jd_begin = atof(argv[4]);
+    const double jd_end = atof(argv[5]);
+    const int n_asteroids = argc > 6 ? atoi(argv[6]) : (asteroids != NULL ? 16 : 0);
+
+    struct rebx_ephemeris* eph = rebx_ephemeris_load(argv[1], asteroids);
+    if(eph == NULL){
+	return 1;
+    }
+
+    if(!rebx_ephemeris_write_native(eph, argv[3], jd_begin, jd_end, n_asteroids)){
+	rebx_ephemeris_release(eph);
+	return 1;
+    }
+
+    rebx_ephemeris_release(eph);
+    return 0;
+}
@@ -40,7 +40,7 @@ def params(self):
 
 rebound.Particle.params = params
 
-from .extras import Extras, Param, Node, Force, Operator, integrators
+from .extras import Extras, Param, Node, Force, Operator, Stats, integrators
 from .simulationarchive import SimulationArchive
 from .tools import coordinates, install_test
 from .params import Params
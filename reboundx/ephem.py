@@ -0,0 +1,129 @@
+"""
+Propagation of test particles through the ephemeris model (see integration_function in the C API).
+The default ephemeris kernels, linux_p1550p2650.430 and sb431-n16s.bsp, are loaded from the working directory.
+
+The C calls release the GIL (clibreboundx is a ctypes CDLL), so several propagations can run at once
+on Python threads.
+"""
+from . import clibreboundx
+from ctypes import Structure, POINTER, c_double, c_int, c_char_p, c_void_p, byref, cast
+import numpy as np
+import weakref
+
+class TimeState(Structure):
+    _fields_ = [("t", POINTER(c_double)),
+                ("state", POINTER(c_double)),
+                ("n_out", c_int),
+                ("n_particles", c_int)]
+
+clibreboundx.rebx_ephem_free_output.argtypes = [c_void_p]
+clibreboundx.rebx_ephem_free_output.restype = None
+clibreboundx.integration_function_trajectory.argtypes = [c_double, c_double, c_double, c_int, c_int, POINTER(c_double)]
+clibreboundx.integration_function_trajectory.restype = c_void_p
+clibreboundx.rebx_ephem_trajectory_write_spk.argtypes = [c_void_p, c_void_p, c_char_p, POINTER(c_int), c_double, c_double]
+clibreboundx.rebx_ephem_trajectory_write_spk.restype = c_int
+clibreboundx.rebx_ephem_trajectory_free.argtypes = [c_void_p]
+clibreboundx.rebx_ephem_trajectory_free.restype = None
+
+def _owned_array(ptr, shape):
+    # Wraps a malloc'd output array without copying. The buffer is freed when the last array viewing it goes away.
+    address = cast(ptr, c_void_p).value
+    n = int(np.prod(shape))
+    if not address or n == 0:
+        clibreboundx.rebx_ephem_free_output(address)
+        return np.empty(shape)
+    buf = (c_double*n).from_address(address)
+    weakref.finalize(buf, clibreboundx.rebx_ephem_free_output, address)
+    return np.frombuffer(buf, dtype=np.float64).reshape(shape)
+
+def _timestate_arrays(ts):
+    times = _owned_array(ts.t, (ts.n_out,))
+    states = _owned_array(ts.state, (ts.n_out, ts.n_particles, 6))
+    return times, states
+
+def _instate(instate):
+    instate = np.ascontiguousarray(instate, dtype=np.float64)
+    if instate.ndim != 2 or instate.shape[1] != 6:
+        raise ValueError("REBOUNDx Error: instate must be an (n, 6) array of x, y, z, vx, vy, vz.")
+    return instate
+
+def integrate(tstart, tstep, trange, instate, geocentric=False):
+    """
+    Propagate test particles with IAS15, and return the 8 samples of each step.
+
+    Arguments
+    ---------
+    tstart : float
+        Initial time (JD, TDB).
+    tstep : float
+        Initial time step in days (negative to integrate backwards).
+    trange : float
+        Length of the integration in days.
+    instate : array_like
+        (n, 6) initial positions and velocities.
+    geocentric : bool
+        Whether the states are geocentric rather than barycentric.
+
+    Returns
+    -------
+    times, states : NumPy arrays of shape (n_out,) and (n_out, n, 6), viewing the C output directly.
+    """
+    instate = _instate(instate)
+    ts = TimeState()
+    success = clibreboundx.integration_function(c_double(tstart), c_double(tstep), c_double(trange), c_int(int(geocentric)), c_int(instate.shape[0]), instate.ctypes.data_as(POINTER(c_double)), byref(ts))
+    times, states = _timestate_arrays(ts)
+    if not success:
+        raise RuntimeError("REBOUNDx Error: Ephemeris propagation failed. Check that the ephemeris files are in the working directory and cover the time span.")
+    return times, states
+
+def integrate_batch(tstart, tstep, trange, instate, geocentric=False, group_size=1, n_threads=0):
+    """
+    Propagate many independent test particles on a pool of C threads, each group of group_size particles
+    with its own adaptive steps. See integrate for the arguments. n_threads=0 uses one per processor.
+
+    Returns
+    -------
+    List of (times, states) for each particle, with states of shape (n_out, 1, 6).
+    """
+    instate = _instate(instate)
+    n = instate.shape[0]
+    ts = (TimeState*n)()
+    success = clibreboundx.integration_function_batch(c_double(tstart), c_double(tstep), c_double(trange), c_int(int(geocentric)), c_int(n), instate.ctypes.data_as(POINTER(c_double)), c_int(group_size), c_int(n_threads), None, ts)
+    outputs = [_timestate_arrays(ts[i]) for i in range(n)]
+    if not success:
+        raise RuntimeError("REBOUNDx Error: Ephemeris propagation failed. Check that the ephemeris files are in the working directory and cover the time span.")
+    return outputs
+
+def write_spk(tstart, tstep, trange, instate, path, naif_ids=None, window=32., tolerance=1e-10, geocentric=False):
+    """
+    Propagate up to 32 test particles and write their trajectories to an SPK file as Chebyshev series
+    (see rebx_ephem_trajectory_write_spk), instead of returning the samples. See integrate for the
+    first arguments.
+
+    Arguments
+    ---------
+    path : str
+        File to write.
+    naif_ids : list of int
+        NAIF IDs of the particles, or None to number them -1, -2, ...
+    window : float
+        Longest record in days.
+    tolerance : float
+        Largest position error in au (and velocity error in au/day) of the series.
+    """
+    instate = _instate(instate)
+    n = instate.shape[0]
+    ids = None
+    if naif_ids is not None:
+        if len(naif_ids) != n:
+            raise ValueError("REBOUNDx Error: naif_ids must have one ID per particle.")
+        ids = (c_int*n)(*naif_ids)
+    traj = clibreboundx.integration_function_trajectory(c_double(tstart), c_double(tstep), c_double(trange), c_int(int(geocentric)), c_int(n), instate.ctypes.data_as(POINTER(c_double)))
+    if not traj:
+        raise RuntimeError("REBOUNDx Error: Ephemeris propagation failed. Check that the ephemeris files are in the working directory and cover the time span.")
+    try:
+        success = clibreboundx.rebx_ephem_trajectory_write_spk(traj, None, path.encode('ascii'), ids, c_double(window), c_double(tolerance))
+    finally:
+        clibreboundx.rebx_ephem_trajectory_free(traj)
+    if not success:
+        raise RuntimeError("REBOUNDx Error: Could not write SPK file {0}.".format(path))
@@ -1,10 +1,11 @@
 from . import clibreboundx
-from ctypes import Structure, c_double, POINTER, c_int, c_uint, c_long, c_ulong, c_void_p, c_char_p, CFUNCTYPE, byref, c_uint32, c_uint, cast, c_char
+from ctypes import Structure, c_double, POINTER, c_int, c_uint, c_long, c_ulong, c_void_p, c_char_p, CFUNCTYPE, byref, c_uint32, c_uint64, c_uint, cast, c_char
 import rebound
 import reboundx
 import warnings
+import numpy as np
 
-integrators = {"implicit_midpoint": 0, "rk4":1, "euler": 2, "rk2": 3, "none": -1}
+integrators = {"implicit_midpoint": 0, "rk4":1, "euler": 2, "rk2": 3, "dopri5": 4, "none": -1}
 
 REBX_TIMING = {"pre":-1, "post":1}
 REBX_FORCE_TYPE = {"none":0, "pos":1, "vel":2}
@@ -25,7 +26,9 @@ REBX_BINARY_WARNINGS = [
     (False, 2048, "REBOUNDx: Unknown field found in binary file. Any unknown fields not loaded.  This can happen if the binary was created with a later version of REBOUNDx than the one used to read it."),
     (False, 4096, "REBOUNDx: Unknown list in the REBOUNDx structure wasn't loaded. This can happen if the binary was created with a later version of REBOUNDx than the one used to read it."),
     (False, 8192, "REBOUNDx: The value of at least one parameter was not loaded. This can happen if a custom structure was added by the user as a parameter. See Parameters.ipynb jupyter notebook example."),
-    (False,16384, "REBOUNDx: Binary file was saved with a different version of REBOUNDx. Binary format might have changed. Check that effects and parameters are loaded as expected.")
+    (False,16384, "REBOUNDx: Binary file was saved with a different version of REBOUNDx. Binary format might have changed. Check that effects and parameters are loaded as expected."),
+    (False,32768, "REBOUNDx: A force parameter failed to load from the list of REBOUNDx implemented forces. Custom forces can't be saved to a REBOUNDx binary, and function points must be reset when a simulation is reloaded."),
+    (False,65536, "REBOUNDx: At least one parameter column was not loaded fully from the binary file.")
 ]
 
 class Extras(Structure):
@@ -36,11 +39,11 @@ class Extras(Structure):
     The fastest way to understand it is to follow the examples at :ref:`ipython_examples`.  
     """
     
-    def __new__(cls, sim, filename=None):
+    def __new__(cls, sim, filename=None, snapshot=None):
         rebx = super(Extras,cls).__new__(cls)
         return rebx
 
-    def __init__(self, sim, filename=None):
+    def __init__(self, sim, filename=None, snapshot=None):
         sim._extras_ref = self # add a reference to this instance in sim to make sure it's not garbage collected_ 
         clibreboundx.rebx_initialize(byref(sim), byref(self))
         # Create simulation
@@ -50,8 +53,12 @@ class Extras(Structure):
         else:
             # Recreate existing simulation.
             # Load registered parameters from binary
+            # or from a snapshot of an archive, opened with reboundx.simulationarchive.Archive
             w = c_int(0)
-            clibreboundx.rebx_init_extras_from_binary(byref(self), c_char_p(filename.encode('ascii')), byref(w))
+            if snapshot is None:
+                clibreboundx.rebx_init_extras_from_binary(byref(self), c_char_p(filename.encode('ascii')), byref(w))
+            else:
+                clibreboundx.rebx_init_extras_from_archive(byref(self), filename._archive, c_int(snapshot), byref(w))
             for majorerror, value, message in REBX_BINARY_WARNINGS:
                 if w.value & value:
                     if majorerror:
@@ -77,6 +84,45 @@ class Extras(Structure):
         clibreboundx.rebx_register_param(byref(self), c_char_p(name.encode('ascii')), c_int(type_enum))
         self.process_messages()
 
+    def _particle_param_dtype(self, name):
+        param_type = clibreboundx.rebx_get_type(byref(self), c_char_p(name.encode('ascii')))
+        dtypes = {c_double: np.float64, c_int: np.intc, c_uint32: np.uint32}
+        ctype = REBX_CTYPES[param_type]
+        if ctype not in dtypes:
+            raise AttributeError("REBOUNDx Error: Parameter '{0}' is not a registered double, int or uint32 parameter.".format(name))
+        return ctype, dtypes[ctype]
+
+    def set_particle_param_array(self, name, values, column=False):
+        """
+        Set a particle parameter on particles 0 to len(values)-1 in one call.
+        With column=True the parameter gets a column (see rebx_add_param_column in the C API), so that 
+        get_particle_param_array can return the values without copying.
+        """
+        ctype, dtype = self._particle_param_dtype(name)
+        values = np.ascontiguousarray(values, dtype=dtype)
+        if column:
+            clibreboundx.rebx_add_param_column.restype = c_void_p
+            clibreboundx.rebx_add_param_column(byref(self), c_char_p(name.encode('ascii')))
+        clibreboundx.rebx_set_particle_param_array(byref(self), c_char_p(name.encode('ascii')), values.ctypes.data_as(c_void_p), c_int(values.size))
+        self.process_messages()
+
+    def get_particle_param_array(self, name):
+        """
+        Get a particle parameter for all particles as a NumPy array.
+        If the parameter has a column with all the particles' rows set, this is a writable view of the column, 
+        valid until particles are added or the column is removed. Otherwise it is a copy, with NaN (or 0 for int 
+        types) for particles that do not have the parameter.
+        """
+        ctype, dtype = self._particle_param_dtype(name)
+        N = self._sim.contents.N
+        clibreboundx.rebx_get_particle_param_view.restype = c_void_p
+        ptr = clibreboundx.rebx_get_particle_param_view(byref(self), c_char_p(name.encode('ascii')), c_int(N))
+        if ptr and N > 0:
+            return np.ctypeslib.as_array(cast(ptr, POINTER(ctype)), shape=(N,))
+        values = np.full(N, np.nan) if dtype == np.float64 else np.zeros(N, dtype=dtype)
+        clibreboundx.rebx_get_particle_param_array(byref(self), c_char_p(name.encode('ascii')), values.ctypes.data_as(c_void_p), c_int(N))
+        return values
+
     def load_force(self, name):
         clibreboundx.rebx_load_force.restype = POINTER(Force)
         ptr = clibreboundx.rebx_load_force(byref(self), c_char_p(name.encode('ascii')))
@@ -148,6 +194,37 @@ class Extras(Structure):
         if not success:
             raise AttributeError("REBOUNDx Error: Operator {0} passed to rebx.remove_operator not found in simulation.")
 
+    #######################################
+    # Profiling
+    #######################################
+
+    @property
+    def stats_enabled(self):
+        """
+        Whether forces and operators count their calls, particles, iterations and time. See get_stats.
+        """
+        return bool(self._stats_enabled)
+
+    @stats_enabled.setter
+    def stats_enabled(self, value):
+        clibreboundx.rebx_enable_stats(byref(self), c_int(1 if value else 0))
+
+    def get_stats(self, name):
+        """
+        Returns a copy of the Stats of the force, or else the operator, with the given name.
+        """
+        stats = Stats()
+        found = clibreboundx.rebx_get_stats(byref(self), c_char_p(name.encode('ascii')), byref(stats))
+        if not found:
+            raise AttributeError("REBOUNDx Error: Force or operator {0} passed to rebx.get_stats not found.".format(name))
+        return stats
+
+    def reset_stats(self):
+        """
+        Sets the Stats of all forces and operators to zero.
+        """
+        clibreboundx.rebx_reset_stats(byref(self))
+
     #######################################
     # Input/Output Routines
     #######################################
@@ -158,6 +235,22 @@ class Extras(Structure):
         clibreboundx.rebx_output_binary(byref(self), c_char_p(filename.encode("ascii")))
         self.process_messages()
 
+    def archive_append(self, filename):
+        """
+        Append a snapshot to an archive file, as only the parameters that changed since the last append when possible.
+        Open with reboundx.SimulationArchive, passing the archive as rebxfilename.
+        """
+        clibreboundx.rebx_archive_append(byref(self), c_char_p(filename.encode("ascii")))
+        self.process_messages()
+
+    def automate_archive(self, filename, interval):
+        """
+        Append a snapshot to an archive file every interval in simulation time, like sim.automateSimulationArchive.
+        Deletes the file if it exists. An interval of 0 stops appending.
+        """
+        clibreboundx.rebx_archive_automate_interval(byref(self), c_char_p(filename.encode("ascii")), c_double(interval))
+        self.process_messages()
+
     #######################################
     # Convenience Functions
     #######################################
@@ -216,7 +309,8 @@ class Param(Structure): # need to define fields afterward because of circular re
     pass    
 Param._fields_ =  [ ("name", c_char_p),
                     ("type", c_int),
-                    ("value", c_void_p)]
+                    ("value", c_void_p),
+                    ("id", c_int)]
 
 class Node(Structure): # need to define fields afterward because of circular ref in linked list
     pass    
@@ -249,13 +343,29 @@ class Operator(Structure):
         params = Params(self)
         return params
 
+class Stats(Structure):
+    """
+    Counters of a force or operator, kept while Extras.stats_enabled is True.
+    calls and time (in seconds) are for the calls from the simulation, particles is the number
+    of particles passed to them summed, and iterations counts the fixed-point iterations of gr,
+    gr_full, ephemeris_forces and the implicit_midpoint integrator.
+    """
+    _fields_ = [("calls", c_uint64),
+                ("particles", c_uint64),
+                ("iterations", c_uint64),
+                ("time", c_double)]
+
+    def __repr__(self):
+        return "<reboundx.Stats calls={0} particles={1} iterations={2} time={3:.6g} s>".format(self.calls, self.particles, self.iterations, self.time)
+
 STEPFUNCPTR = CFUNCTYPE(None, POINTER(rebound.Simulation), POINTER(Operator), c_double)
 
 Operator._fields_ = [   ("name", c_char_p),
                         ("ap", POINTER(Node)),
                         ("_sim", POINTER(rebound.Simulation)),
                         ("_operator_type", c_int),
-                        ("_step_function", STEPFUNCPTR)]
+                        ("_step_function", STEPFUNCPTR),
+                        ("stats", Stats)]
 class Force(Structure):
     @property
     def force_type(self):
@@ -285,7 +395,8 @@ Force._fields_ = [  ("name", c_char_p),
                     ("ap", POINTER(Node)),
                     ("_sim", POINTER(rebound.Simulation)),
                     ("_force_type", c_int),
-                    ("_update_accelerations", FORCEFUNCPTR)]
+                    ("_update_accelerations", FORCEFUNCPTR),
+                    ("stats", Stats)]
 
 # Need to put fields after class definition because of self-referencing
 Extras._fields_ =  [("_sim", POINTER(rebound.Simulation)),
@@ -294,7 +405,20 @@ Extras._fields_ =  [("_sim", POINTER(rebound.Simulation)),
                     ("_post_timestep_modifications", POINTER(Node)),
                     ("_registered_params", POINTER(Node)),
                     ("_allocated_forces", POINTER(Node)),
-                    ("_allocated_operators", POINTER(Node))]
+                    ("_allocated_operators", POINTER(Node)),
+                    ("_param_ids", c_void_p),
+                    ("_pools", c_void_p),
+                    ("_param_columns", POINTER(Node)),
+                    ("_column_removal", c_void_p),
+                    ("_integrator_workspace", c_void_p),
+                    ("_schedule", c_void_p),
+                    ("_param_generation", c_uint64),
+                    ("_stats_enabled", c_int),
+                    ("_archive_writer", c_void_p),
+                    ("_passes_running", c_int),
+                    ("_removed_forces", POINTER(Node)),
+                    ("_removed_operators", POINTER(Node)),
+                    ("_removed_steps", POINTER(Node))]
 
 # This list keeps pairing from C rebx_param_type enum to ctypes type 1-to-1. Derive the required mappings from it
 REBX_C_TO_CTYPES = [["REBX_TYPE_NONE", None], ["REBX_TYPE_DOUBLE", c_double], ["REBX_TYPE_INT",c_int], ["REBX_TYPE_POINTER", c_void_p], ["REBX_TYPE_FORCE", Force], ["REBX_TYPE_UNIT32", c_uint32], ["REBX_TYPE_ORBIT", rebound.Orbit]]
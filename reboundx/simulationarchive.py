@@ -1,5 +1,45 @@
 import rebound
 import reboundx
+import warnings
+from ctypes import Structure, POINTER, c_int, c_long, c_double, c_void_p, c_char_p, byref
+from . import clibreboundx
+from .extras import REBX_BINARY_WARNINGS
+
+class ArchiveStructure(Structure):
+    _fields_ = [("N", c_int),
+                ("t", POINTER(c_double)),
+                ("offsets", POINTER(c_long)),
+                ("keyframes", POINTER(c_int)),
+                ("map", c_void_p),
+                ("size", c_long)]
+
+class Archive(object):
+    """
+    REBOUNDx archive file written with rebx.archive_append or rebx.automate_archive.
+    """
+    def __init__(self, filename):
+        w = c_int(0)
+        clibreboundx.rebx_open_archive.restype = POINTER(ArchiveStructure)
+        self._archive = clibreboundx.rebx_open_archive(c_char_p(filename.encode('ascii')), byref(w))
+        for majorerror, value, message in REBX_BINARY_WARNINGS:
+            if w.value & value:
+                if majorerror:
+                    raise RuntimeError(message)
+                else:
+                    warnings.warn(message, RuntimeWarning)
+
+    def __del__(self):
+        if getattr(self, "_archive", None):
+            clibreboundx.rebx_free_archive(self._archive)
+
+    def __len__(self):
+        return self._archive.contents.N
+
+    def find(self, t):
+        """
+        Index of the last snapshot at or before time t, or -1 if there is none.
+        """
+        return clibreboundx.rebx_archive_find(self._archive, c_double(t))
 
 class SimulationArchive(rebound.SimulationArchive):
     """
@@ -12,18 +52,31 @@ class SimulationArchive(rebound.SimulationArchive):
         filename : str
             Filename of the SimulationArchive file to be opened.
         rebxfilename : str
-            Filename of the REBOUNDx binary file.
+            Filename of the REBOUNDx binary file, or of a REBOUNDx archive. With an archive, each simulation 
+            gets the last REBOUNDx snapshot at or before its time.
         """
         super(SimulationArchive, self).__init__(filename, *args, **kwargs)
         self.rebxfilename = rebxfilename
+        with open(rebxfilename, 'rb') as f:
+            isarchive = f.read(22) == b"REBOUNDx Archive File."
+        self.archive = Archive(rebxfilename) if isarchive else None
         sim, rebx = self[0] # test you can open rebxfilename to warn user if not
 
+    def _extras(self, sim):
+        if self.archive is None:
+            return reboundx.Extras(sim, self.rebxfilename)
+        snapshot = self.archive.find(sim.t)
+        if snapshot < 0:
+            warnings.warn("REBOUNDx: Simulation is earlier than the first snapshot in the archive. Loading the first snapshot.", RuntimeWarning)
+            snapshot = 0
+        return reboundx.Extras(sim, self.archive, snapshot)
+
     def __getitem__(self, key):
         sim = super(SimulationArchive, self).__getitem__(key)
-        rebx = reboundx.Extras(sim, self.rebxfilename)
+        rebx = self._extras(sim)
         return sim, rebx
 
     def getSimulation(self, *args, **kwargs):
         sim = super(SimulationArchive, self).getSimulation(*args, **kwargs)
-        rebx = reboundx.Extras(sim, self.rebxfilename)
+        rebx = self._extras(sim)
         return sim, rebx
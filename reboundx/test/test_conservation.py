@@ -2,10 +2,25 @@ import rebound
 import reboundx
 import unittest
 import os
+import math
 
 THIS_DIR = os.path.dirname(os.path.abspath(__file__))
 binary = os.path.join(THIS_DIR, 'binaries/twoplanets.bin')
 
+def many_bodies(N, reverse=False):
+    # enough bodies for gr_full to split the pairs into several blocks
+    sim = rebound.Simulation()
+    sim.add(m=1.)
+    for i in range(1, N):
+        sim.add(m=1.e-4, a=1.+2.*i/N, f=2.4*i, inc=0.01*math.sin(i))
+    if reverse:
+        rev = rebound.Simulation()
+        for i in reversed(range(sim.N)):
+            rev.add(sim.particles[i])
+        sim = rev
+    sim.integrator = "ias15"
+    return sim
+
 class TestConservation(unittest.TestCase):
     def test_gr_full(self):
         name = 'gr_full'
@@ -20,6 +35,32 @@ class TestConservation(unittest.TestCase):
         sim.integrate(1.e4)
         H = rebx.gr_full_hamiltonian(force)
         self.assertLess(abs((H-H0)/H0), 1.e-12)
+
+    def test_gr_full_many_bodies(self):
+        sim = many_bodies(80)
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('gr_full')
+        rebx.add_force(force)
+        force.params['c'] = 1.e3
+        H0 = rebx.gr_full_hamiltonian(force)
+        sim.integrate(1.)
+        H = rebx.gr_full_hamiltonian(force)
+        self.assertLess(abs((H-H0)/H0), 1.e-11)
+
+    def test_gr_full_order(self):
+        # every pair has to be added to both bodies whichever block it falls in
+        sims = [many_bodies(80), many_bodies(80, reverse=True)]
+        for sim in sims:
+            rebx = reboundx.Extras(sim)
+            force = rebx.load_force('gr_full')
+            rebx.add_force(force)
+            force.params['c'] = 1.e3
+            sim.integrate(1.)
+        ps, rev = sims[0].particles, sims[1].particles
+        for i in range(sims[0].N):
+            self.assertAlmostEqual(ps[i].x, rev[sims[0].N-1-i].x, delta=1.e-10)
+            self.assertAlmostEqual(ps[i].y, rev[sims[0].N-1-i].y, delta=1.e-10)
+            self.assertAlmostEqual(ps[i].z, rev[sims[0].N-1-i].z, delta=1.e-10)
     
     def test_gr(self):
         name = 'gr'
@@ -35,6 +76,30 @@ class TestConservation(unittest.TestCase):
         H = rebx.gr_hamiltonian(force)
         self.assertLess(abs((H-H0)/H0), 1.e-12)
     
+    def test_gr_source(self):
+        # with the star second, the hamiltonian has to follow gr_source as the force does
+        ref = rebound.Simulation()
+        ref.add(m=1.)
+        ref.add(m=1.e-4, a=1.3, e=0.1)
+        ref.add(m=1.e-4, a=2.1, f=2.)
+        sim = rebound.Simulation()
+        for i in [1, 0, 2]:
+            sim.add(ref.particles[i])
+        sim.integrator = "ias15"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('gr')
+        rebx.add_force(force)
+        force.params['c'] = 1.e2
+        sim.particles[1].params['gr_source'] = 1
+        rebx_ref = reboundx.Extras(ref)
+        force_ref = rebx_ref.load_force('gr')
+        force_ref.params['c'] = 1.e2
+        H0 = rebx.gr_hamiltonian(force)
+        self.assertAlmostEqual(H0, rebx_ref.gr_hamiltonian(force_ref), delta=1.e-14*abs(H0))
+        sim.integrate(1.e3)
+        H = rebx.gr_hamiltonian(force)
+        self.assertLess(abs((H-H0)/H0), 1.e-12)
+    
     def test_gr_potential(self):
         name = 'gr_potential'
         sim = rebound.Simulation(binary)
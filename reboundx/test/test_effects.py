@@ -1,6 +1,7 @@
 import rebound
 import reboundx
 import unittest
+import math
 
 class TestForces(unittest.TestCase):
     def setUp(self):
@@ -230,6 +231,162 @@ class TestAddOperator(unittest.TestCase):
         self.sim.step()
         self.assertEqual(self.cust.params['ctr'], 1)
 
+class TestIntegrateForce(unittest.TestCase):
+    def integrate_gr(self, **params):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1., e=0.2)
+        sim.integrator = "whfast"
+        sim.dt = 0.05
+        rebx = reboundx.Extras(sim)
+        gr = rebx.load_force('gr')
+        gr.params['c'] = 10.
+        intforce = rebx.load_operator('integrate_force')
+        rebx.add_operator(intforce)
+        intforce.params['force'] = gr
+        intforce.params['integrator'] = reboundx.integrators['implicit_midpoint']
+        for name, value in params.items():
+            intforce.params[name] = value
+        sim.integrate(10.)
+        return sim, intforce
+
+    def test_implicit_midpoint(self):
+        # warm starts and mixing have to converge to the same steps as a long iteration
+        sim, intforce = self.integrate_gr()
+        ref, _ = self.integrate_gr(max_iterations=100)
+        for p, q in zip(sim.particles, ref.particles):
+            self.assertAlmostEqual(p.x, q.x, delta=1.e-12)
+            self.assertAlmostEqual(p.y, q.y, delta=1.e-12)
+            self.assertAlmostEqual(p.vx, q.vx, delta=1.e-12)
+            self.assertAlmostEqual(p.vy, q.vy, delta=1.e-12)
+        self.assertGreater(intforce.params['force_evaluations'], 0)
+        self.assertLessEqual(intforce.params['force_evaluations'], 10)
+
+    def integrate_radiation(self, integrator, **params):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(a=1., e=0.5)
+        sim.integrator = "whfast"
+        sim.dt = 0.1
+        rebx = reboundx.Extras(sim)
+        rf = rebx.load_force('radiation_forces')
+        rf.params['c'] = 3.
+        sim.particles[0].params['radiation_source'] = 1
+        sim.particles[1].params['beta'] = 0.05
+        intforce = rebx.load_operator('integrate_force')
+        rebx.add_operator(intforce)
+        intforce.params['force'] = rf
+        intforce.params['integrator'] = reboundx.integrators[integrator]
+        for name, value in params.items():
+            intforce.params[name] = value
+        sim.integrate(2.*math.pi)
+        return sim, intforce
+
+    def test_dopri5(self):
+        sim, intforce = self.integrate_radiation('dopri5')
+        ref, _ = self.integrate_radiation('dopri5', tolerance=1.e-14)
+        p, q = sim.particles[1], ref.particles[1]
+        self.assertAlmostEqual(p.x, q.x, delta=1.e-10)
+        self.assertAlmostEqual(p.y, q.y, delta=1.e-10)
+        self.assertAlmostEqual(p.vx, q.vx, delta=1.e-10)
+        self.assertAlmostEqual(p.vy, q.vy, delta=1.e-10)
+        self.assertGreater(intforce.params['force_evaluations'], 0)
+
+class TestModifyMass(unittest.TestCase):
+    def integrate(self, **params):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1.)
+        sim.add(m=1.e-4, a=1.7, f=math.pi)
+        sim.move_to_com()
+        sim.integrator = "whfast"
+        sim.dt = 1.e-3
+        rebx = reboundx.Extras(sim)
+        mm = rebx.load_operator('modify_mass')
+        rebx.add_operator(mm)
+        sim.particles[0].params['tau_mass'] = -1.e2
+        for name, value in params.items():
+            mm.params[name] = value
+        sim.integrate(10.)
+        return sim
+
+    def test_mass_exponential(self):
+        m = math.exp(10./-1.e2)
+        sim = self.integrate(mass_exponential=1)
+        self.assertLess(abs(sim.particles[0].m/m - 1.), 1.e-10)
+        sim = self.integrate()
+        self.assertGreater(abs(sim.particles[0].m/m - 1.), 1.e-9)
+
+    def test_com_interval(self):
+        # correcting the tracked center of mass every call matches reb_move_to_com, and doing it less often only shifts the system
+        ref = self.integrate()
+        sim = self.integrate(com_interval=1)
+        for p, q in zip(sim.particles, ref.particles):
+            self.assertAlmostEqual(p.x, q.x, delta=1.e-10)
+            self.assertAlmostEqual(p.y, q.y, delta=1.e-10)
+        sim = self.integrate(com_interval=10)
+        for p, q in zip(sim.particles[1:], ref.particles[1:]):
+            self.assertAlmostEqual(p.x - sim.particles[0].x, q.x - ref.particles[0].x, delta=1.e-10)
+            self.assertAlmostEqual(p.y - sim.particles[0].y, q.y - ref.particles[0].y, delta=1.e-10)
+            self.assertAlmostEqual(p.vx - sim.particles[0].vx, q.vx - ref.particles[0].vx, delta=1.e-10)
+
+class TestTrackMinDistance(unittest.TestCase):
+    def flyby(self, **params):
+        # hyperbolic two-body flyby with periapsis at a(1-e) = 1, reached at t = 1.82 between the steps at 1.6 and 2.0
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(a=-1., e=2., f=-1.5)
+        sim.integrator = "whfast"
+        sim.dt = 0.4
+        rebx = reboundx.Extras(sim)
+        tmd = rebx.load_operator('track_min_distance')
+        rebx.add_operator(tmd)
+        for name, value in params.items():
+            tmd.params[name] = value
+        sim.particles[1].params['min_distance'] = 100.
+        sim.integrate(4., exact_finish_time=0)
+        return sim.particles[1].params['min_distance']
+
+    def test_interpolate(self):
+        sampled = self.flyby()
+        interpolated = self.flyby(min_distance_interpolate=1)
+        self.assertGreater(sampled - 1., 1.e-2)
+        self.assertLess(interpolated, sampled)
+        self.assertLess(abs(interpolated - 1.), 1.e-3)
+
+    def track_planet(self, decoys):
+        # the last particle measures from the planet by hash, while massless decoys ahead of it are removed and replaced
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        if decoys:
+            sim.add(a=3., hash="decoy1")
+            sim.add(a=4., hash="decoy2")
+        sim.add(m=1.e-3, a=1., hash="planet")
+        sim.add(a=1.3, f=0.5, hash="tracked")
+        sim.integrator = "whfast"
+        sim.dt = 0.05
+        rebx = reboundx.Extras(sim)
+        tmd = rebx.load_operator('track_min_distance')
+        rebx.add_operator(tmd)
+        tmd.params['min_distance_interpolate'] = 1
+        sim.particles["tracked"].params['min_distance'] = 100.
+        sim.particles["tracked"].params['min_distance_from'] = sim.particles["planet"].hash.value
+        sim.integrate(3.)
+        if decoys:
+            sim.remove(hash="decoy1")           # fewer particles
+        sim.integrate(8.)
+        if decoys:
+            sim.remove(hash="decoy2")           # same number of particles, the planet one index lower
+            sim.add(a=5., hash="decoy3")
+        sim.integrate(25.)                      # conjunction near t = 17.8
+        return sim.particles["tracked"].params['min_distance']
+
+    def test_remove_reorder(self):
+        ref = self.track_planet(decoys=False)
+        min_distance = self.track_planet(decoys=True)
+        self.assertLess(ref, 0.35)
+        self.assertAlmostEqual(min_distance, ref, delta=1.e-9*ref)
+
 if __name__ == '__main__':
     unittest.main()
 
@@ -0,0 +1,159 @@
+import rebound
+import reboundx
+import reboundx.ephem
+import unittest
+import threading
+import numpy as np
+import os
+import tempfile
+from ctypes import Structure, POINTER, byref, c_char_p, c_double, c_int, c_void_p
+
+class MPos(Structure): # struct mpos_s
+    _fields_ = [("u", c_double*3),
+                ("v", c_double*3),
+                ("w", c_double*3),
+                ("jde", c_double)]
+
+THIS_DIR = os.path.dirname(os.path.abspath(__file__))
+EPHEM_DIR = os.path.join(THIS_DIR, '../../examples/ephem_forces')
+
+@unittest.skipUnless(os.path.exists(os.path.join(EPHEM_DIR, 'linux_p1550p2650.430')), "ephemeris files not found")
+class TestEphem(unittest.TestCase):
+    def setUp(self):
+        self.cwd = os.getcwd()
+        os.chdir(EPHEM_DIR) # default ephemeris files are loaded from the working directory
+        self.tstart, self.tstep, self.trange = 2458849.5, 20.0, 100.
+        self.instate = np.array([[3.338876057509365E+00, -9.176517956664152E-01, -5.038590450387491E-01,
+                                  2.805663678557796E-03, 7.550408259144305E-03, 2.980028369986096E-03]]*3)
+
+    def tearDown(self):
+        os.chdir(self.cwd)
+
+    def test_integrate(self):
+        times, states = reboundx.ephem.integrate(self.tstart, self.tstep, self.trange, self.instate)
+        self.assertEqual(states.shape, (times.size, 3, 6))
+        self.assertGreaterEqual(times[0], self.tstart)
+        self.assertGreaterEqual(times[-1], self.tstart + self.trange)
+        self.assertTrue(np.all(np.diff(times) >= 0.))
+        self.assertTrue(np.all(states[:, 0] == states[:, 1])) # same initial conditions
+        with self.assertRaises(ValueError):
+            reboundx.ephem.integrate(self.tstart, self.tstep, self.trange, self.instate[:, :3])
+
+    def test_threads(self):
+        times, states = reboundx.ephem.integrate(self.tstart, self.tstep, self.trange, self.instate)
+        results = [None]*4
+        def run(i):
+            results[i] = reboundx.ephem.integrate(self.tstart, self.tstep, self.trange, self.instate)
+        threads = [threading.Thread(target=run, args=(i,)) for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for t, s in results:
+            np.testing.assert_array_equal(t, times)
+            np.testing.assert_array_equal(s, states)
+
+    def test_batch(self):
+        outputs = reboundx.ephem.integrate_batch(self.tstart, self.tstep, self.trange, self.instate, n_threads=2)
+        self.assertEqual(len(outputs), 3)
+        for times, states in outputs:
+            self.assertEqual(states.shape, (times.size, 1, 6))
+            self.assertGreaterEqual(times[-1], self.tstart + self.trange)
+
+    def test_spk(self):
+        path = os.path.join(tempfile.mkdtemp(), 'objects.bsp')
+        reboundx.ephem.write_spk(self.tstart, self.tstep, self.trange, self.instate, path, naif_ids=[-1, -2, -3], tolerance=1.e-9)
+        with open(path, 'rb') as f:
+            self.assertEqual(f.read(8), b'DAF/SPK ')
+        clibreboundx = reboundx.clibreboundx
+        clibreboundx.rebx_ephemeris_load.restype = c_void_p
+        clibreboundx.rebx_ephemeris_release.argtypes = [c_void_p]
+        eph = clibreboundx.rebx_ephemeris_load(b'linux_p1550p2650.430', path.encode('ascii'))
+        self.assertTrue(eph) # readable as the asteroid kernel
+        clibreboundx.rebx_ephemeris_release(eph)
+        self.check_spk(path, 1.e-9)
+        with self.assertRaises(ValueError):
+            reboundx.ephem.write_spk(self.tstart, self.tstep, self.trange, self.instate, path, naif_ids=[-1])
+        with self.assertRaises(RuntimeError):
+            reboundx.ephem.write_spk(self.tstart, self.tstep, self.trange, np.tile(self.instate, (11, 1)), path)
+
+    def accelerations(self, sim, force):
+        for i in range(sim.N):
+            sim._particles[i].ax = sim._particles[i].ay = sim._particles[i].az = 0.
+        reboundx.clibreboundx.rebx_ephemeris_forces(byref(sim), byref(force), sim._particles, c_int(sim.N - sim.N_var))
+        p = sim._particles[0]
+        return np.array([p.ax, p.ay, p.az])
+
+    def test_variational(self):
+        # The tangent of the point masses, GR and the J2 and J4 of the Earth, against a central difference of the accelerations
+        sim = rebound.Simulation()
+        sim.G = 0.295912208285591100E-03
+        sim.t = self.tstart
+        sim.gravity = "none"
+        rebx = reboundx.Extras(sim)
+        force = rebx.load_force('ephemeris_forces')
+        force.params['geocentric'] = 1
+        force.params['N_ephem'] = 11
+        force.params['N_ast'] = 0
+        force.params['c'] = 173.144632674
+        sim.add(x=3.5e-5, y=3.e-5, z=2.e-5, vy=3.e-3) # 1.2 Earth radii from the geocenter
+        variations = [sim.add_variation() for k in range(3)]
+        for k, var in enumerate(variations):
+            setattr(var.particles[0], 'xyz'[k], 1.)
+        self.accelerations(sim, force)
+        tangent = np.array([[var.particles[0].ax, var.particles[0].ay, var.particles[0].az] for var in variations])
+        p = sim._particles[0]
+        h = 1.e-5*np.sqrt(p.x*p.x + p.y*p.y + p.z*p.z)
+        for k, q in enumerate('xyz'):
+            setattr(p, q, getattr(p, q) + h)
+            a_plus = self.accelerations(sim, force)
+            setattr(p, q, getattr(p, q) - 2.*h)
+            a_minus = self.accelerations(sim, force)
+            setattr(p, q, getattr(p, q) + h)
+            np.testing.assert_allclose((a_plus - a_minus)/(2.*h), tangent[k], rtol=0., atol=1.e-8*np.abs(tangent).max())
+
+    def check_spk(self, path, tolerance):
+        # Evaluates the series between the fit nodes against the heliocentric states of the trajectory
+        clibreboundx = reboundx.clibreboundx
+        clibreboundx.spk_init.argtypes = [c_char_p]
+        clibreboundx.spk_init.restype = c_void_p
+        clibreboundx.spk_calc.argtypes = [c_void_p, c_int, c_double, POINTER(MPos)]
+        clibreboundx.spk_calc.restype = c_int
+        clibreboundx.spk_free.argtypes = [c_void_p]
+        clibreboundx.ephem_all.argtypes = [c_void_p, c_double, c_double, POINTER(c_double), POINTER(MPos)]
+        clibreboundx.ephem_all.restype = c_int
+        clibreboundx.rebx_ephem_trajectory_state.argtypes = [c_void_p, c_double, POINTER(c_double)]
+        clibreboundx.rebx_ephem_trajectory_state.restype = c_int
+        n = self.instate.shape[0]
+        instate = np.ascontiguousarray(self.instate)
+        traj = clibreboundx.integration_function_trajectory(c_double(self.tstart), c_double(self.tstep), c_double(self.trange), c_int(0), c_int(n), instate.ctypes.data_as(POINTER(c_double)))
+        self.assertTrue(traj)
+        eph = clibreboundx.rebx_ephemeris_load(b'linux_p1550p2650.430', b'sb431-n16s.bsp')
+        pl = clibreboundx.spk_init(path.encode('ascii'))
+        self.assertTrue(eph)
+        self.assertTrue(pl)
+        try:
+            state = (c_double*(6*n))()
+            m = (c_double*11)()
+            sun = (MPos*11)()
+            pos = MPos()
+            after, before = MPos(), MPos()
+            h = 1.e-3
+            for t in self.tstart + self.trange*(np.arange(20) + 0.37)/20.:
+                self.assertEqual(clibreboundx.rebx_ephem_trajectory_state(traj, t, state), 1)
+                self.assertEqual(clibreboundx.ephem_all(eph, c_double(1.), c_double(t), m, sun), 1)
+                for j in range(n):
+                    self.assertEqual(clibreboundx.spk_calc(pl, j, t, byref(pos)), 0)
+                    self.assertEqual(clibreboundx.spk_calc(pl, j, t + h, byref(after)), 0)
+                    self.assertEqual(clibreboundx.spk_calc(pl, j, t - h, byref(before)), 0)
+                    for k in range(3):
+                        self.assertAlmostEqual(pos.u[k], state[6*j+k] - sun[0].u[k], delta=10.*tolerance)
+                        self.assertAlmostEqual(pos.v[k], state[6*j+3+k] - sun[0].v[k], delta=10.*tolerance)
+                        self.assertAlmostEqual(pos.v[k], (after.u[k] - before.u[k])/(2.*h), delta=10.*tolerance) # au/day
+        finally:
+            clibreboundx.spk_free(pl)
+            clibreboundx.rebx_ephemeris_release(eph)
+            clibreboundx.rebx_ephem_trajectory_free(traj)
+
+if __name__ == '__main__':
+    unittest.main()
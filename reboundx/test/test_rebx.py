@@ -1,6 +1,7 @@
 import rebound
 import reboundx
 import unittest
+import numpy as np
 
 class TestRebx(unittest.TestCase):
     def setUp(self):
@@ -17,5 +18,37 @@ class TestRebx(unittest.TestCase):
         self.sim.integrate(10)
         self.assertGreater(self.sim.particles[1].pomega, 1.e-4)
 
+    def test_stats(self):
+        self.gr = self.rebx.load_force('gr')
+        self.rebx.add_force(self.gr)
+        self.gr.params['c'] = 1e2
+
+        self.sim.integrate(1)
+        self.assertEqual(self.rebx.get_stats('gr').calls, 0)
+        self.rebx.stats_enabled = True
+        self.sim.integrate(2)
+        stats = self.rebx.get_stats('gr')
+        self.assertGreater(stats.calls, 0)
+        self.assertEqual(stats.particles, 2*stats.calls)
+        self.assertGreaterEqual(stats.iterations, stats.calls)
+        self.assertGreaterEqual(stats.time, 0.)
+        self.rebx.reset_stats()
+        self.assertEqual(self.gr.stats.calls, 0)
+        with self.assertRaises(AttributeError):
+            self.rebx.get_stats('not_loaded')
+
+    def test_particle_param_array(self):
+        self.rebx.set_particle_param_array('beta', [0.1, 0.2])
+        self.assertEqual(self.sim.particles[1].params['beta'], 0.2)
+        np.testing.assert_array_equal(self.rebx.get_particle_param_array('beta'), [0.1, 0.2])
+        self.rebx.set_particle_param_array('tau_mass', [-1., -2.], column=True)
+        tau = self.rebx.get_particle_param_array('tau_mass')
+        tau[1] = -3. # view of the column
+        np.testing.assert_array_equal(self.rebx.get_particle_param_array('tau_mass'), [-1., -3.])
+        self.rebx.set_particle_param_array('max_iterations', [7])
+        np.testing.assert_array_equal(self.rebx.get_particle_param_array('max_iterations'), [7, 0])
+        with self.assertRaises(AttributeError):
+            self.rebx.set_particle_param_array('not_registered', [1., 2.])
+
 if __name__ == '__main__':
     unittest.main()
@@ -143,6 +143,99 @@ class TestSimulationArchive(unittest.TestCase):
                 sim.integrate(tmax)
                 self.assertEqual(self.sim.particles[1].x, sim.particles[1].x, msg='REB integrator: {0}, REBX integrator: {1}'.format(integrator, rebxintegrator))
 
+    def test_archive(self):
+        self.rebx.add_force(self.gr)
+        self.sim.simulationarchive_snapshot('test.sa', deletefile=True)
+        self.rebx.automate_archive('test.rebxa', 1.e10) # writes the first snapshot only
+        for i in range(1, 5):
+            self.sim.integrate(10*i)
+            self.gr.params['c'] = 1e2*(i+1)
+            self.sim.simulationarchive_snapshot('test.sa')
+            self.rebx.archive_append('test.rebxa')
+
+        sa = reboundx.SimulationArchive('test.sa', 'test.rebxa')
+        self.assertEqual(len(sa.archive), 5)
+        for i in range(5):
+            sim, rebx = sa[i]
+            self.assertEqual(rebx.get_force('gr').params['c'], 1e2*(i+1))
+        sim, rebx = sa.getSimulation(25.)
+        self.assertEqual(rebx.get_force('gr').params['c'], 3e2)
+
+    def load(self, archive, snapshot):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1.e-4, a=1., e=0.2)
+        rebx = reboundx.Extras(sim, archive, snapshot)
+        return sim, rebx
+
+    def append_changes(self, filename, n):
+        # a keyframe, then n deltas changing a force and a particle param
+        self.rebx.add_force(self.gr)
+        self.sim.particles[1].params['tau_mass'] = -1.e3
+        self.rebx.automate_archive(filename, 1.e10)
+        for i in range(1, n+1):
+            self.gr.params['c'] = 1e2*(i+1)
+            self.sim.particles[1].params['tau_mass'] = -1.e3*(i+1)
+            self.rebx.archive_append(filename)
+
+    def test_archive_deltas(self):
+        self.append_changes('test.rebxa', 7)
+        archive = reboundx.simulationarchive.Archive('test.rebxa')
+        self.assertEqual(len(archive), 8)
+        self.assertEqual(archive._archive.contents.keyframes[6], 0)
+        sim, rebx = self.load(archive, 6)
+        self.assertEqual(rebx.get_force('gr').params['c'], 7e2)
+        self.assertEqual(sim.particles[1].params['tau_mass'], -7e3)
+
+    def test_archive_param_generation(self):
+        self.append_changes('test.rebxa', 3)
+        self.sim.particles[1].params['tau_e'] = -1.e4     # adding a param changes param_generation
+        self.rebx.archive_append('test.rebxa')
+        self.sim.particles[1].params['tau_e'] = -2.e4
+        self.rebx.archive_append('test.rebxa')
+        archive = reboundx.simulationarchive.Archive('test.rebxa')
+        self.assertEqual(len(archive), 6)
+        self.assertEqual([archive._archive.contents.keyframes[i] for i in range(6)], [0, 0, 0, 0, 4, 4])
+        sim, rebx = self.load(archive, 3)
+        with self.assertRaises(AttributeError):
+            sim.particles[1].params['tau_e']
+        sim, rebx = self.load(archive, 5)
+        self.assertEqual(sim.particles[1].params['tau_e'], -2.e4)
+        self.assertEqual(sim.particles[1].params['tau_mass'], -4.e3)
+
+    def test_archive_max_deltas(self):
+        max_deltas = 100    # REBX_ARCHIVE_MAX_DELTAS in core.h
+        self.append_changes('test.rebxa', max_deltas + 2)
+        archive = reboundx.simulationarchive.Archive('test.rebxa')
+        self.assertEqual(len(archive), max_deltas + 3)
+        self.assertEqual(archive._archive.contents.keyframes[max_deltas], 0)
+        self.assertEqual(archive._archive.contents.keyframes[max_deltas + 1], max_deltas + 1)
+        self.assertEqual(archive._archive.contents.keyframes[max_deltas + 2], max_deltas + 1)
+        for snapshot in [max_deltas, max_deltas + 2]:
+            sim, rebx = self.load(archive, snapshot)
+            self.assertEqual(rebx.get_force('gr').params['c'], 1e2*(snapshot+1))
+            self.assertEqual(sim.particles[1].params['tau_mass'], -1.e3*(snapshot+1))
+
+    def test_archive_truncated(self):
+        # a record cut short is left out, and a cut header fails to open, without reading past the end of the file
+        self.append_changes('test.rebxa', 3)
+        with open('test.rebxa', 'rb') as f:
+            data = f.read()
+        with open('test_truncated.rebxa', 'wb') as f:
+            f.write(data[:-7])
+        archive = reboundx.simulationarchive.Archive('test_truncated.rebxa')
+        self.assertEqual(len(archive), 3)
+        sim, rebx = self.load(archive, 2)
+        self.assertEqual(rebx.get_force('gr').params['c'], 3e2)
+        with open('test_truncated.rebxa', 'wb') as f:
+            f.write(data[:100])
+        archive = reboundx.simulationarchive.Archive('test_truncated.rebxa')
+        self.assertEqual(len(archive), 0)
+        with open('test_truncated.rebxa', 'wb') as f:
+            f.write(data[:10])
+        with self.assertRaises(RuntimeError):
+            reboundx.simulationarchive.Archive('test_truncated.rebxa')
+
 if __name__ == '__main__':
     unittest.main()
 
@@ -35,6 +35,13 @@ REBX_BINARY_FIELD_TYPE = {
         24: 'Particles',
         25: 'Force',
         26: 'Snapshot',
+        27: 'Param columns',
+        28: 'Param column',
+        29: 'Column present',
+        30: 'Archive keyframe',
+        31: 'Archive delta',
+        32: 'Archive time',
+        33: 'Archive changes',
         }
 
 class BinaryField(Structure):
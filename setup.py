@@ -43,7 +43,7 @@ class build_ext(_build_ext):
         # get site-packages dir to add to paths in case reb & rebx installed simul in tmp dir
         rebdirsp = get_python_lib()+'/'#[p for p in sys.path if p.endswith('site-packages')][0]+'/'
         self.include_dirs.append(rebdir)
-        sources = [ 'src/modify_mass.c', 'src/integrator_euler.c', 'src/modify_orbits_forces.c', 'src/integrator_rk2.c', 'src/track_min_distance.c', 'src/tides_precession.c', 'src/rebxtools.c', 'src/ephemeris_forces.c', 'src/gravitational_harmonics.c', 'src/gr_potential.c', 'src/core.c', 'src/integrator_rk4.c', 'src/input.c', 'src/central_force.c', 'src/gr.c', 'src/modify_orbits_direct.c', 'src/gr_full.c', 'src/steppers.c', 'src/integrate_force.c', 'src/output.c', 'src/radiation_forces.c', 'src/integrator_implicit_midpoint.c', 'src/linkedlist.c'],
+        sources = [ 'src/modify_mass.c', 'src/integrator_euler.c', 'src/modify_orbits_forces.c', 'src/integrator_rk2.c', 'src/track_min_distance.c', 'src/tides_precession.c', 'src/rebxtools.c', 'src/ephemeris_forces.c', 'src/gravitational_harmonics.c', 'src/gr_potential.c', 'src/core.c', 'src/integrator_rk4.c', 'src/input.c', 'src/central_force.c', 'src/gr.c', 'src/modify_orbits_direct.c', 'src/gr_full.c', 'src/steppers.c', 'src/integrate_force.c', 'src/output.c', 'src/radiation_forces.c', 'src/integrator_implicit_midpoint.c', 'src/integrator_dopri5.c', 'src/linkedlist.c', 'src/spk.c', 'src/planets.c', 'src/ephem_native.c', 'src/ephem_ensemble.c'],
         self.library_dirs.append(rebdir+'/../')
         self.library_dirs.append(rebdirsp)
         for ext in self.extensions:
@@ -54,7 +54,15 @@ class build_ext(_build_ext):
 
 from distutils.version import LooseVersion
 
-extra_link_args=[]
+extra_link_args=['-lpthread']
+extra_compile_args=['-fstrict-aliasing', '-O3','-std=c99', '-D_GNU_SOURCE', '-fPIC', '-Wpointer-arith', '-fno-math-errno', ghash_arg] # _GNU_SOURCE as in REBOUND's Makefile.defs, for madvise and MAP_ANONYMOUS
+if os.environ.get('REBX_OPENMP') == '1':
+    extra_compile_args += ['-fopenmp', '-DREBX_OPENMP']
+    extra_link_args.append('-fopenmp')
+if os.environ.get('REBX_OPENMP_OFFLOAD') == '1':
+    offload_flags = os.environ.get('REBX_OFFLOAD_FLAGS', '').split()
+    extra_compile_args += ['-fopenmp', '-DREBX_OPENMP_OFFLOAD'] + offload_flags
+    extra_link_args += ['-fopenmp'] + offload_flags
 if sys.platform == 'darwin':
     from distutils import sysconfig
     vars = sysconfig.get_config_vars()
@@ -62,13 +70,13 @@ if sys.platform == 'darwin':
     extra_link_args.append('-Wl,-install_name,@rpath/libreboundx'+suffix)
 
 libreboundxmodule = Extension('libreboundx',
-        sources = [ 'src/modify_mass.c', 'src/integrator_euler.c', 'src/modify_orbits_forces.c', 'src/integrator_rk2.c', 'src/track_min_distance.c', 'src/tides_precession.c', 'src/rebxtools.c', 'src/ephemeris_forces.c', 'src/gravitational_harmonics.c', 'src/gr_potential.c', 'src/core.c', 'src/integrator_rk4.c', 'src/input.c', 'src/central_force.c', 'src/gr.c', 'src/modify_orbits_direct.c', 'src/gr_full.c', 'src/steppers.c', 'src/integrate_force.c', 'src/output.c', 'src/radiation_forces.c', 'src/integrator_implicit_midpoint.c', 'src/linkedlist.c'],
+        sources = [ 'src/modify_mass.c', 'src/integrator_euler.c', 'src/modify_orbits_forces.c', 'src/integrator_rk2.c', 'src/track_min_distance.c', 'src/tides_precession.c', 'src/rebxtools.c', 'src/ephemeris_forces.c', 'src/gravitational_harmonics.c', 'src/gr_potential.c', 'src/core.c', 'src/integrator_rk4.c', 'src/input.c', 'src/central_force.c', 'src/gr.c', 'src/modify_orbits_direct.c', 'src/gr_full.c', 'src/steppers.c', 'src/integrate_force.c', 'src/output.c', 'src/radiation_forces.c', 'src/integrator_implicit_midpoint.c', 'src/integrator_dopri5.c', 'src/linkedlist.c', 'src/spk.c', 'src/planets.c', 'src/ephem_native.c', 'src/ephem_ensemble.c'],
                     include_dirs = ['src'],
                     library_dirs = [],
                     runtime_library_dirs = ["."],
                     libraries=['rebound'+suffix[:-3]], #take off .so from the suffix
                     define_macros=[ ('LIBREBOUNDX', None) ],
-                    extra_compile_args=['-fstrict-aliasing', '-O3','-std=c99', '-fPIC', '-Wpointer-arith', ghash_arg],
+                    extra_compile_args=extra_compile_args,
                     extra_link_args=extra_link_args,
                     )
 
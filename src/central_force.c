@@ -40,7 +40,11 @@
  *
  * **Effect Parameters**
  * 
- * None
+ * ============================ =========== ==================================================================
+ * Field (C type)               Required    Description
+ * ============================ =========== ==================================================================
+ * fused (int)                  No          If nonzero, evaluated in one pass over the particles with the other fused forces
+ * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
  *
@@ -59,6 +63,61 @@
 #include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
+
+// Indices of the particles with Acentral and gammacentral, in increasing order.  Kept on the force and rebuilt when
+// rebx->param_generation or the number of particles changes.
+struct rebx_central_force_workspace {
+    uint64_t param_generation;
+    int N;
+    int n;
+    int* sources;
+};
+
+void rebx_central_force_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_central_force_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_central_force_workspace));
+    if (ws){
+        free(ws->sources);
+        free(ws);
+    }
+}
+
+static struct rebx_central_force_workspace* rebx_central_force_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_central_force_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_central_force_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        ws->N = -1;
+        rebx_set_param_pointer(rebx, &force->ap, "central_force_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_central_force_free_arrays);
+    }
+    return ws;
+}
+
+static int rebx_central_force_build(struct rebx_extras* const rebx, struct rebx_central_force_workspace* const ws, const struct reb_particle* const particles, const int N, const rebx_param_handle Acentral_h, const rebx_param_handle gammacentral_h){
+    int n = 0;
+    for (int i=0; i<N; i++){
+        n += rebx_get_param_h(particles[i].ap, Acentral_h) != NULL && rebx_get_param_h(particles[i].ap, gammacentral_h) != NULL;
+    }
+    int* const sources = malloc((n > 0 ? n : 1)*sizeof(*sources));
+    if (sources == NULL){
+        return 0;
+    }
+    n = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_h(particles[i].ap, Acentral_h) != NULL && rebx_get_param_h(particles[i].ap, gammacentral_h) != NULL){
+            sources[n++] = i;
+        }
+    }
+    free(ws->sources);
+    ws->sources = sources;
+    ws->n = n;
+    ws->N = N;
+    ws->param_generation = rebx->param_generation;
+    return 1;
+}
 
 static void rebx_calculate_central_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double A, const double gamma, const int source_index){
     const struct reb_particle source = particles[source_index];
@@ -83,10 +142,19 @@ static void rebx_calculate_central_force(struct reb_simulation* const sim, struc
 }
 
 void rebx_central_force(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
-    for (int i=0; i<N; i++){
-        const double* const Acentral = rebx_get_param(sim->extras, particles[i].ap, "Acentral");
+    struct rebx_extras* const rebx = sim->extras;
+    const rebx_param_handle Acentral_h = rebx_default_param(rebx, REBX_PARAM_Acentral);
+    const rebx_param_handle gammacentral_h = rebx_default_param(rebx, REBX_PARAM_gammacentral);
+    struct rebx_central_force_workspace* const ws = rebx_central_force_workspace_get(rebx, force);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_central_force_build(rebx, ws, particles, N, Acentral_h, gammacentral_h))){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for central_force.\n");
+        return;
+    }
+    for (int k=0; k<ws->n; k++){
+        const int i = ws->sources[k];
+        const double* const Acentral = rebx_get_param_double_h(particles[i].ap, Acentral_h);   // the list is a superset if an ap was changed behind rebx_set_param, so check again
         if (Acentral != NULL){
-            const double* const gammacentral = rebx_get_param(sim->extras, particles[i].ap, "gammacentral");
+            const double* const gammacentral = rebx_get_param_double_h(particles[i].ap, gammacentral_h);
             if (gammacentral != NULL){
                 rebx_calculate_central_force(sim, particles, N, *Acentral, *gammacentral, i); // only calculates force if a particle has both Acentral and gammacentral parameters set.
             }
@@ -94,6 +162,63 @@ void rebx_central_force(struct reb_simulation* const sim, struct rebx_force* con
     }
 }
 
+struct rebx_central_force_state {
+    const struct rebx_central_force_workspace* ws;
+    rebx_param_handle Acentral_h;
+    rebx_param_handle gammacentral_h;
+};
+
+static int rebx_central_force_begin(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, void* const state){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_central_force_state* const st = state;
+    st->Acentral_h = rebx_default_param(rebx, REBX_PARAM_Acentral);
+    st->gammacentral_h = rebx_default_param(rebx, REBX_PARAM_gammacentral);
+    struct rebx_central_force_workspace* const ws = rebx_central_force_workspace_get(rebx, force);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_central_force_build(rebx, ws, particles, N, st->Acentral_h, st->gammacentral_h))){
+        return 0;   // rebx_central_force reports the error
+    }
+    st->ws = ws;
+    return 1;
+}
+
+static void rebx_central_force_block(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, struct rebx_fused_block* const b, void* const state){
+    const struct rebx_central_force_state* const st = state;
+    for (int s=0; s<st->ws->n; s++){
+        const int source_index = st->ws->sources[s];
+        const double* const Acentral = rebx_get_param_double_h(particles[source_index].ap, st->Acentral_h);
+        const double* const gammacentral = rebx_get_param_double_h(particles[source_index].ap, st->gammacentral_h);
+        if (Acentral == NULL || gammacentral == NULL){
+            continue;
+        }
+        const double A = *Acentral;
+        const double gamma = *gammacentral;
+        const struct reb_particle source = particles[source_index];
+        double rx = 0., ry = 0., rz = 0.;
+        for (int k=0; k<b->n; k++){
+            if (b->i0 + k == source_index){
+                continue;
+            }
+            const double dx = b->x[k] - source.x;
+            const double dy = b->y[k] - source.y;
+            const double dz = b->z[k] - source.z;
+            const double r2 = dx*dx + dy*dy + dz*dz;
+            const double prefac = A*pow(r2, (gamma-1.)/2.);
+
+            b->ax[k] += prefac*dx;
+            b->ay[k] += prefac*dy;
+            b->az[k] += prefac*dz;
+            rx -= b->m[k]/source.m*prefac*dx;
+            ry -= b->m[k]/source.m*prefac*dy;
+            rz -= b->m[k]/source.m*prefac*dz;
+        }
+        particles[source_index].ax += rx;
+        particles[source_index].ay += ry;
+        particles[source_index].az += rz;
+    }
+}
+
+const struct rebx_fused_kernel rebx_central_force_fused = {rebx_central_force, sizeof(struct rebx_central_force_state), rebx_central_force_begin, rebx_central_force_block};
+
 static double rebx_calculate_central_force_potential(struct reb_simulation* const sim, const double A, const double gamma, const int source_index){
     const struct reb_particle* const particles = sim->particles;
 	const int _N_real = sim->N - sim->N_var;
@@ -127,11 +252,13 @@ double rebx_central_force_potential(struct rebx_extras* const rebx){
     struct reb_simulation* sim = rebx->sim;
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
+    const rebx_param_handle Acentral_h = rebx_default_param(rebx, REBX_PARAM_Acentral);
+    const rebx_param_handle gammacentral_h = rebx_default_param(rebx, REBX_PARAM_gammacentral);
     double Htot = 0.;
     for (int i=0; i<N_real; i++){
-        const double* const Acentral = rebx_get_param(rebx, particles[i].ap, "Acentral");
+        const double* const Acentral = rebx_get_param_double_h(particles[i].ap, Acentral_h);
         if (Acentral != NULL){
-            const double* const gammacentral = rebx_get_param(rebx, particles[i].ap, "gammacentral");
+            const double* const gammacentral = rebx_get_param_double_h(particles[i].ap, gammacentral_h);
             if (gammacentral != NULL){
                 Htot += rebx_calculate_central_force_potential(sim, *Acentral, *gammacentral, i);
             }
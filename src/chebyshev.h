@@ -0,0 +1,82 @@
+// chebyshev.h - Chebyshev series evaluation shared by the planet and asteroid kernels
+
+#ifndef _CHEBYSHEV_H
+#define _CHEBYSHEV_H
+
+#if defined(__GNUC__)
+#define _CHEB_INLINE	static inline __attribute__((always_inline))
+#else
+#define _CHEB_INLINE	static inline
+#endif
+
+// Clenshaw's recurrence for the ncm (<= 3) series c[m*s + p], p < ncf, at
+// x in [-1, 1], with the first (v) and second (w) derivatives in x.  The
+// components are carried together so the loop over them vectorises.  v
+// and w may be NULL.
+_CHEB_INLINE void _cheb_clenshaw(const double *c, int s, int ncm, int ncf, double x,
+				 double *u, double *v, double *w)
+{
+	double b1[3] = {0.0}, b2[3] = {0.0};	// series
+	double d1[3] = {0.0}, d2[3] = {0.0};	// first derivative
+	double e1[3] = {0.0}, e2[3] = {0.0};	// second derivative
+	const double x2 = 2.0 * x;
+	double t;
+	int k, m;
+
+	for (k = ncf - 1; k >= 1; k--) {
+		for (m = 0; m < ncm; m++) {
+			if (w != NULL) {
+				t = 4.0 * d1[m] + x2 * e1[m] - e2[m];
+				e2[m] = e1[m]; e1[m] = t;
+			}
+			if (v != NULL) {
+				t = 2.0 * b1[m] + x2 * d1[m] - d2[m];
+				d2[m] = d1[m]; d1[m] = t;
+			}
+			t = x2 * b1[m] - b2[m] + c[m * s + k];
+			b2[m] = b1[m]; b1[m] = t;
+		}
+	}
+
+	for (m = 0; m < ncm; m++) {
+		u[m] = x * b1[m] - b2[m] + c[m * s];
+		if (v != NULL)
+			v[m] = b1[m] + x * d1[m] - d2[m];
+		if (w != NULL)
+			w[m] = 2.0 * d1[m] + x * e1[m] - e2[m];
+	}
+}
+
+// three components, specialised for the coefficient counts of DE430
+// (6, 7, 8, 10, 11, 13, 14) and sb431 (8) so the recurrence unrolls
+#define _CHEB_CASE(N)	case N: _cheb_clenshaw(c, s, 3, N, x, u, v, w); return;
+
+_CHEB_INLINE void cheb_eval3(const double *c, int s, int ncf, double x,
+			     double *u, double *v, double *w)
+{
+	switch (ncf) {
+	_CHEB_CASE(6)
+	_CHEB_CASE(7)
+	_CHEB_CASE(8)
+	_CHEB_CASE(10)
+	_CHEB_CASE(11)
+	_CHEB_CASE(13)
+	_CHEB_CASE(14)
+	}
+
+	_cheb_clenshaw(c, s, 3, ncf, x, u, v, w);
+}
+
+#undef _CHEB_CASE
+
+// any number of components, not specialised
+static inline void cheb_eval(const double *c, int s, int ncm, int ncf, double x,
+			     double *u, double *v, double *w)
+{
+	if (ncm == 3)
+		cheb_eval3(c, s, ncf, x, u, v, w);
+	else
+		_cheb_clenshaw(c, s, ncm, ncf, x, u, v, w);
+}
+
+#endif // _CHEBYSHEV_H
@@ -24,6 +24,9 @@
  */
 
 /* Main routines called each timestep. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // posix_memalign with -std=c99
+#endif
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,6 +34,7 @@
 #include <string.h>
 #include <limits.h>
 #include <float.h>
+#include <time.h>
 #include "core.h"
 #include "rebound.h"
 #include "linkedlist.h"
@@ -49,46 +53,9 @@ const char* rebx_githash_str = STRINGIFY(REBXGITHASH);             // This line
  ****************************/
 
 void rebx_register_default_params(struct rebx_extras* rebx){
-    rebx_register_param(rebx, "c", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "gr_source", REBX_TYPE_INT);
-    rebx_register_param(rebx, "tau_mass", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "force", REBX_TYPE_FORCE);
-    rebx_register_param(rebx, "particle", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "Acentral", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "gammacentral", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "max_iterations", REBX_TYPE_INT);
-    rebx_register_param(rebx, "J2", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "J4", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "R_eq", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "coordinates", REBX_TYPE_INT);
-    rebx_register_param(rebx, "p", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "tau_a", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "tau_e", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "tau_inc", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "tau_omega", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "tau_Omega", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "primary", REBX_TYPE_INT);
-    rebx_register_param(rebx, "radiation_source", REBX_TYPE_INT);
-    rebx_register_param(rebx, "beta", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "tides_primary", REBX_TYPE_INT);
-    rebx_register_param(rebx, "R_tides", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "k1", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "integrator", REBX_TYPE_INT);
-    rebx_register_param(rebx, "free_arrays", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "im_ps_final", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "im_ps_prev", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "im_ps_avg", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "rk2_k2", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "rk4_k2", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "rk4_k3", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "min_distance", REBX_TYPE_DOUBLE);
-    rebx_register_param(rebx, "min_distance_from", REBX_TYPE_UINT32);
-    rebx_register_param(rebx, "min_distance_orbit", REBX_TYPE_ORBIT);
-    rebx_register_param(rebx, "N_ephem", REBX_TYPE_INT);
-    rebx_register_param(rebx, "N_ast", REBX_TYPE_INT);
-    rebx_register_param(rebx, "geocentric", REBX_TYPE_INT);
-    rebx_register_param(rebx, "outstate", REBX_TYPE_POINTER);
-    rebx_register_param(rebx, "n_out", REBX_TYPE_INT);        
+#define REBX_REGISTER_DEFAULT_PARAM(name, type) rebx_register_param(rebx, #name, type);
+    REBX_DEFAULT_PARAMS(REBX_REGISTER_DEFAULT_PARAM)
+#undef REBX_REGISTER_DEFAULT_PARAM
 }
 
 void rebx_register_param(struct rebx_extras* const rebx, const char* name, enum rebx_param_type type){
@@ -168,6 +135,19 @@ void rebx_initialize(struct reb_simulation* sim, struct rebx_extras* rebx){
     rebx->allocated_forces=NULL;
     rebx->allocated_operators=NULL;
     rebx->registered_params=NULL;
+    rebx->param_ids=NULL;
+    rebx->pools=NULL;
+    rebx->param_columns=NULL;
+    rebx->column_removal=NULL;
+    rebx->integrator_workspace=NULL;
+    rebx->schedule=NULL;
+    rebx->param_generation=0;
+    rebx->stats_enabled=0;
+    rebx->archive_writer=NULL;
+    rebx->passes_running=0;
+    rebx->removed_forces=NULL;
+    rebx->removed_operators=NULL;
+    rebx->removed_steps=NULL;
     
     sim->free_particle_ap = rebx_free_particle_ap;
     sim->extras_cleanup = rebx_extras_cleanup;
@@ -199,6 +179,7 @@ struct rebx_force* rebx_create_force(struct rebx_extras* const rebx, const char*
     force->sim = rebx->sim;
     force->force_type = REBX_FORCE_NONE;
     force->update_accelerations = NULL;
+    force->stats = (struct rebx_stats){0};
     force->name = NULL;
     if(name != NULL)
     {
@@ -289,11 +270,12 @@ struct rebx_operator* rebx_create_operator(struct rebx_extras* const rebx, const
     operator->sim = rebx->sim;
     operator->operator_type = REBX_OPERATOR_NONE;
     operator->step_function = NULL;
+    operator->stats = (struct rebx_stats){0};
     operator->name = NULL;
     if(name != NULL){
         operator->name = rebx_malloc(rebx, strlen(name) + 1); // +1 for \0 at end
         if (operator->name == NULL){
-            rebx_free_operator(operator);
+            rebx_free_operator(rebx, operator);
             return NULL;
         }
         else{
@@ -304,7 +286,7 @@ struct rebx_operator* rebx_create_operator(struct rebx_extras* const rebx, const
     // Add operator to allocated_operators list for later freeing
     struct rebx_node* node = rebx_create_node(rebx);
     if (node == NULL){
-        rebx_free_operator(operator);
+        rebx_free_operator(rebx, operator);
         return NULL;
     }
     node->object = operator;
@@ -368,6 +350,8 @@ struct rebx_operator* rebx_load_operator(struct rebx_extras* const rebx, const c
     return operator;
 }
 
+static void rebx_invalidate_schedule(struct rebx_extras* const rebx);
+
 int rebx_add_force(struct rebx_extras* rebx, struct rebx_force* force){
     if (rebx->sim == NULL){
         rebx_error(rebx, ""); // rebx_error gives meaningful err
@@ -400,6 +384,7 @@ int rebx_add_force(struct rebx_extras* rebx, struct rebx_force* force){
     }
     node->object = force;
     rebx_add_node(&rebx->additional_forces, node);
+    rebx_invalidate_schedule(rebx);
     if (rebx->sim->additional_forces != NULL && rebx->sim->additional_forces != rebx_additional_forces){
         reb_warning(rebx->sim, "REBOUNDx Warning: additional_forces was set and is being overwritten by REBOUNDx. To incorporate both, you can add your own custom effects through REBOUNDx.  See https://github.com/dtamayo/reboundx/blob/master/ipython_examples/Custom_Effects.ipynb for a tutorial.\n");
     }
@@ -439,6 +424,7 @@ int rebx_add_operator_step(struct rebx_extras* rebx, struct rebx_operator* opera
         return 0;
     }
     node->object = step;
+    rebx_invalidate_schedule(rebx);
     
     if (timing == REBX_TIMING_PRE){
         rebx_add_node(&rebx->pre_timestep_modifications, node);
@@ -554,8 +540,8 @@ void rebx_set_param_double(struct rebx_extras* const rebx, struct rebx_node** ap
     if (param == NULL){
         return;
     }
-    if (param->value == NULL){ // new parameter, allocate
-        param->value = rebx_malloc(rebx, sizeof(double));
+    if (param->value == NULL){ // new parameter
+        param->value = &param->storage.d;
     }
     // Update new or existing param value
     double* valptr = param->value;
@@ -569,8 +555,8 @@ void rebx_set_param_int(struct rebx_extras* const rebx, struct rebx_node** apptr
     if (param == NULL){
         return;
     }
-    if (param->value == NULL){ // new parameter, allocate
-        param->value = rebx_malloc(rebx, sizeof(int));
+    if (param->value == NULL){ // new parameter
+        param->value = &param->storage.i;
     }
     // Update new or existing param value
     int* valptr = param->value;
@@ -584,8 +570,8 @@ void rebx_set_param_uint32(struct rebx_extras* const rebx, struct rebx_node** ap
     if (param == NULL){
         return;
     }
-    if (param->value == NULL){ // new parameter, allocate
-        param->value = rebx_malloc(rebx, sizeof(uint32_t));
+    if (param->value == NULL){ // new parameter
+        param->value = &param->storage.u;
     }
     // Update new or existing param value
     uint32_t* valptr = param->value;
@@ -599,10 +585,16 @@ void rebx_set_param_uint32(struct rebx_extras* const rebx, struct rebx_node** ap
  *******************************************************************/
 
 struct rebx_param* rebx_get_param_struct(struct rebx_extras* rebx, struct rebx_node* ap, const char* const param_name){
+    if (ap == NULL){
+        return NULL;
+    }
+    // Params whose name was not registered when they were added have no
+    // id, and are matched by name.
+    const int id = rebx_param_id(rebx, param_name);
     struct rebx_node* current = ap;
     while(current != NULL){
         struct rebx_param* param = current->object;
-        if(strcmp(param->name, param_name) == 0){
+        if(param->id >= 0 ? param->id == id : strcmp(param->name, param_name) == 0){
             return param;
         }
         current = current->next;
@@ -651,54 +643,67 @@ struct rebx_operator* rebx_get_operator(struct rebx_extras* const rebx, const ch
  User interface for removing REBOUNDx objects
  *******************************************************************/
 
+// Unlinks the node holding object from the list without freeing it.  Returns NULL if object isn't in the list
+static struct rebx_node* rebx_unlink_node(struct rebx_node** head, void* object){
+    for (struct rebx_node** link = head; *link != NULL; link = &(*link)->next){
+        if ((*link)->object == object){
+            struct rebx_node* const node = *link;
+            *link = node->next;
+            return node;
+        }
+    }
+    return NULL;
+}
+
 int rebx_remove_force(struct rebx_extras* rebx, struct rebx_force* force){
-    int allocated = rebx_remove_node(&rebx->allocated_forces, force);
+    struct rebx_node* allocated = rebx_unlink_node(&rebx->allocated_forces, force);
     if(allocated){
-        rebx_free_force(rebx, force);
+        if (rebx->passes_running){
+            rebx_add_node(&rebx->removed_forces, allocated);    // the pass calling the forces may still hold it
+        }
+        else{
+            rebx_free_force(rebx, force);
+            rebx_free_node(allocated);
+        }
     }
     // success only cares about removal from add_forces that affects sim
     int success = rebx_remove_node(&rebx->additional_forces, force);
+    rebx_invalidate_schedule(rebx);
     return success;
 }
 
 // Remove all steps in head pointer that have the passed operator in them.
 // Success = 1 if at least one removed. Need separate logic since operator
 // is nested inside step
-static int rebx_remove_step_node(struct rebx_node** head, struct rebx_operator* operator){
-    if (*head == NULL){
-        return 0;
-    }
-    
-    struct rebx_node* current = *head;
-    struct rebx_step* step = current->object;
-    if(step->operator == operator){ // edge case where step is first in list
-        *head = current->next;
-        rebx_free_step(step);
-        free(current);
-        return 1;
-    }
-    
-    struct rebx_node* prev = current;
-    current = current->next;
-    while (current != NULL){
-        step = current->object;
+static int rebx_remove_step_node(struct rebx_extras* rebx, struct rebx_node** head, struct rebx_operator* operator){
+    for (struct rebx_node** link = head; *link != NULL; link = &(*link)->next){
+        struct rebx_node* const current = *link;
+        struct rebx_step* const step = current->object;
         if(step->operator == operator){
-            prev->next = current->next;
-            rebx_free_step(step);
-            free(current);
+            *link = current->next;
+            if (rebx->passes_running){
+                rebx_add_node(&rebx->removed_steps, current);   // the pass calling the steps may still hold it
+            }
+            else{
+                rebx_free_step(step);
+                rebx_free_node(current);
+            }
             return 1;
         }
-        prev = current;
-        current = current->next;
     }
     return 0;
 }
 
 int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operator){
-    int allocated = rebx_remove_node(&rebx->allocated_operators, operator);
+    struct rebx_node* allocated = rebx_unlink_node(&rebx->allocated_operators, operator);
     if(allocated){
-        rebx_free_operator(operator);
-        
+        if (rebx->passes_running){
+            rebx_add_node(&rebx->removed_operators, allocated);
+        }
+        else{
+            rebx_free_operator(rebx, operator);
+            rebx_free_node(allocated);
+        }
     }
     
     // success only cares about removal from lists that actually do
@@ -706,7 +711,7 @@ int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operato
     int success = 0;
     int keep_searching = 1;
     while(keep_searching){ // keep searching while steps are found
-        keep_searching = rebx_remove_step_node(&rebx->pre_timestep_modifications, operator);
+        keep_searching = rebx_remove_step_node(rebx, &rebx->pre_timestep_modifications, operator);
         if (keep_searching == 1){ // success if at least one step found
             success = 1;
         }
@@ -714,11 +719,12 @@ int rebx_remove_operator(struct rebx_extras* rebx, struct rebx_operator* operato
 
     keep_searching = 1;
     while(keep_searching){ // keep searching while steps are found
-        keep_searching = rebx_remove_step_node(&rebx->post_timestep_modifications, operator);
+        keep_searching = rebx_remove_step_node(rebx, &rebx->post_timestep_modifications, operator);
         if (keep_searching == 1){ // success if at least one step found
             success = 1;
         }
     }
+    rebx_invalidate_schedule(rebx);
     
     return success;
 }
@@ -737,17 +743,138 @@ void* rebx_malloc(struct rebx_extras* const rebx, size_t memsize){
     return ptr;
 }
 
-void rebx_free_param(struct rebx_param* param){
-    if(param->name){
-        free(param->name);
+/*****************************************************************
+ Pools.  Nodes and params come from per extras slabs of equal sized
+ objects, with freed objects kept on a list for reuse, and parameter
+ names are packed into slabs of their own.  Slabs are aligned to their
+ size so an object finds its slab from its address (rebx_free_param
+ and rebx_free_ap have no rebx), and rebx_free_pointers releases them
+ all at once.  Names and small values are never freed on their own:
+ names borrow the registered copy or live in a name slab, and DOUBLE,
+ INT and UINT32 values are stored in the param.
+ *****************************************************************/
+
+#define REBX_SLAB_SIZE ((size_t)1 << 16)
+#define REBX_SLAB_HEADER 64         // keeps the objects cache line aligned
+
+struct rebx_pool_class {
+    size_t size;                    // object size
+    void* free_list;                // freed or not yet used objects, linked through their first word
+};
+
+struct rebx_slab {
+    struct rebx_slab* next;         // all slabs of the pools
+    struct rebx_pool_class* cls;    // NULL for name slabs
+};
+
+struct rebx_pools {
+    struct rebx_pool_class node;
+    struct rebx_pool_class param;
+    struct rebx_slab* slabs;
+    char* str;                      // next free byte of the current name slab
+    size_t str_left;
+};
+
+static struct rebx_slab* rebx_new_slab(struct rebx_extras* const rebx, struct rebx_pool_class* const cls){
+    void* mem;
+    if (posix_memalign(&mem, REBX_SLAB_SIZE, REBX_SLAB_SIZE) != 0){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory.\n");
+        return NULL;
+    }
+    struct rebx_slab* const slab = mem;
+    slab->next = rebx->pools->slabs;
+    slab->cls = cls;
+    rebx->pools->slabs = slab;
+    if (cls != NULL){
+        char* const first = (char*)slab + REBX_SLAB_HEADER;
+        const size_t n = (REBX_SLAB_SIZE - REBX_SLAB_HEADER)/cls->size;
+        for (size_t k=n; k-- > 0;){
+            void** const obj = (void**)(first + k*cls->size);
+            *obj = cls->free_list;
+            cls->free_list = obj;
+        }
+    }
+    return slab;
+}
+
+static int rebx_init_pools(struct rebx_extras* const rebx){
+    if (rebx->pools != NULL){
+        return 1;
+    }
+    struct rebx_pools* const pools = calloc(1, sizeof(*pools));
+    if (pools == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory.\n");
+        return 0;
+    }
+    pools->node.size = (sizeof(struct rebx_node) + 15) & ~(size_t)15;
+    pools->param.size = (sizeof(struct rebx_param) + 15) & ~(size_t)15;
+    rebx->pools = pools;
+    return 1;
+}
+
+static void* rebx_pool_alloc(struct rebx_extras* const rebx, struct rebx_pool_class* const cls){
+    if (cls->free_list == NULL && rebx_new_slab(rebx, cls) == NULL){
+        return NULL;
+    }
+    void** const obj = cls->free_list;
+    cls->free_list = *obj;
+    return obj;
+}
+
+static void rebx_pool_free(void* const obj){
+    if (obj == NULL){
+        return;
+    }
+    struct rebx_slab* const slab = (struct rebx_slab*)((uintptr_t)obj & ~(uintptr_t)(REBX_SLAB_SIZE - 1));
+    *(void**)obj = slab->cls->free_list;
+    slab->cls->free_list = obj;
+}
+
+char* rebx_pool_strdup(struct rebx_extras* const rebx, const char* const str){
+    const size_t len = strlen(str) + 1;
+    if (len > REBX_SLAB_SIZE - REBX_SLAB_HEADER){
+        rebx_error(rebx, "REBOUNDx Error: Parameter name too long.\n");
+        return NULL;
+    }
+    if (!rebx_init_pools(rebx)){
+        return NULL;
     }
-    // Don't free pointers to structs
-    if(param->type == REBX_TYPE_INT || param->type == REBX_TYPE_DOUBLE){
-        if(param->value){
-            free(param->value);
+    struct rebx_pools* const pools = rebx->pools;
+    if (len > pools->str_left){
+        struct rebx_slab* const slab = rebx_new_slab(rebx, NULL);
+        if (slab == NULL){
+            return NULL;
         }
+        pools->str = (char*)slab + REBX_SLAB_HEADER;
+        pools->str_left = REBX_SLAB_SIZE - REBX_SLAB_HEADER;
+    }
+    char* const copy = pools->str;
+    memcpy(copy, str, len);
+    pools->str += len;
+    pools->str_left -= len;
+    return copy;
+}
+
+void rebx_free_pools(struct rebx_pools* pools){
+    if (pools == NULL){
+        return;
     }
-    free(param);
+    struct rebx_slab* slab = pools->slabs;
+    while (slab != NULL){
+        struct rebx_slab* const next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(pools);
+}
+
+void rebx_free_node(struct rebx_node* node){
+    rebx_pool_free(node);
+}
+
+void rebx_free_param(struct rebx_param* param){
+    // The name and DOUBLE, INT and UINT32 values go with the pools.  Don't free pointers to structs
+    rebx_pool_free(param);
 }
 
 void rebx_free_ap(struct rebx_node** ap){
@@ -756,13 +883,21 @@ void rebx_free_ap(struct rebx_node** ap){
     while (current != NULL){
         next = current->next;
         rebx_free_param(current->object);
-        free(current);
+        rebx_free_node(current);
         current = next;
     }
+    *ap = NULL;
 }
 
+static void rebx_record_column_removal(struct rebx_extras* const rebx, const struct reb_particle* const p);
+
 void rebx_free_particle_ap(struct reb_particle* p){
     rebx_free_ap(&p->ap);
+    if (p->sim != NULL && p->sim->extras != NULL){
+        struct rebx_extras* const rebx = p->sim->extras;
+        rebx->param_generation++;
+        rebx_record_column_removal(rebx, p);    // reb_remove calls this before it moves the particles
+    }
 }
 
 void rebx_free_force(struct rebx_extras* rebx, struct rebx_force* force){
@@ -770,6 +905,7 @@ void rebx_free_force(struct rebx_extras* rebx, struct rebx_force* force){
     if (free_arrays){
         free_arrays(rebx, force);
     }
+    rebx_integrator_forget(rebx, force);
     if(force->name){
         free(force->name);
     }
@@ -777,7 +913,11 @@ void rebx_free_force(struct rebx_extras* rebx, struct rebx_force* force){
     free(force);
 }
 
-void rebx_free_operator(struct rebx_operator* operator){
+void rebx_free_operator(struct rebx_extras* rebx, struct rebx_operator* operator){
+    void (*free_arrays)(struct rebx_extras* rebx, struct rebx_operator* operator) = rebx_get_param(rebx, operator->ap, "free_arrays");
+    if (free_arrays){
+        free_arrays(rebx, operator);
+    }
     if(operator->name){
         free(operator->name);
     }
@@ -789,17 +929,40 @@ void rebx_free_step(struct rebx_step* step){
     free(step);
 }
 
-void rebx_free_reg_param(struct rebx_param* param){
-    if(param->name){
-        free(param->name);
+// Frees what was removed while the forces or steps were being called, once they have all returned
+static void rebx_free_removed(struct rebx_extras* const rebx){
+    struct rebx_node* next;
+    for (struct rebx_node* current = rebx->removed_forces; current != NULL; current = next){
+        next = current->next;
+        rebx_free_force(rebx, current->object);
+        rebx_free_node(current);
+    }
+    for (struct rebx_node* current = rebx->removed_operators; current != NULL; current = next){
+        next = current->next;
+        rebx_free_operator(rebx, current->object);
+        rebx_free_node(current);
+    }
+    for (struct rebx_node* current = rebx->removed_steps; current != NULL; current = next){
+        next = current->next;
+        rebx_free_step(current->object);
+        rebx_free_node(current);
     }
-    free(param);
+    rebx->removed_forces = NULL;
+    rebx->removed_operators = NULL;
+    rebx->removed_steps = NULL;
 }
 
 void rebx_free_pointers(struct rebx_extras* rebx){
     if (rebx == NULL){
         return;
     }
+    // The parameters of the particles go with the pools below
+    struct reb_simulation* const sim = rebx->sim;
+    if (sim != NULL){
+        for (int i=0; i<sim->N; i++){
+            sim->particles[i].ap = NULL;
+        }
+    }
     rebx_detach(rebx->sim, rebx);
     struct rebx_node* current;
     struct rebx_node* next;
@@ -808,22 +971,24 @@ void rebx_free_pointers(struct rebx_extras* rebx){
     while (current != NULL){
         next = current->next;
         rebx_free_force(rebx, current->object);
-        free(current);
+        rebx_free_node(current);
         current = next;
     }
     
     current = rebx->allocated_operators;
     while (current != NULL){
         next = current->next;
-        rebx_free_operator(current->object);
-        free(current);
+        rebx_free_operator(rebx, current->object);
+        rebx_free_node(current);
         current = next;
     }
     
+    rebx_free_removed(rebx);
+    
     current = rebx->additional_forces;
     while (current != NULL){
         next = current->next;
-        free(current);
+        rebx_free_node(current);
         current = next;
     }
     
@@ -832,7 +997,7 @@ void rebx_free_pointers(struct rebx_extras* rebx){
     while (current != NULL){
         next = current->next;
         rebx_free_step(current->object);
-        free(current);
+        rebx_free_node(current);
         current = next;
     }
     
@@ -840,17 +1005,25 @@ void rebx_free_pointers(struct rebx_extras* rebx){
     while (current != NULL){
         next = current->next;
         rebx_free_step(current->object);
-        free(current);
+        rebx_free_node(current);
         current = next;
     }
     
-    current = rebx->registered_params;
-    while (current != NULL){
-        next = current->next;
-        rebx_free_reg_param(current->object);
-        free(current);
-        current = next;
-    }
+    rebx->additional_forces = NULL;
+    rebx->pre_timestep_modifications = NULL;
+    rebx->post_timestep_modifications = NULL;
+    rebx->allocated_forces = NULL;
+    rebx->allocated_operators = NULL;
+    rebx->registered_params = NULL;     // in the pools
+    rebx_free_param_columns(rebx);      // nodes are in the pools
+    rebx_free_integrator_workspace(rebx);
+    rebx_invalidate_schedule(rebx);
+    rebx_free_archive_writer(rebx->archive_writer);
+    rebx->archive_writer = NULL;
+    rebx_free_param_ids(rebx->param_ids);
+    rebx->param_ids = NULL;
+    rebx_free_pools(rebx->pools);
+    rebx->pools = NULL;
 }
 
 /**********************************************
@@ -865,139 +1038,1228 @@ void rebx_reset_accelerations(struct reb_particle* const ps, const int N){
     }
 }
 
-void rebx_additional_forces(struct reb_simulation* sim){
-    struct rebx_extras* rebx = sim->extras;
-    struct rebx_node* current = rebx->additional_forces;
-    while(current != NULL){
-        /*if(sim->force_is_velocity_dependent && sim->integrator==REB_INTEGRATOR_WHFAST){
-         reb_warning(sim, "REBOUNDx: Passing a velocity-dependent force to WHFAST. Need to apply as an operator.");
-         }*/
-        struct rebx_force* force = current->object;
-        const double N = sim->N - sim->N_var;
-        force->update_accelerations(sim, force, sim->particles, N);
-        current = current->next;
+struct rebx_integrator_workspace* rebx_integrator_workspace_get(struct rebx_extras* const rebx, const int N){
+    struct rebx_integrator_workspace* ws = rebx->integrator_workspace;
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        rebx->integrator_workspace = ws;
+    }
+    if (N > ws->N_alloc){   // particles added since the last step.  Nothing is kept between steps, so no need to copy.
+        struct reb_particle* const ps = malloc(N*sizeof(*ps));
+        double* const vec = malloc(REBX_INTEGRATOR_N_VEC*3*N*sizeof(*vec));
+        if (ps == NULL || vec == NULL){
+            free(ps);
+            free(vec);
+            return NULL;
+        }
+        free(ws->ps);
+        free(ws->vec[0]);
+        ws->ps = ps;
+        for (int k=0; k<REBX_INTEGRATOR_N_VEC; k++){
+            ws->vec[k] = vec + k*3*N;
+        }
+        ws->N_alloc = N;
     }
+    return ws;
 }
 
-void rebx_pre_timestep_modifications(struct reb_simulation* sim){
-    struct rebx_extras* rebx = sim->extras;
-    struct rebx_node* current = rebx->pre_timestep_modifications;
-    const double dt = sim->dt;
-    
-    while(current != NULL){
-        struct rebx_step* step = current->object;
-        struct rebx_operator* operator = step->operator;
-        if(sim->integrator==REB_INTEGRATOR_IAS15 && sim->ri_ias15.epsilon != 0 && operator->operator_type == REBX_OPERATOR_UPDATER){
-            reb_warning(sim, "REBOUNDx: Operators that affect particle trajectories with adaptive timesteps can give spurious results. Use sim.ri_ias15.epsilon=0 for fixed timestep with IAS, or use a different integrator.");
+struct rebx_integrator_history* rebx_integrator_history_get(struct rebx_extras* const rebx, struct rebx_force* const force, const int N){
+    struct rebx_integrator_workspace* const ws = rebx_integrator_workspace_get(rebx, N);
+    if (ws == NULL){
+        return NULL;
+    }
+    struct rebx_integrator_history* h = ws->history;
+    while (h != NULL && h->force != force){
+        h = h->next;
+    }
+    if (h == NULL){
+        h = calloc(1, sizeof(*h));
+        if (h == NULL){
+            return NULL;
         }
-        operator->step_function(sim, operator, dt*step->dt_fraction);
-        current = current->next;
+        h->force = force;
+        h->next = ws->history;
+        ws->history = h;
+    }
+    if (h->N != N){             // particles were added or removed, the last step says nothing about this one
+        h->N = 0;
+    }
+    if (N > h->N_alloc){
+        double* const dv = malloc(3*N*sizeof(*dv));
+        if (dv == NULL){
+            return NULL;
+        }
+        free(h->dv);
+        h->dv = dv;
+        h->N_alloc = N;
     }
+    return h;
 }
 
-void rebx_post_timestep_modifications(struct reb_simulation* sim){
-    struct rebx_extras* rebx = sim->extras;
-    struct rebx_node* current = rebx->post_timestep_modifications;
-    const double dt = sim->dt;
-    
-    while(current != NULL){
-        struct rebx_step* step = current->object;
-        struct rebx_operator* operator = step->operator;
-        if(sim->integrator==REB_INTEGRATOR_IAS15 && sim->ri_ias15.epsilon != 0 && operator->operator_type == REBX_OPERATOR_UPDATER){
-            reb_warning(sim, "REBOUNDx: Operators that affect particle trajectories with adaptive timesteps can give spurious results. Use sim.ri_ias15.epsilon=0 for fixed timestep with IAS, or use a different integrator.");
+void rebx_integrator_forget(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_integrator_workspace* const ws = rebx->integrator_workspace;
+    if (ws == NULL){
+        return;
+    }
+    struct rebx_integrator_history** h = &ws->history;
+    while (*h != NULL){
+        if ((*h)->force == force){
+            struct rebx_integrator_history* const next = (*h)->next;
+            free((*h)->dv);
+            free(*h);
+            *h = next;
+        }
+        else{
+            h = &(*h)->next;
         }
-        operator->step_function(sim, operator, dt*step->dt_fraction);
-        current = current->next;
     }
 }
 
-/****************************************************************
- Internal functions for dealing with parameters
- ****************************************************************/
+void rebx_free_integrator_workspace(struct rebx_extras* const rebx){
+    struct rebx_integrator_workspace* const ws = rebx->integrator_workspace;
+    if (ws != NULL){
+        struct rebx_integrator_history* h = ws->history;
+        while (h != NULL){
+            struct rebx_integrator_history* const next = h->next;
+            free(h->dv);
+            free(h);
+            h = next;
+        }
+        free(ws->ps);
+        free(ws->vec[0]);
+        free(ws);
+    }
+    rebx->integrator_workspace = NULL;
+}
 
-struct rebx_node* rebx_create_node(struct rebx_extras* rebx){
-    struct rebx_node* node = rebx_malloc(rebx, sizeof(*node));
-    if (node == NULL){
-        return NULL;
+/****************************************
+ Profiling
+ *****************************************/
+
+static double rebx_stats_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void rebx_stats_add(struct rebx_stats* const stats, const int N, const double time){
+    stats->calls++;
+    stats->particles += N;
+    stats->time += time;
+}
+
+void rebx_enable_stats(struct rebx_extras* const rebx, const int enable){
+    rebx->stats_enabled = enable != 0;
+}
+
+void rebx_reset_stats(struct rebx_extras* const rebx){
+    for (struct rebx_node* node = rebx->allocated_forces; node != NULL; node = node->next){
+        ((struct rebx_force*)node->object)->stats = (struct rebx_stats){0};
+    }
+    for (struct rebx_node* node = rebx->allocated_operators; node != NULL; node = node->next){
+        ((struct rebx_operator*)node->object)->stats = (struct rebx_stats){0};
     }
-    node->object = NULL;
-    node->next = NULL;
-    return node;
 }
 
-struct rebx_param* rebx_create_param(struct rebx_extras* rebx, const char* name, enum rebx_param_type type){
-    // Allocate and initialize new param struct
-    struct rebx_param* param = rebx_malloc(rebx, sizeof(*param));
-    if (param == NULL){
-        return NULL;
+int rebx_get_stats(struct rebx_extras* const rebx, const char* const name, struct rebx_stats* const stats){
+    const struct rebx_force* const force = rebx_get_force(rebx, name);
+    if (force != NULL){
+        *stats = force->stats;
+        return 1;
     }
-    param->type = type;
-    param->value = NULL;
-    param->name = rebx_malloc(rebx, strlen(name) + 1); // +1 for \0 at end
-    if (param->name == NULL){
-        return NULL;
+    const struct rebx_operator* const operator = rebx_get_operator(rebx, name);
+    if (operator != NULL){
+        *stats = operator->stats;
+        return 1;
     }
-    else{
-        strcpy(param->name, name);
+    return 0;
+}
+
+// The forces and operator steps in the order they are called, rebuilt from the lists when one is added or removed.
+struct rebx_schedule_force {
+    struct rebx_force* force;
+    const struct rebx_fused_kernel* fused;  // NULL unless the force is evaluated in the fused pass
+    void* fused_state;
+    int fused_active;                       // begin accepted the current pass
+};
+
+struct rebx_schedule_step {
+    struct rebx_step* step;
+    struct rebx_operator* operator;
+    double dt_fraction;
+};
+
+struct rebx_schedule {
+    int N_forces;
+    int N_pre;
+    int N_post;
+    int pre_updates_particles;      // any operator of type REBX_OPERATOR_UPDATER, for the IAS15 warning
+    int post_updates_particles;
+    int running;                    // passes going through the arrays, which are freed once they return
+    int stale;                      // forces or operators changed during those passes
+    int fused_at;                   // index of the first fused force, where the fused pass runs, or -1
+    int fusable;                    // some force has a fused kernel, so the schedule follows its "fused" parameter
+    uint64_t param_generation;      // rebx->param_generation when the schedule was built
+    struct rebx_schedule_force* forces;
+    struct rebx_schedule_step* pre;
+    struct rebx_schedule_step* post;
+};
+
+static void rebx_free_schedule(struct rebx_schedule* const schedule){
+    for (int i=0; i<schedule->N_forces; i++){
+        free(schedule->forces[i].fused_state);
+    }
+    free(schedule->forces);
+    free(schedule->pre);
+    free(schedule->post);
+    free(schedule);
+}
+
+static void rebx_invalidate_schedule(struct rebx_extras* const rebx){
+    struct rebx_schedule* const schedule = rebx->schedule;
+    if (schedule != NULL){
+        if (schedule->running){
+            schedule->stale = 1;
+        }
+        else{
+            rebx_free_schedule(schedule);
+        }
     }
-    
-    return param;
+    rebx->schedule = NULL;
 }
 
-int rebx_add_param(struct rebx_extras* const rebx, struct rebx_node** apptr, struct rebx_param* param){
-    struct rebx_node* node = rebx_create_node(rebx);
-    if (node == NULL){
-        return 0;
+// While a pass holds a schedule, forces and operators that are removed stay allocated, so the pass can go on through its arrays
+static void rebx_hold_schedule(struct rebx_extras* const rebx, struct rebx_schedule* const schedule){
+    schedule->running++;
+    rebx->passes_running++;
+}
+
+static void rebx_release_schedule(struct rebx_extras* const rebx, struct rebx_schedule* const schedule){
+    schedule->running--;
+    if (schedule->stale && schedule->running == 0){
+        rebx_free_schedule(schedule);
+    }
+    rebx->passes_running--;
+    if (rebx->passes_running == 0){
+        rebx_free_removed(rebx);
     }
-    node->object = param;
-    rebx_add_node(apptr, node);
-    return 1;
 }
 
-// needed from Python
-enum rebx_param_type rebx_get_type(struct rebx_extras* rebx, const char* name){
-    struct rebx_param* param = rebx_get_param_struct(rebx, rebx->registered_params, name);
-    
-    if (param == NULL){ // param not found
-        return REBX_TYPE_NONE;
+static int rebx_in_list(const struct rebx_node* node, const void* const object){
+    for (; node != NULL; node = node->next){
+        if (node->object == object){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int rebx_schedule_steps(struct rebx_node* current, struct rebx_schedule_step** steps, int* const updates_particles){
+    int N = 0;
+    for (struct rebx_node* node = current; node != NULL; node = node->next){
+        N++;
+    }
+    *steps = malloc((N > 0 ? N : 1)*sizeof(**steps));
+    if (*steps == NULL){
+        return -1;
+    }
+    *updates_particles = 0;
+    for (int i=0; i<N; i++){
+        struct rebx_step* const step = current->object;
+        (*steps)[i].step = step;
+        (*steps)[i].operator = step->operator;
+        (*steps)[i].dt_fraction = step->dt_fraction;
+        if (step->operator->operator_type == REBX_OPERATOR_UPDATER){
+            *updates_particles = 1;
+        }
+        current = current->next;
+    }
+    return N;
+}
+
+// Forces with a fused kernel and the "fused" parameter set are all evaluated together, where the first of them would be
+static const struct rebx_fused_kernel* const rebx_fused_kernels[] = {
+    &rebx_gr_potential_fused,
+    &rebx_radiation_forces_fused,
+    &rebx_tides_precession_fused,
+    &rebx_central_force_fused,
+    &rebx_gravitational_harmonics_fused,
+};
+
+static const struct rebx_fused_kernel* rebx_fused_kernel_of(const struct rebx_force* const force){
+    for (size_t k=0; k<sizeof(rebx_fused_kernels)/sizeof(rebx_fused_kernels[0]); k++){
+        if (rebx_fused_kernels[k]->update_accelerations == force->update_accelerations){
+            return rebx_fused_kernels[k];
+        }
     }
+    return NULL;
+}
+
+static struct rebx_schedule* rebx_get_schedule(struct rebx_extras* const rebx){
+    if (rebx->schedule != NULL){
+        return rebx->schedule;
+    }
+    struct rebx_schedule* const schedule = calloc(1, sizeof(*schedule));
+    if (schedule == NULL){
+        reb_error(rebx->sim, "REBOUNDx Error: Could not allocate memory for the forces and operators.\n");
+        return NULL;
+    }
+    rebx->schedule = schedule;
     
-    return param->type;
+    int N = 0;
+    for (struct rebx_node* node = rebx->additional_forces; node != NULL; node = node->next){
+        N++;
+    }
+    schedule->forces = calloc(N > 0 ? N : 1, sizeof(*schedule->forces));
+    schedule->N_pre = rebx_schedule_steps(rebx->pre_timestep_modifications, &schedule->pre, &schedule->pre_updates_particles);
+    schedule->N_post = rebx_schedule_steps(rebx->post_timestep_modifications, &schedule->post, &schedule->post_updates_particles);
+    if (schedule->forces == NULL || schedule->N_pre < 0 || schedule->N_post < 0){
+        rebx_invalidate_schedule(rebx);
+        reb_error(rebx->sim, "REBOUNDx Error: Could not allocate memory for the forces and operators.\n");
+        return NULL;
+    }
+    schedule->N_forces = N;
+    schedule->fused_at = -1;
+    schedule->param_generation = rebx->param_generation;
+    const rebx_param_handle fused_h = rebx_default_param(rebx, REBX_PARAM_fused);
+    struct rebx_node* current = rebx->additional_forces;
+    for (int i=0; i<N; i++){
+        struct rebx_force* const force = current->object;
+        schedule->forces[i].force = force;
+        const struct rebx_fused_kernel* const kernel = rebx_fused_kernel_of(force);
+        const int* const fused = rebx_get_param_int_h(force->ap, fused_h);
+        schedule->fusable |= kernel != NULL;
+        if (kernel != NULL && fused != NULL && *fused){
+            schedule->forces[i].fused_state = calloc(1, kernel->state_size > 0 ? kernel->state_size : 1);
+            if (schedule->forces[i].fused_state == NULL){
+                rebx_invalidate_schedule(rebx);
+                reb_error(rebx->sim, "REBOUNDx Error: Could not allocate memory for the forces and operators.\n");
+                return NULL;
+            }
+            schedule->forces[i].fused = kernel;
+            if (schedule->fused_at < 0){
+                schedule->fused_at = i;
+            }
+        }
+        current = current->next;
+    }
+    return schedule;
 }
 
-size_t rebx_sizeof(struct rebx_extras* rebx, enum rebx_param_type type){
-    switch(type){
-        case REBX_TYPE_DOUBLE:
-        {
-            return sizeof(double);
+static void rebx_call_force(struct reb_simulation* const sim, struct rebx_force* const force, const int N){
+    const struct rebx_extras* const rebx = sim->extras;
+    if (rebx->stats_enabled){
+        const double t0 = rebx_stats_clock();
+        force->update_accelerations(sim, force, sim->particles, N);
+        rebx_stats_add(&force->stats, N, rebx_stats_clock() - t0);
+    }
+    else{
+        force->update_accelerations(sim, force, sim->particles, N);
+    }
+}
+
+// One pass over the particles for all the fused forces.  A force whose kernel declines is called on its own instead.
+static void rebx_fused_forces(struct reb_simulation* const sim, struct rebx_schedule* const schedule, const int N){
+    struct reb_particle* const particles = sim->particles;
+    const struct rebx_extras* const rebx = sim->extras;
+    const int stats = rebx->stats_enabled;
+    int n_active = 0;
+    for (int i=schedule->fused_at; i<schedule->N_forces; i++){
+        struct rebx_schedule_force* const f = &schedule->forces[i];
+        f->fused_active = 0;
+        if (f->fused == NULL || (schedule->stale && !rebx_in_list(rebx->additional_forces, f->force))){
+            continue;
         }
-        case REBX_TYPE_INT:
-        {
-            return sizeof(int);
+        const double t0 = stats ? rebx_stats_clock() : 0.;
+        if (f->force->update_accelerations == f->fused->update_accelerations){
+            f->fused_active = f->fused->begin(sim, f->force, particles, N, f->fused_state);
         }
-        case REBX_TYPE_FORCE:
-        {
-            return sizeof(struct rebx_force);
+        if (f->fused_active){
+            n_active++;
         }
-        /*case REBX_TYPE_ORBIT:
-        {
-            return sizeof(struct reb_orbit);
-        }*/
-        case REBX_TYPE_POINTER:
-        {
-            return 0;
+        else{
+            f->force->update_accelerations(sim, f->force, sim->particles, N);
         }
-        case REBX_TYPE_NONE:
-        {
-            rebx_error(rebx, "REBOUNDx Error: Parameter name passed to rebx_sizeof was not registered. This should not happen. Please open issue on github.com/dtamayo/reboundx.\n");
-            return 0;
+        if (stats){
+            rebx_stats_add(&f->force->stats, N, rebx_stats_clock() - t0);
         }
-        default:
-        {
-            rebx_error(rebx, "REBOUNDx Error: Need to add new param type to switch statement in rebx_sizeof. Please open issue on github.com/dtamayo/reboundx.\n");
-            return 0;
+    }
+    if (n_active == 0){
+        return;
+    }
+    if (schedule->stale){
+        // A force that declined may have removed others, or added particles
+        n_active = 0;
+        for (int i=schedule->fused_at; i<schedule->N_forces; i++){
+            struct rebx_schedule_force* const f = &schedule->forces[i];
+            f->fused_active = f->fused_active && rebx_in_list(rebx->additional_forces, f->force);
+            n_active += f->fused_active;
         }
+        if (sim->particles != particles){
+            for (int i=schedule->fused_at; i<schedule->N_forces; i++){
+                struct rebx_schedule_force* const f = &schedule->forces[i];
+                if (f->fused_active){
+                    f->force->update_accelerations(sim, f->force, sim->particles, N);   // counted when begin was called
+                }
+            }
+            return;
+        }
+    }
+    if (n_active == 0){
+        return;
     }
+    struct rebx_fused_block block;
+    for (int i0=0; i0<N; i0+=REBX_FUSED_BLOCK){
+        const int n = N - i0 < REBX_FUSED_BLOCK ? N - i0 : REBX_FUSED_BLOCK;
+        block.i0 = i0;
+        block.n = n;
+        for (int k=0; k<n; k++){
+            const struct reb_particle* const p = &particles[i0+k];
+            block.x[k] = p->x; block.y[k] = p->y; block.z[k] = p->z;
+            block.vx[k] = p->vx; block.vy[k] = p->vy; block.vz[k] = p->vz;
+            block.m[k] = p->m;
+            block.ax[k] = 0.; block.ay[k] = 0.; block.az[k] = 0.;
+        }
+        for (int i=schedule->fused_at; i<schedule->N_forces; i++){
+            struct rebx_schedule_force* const f = &schedule->forces[i];
+            if (f->fused != NULL && f->fused_active){
+                if (stats){
+                    const double t0 = rebx_stats_clock();
+                    f->fused->block(sim, f->force, particles, &block, f->fused_state);
+                    f->force->stats.time += rebx_stats_clock() - t0;
+                }
+                else{
+                    f->fused->block(sim, f->force, particles, &block, f->fused_state);
+                }
+            }
+        }
+        for (int k=0; k<n; k++){
+            struct reb_particle* const p = &particles[i0+k];
+            p->ax += block.ax[k];
+            p->ay += block.ay[k];
+            p->az += block.az[k];
+        }
+    }
+}
+
+static int rebx_schedule_has_force(const struct rebx_schedule* const schedule, const struct rebx_force* const force){
+    for (int i=0; i<schedule->N_forces; i++){
+        if (schedule->forces[i].force == force){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Calls the forces of the schedule, except those of called, the schedule of the pass it continues.  Forces removed by one
+// called earlier are skipped, and those added are called after the others from the rebuilt schedule.
+static void rebx_force_pass(struct reb_simulation* const sim, struct rebx_schedule* const schedule, const struct rebx_schedule* const called, const int N){
+    struct rebx_extras* const rebx = sim->extras;
+    rebx_hold_schedule(rebx, schedule);
+    for (int i=0; i<schedule->N_forces; i++){
+        struct rebx_schedule_force* const f = &schedule->forces[i];
+        if (called != NULL && rebx_schedule_has_force(called, f->force)){
+            continue;
+        }
+        if (f->fused != NULL && called == NULL){
+            if (i == schedule->fused_at){
+                rebx_fused_forces(sim, schedule, N);
+            }
+        }
+        else if (!schedule->stale || rebx_in_list(rebx->additional_forces, f->force)){
+            rebx_call_force(sim, f->force, N);
+        }
+    }
+    if (schedule->stale){
+        struct rebx_schedule* const current = rebx_get_schedule(rebx);
+        if (current != NULL){
+            rebx_force_pass(sim, current, schedule, N);
+        }
+    }
+    rebx_release_schedule(rebx, schedule);
+}
+
+void rebx_additional_forces(struct reb_simulation* sim){
+    struct rebx_extras* rebx = sim->extras;
+    rebx_sync_param_columns(rebx);
+    if (rebx->schedule != NULL && rebx->schedule->fusable && !rebx->schedule->running && rebx->schedule->param_generation != rebx->param_generation){
+        rebx_invalidate_schedule(rebx);     // the "fused" parameter of a force may have been set
+    }
+    struct rebx_schedule* const schedule = rebx_get_schedule(rebx);
+    if (schedule == NULL){
+        return;
+    }
+    /*if(sim->force_is_velocity_dependent && sim->integrator==REB_INTEGRATOR_WHFAST){
+     reb_warning(sim, "REBOUNDx: Passing a velocity-dependent force to WHFAST. Need to apply as an operator.");
+     }*/
+    rebx_force_pass(sim, schedule, NULL, sim->N - sim->N_var);
+}
+
+static int rebx_schedule_has_step(const struct rebx_schedule_step* const steps, const int N_steps, const struct rebx_step* const step){
+    for (int i=0; i<N_steps; i++){
+        if (steps[i].step == step){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Like rebx_force_pass, for the operator steps before or after the timestep
+static void rebx_run_steps(struct reb_simulation* const sim, struct rebx_schedule* const schedule, const enum rebx_timing timing, const struct rebx_schedule* const called){
+    struct rebx_extras* const rebx = sim->extras;
+    const int pre = timing == REBX_TIMING_PRE;
+    const struct rebx_schedule_step* const steps = pre ? schedule->pre : schedule->post;
+    const int N_steps = pre ? schedule->N_pre : schedule->N_post;
+    const int updates_particles = pre ? schedule->pre_updates_particles : schedule->post_updates_particles;
+    if(called == NULL && updates_particles && sim->integrator==REB_INTEGRATOR_IAS15 && sim->ri_ias15.epsilon != 0){
+        reb_warning(sim, "REBOUNDx: Operators that affect particle trajectories with adaptive timesteps can give spurious results. Use sim.ri_ias15.epsilon=0 for fixed timestep with IAS, or use a different integrator.");
+    }
+    const double dt = sim->dt;
+    const int stats = rebx->stats_enabled;
+    rebx_hold_schedule(rebx, schedule);
+    for (int i=0; i<N_steps; i++){
+        const struct rebx_schedule_step* const s = &steps[i];
+        if (called != NULL && rebx_schedule_has_step(pre ? called->pre : called->post, pre ? called->N_pre : called->N_post, s->step)){
+            continue;
+        }
+        if (schedule->stale && !rebx_in_list(pre ? rebx->pre_timestep_modifications : rebx->post_timestep_modifications, s->step)){
+            continue;
+        }
+        if (stats){
+            const double t0 = rebx_stats_clock();
+            s->operator->step_function(sim, s->operator, dt*s->dt_fraction);
+            rebx_stats_add(&s->operator->stats, sim->N - sim->N_var, rebx_stats_clock() - t0);
+        }
+        else{
+            s->operator->step_function(sim, s->operator, dt*s->dt_fraction);
+        }
+    }
+    if (schedule->stale){
+        struct rebx_schedule* const current = rebx_get_schedule(rebx);
+        if (current != NULL){
+            rebx_run_steps(sim, current, timing, schedule);
+        }
+    }
+    rebx_release_schedule(rebx, schedule);
+}
+
+void rebx_pre_timestep_modifications(struct reb_simulation* sim){
+    struct rebx_extras* rebx = sim->extras;
+    rebx_sync_param_columns(rebx);
+    struct rebx_schedule* const schedule = rebx_get_schedule(rebx);
+    if (schedule == NULL){
+        return;
+    }
+    rebx_run_steps(sim, schedule, REBX_TIMING_PRE, NULL);
+}
+
+void rebx_post_timestep_modifications(struct reb_simulation* sim){
+    struct rebx_extras* rebx = sim->extras;
+    rebx_sync_param_columns(rebx);
+    struct rebx_schedule* const schedule = rebx_get_schedule(rebx);
+    if (schedule != NULL){
+        rebx_run_steps(sim, schedule, REBX_TIMING_POST, NULL);
+    }
+    if (rebx->archive_writer != NULL){  // after the steps, so the snapshot has what they recorded
+        rebx_archive_heartbeat(rebx);
+    }
+}
+
+/****************************************************************
+ Internal functions for dealing with parameters
+ ****************************************************************/
+
+static struct rebx_param* rebx_param_ids_find(const struct rebx_param_ids* const ids, const char* const name);
+
+struct rebx_node* rebx_create_node(struct rebx_extras* rebx){
+    if (!rebx_init_pools(rebx)){
+        return NULL;
+    }
+    struct rebx_node* node = rebx_pool_alloc(rebx, &rebx->pools->node);
+    if (node == NULL){
+        return NULL;
+    }
+    node->object = NULL;
+    node->next = NULL;
+    return node;
+}
+
+struct rebx_param* rebx_create_param(struct rebx_extras* rebx, const char* name, enum rebx_param_type type){
+    // Allocate and initialize new param struct
+    if (!rebx_init_pools(rebx)){
+        return NULL;
+    }
+    struct rebx_param* param = rebx_pool_alloc(rebx, &rebx->pools->param);
+    if (param == NULL){
+        return NULL;
+    }
+    param->type = type;
+    param->value = NULL;
+    param->id = -1;             // set when added to a list
+    // Params of registered names share the registered copy of the name
+    const struct rebx_param* const reg = rebx_param_ids_find(rebx->param_ids, name);
+    param->name = reg ? reg->name : rebx_pool_strdup(rebx, name);
+    if (param->name == NULL){
+        rebx_free_param(param);
+        return NULL;
+    }
+    
+    return param;
+}
+
+/*****************************************************************
+ Registered parameter ids.  Every registered name gets the next small
+ integer, and the params in particle and force lists carry the id of
+ their name, so lookups compare integers rather than strings.
+ *****************************************************************/
+
+struct rebx_param_ids {
+    int n;                      // names registered, and the next id
+    int n_slots;                // power of two, at most half full
+    struct rebx_param** slot;   // registered params by hash of name, NULL if empty
+    rebx_param_handle defaults[REBX_N_DEFAULT_PARAMS]; // id -1 if the default param is not registered
+};
+
+static const char* const rebx_default_param_names[REBX_N_DEFAULT_PARAMS] = {
+#define REBX_DEFAULT_PARAM_NAME(name, type) #name,
+    REBX_DEFAULT_PARAMS(REBX_DEFAULT_PARAM_NAME)
+#undef REBX_DEFAULT_PARAM_NAME
+};
+
+static uint32_t rebx_hash_name(const char* name){
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (; *name; name++){
+        h = (h ^ (unsigned char)*name)*16777619u;
+    }
+    return h;
+}
+
+static struct rebx_param* rebx_param_ids_find(const struct rebx_param_ids* const ids, const char* const name){
+    if (ids == NULL){
+        return NULL;
+    }
+    const int mask = ids->n_slots - 1;
+    for (int i = rebx_hash_name(name) & mask; ids->slot[i] != NULL; i = (i + 1) & mask){
+        if (strcmp(ids->slot[i]->name, name) == 0){
+            return ids->slot[i];
+        }
+    }
+    return NULL;
+}
+
+static int rebx_param_ids_insert(struct rebx_param_ids* const ids, struct rebx_param* const param){
+    const int mask = ids->n_slots - 1;
+    int i = rebx_hash_name(param->name) & mask;
+    while (ids->slot[i] != NULL){
+        i = (i + 1) & mask;
+    }
+    ids->slot[i] = param;
+    return i;
+}
+
+// Gives the registered param the next id.  Returns 0 if the name is 
+// already registered or memory runs out.
+static int rebx_param_ids_add(struct rebx_extras* const rebx, struct rebx_param* const param){
+    struct rebx_param_ids* ids = rebx->param_ids;
+    if (rebx_param_ids_find(ids, param->name) != NULL){
+        return 0;
+    }
+    if (ids == NULL || 2*(ids->n + 1) > ids->n_slots){
+        const int n_slots = ids ? 2*ids->n_slots : 128;
+        struct rebx_param** const slot = calloc(n_slots, sizeof(*slot));
+        if (slot == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory.\n");
+            return 0;
+        }
+        if (ids == NULL){
+            ids = calloc(1, sizeof(*ids));
+            if (ids == NULL){
+                free(slot);
+                rebx_error(rebx, "REBOUNDx Error: Could not allocate memory.\n");
+                return 0;
+            }
+            for (int k=0; k<REBX_N_DEFAULT_PARAMS; k++){
+                ids->defaults[k].id = -1;
+                ids->defaults[k].type = REBX_TYPE_NONE;
+            }
+            rebx->param_ids = ids;
+        }
+        struct rebx_param** const old = ids->slot;
+        const int n_old = ids->n_slots;
+        ids->slot = slot;
+        ids->n_slots = n_slots;
+        for (int i=0; i<n_old; i++){
+            if (old[i] != NULL){
+                rebx_param_ids_insert(ids, old[i]);
+            }
+        }
+        free(old);
+    }
+    param->id = ids->n++;
+    rebx_param_ids_insert(ids, param);
+    for (int k=0; k<REBX_N_DEFAULT_PARAMS; k++){
+        if (strcmp(rebx_default_param_names[k], param->name) == 0){
+            ids->defaults[k].id = param->id;
+            ids->defaults[k].type = param->type;
+            break;
+        }
+    }
+    return 1;
+}
+
+void rebx_free_param_ids(struct rebx_param_ids* ids){
+    if (ids != NULL){
+        free(ids->slot);
+        free(ids);
+    }
+}
+
+int rebx_param_id(struct rebx_extras* rebx, const char* name){
+    const struct rebx_param* const reg = rebx_param_ids_find(rebx->param_ids, name);
+    return reg ? reg->id : -1;
+}
+
+rebx_param_handle rebx_param_resolve(struct rebx_extras* const rebx, const char* const param_name){
+    const struct rebx_param* const reg = rebx_param_ids_find(rebx->param_ids, param_name);
+    rebx_param_handle h = {-1, REBX_TYPE_NONE};
+    if (reg != NULL){
+        h.id = reg->id;
+        h.type = reg->type;
+    }
+    return h;
+}
+
+rebx_param_handle rebx_default_param(const struct rebx_extras* const rebx, const enum rebx_default_param param){
+    const struct rebx_param_ids* const ids = rebx->param_ids;
+    if (ids == NULL){
+        const rebx_param_handle h = {-1, REBX_TYPE_NONE};
+        return h;
+    }
+    return ids->defaults[param];
+}
+
+void* rebx_get_param_h(struct rebx_node* ap, const rebx_param_handle h){
+    if (h.id < 0){
+        return NULL;
+    }
+    for (struct rebx_node* current = ap; current != NULL; current = current->next){
+        const struct rebx_param* const param = current->object;
+        if (param->id == h.id){
+            return param->value;
+        }
+    }
+    return NULL;
+}
+
+int rebx_add_param(struct rebx_extras* const rebx, struct rebx_node** apptr, struct rebx_param* param){
+    struct rebx_node* node = rebx_create_node(rebx);
+    if (node == NULL){
+        return 0;
+    }
+    if (apptr == &rebx->registered_params){
+        if (!rebx_param_ids_add(rebx, param)){
+            rebx_free_node(node);
+            return 0;
+        }
+    }
+    else{
+        param->id = rebx_param_id(rebx, param->name);
+        rebx->param_generation++;
+    }
+    node->object = param;
+    rebx_add_node(apptr, node);
+    return 1;
+}
+
+// needed from Python
+enum rebx_param_type rebx_get_type(struct rebx_extras* rebx, const char* name){
+    const struct rebx_param* const param = rebx_param_ids_find(rebx->param_ids, name);
+    
+    if (param == NULL){ // param not found
+        return REBX_TYPE_NONE;
+    }
+    
+    return param->type;
+}
+
+size_t rebx_sizeof(struct rebx_extras* rebx, enum rebx_param_type type){
+    switch(type){
+        case REBX_TYPE_DOUBLE:
+        {
+            return sizeof(double);
+        }
+        case REBX_TYPE_INT:
+        {
+            return sizeof(int);
+        }
+        case REBX_TYPE_UINT32:
+        {
+            return sizeof(uint32_t);
+        }
+        case REBX_TYPE_FORCE:
+        {
+            return sizeof(struct rebx_force);
+        }
+        /*case REBX_TYPE_ORBIT:
+        {
+            return sizeof(struct reb_orbit);
+        }*/
+        case REBX_TYPE_POINTER:
+        {
+            return 0;
+        }
+        case REBX_TYPE_NONE:
+        {
+            rebx_error(rebx, "REBOUNDx Error: Parameter name passed to rebx_sizeof was not registered. This should not happen. Please open issue on github.com/dtamayo/reboundx.\n");
+            return 0;
+        }
+        default:
+        {
+            rebx_error(rebx, "REBOUNDx Error: Need to add new param type to switch statement in rebx_sizeof. Please open issue on github.com/dtamayo/reboundx.\n");
+            return 0;
+        }
+    }
+}
+
+/*****************************************************************
+ Particle parameter columns.  A column holds one registered DOUBLE or
+ INT parameter for all the particles in a contiguous array indexed by
+ particle index, with a bitmap of the rows that are set.  REBOUND only
+ tells us about a removal through free_particle_ap, before it moves
+ the particles, so the call is recorded and the rows are moved the
+ next time the columns are used, once the particles show how.
+ *****************************************************************/
+
+struct rebx_column_removal {
+    int pending;
+    int index;                      // of the particle whose ap was freed
+    int N;                          // sim->N at the time
+    struct reb_particle removed;    // particles[index], with its ap freed
+    struct reb_particle next;       // particles[index+1]
+    struct reb_particle last;       // particles[N-1]
+};
+
+static size_t rebx_column_value_size(const enum rebx_param_type type){
+    return type == REBX_TYPE_DOUBLE ? sizeof(double) : sizeof(int);
+}
+
+static int rebx_column_grow(struct rebx_param_column* const column, const int N){
+    if (N <= column->N_alloc){
+        return 1;
+    }
+    int N_alloc = column->N_alloc ? column->N_alloc : 64;
+    while (N_alloc < N){
+        N_alloc *= 2;
+    }
+    void* const values = realloc(column->values, N_alloc*rebx_column_value_size(column->type));
+    if (values == NULL){
+        return 0;
+    }
+    column->values = values;
+    const size_t words = (N_alloc + 63)/64;
+    const size_t words_old = (column->N_alloc + 63)/64;
+    uint64_t* const present = realloc(column->present, words*sizeof(uint64_t));
+    if (present == NULL){
+        return 0;
+    }
+    memset(present + words_old, 0, (words - words_old)*sizeof(uint64_t));
+    column->present = present;
+    column->N_alloc = N_alloc;
+    return 1;
+}
+
+static void rebx_column_set_present(struct rebx_param_column* const column, const int index){
+    if (!rebx_param_column_present(column, index)){
+        column->present[index >> 6] |= (uint64_t)1 << (index & 63);
+        column->n_present++;
+    }
+    if (index >= column->N){
+        column->N = index + 1;
+    }
+}
+
+static void rebx_column_clear_row(struct rebx_param_column* const column, const int index){
+    if (rebx_param_column_present(column, index)){
+        column->present[index >> 6] &= ~((uint64_t)1 << (index & 63));
+        column->n_present--;
+    }
+}
+
+static void rebx_column_move_row(struct rebx_param_column* const column, const int dst, const int src){
+    rebx_column_clear_row(column, dst);
+    if (rebx_param_column_present(column, src)){
+        const size_t size = rebx_column_value_size(column->type);
+        memcpy((char*)column->values + dst*size, (char*)column->values + src*size, size);
+        column->present[src >> 6] &= ~((uint64_t)1 << (src & 63));
+        column->present[dst >> 6] |= (uint64_t)1 << (dst & 63);
+    }
+}
+
+// Drops the rows from N on
+static void rebx_column_truncate(struct rebx_param_column* const column, const int N){
+    for (int i=N; i<column->N; i++){
+        rebx_column_clear_row(column, i);
+    }
+    if (column->N > N){
+        column->N = N;
+    }
+}
+
+// Row index was removed from N particles, either shifting the later rows down or moving the last row into its place.
+static void rebx_column_delete_row(struct rebx_param_column* const column, const int index, const int N, const int keep_sorted){
+    rebx_column_clear_row(column, index);
+    if (keep_sorted){
+        for (int i=index; i<column->N-1; i++){
+            rebx_column_move_row(column, i, i+1);
+        }
+    }
+    else if (N-1 > index && N-1 < column->N){
+        rebx_column_move_row(column, index, N-1);
+    }
+    rebx_column_truncate(column, N-1);
+}
+
+static int rebx_column_particle_equal(const struct reb_particle* const a, const struct reb_particle* const b){
+    return a->x == b->x && a->y == b->y && a->z == b->z && a->vx == b->vx && a->vy == b->vy && a->vz == b->vz && a->m == b->m && a->hash == b->hash && a->ap == b->ap;
+}
+
+static void rebx_resolve_column_removal(struct rebx_extras* const rebx){
+    struct rebx_column_removal* const removal = rebx->column_removal;
+    if (removal == NULL || !removal->pending){
+        return;
+    }
+    removal->pending = 0;
+    struct reb_simulation* const sim = rebx->sim;
+    if (sim == NULL){
+        return;
+    }
+    const int index = removal->index;
+    const struct reb_particle* const particles = sim->particles;
+    if (sim->N >= removal->N && rebx_column_particle_equal(&particles[index], &removal->removed)){
+        // Parameters freed without removing the particle
+        for (struct rebx_node* current = rebx->param_columns; current != NULL; current = current->next){
+            rebx_column_clear_row(current->object, index);
+        }
+        return;
+    }
+    int keep_sorted = 1;
+    if (index < removal->N-2 && index < sim->N){    // otherwise both ways give the same rows
+        if (!rebx_column_particle_equal(&particles[index], &removal->next)){
+            if (rebx_column_particle_equal(&particles[index], &removal->last)){
+                keep_sorted = 0;
+            }
+            else{
+                reb_warning(sim, "REBOUNDx: Could not tell how a particle was removed from the simulation.  Assuming the particles were kept sorted, and moving the parameter column rows to match.");
+            }
+        }
+    }
+    for (struct rebx_node* current = rebx->param_columns; current != NULL; current = current->next){
+        rebx_column_delete_row(current->object, index, removal->N, keep_sorted);
+    }
+}
+
+// Called from free_particle_ap, after the particle's ap was freed
+static void rebx_record_column_removal(struct rebx_extras* const rebx, const struct reb_particle* const p){
+    struct reb_simulation* const sim = rebx->sim;
+    if (rebx->param_columns == NULL || sim == NULL || p < sim->particles || p >= sim->particles + sim->N){
+        return;
+    }
+    rebx_resolve_column_removal(rebx);
+    if (rebx->column_removal == NULL){
+        rebx->column_removal = calloc(1, sizeof(*rebx->column_removal));
+        if (rebx->column_removal == NULL){
+            return;
+        }
+    }
+    struct rebx_column_removal* const removal = rebx->column_removal;
+    const int index = p - sim->particles;
+    removal->pending = 1;
+    removal->index = index;
+    removal->N = sim->N;
+    removal->removed = *p;
+    if (index + 1 < sim->N){
+        removal->next = sim->particles[index+1];
+    }
+    removal->last = sim->particles[sim->N-1];
+}
+
+void rebx_sync_param_columns(struct rebx_extras* const rebx){
+    if (rebx->param_columns == NULL){
+        return;
+    }
+    rebx_resolve_column_removal(rebx);
+    if (rebx->sim != NULL){
+        for (struct rebx_node* current = rebx->param_columns; current != NULL; current = current->next){
+            rebx_column_truncate(current->object, rebx->sim->N);
+        }
+    }
+}
+
+static void rebx_free_param_column(struct rebx_param_column* const column){
+    free(column->values);
+    free(column->present);
+    free(column);
+}
+
+void rebx_free_param_columns(struct rebx_extras* const rebx){
+    struct rebx_node* current = rebx->param_columns;
+    while (current != NULL){
+        struct rebx_node* const next = current->next;
+        rebx_free_param_column(current->object);
+        rebx_free_node(current);
+        current = next;
+    }
+    rebx->param_columns = NULL;
+    free(rebx->column_removal);
+    rebx->column_removal = NULL;
+}
+
+struct rebx_param_column* rebx_get_param_column(struct rebx_extras* const rebx, const rebx_param_handle h){
+    if (h.id < 0 || rebx->param_columns == NULL){
+        return NULL;
+    }
+    rebx_sync_param_columns(rebx);
+    for (struct rebx_node* current = rebx->param_columns; current != NULL; current = current->next){
+        struct rebx_param_column* const column = current->object;
+        if (column->id == h.id){
+            return column;
+        }
+    }
+    return NULL;
+}
+
+struct rebx_param_column* rebx_add_param_column(struct rebx_extras* const rebx, const char* const param_name){
+    const rebx_param_handle h = rebx_param_resolve(rebx, param_name);
+    if (h.id < 0){
+        char str[300];
+        sprintf(str, "REBOUNDx Error: Need to register parameter name '%s' before adding a column for it. See examples.\n", param_name);
+        rebx_error(rebx, str);
+        return NULL;
+    }
+    if (h.type != REBX_TYPE_DOUBLE && h.type != REBX_TYPE_INT){
+        char str[300];
+        sprintf(str, "REBOUNDx Error: Parameter '%s' is not a DOUBLE or INT parameter. Only those can have columns.\n", param_name);
+        rebx_error(rebx, str);
+        return NULL;
+    }
+    struct rebx_param_column* column = rebx_get_param_column(rebx, h);
+    if (column != NULL){
+        return column;
+    }
+    struct rebx_node* const node = rebx_create_node(rebx);
+    column = calloc(1, sizeof(*column));
+    if (node == NULL || column == NULL){
+        if (node != NULL){
+            rebx_free_node(node);
+        }
+        free(column);
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate parameter column.\n");
+        return NULL;
+    }
+    column->name = rebx_param_ids_find(rebx->param_ids, param_name)->name;
+    column->id = h.id;
+    column->type = h.type;
+    node->object = column;
+    rebx_add_node(&rebx->param_columns, node);
+    return column;
+}
+
+static int rebx_set_param_column_row(struct rebx_extras* const rebx, struct rebx_param_column* const column, const int index, const enum rebx_param_type type){
+    if (column == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Passed NULL column to rebx_set_param_column.\n");
+        return 0;
+    }
+    if (column->type != type){
+        rebx_error(rebx, "REBOUNDx Error: Type of value passed to rebx_set_param_column does not match the type of the column.\n");
+        return 0;
+    }
+    if (rebx->sim == NULL || index < 0 || index >= rebx->sim->N){
+        rebx_error(rebx, "REBOUNDx Error: Particle index passed to rebx_set_param_column is out of range.\n");
+        return 0;
+    }
+    rebx_sync_param_columns(rebx);
+    if (!rebx_column_grow(column, index + 1)){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate parameter column.\n");
+        return 0;
+    }
+    rebx_column_set_present(column, index);
+    rebx->param_generation++;
+    return 1;
+}
+
+int rebx_set_param_column_double(struct rebx_extras* const rebx, struct rebx_param_column* const column, const int index, const double val){
+    if (!rebx_set_param_column_row(rebx, column, index, REBX_TYPE_DOUBLE)){
+        return 0;
+    }
+    ((double*)column->values)[index] = val;
+    return 1;
+}
+
+int rebx_set_param_column_int(struct rebx_extras* const rebx, struct rebx_param_column* const column, const int index, const int val){
+    if (!rebx_set_param_column_row(rebx, column, index, REBX_TYPE_INT)){
+        return 0;
+    }
+    ((int*)column->values)[index] = val;
+    return 1;
+}
+
+int rebx_set_param_column_rows(struct rebx_extras* const rebx, struct rebx_param_column* const column, const void* const values, const void* const present, const int N){
+    if (rebx->sim == NULL || N < 0){
+        return 0;
+    }
+    rebx_sync_param_columns(rebx);
+    if (!rebx_column_grow(column, N)){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate parameter column.\n");
+        return 0;
+    }
+    const size_t size = rebx_column_value_size(column->type);
+    for (int w=0; 64*w < N; w++){
+        uint64_t bits;
+        memcpy(&bits, (const char*)present + w*sizeof(bits), sizeof(bits));
+        const int n = N - 64*w < 64 ? N - 64*w : 64;
+        if (n < 64){
+            bits &= ((uint64_t)1 << n) - 1;
+        }
+        if (bits == 0){
+            continue;
+        }
+        if (64*w + n > rebx->sim->N){
+            for (int i=64*w; i<64*w+n; i++){
+                if (i >= rebx->sim->N && ((bits >> (i & 63)) & 1)){
+                    return 0;
+                }
+            }
+        }
+        if (bits == ~(uint64_t)0){
+            memcpy((char*)column->values + 64*w*size, (const char*)values + 64*w*size, 64*size);
+        }
+        for (int i=64*w; i<64*w+n; i++){
+            if ((bits >> (i & 63)) & 1){
+                if (bits != ~(uint64_t)0){
+                    memcpy((char*)column->values + i*size, (const char*)values + i*size, size);
+                }
+                rebx_column_set_present(column, i);
+            }
+        }
+    }
+    rebx->param_generation++;
+    return 1;
+}
+
+void rebx_clear_param_column(struct rebx_param_column* const column, const int index){
+    if (column != NULL && index >= 0){
+        rebx_column_clear_row(column, index);
+    }
+}
+
+int rebx_remove_param_column(struct rebx_extras* const rebx, const char* const param_name){
+    const int id = rebx_param_id(rebx, param_name);
+    struct rebx_node** prev = &rebx->param_columns;
+    for (struct rebx_node* current = rebx->param_columns; current != NULL; current = current->next){
+        struct rebx_param_column* const column = current->object;
+        if (id >= 0 && column->id == id){
+            *prev = current->next;
+            rebx_free_param_column(column);
+            rebx_free_node(current);
+            return 1;
+        }
+        prev = &current->next;
+    }
+    return 0;
+}
+
+// Where the parameter has a column the values go to its rows, and otherwise to the particles' ap lists
+int rebx_set_particle_param_array(struct rebx_extras* const rebx, const char* const param_name, const void* const values, const int N){
+    struct reb_simulation* const sim = rebx->sim;
+    if (sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return 0;
+    }
+    if (N < 0 || N > sim->N){
+        rebx_error(rebx, "REBOUNDx Error: The number of values passed to rebx_set_particle_param_array is larger than the number of particles.\n");
+        return 0;
+    }
+    const rebx_param_handle h = rebx_param_resolve(rebx, param_name);
+    if (h.id < 0){
+        char str[300];
+        sprintf(str, "REBOUNDx Error: Need to register parameter name '%s' before using it. See examples.\n", param_name);
+        rebx_error(rebx, str);
+        return 0;
+    }
+    if (h.type != REBX_TYPE_DOUBLE && h.type != REBX_TYPE_INT && h.type != REBX_TYPE_UINT32){
+        char str[300];
+        sprintf(str, "REBOUNDx Error: Parameter '%s' is not a DOUBLE, INT or UINT32 parameter. Only those can be set from an array.\n", param_name);
+        rebx_error(rebx, str);
+        return 0;
+    }
+    if (N == 0){
+        return 1;
+    }
+    const size_t size = rebx_sizeof(rebx, h.type);
+    struct rebx_param_column* const column = rebx_get_param_column(rebx, h);
+    if (column != NULL){
+        const size_t N_words = (N + 63)/64;
+        uint64_t* const present = malloc(N_words*sizeof(*present));
+        if (present == NULL){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory in rebx_set_particle_param_array.\n");
+            return 0;
+        }
+        memset(present, 0xff, N_words*sizeof(*present));
+        const int success = rebx_set_param_column_rows(rebx, column, values, present, N);
+        free(present);
+        return success;
+    }
+    for (int i=0; i<N; i++){
+        struct rebx_node** const apptr = (struct rebx_node**)&sim->particles[i].ap;
+        void* value = rebx_get_param_h(*apptr, h);
+        if (value == NULL){
+            struct rebx_param* const param = rebx_create_param(rebx, param_name, h.type);
+            if (param == NULL){
+                return 0;
+            }
+            if (!rebx_add_param(rebx, apptr, param)){
+                rebx_free_param(param);
+                return 0;
+            }
+            value = param->value = &param->storage;
+        }
+        memcpy(value, (const char*)values + i*size, size);
+    }
+    return 1;
+}
+
+int rebx_get_particle_param_array(struct rebx_extras* const rebx, const char* const param_name, void* const values, const int N){
+    struct reb_simulation* const sim = rebx->sim;
+    if (sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return 0;
+    }
+    const rebx_param_handle h = rebx_param_resolve(rebx, param_name);
+    if (h.type != REBX_TYPE_DOUBLE && h.type != REBX_TYPE_INT && h.type != REBX_TYPE_UINT32){
+        return 0;
+    }
+    rebx_sync_param_columns(rebx);
+    const size_t size = rebx_sizeof(rebx, h.type);
+    struct rebx_param_column* const column = rebx_get_param_column(rebx, h);
+    const int N_particles = N < sim->N ? N : sim->N;
+    int found = 0;
+    for (int i=0; i<N_particles; i++){
+        const void* const value = rebx_param_column_present(column, i) ? (const char*)column->values + i*size : rebx_get_param_h(sim->particles[i].ap, h);
+        if (value != NULL){
+            memcpy((char*)values + i*size, value, size);
+            found++;
+        }
+    }
+    return found;
+}
+
+void* rebx_get_particle_param_view(struct rebx_extras* const rebx, const char* const param_name, const int N){
+    rebx_sync_param_columns(rebx);
+    struct rebx_param_column* const column = rebx_get_param_column(rebx, rebx_param_resolve(rebx, param_name));
+    return rebx_param_column_full(column, N) ? column->values : NULL;
 }
 
 void rebx_error(struct rebx_extras* rebx, const char* const msg){
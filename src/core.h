@@ -31,6 +31,7 @@ struct rebx_param;
 enum rebx_param_type;
 struct rebx_step;
 struct rebx_node;
+struct rebx_param_ids;
 
 #include <stdint.h>
 #include "rebound.h"
@@ -45,6 +46,79 @@ struct rebx_node;
 void rebx_initialize(struct reb_simulation* sim, struct rebx_extras* rebx); // Initializes all pointers and values.
 void rebx_register_default_params(struct rebx_extras* rebx); // Registers default params
 
+// The default params, in the order they are registered.  X(name, type) is expanded once per param.
+#define REBX_DEFAULT_PARAMS(X) \
+    X(c, REBX_TYPE_DOUBLE) \
+    X(gr_source, REBX_TYPE_INT) \
+    X(tau_mass, REBX_TYPE_DOUBLE) \
+    X(force, REBX_TYPE_FORCE) \
+    X(particle, REBX_TYPE_POINTER) \
+    X(Acentral, REBX_TYPE_DOUBLE) \
+    X(gammacentral, REBX_TYPE_DOUBLE) \
+    X(max_iterations, REBX_TYPE_INT) \
+    X(tolerance, REBX_TYPE_DOUBLE) \
+    X(force_evaluations, REBX_TYPE_INT) \
+    X(J2, REBX_TYPE_DOUBLE) \
+    X(J4, REBX_TYPE_DOUBLE) \
+    X(R_eq, REBX_TYPE_DOUBLE) \
+    X(coordinates, REBX_TYPE_INT) \
+    X(p, REBX_TYPE_DOUBLE) \
+    X(tau_a, REBX_TYPE_DOUBLE) \
+    X(tau_e, REBX_TYPE_DOUBLE) \
+    X(tau_inc, REBX_TYPE_DOUBLE) \
+    X(tau_omega, REBX_TYPE_DOUBLE) \
+    X(tau_Omega, REBX_TYPE_DOUBLE) \
+    X(primary, REBX_TYPE_INT) \
+    X(radiation_source, REBX_TYPE_INT) \
+    X(beta, REBX_TYPE_DOUBLE) \
+    X(tides_primary, REBX_TYPE_INT) \
+    X(R_tides, REBX_TYPE_DOUBLE) \
+    X(k1, REBX_TYPE_DOUBLE) \
+    X(integrator, REBX_TYPE_INT) \
+    X(free_arrays, REBX_TYPE_POINTER) \
+    X(min_distance, REBX_TYPE_DOUBLE) \
+    X(min_distance_from, REBX_TYPE_UINT32) \
+    X(min_distance_orbit, REBX_TYPE_ORBIT) \
+    X(min_distance_interpolate, REBX_TYPE_INT) \
+    X(min_distance_workspace, REBX_TYPE_POINTER) \
+    X(mass_exponential, REBX_TYPE_INT) \
+    X(com_interval, REBX_TYPE_INT) \
+    X(modify_mass_workspace, REBX_TYPE_POINTER) \
+    X(radiation_float, REBX_TYPE_INT) \
+    X(radiation_workspace, REBX_TYPE_POINTER) \
+    X(gravitational_harmonics_workspace, REBX_TYPE_POINTER) \
+    X(tides_precession_workspace, REBX_TYPE_POINTER) \
+    X(central_force_workspace, REBX_TYPE_POINTER) \
+    X(fused, REBX_TYPE_INT) \
+    X(N_ephem, REBX_TYPE_INT) \
+    X(N_ast, REBX_TYPE_INT) \
+    X(geocentric, REBX_TYPE_INT) \
+    X(origin, REBX_TYPE_INT) \
+    X(outstate, REBX_TYPE_POINTER) \
+    X(n_out, REBX_TYPE_INT) \
+    X(ephem_cache, REBX_TYPE_POINTER) \
+    X(ephem_workspace, REBX_TYPE_POINTER) \
+    X(gr_full_workspace, REBX_TYPE_POINTER) \
+    X(gr_workspace, REBX_TYPE_POINTER) \
+    X(newtonian_from_sim, REBX_TYPE_INT) \
+    X(soa, REBX_TYPE_INT) \
+    X(device, REBX_TYPE_INT) \
+    X(n_threads, REBX_TYPE_INT) \
+    X(ephemeris, REBX_TYPE_POINTER) \
+    X(perturbers, REBX_TYPE_POINTER) \
+    X(earth_pole_ra_rate, REBX_TYPE_DOUBLE) \
+    X(earth_pole_dec_rate, REBX_TYPE_DOUBLE)
+
+// Index of each default param among the handles resolved at registration
+enum rebx_default_param {
+#define REBX_DEFAULT_PARAM_ENUM(name, type) REBX_PARAM_##name,
+    REBX_DEFAULT_PARAMS(REBX_DEFAULT_PARAM_ENUM)
+#undef REBX_DEFAULT_PARAM_ENUM
+    REBX_N_DEFAULT_PARAMS
+};
+
+rebx_param_handle rebx_default_param(const struct rebx_extras* const rebx, const enum rebx_default_param param); // Handle of a default param, taken from a table filled when the name was registered.  Effects use it instead of rebx_param_resolve so that nothing is hashed when they are called
+
 /**********************************************
  Functions executing forces & ptm each timestep
  *********************************************/
@@ -73,6 +147,53 @@ void rebx_central_force(struct reb_simulation* const sim, struct rebx_force* con
 void rebx_gravitational_harmonics(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
 void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N);
 
+/****************************************
+ Fused force kernels
+ *****************************************/
+// Forces with the "fused" parameter set are evaluated in one pass.  The particles are gathered in blocks, each kernel adds
+// its accelerations to the block, and the block is added to the particles once.  Reactions on sources can go to the particles directly.
+#define REBX_FUSED_BLOCK 256
+
+struct rebx_fused_block {
+    int i0;                     // index of the first particle in the block
+    int n;
+    double x[REBX_FUSED_BLOCK], y[REBX_FUSED_BLOCK], z[REBX_FUSED_BLOCK];
+    double vx[REBX_FUSED_BLOCK], vy[REBX_FUSED_BLOCK], vz[REBX_FUSED_BLOCK];
+    double m[REBX_FUSED_BLOCK];
+    double ax[REBX_FUSED_BLOCK], ay[REBX_FUSED_BLOCK], az[REBX_FUSED_BLOCK];   // added by the kernels, from zero
+};
+
+struct rebx_fused_kernel {
+    void (*update_accelerations)(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N); // of the force the kernel stands in for
+    size_t state_size;          // what begin keeps for the blocks of one pass
+    int (*begin)(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N, void* const state); // 0 if the force has to be called on its own, e.g. to report an error
+    void (*block)(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, struct rebx_fused_block* const block, void* const state);
+};
+
+extern const struct rebx_fused_kernel rebx_gr_potential_fused;
+extern const struct rebx_fused_kernel rebx_radiation_forces_fused;
+extern const struct rebx_fused_kernel rebx_tides_precession_fused;
+extern const struct rebx_fused_kernel rebx_central_force_fused;
+extern const struct rebx_fused_kernel rebx_gravitational_harmonics_fused;
+
+/****************************************
+ Shared GR kernel
+ *****************************************/
+// The GR terms of gr and ephemeris_forces depend on the velocity vi = v/(1 - A), with A = (vi^2/2 + 3 mu/r)/c^2, which is
+// solved by fixed-point iteration.  Particles are iterated together in blocks of lanes, and a lane stops changing once
+// it has converged, so the loops over the lanes have no early exits and vectorize.
+#define REBX_GR_LANES 16
+
+struct rebx_gr_lanes {
+    int n;                      // lanes in use
+    double vx[REBX_GR_LANES], vy[REBX_GR_LANES], vz[REBX_GR_LANES];
+    double phi[REBX_GR_LANES];  // 3 mu/r
+    double vix[REBX_GR_LANES], viy[REBX_GR_LANES], viz[REBX_GR_LANES];  // solution
+    double A[REBX_GR_LANES];    // at the solution
+};
+
+int rebx_gr_solve_lanes(struct rebx_gr_lanes* const b, const double C2, const int max_iterations, uint64_t* const iterations); // Returns the lanes that did not converge in max_iterations, and adds the iterations of each lane to *iterations unless it is NULL
+
 /****************************************
  Operator prototypes
  *****************************************/
@@ -88,21 +209,83 @@ void rebx_track_min_distance(struct reb_simulation* const sim, struct rebx_opera
 void rebx_integrator_euler_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
 void rebx_integrator_rk2_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
 void rebx_integrator_rk4_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
-void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force);
+void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt, struct rebx_force* const force);
+void rebx_integrator_dopri5_integrate(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt, struct rebx_force* const force);
+
+// Forces are integrated one at a time, so the integrators share one workspace, grown when the number of particles increases.
+#define REBX_INTEGRATOR_N_VEC 7
+
+struct rebx_integrator_history;
+
+struct rebx_integrator_workspace {
+    int N_alloc;
+    struct reb_particle* ps;    // particles passed to the force at each stage
+    double* vec[REBX_INTEGRATOR_N_VEC]; // state vectors of 3*N_alloc doubles, with the x, y and z components of particle i at i, N_alloc+i and 2*N_alloc+i
+    struct rebx_integrator_history* history;    // what integrators keep from one step to the next, per force
+};
+
+// What the integrators keep from the last step of a force to start the next one from
+struct rebx_integrator_history {
+    struct rebx_force* force;
+    int N;                      // particles dv is for, 0 if none
+    int N_alloc;
+    double dt;                  // of the last step
+    double* dv;                 // components strided by N
+    double h;                   // sub-step of the adaptive integrators, 0 if none yet
+    struct rebx_integrator_history* next;
+};
+
+struct rebx_integrator_workspace* rebx_integrator_workspace_get(struct rebx_extras* const rebx, const int N); // NULL if out of memory
+struct rebx_integrator_history* rebx_integrator_history_get(struct rebx_extras* const rebx, struct rebx_force* const force, const int N); // N is reset to 0 if it changed.  NULL if out of memory
+void rebx_integrator_forget(struct rebx_extras* const rebx, struct rebx_force* const force);  // Drops the history of a force
+void rebx_free_integrator_workspace(struct rebx_extras* const rebx);
 
 void* rebx_malloc(struct rebx_extras* const rebx, size_t memsize);
 void rebx_free_ap(struct rebx_node** ap);
 void rebx_free_particle_ap(struct reb_particle* p);
 void rebx_free_force(struct rebx_extras* rebx, struct rebx_force* force);
-void rebx_free_operator(struct rebx_operator* operator);
+void rebx_free_operator(struct rebx_extras* rebx, struct rebx_operator* operator);
 void rebx_free_step(struct rebx_step* step);
 void rebx_free_pointers(struct rebx_extras* rebx);
 void rebx_free_param(struct rebx_param* param);
 
 enum rebx_param_type rebx_get_type(struct rebx_extras* rebx, const char* name);
+int rebx_param_id(struct rebx_extras* rebx, const char* name);
+void rebx_free_param_ids(struct rebx_param_ids* ids);
 
 struct rebx_param* rebx_create_param(struct rebx_extras* rebx, const char* name, enum rebx_param_type type);
 int rebx_add_param(struct rebx_extras* const rebx, struct rebx_node** apptr, struct rebx_param* param);
 struct rebx_node* rebx_create_node(struct rebx_extras* rebx);
+void rebx_free_node(struct rebx_node* node);
+char* rebx_pool_strdup(struct rebx_extras* const rebx, const char* const str);
+void rebx_free_pools(struct rebx_pools* pools);
+
+/****************************************
+ Archive
+ *****************************************/
+#define REBX_ARCHIVE_MAX_DELTAS 100     // between keyframes, so loading a snapshot applies at most this many deltas
+
+// Where a change in a delta goes
+enum rebx_archive_change_kind {
+    REBX_ARCHIVE_CHANGE_PARTICLE = 0,   // owner is the particle index
+    REBX_ARCHIVE_CHANGE_FORCE = 1,      // owner is the index of the force name in the delta
+    REBX_ARCHIVE_CHANGE_OPERATOR = 2,   // owner is the index of the operator name in the delta
+    REBX_ARCHIVE_CHANGE_COLUMN = 3,     // owner is the row
+};
+
+// Each change in the ARCHIVE_CHANGES field of a delta is one of these, followed by size bytes of the new value
+struct rebx_archive_change {
+    int32_t kind;
+    int32_t owner;
+    int32_t name;               // index of the param or column name in the delta
+    int32_t size;
+};
+
+void rebx_archive_heartbeat(struct rebx_extras* const rebx); // Appends to an automated archive if the interval has passed
+void rebx_free_archive_writer(struct rebx_archive_writer* const writer);
+
+void rebx_sync_param_columns(struct rebx_extras* const rebx);    // Moves the column rows after particles were removed
+int rebx_set_param_column_rows(struct rebx_extras* const rebx, struct rebx_param_column* const column, const void* const values, const void* const present, const int N); // Sets the rows of N values whose bits are set in the present bitmap.  Neither has to be aligned.  0 if a row is not a particle
+void rebx_free_param_columns(struct rebx_extras* const rebx);
 
 #endif
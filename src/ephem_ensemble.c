@@ -0,0 +1,357 @@
+/**
+ * @file    ephem_ensemble.c
+ * @brief   Propagation of catalogs of test particles across the ranks of an MPI job, and the ensemble file it writes.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2015 Dan Tamayo, Hanno Rein
+ *
+ * This file is part of reboundx.
+ *
+ * reboundx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * reboundx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * An ensemble file holds the output of every particle as in a timestate
+ * with n_particles = 1, in the host's byte order:
+ *
+ *   struct rebx_ensemble_header       magic, number of particles
+ *   struct rebx_ensemble_entry[n]     where each particle's record starts, and its n_out
+ *   records                           n_out times, then n_out rows of x, y, z, vx, vy, vz
+ *
+ * The records are in no particular order, since each rank writes the
+ * particles it propagated in one piece.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "rebound.h"
+#include "reboundx.h"
+
+#define REBX_ENSEMBLE_MAGIC "REBXENS1"
+
+struct rebx_ensemble_header {
+    char magic[8];
+    int64_t n_particles;
+};
+
+struct rebx_ensemble_entry {
+    int64_t offset;             // bytes from the start of the file
+    int64_t n_out;              // 0 if the particle failed
+};
+
+timestate* rebx_ephem_ensemble_read(const char* const filename, int* const n_particles){
+    FILE* const f = fopen(filename, "rb");
+    if (f == NULL){
+        fprintf(stderr, "REBOUNDx Error: Could not open ensemble file %s.\n", filename);
+        return NULL;
+    }
+    struct rebx_ensemble_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, REBX_ENSEMBLE_MAGIC, sizeof(header.magic)) != 0 || header.n_particles < 0 || header.n_particles > INT32_MAX){
+        fprintf(stderr, "REBOUNDx Error: %s is not an ensemble file.\n", filename);
+        fclose(f);
+        return NULL;
+    }
+    const int n = (int)header.n_particles;
+    struct rebx_ensemble_entry* const index = malloc(n*sizeof(*index) + 1);
+    timestate* const ts = calloc(n + 1, sizeof(*ts));
+    int success = (index != NULL && ts != NULL && fread(index, sizeof(*index), n, f) == (size_t)n);
+    for (int i=0; success && i<n; i++){
+        const int64_t n_out = index[i].n_out;
+        ts[i].n_particles = 1;
+        if (n_out <= 0){
+            continue;
+        }
+        ts[i].t = malloc(n_out*sizeof(double));
+        ts[i].state = malloc(6*n_out*sizeof(double));
+        ts[i].n_out = (int)n_out;
+        success = (ts[i].t != NULL && ts[i].state != NULL
+                   && fseek(f, index[i].offset, SEEK_SET) == 0
+                   && fread(ts[i].t, sizeof(double), n_out, f) == (size_t)n_out
+                   && fread(ts[i].state, sizeof(double), 6*n_out, f) == (size_t)(6*n_out));
+    }
+    fclose(f);
+    free(index);
+    if (!success){
+        fprintf(stderr, "REBOUNDx Error: Could not read ensemble file %s.\n", filename);
+        rebx_ephem_ensemble_free(ts, n);
+        return NULL;
+    }
+    *n_particles = n;
+    return ts;
+}
+
+void rebx_ephem_ensemble_free(timestate* const ts, const int n_particles){
+    if (ts == NULL){
+        return;
+    }
+    for (int i=0; i<n_particles; i++){
+        free(ts[i].t);
+        free(ts[i].state);
+    }
+    free(ts);
+}
+
+#ifdef REBX_MPI
+
+// Rank 0 hands out groups of particles as the other ranks ask for them,
+// so a rank slowed down by close approaches simply takes fewer groups.
+#define REBX_ENSEMBLE_TAG_REQUEST 1
+#define REBX_ENSEMBLE_TAG_WORK 2
+#define REBX_ENSEMBLE_TAG_STATES 3
+
+// Largest piece handed to one MPI_File_write_at, whose count is an int
+#define REBX_ENSEMBLE_WRITE_CHUNK (1 << 26)
+
+// The records of the particles one rank propagated, back to back, and
+// for each the particle, the offset of its record in data and its n_out.
+struct ensemble_results {
+    int n;
+    int n_alloc;
+    int64_t* entries;           // 3 per particle
+    double* data;
+    size_t size;                // doubles in data
+    size_t size_alloc;
+};
+
+static int ensemble_results_add(struct ensemble_results* const res, const int particle, const timestate* const ts, const int j){
+    const int n_out = ts != NULL ? ts->n_out : 0;
+    if (res->n == res->n_alloc){
+        const int n_alloc = res->n_alloc ? 2*res->n_alloc : 64;
+        int64_t* const entries = realloc(res->entries, 3*n_alloc*sizeof(*entries));
+        if (entries == NULL){
+            return 0;
+        }
+        res->entries = entries;
+        res->n_alloc = n_alloc;
+    }
+    const size_t size = 7*(size_t)n_out;
+    if (res->size + size > res->size_alloc){
+        size_t size_alloc = res->size_alloc ? 2*res->size_alloc : 4096;
+        while (size_alloc < res->size + size){
+            size_alloc *= 2;
+        }
+        double* const data = realloc(res->data, size_alloc*sizeof(*data));
+        if (data == NULL){
+            return 0;
+        }
+        res->data = data;
+        res->size_alloc = size_alloc;
+    }
+    double* const t = res->data + res->size;
+    double* const state = t + n_out;
+    for (int i=0; i<n_out; i++){
+        t[i] = ts->t[i];
+        memcpy(&state[6*i], &ts->state[6*((size_t)i*ts->n_particles + j)], 6*sizeof(double));
+    }
+    res->entries[3*res->n] = particle;
+    res->entries[3*res->n + 1] = (int64_t)(res->size*sizeof(double));
+    res->entries[3*res->n + 2] = n_out;
+    res->n++;
+    res->size += size;
+    return 1;
+}
+
+// Propagates a group and keeps its records.  Returns the number of particles that failed.
+static int ensemble_propagate(struct rebx_ephem_propagator* const p, struct ensemble_results* const res, const double tstart, const double tstep, const double trange, const int first, const int n, const double* const instate){
+    timestate ts;
+    const int success = rebx_ephem_propagate(p, tstart, tstep, trange, n, instate, &ts);
+    int n_failed = 0;
+    for (int j=0; j<n; j++){
+        if (!ensemble_results_add(res, first + j, success ? &ts : NULL, j)){
+            fprintf(stderr, "REBOUNDx Error: Ran out of memory in integration_function_mpi.\n");
+            n_failed++;
+        }
+        else if (!success){
+            n_failed++;
+        }
+    }
+    return n_failed;
+}
+
+static void ensemble_dispatch(const MPI_Comm comm, const int size, const int n_particles, const int group_size, const double* const instate){
+    int next = 0;
+    int n_stopped = 0;
+    while (n_stopped < size - 1){
+        int request;
+        MPI_Status status;
+        MPI_Recv(&request, 1, MPI_INT, MPI_ANY_SOURCE, REBX_ENSEMBLE_TAG_REQUEST, comm, &status);
+        int work[2] = {next, n_particles - next < group_size ? n_particles - next : group_size};
+        MPI_Send(work, 2, MPI_INT, status.MPI_SOURCE, REBX_ENSEMBLE_TAG_WORK, comm);
+        if (work[1] > 0){
+            MPI_Send(instate + 6*(size_t)next, 6*work[1], MPI_DOUBLE, status.MPI_SOURCE, REBX_ENSEMBLE_TAG_STATES, comm);
+            next += work[1];
+        }
+        else{
+            n_stopped++;
+        }
+    }
+}
+
+// Every rank writes its records in one piece after those of the ranks
+// before it, and rank 0 writes the header and the index.
+static int ensemble_write(const MPI_Comm comm, const int rank, const int size, const char* const filename, const int n_particles, const struct ensemble_results* const res){
+    const int64_t header_size = sizeof(struct rebx_ensemble_header) + n_particles*(int64_t)sizeof(struct rebx_ensemble_entry);
+    const int64_t local_size = res->size*sizeof(double);
+    int64_t base = 0;
+    MPI_Exscan(&local_size, &base, 1, MPI_INT64_T, MPI_SUM, comm);
+    if (rank == 0){
+        base = 0;
+    }
+    base += header_size;
+
+    // The index goes to rank 0, with the offsets made absolute
+    int64_t* const entries = malloc(3*res->n*sizeof(*entries) + 1);
+    int failed = (entries == NULL);
+    for (int i=0; !failed && i<res->n; i++){
+        entries[3*i] = res->entries[3*i];
+        entries[3*i + 1] = res->entries[3*i + 1] + base;
+        entries[3*i + 2] = res->entries[3*i + 2];
+    }
+    const int count = failed ? 0 : 3*res->n;
+    int* counts = NULL;
+    int* displs = NULL;
+    int64_t* all = NULL;
+    if (rank == 0){
+        counts = malloc(size*sizeof(*counts));
+        displs = malloc(size*sizeof(*displs));
+        all = malloc(3*(size_t)n_particles*sizeof(*all) + 1);
+        failed |= (counts == NULL || displs == NULL || all == NULL);
+    }
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0 && counts != NULL && displs != NULL){
+        int total = 0;
+        for (int r=0; r<size; r++){
+            displs[r] = total;
+            total += counts[r];
+        }
+        failed |= (total != 3*n_particles);
+    }
+    MPI_Gatherv(entries, count, MPI_INT64_T, all, counts, displs, MPI_INT64_T, 0, comm);
+    free(entries);
+
+    // Opening is collective, so either every rank opens the file or none does
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_LOR, comm);
+    MPI_File fh;
+    if (!failed){
+        if (rank == 0){
+            MPI_File_delete((char*)filename, MPI_INFO_NULL);
+        }
+        MPI_Barrier(comm);
+        failed = (MPI_File_open(comm, (char*)filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS);
+    }
+    if (!failed){
+        if (rank == 0){
+            struct rebx_ensemble_header header = {.n_particles = n_particles};
+            memcpy(header.magic, REBX_ENSEMBLE_MAGIC, sizeof(header.magic));
+            struct rebx_ensemble_entry* const index = calloc(n_particles + 1, sizeof(*index));
+            failed |= (index == NULL);
+            for (int i=0; !failed && i<n_particles; i++){
+                const int64_t particle = all[3*i];
+                if (particle >= 0 && particle < n_particles){
+                    index[particle].offset = all[3*i + 1];
+                    index[particle].n_out = all[3*i + 2];
+                }
+            }
+            failed |= (MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS);
+            failed |= (!failed && MPI_File_write_at(fh, sizeof(header), index, n_particles*sizeof(*index), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS);
+            free(index);
+        }
+        for (size_t written=0; written<res->size; written+=REBX_ENSEMBLE_WRITE_CHUNK){
+            const size_t n = res->size - written < REBX_ENSEMBLE_WRITE_CHUNK ? res->size - written : REBX_ENSEMBLE_WRITE_CHUNK;
+            failed |= (MPI_File_write_at(fh, base + written*sizeof(double), res->data + written, (int)n, MPI_DOUBLE, MPI_STATUS_IGNORE) != MPI_SUCCESS);
+        }
+        MPI_File_close(&fh);
+    }
+    free(counts);
+    free(displs);
+    free(all);
+    return !failed;
+}
+
+int integration_function_mpi(double tstart, double tstep, double trange,
+			     int geocentric,
+			     int n_particles,
+			     double* instate,
+			     int group_size,
+			     struct rebx_ephemeris* eph,
+			     const char* filename,
+			     MPI_Comm comm){
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // Only rank 0's arguments count
+    double times[3] = {tstart, tstep, trange};
+    int ints[3] = {geocentric, n_particles, group_size < 1 ? 1 : group_size};
+    MPI_Bcast(times, 3, MPI_DOUBLE, 0, comm);
+    MPI_Bcast(ints, 3, MPI_INT, 0, comm);
+    tstart = times[0];
+    tstep = times[1];
+    trange = times[2];
+    geocentric = ints[0];
+    n_particles = ints[1];
+    group_size = ints[2];
+
+    // The kernels are mapped shared and read-only, so the ranks on a node
+    // all read the same pages of the page cache.  Rank 0 only hands out
+    // work unless it is alone.
+    struct rebx_ephem_propagator* const p = (rank > 0 || size == 1) ? rebx_ephem_propagator_create(geocentric, eph) : NULL;
+    double* const states = rank > 0 ? malloc(6*(size_t)group_size*sizeof(*states)) : NULL;
+    int ok = (rank == 0 && size > 1) || (p != NULL && (rank == 0 || states != NULL));
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok){
+        if (rank == 0){
+            fprintf(stderr, "REBOUNDx Error: Could not load the ephemeris for integration_function_mpi on every rank.\n");
+        }
+        rebx_ephem_propagator_free(p);
+        free(states);
+        return 0;
+    }
+
+    struct ensemble_results res = {0};
+    int n_failed = 0;
+    if (size == 1){
+        for (int first=0; first<n_particles; first+=group_size){
+            const int n = n_particles - first < group_size ? n_particles - first : group_size;
+            n_failed += ensemble_propagate(p, &res, tstart, tstep, trange, first, n, instate + 6*(size_t)first);
+        }
+    }
+    else if (rank == 0){
+        ensemble_dispatch(comm, size, n_particles, group_size, instate);
+    }
+    else{
+        for (;;){
+            int work[2];
+            MPI_Send(&rank, 1, MPI_INT, 0, REBX_ENSEMBLE_TAG_REQUEST, comm);
+            MPI_Recv(work, 2, MPI_INT, 0, REBX_ENSEMBLE_TAG_WORK, comm, MPI_STATUS_IGNORE);
+            if (work[1] == 0){
+                break;
+            }
+            MPI_Recv(states, 6*work[1], MPI_DOUBLE, 0, REBX_ENSEMBLE_TAG_STATES, comm, MPI_STATUS_IGNORE);
+            n_failed += ensemble_propagate(p, &res, tstart, tstep, trange, work[0], work[1], states);
+        }
+    }
+    rebx_ephem_propagator_free(p);
+    free(states);
+
+    const int written = ensemble_write(comm, rank, size, filename, n_particles, &res);
+    free(res.entries);
+    free(res.data);
+
+    int success = (n_failed == 0 && written);
+    MPI_Allreduce(MPI_IN_PLACE, &success, 1, MPI_INT, MPI_LAND, comm);
+    return success;
+}
+
+#endif // REBX_MPI
@@ -0,0 +1,445 @@
+// ephem_native.c - write and map the pre-converted ephemeris file
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // madvise and MAP_ANONYMOUS with -std=c99
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spk.h"
+#include "planets.h"
+#include "ephem_native.h"
+
+
+// round a count of doubles up to the record alignment
+static size_t _pad(size_t n)
+{
+	const size_t a = EPH_NATIVE_ALIGN / sizeof(double);
+
+	return (n + a - 1) / a * a;
+}
+
+// zero fill the file up to the next aligned offset
+static int _align(FILE *fp, uint64_t *pos)
+{
+	static const char zero[EPH_NATIVE_ALIGN];
+	size_t q;
+
+	q = (size_t)(*pos % EPH_NATIVE_ALIGN);
+
+	if (q == 0)
+		return 0;
+	if (fwrite(zero, 1, EPH_NATIVE_ALIGN - q, fp) != EPH_NATIVE_ALIGN - q)
+		return -1;
+
+	*pos += EPH_NATIVE_ALIGN - q;
+	return 0;
+}
+
+
+/*
+ *  eph_native_write
+ *
+ *  Write the planet records covering [beg, end], and those of the first
+ *  nast asteroids of spl, to path.  Only the series of the bodies are kept
+ *  (no nutations, librations or TT-TDB).
+ *
+ */
+
+// planet series, repacked without the ones we never evaluate
+static size_t _jpl_pack(const struct _jpl_s *pl, struct eph_native_hdr *hdr)
+{
+	size_t o;
+	int p;
+
+	for (o = 2, p = 0; p < _NUM_JPL; p++) {
+		hdr->ncm[p] = pl->ncm[p];
+
+		if (p >= JPL_NUT) {
+			hdr->off[p] = hdr->ncf[p] = hdr->niv[p] = 0;
+			continue;
+		}
+
+		hdr->off[p] = (int32_t)o;
+		hdr->ncf[p] = pl->ncf[p];
+		hdr->niv[p] = pl->niv[p];
+		o += (size_t)(pl->ncf[p] * pl->niv[p] * pl->ncm[p]);
+	}
+
+	return _pad(o);
+}
+
+// check the asteroid's records in the window are uniform and contiguous
+static int _ast_scan(const struct spk_s *spl, int m, double beg, double end, struct eph_native_ast *ast)
+{
+	const struct spk_seg *seg;
+	double t;
+	int n, k, b0, b1, nb;
+
+	memset(ast, 0, sizeof(struct eph_native_ast));
+	ast->tar = spl->tar[m];
+	ast->cen = spl->cen[m];
+
+	for (n = 0; n < spl->ind[m]; n++) {
+		seg = &spl->seg[m][n];
+
+		if (end < seg->beg || beg > seg->end)
+			continue;
+
+		b0 = (int)((beg - seg->beg) / seg->len);
+		b1 = (int)((end - seg->beg) / seg->len);
+
+		if (b0 < 0) b0 = 0;
+		if (b1 >= seg->cnt) b1 = seg->cnt - 1;
+		if ((nb = b1 - b0 + 1) < 1)
+			continue;
+
+		t = seg->beg + b0 * seg->len;
+
+		if (ast->cnt == 0) {
+			ast->ncf = seg->ncf;
+			ast->rsz = (int32_t)_pad(2 + 3 * (size_t)seg->ncf);
+			ast->beg = t;
+			ast->len = seg->len;
+		} else {
+			// skip any records the previous segment already covered
+			k = (int)floor((ast->beg + ast->cnt * ast->len - t) / seg->len + 0.5);
+
+			if (k > 0) {
+				b0 += k;
+				nb -= k;
+				t += k * seg->len;
+			}
+
+			if (nb < 1)
+				continue;
+
+			if (seg->ncf != ast->ncf || fabs(seg->len - ast->len) > 1e-9 ||
+			    fabs(t - (ast->beg + ast->cnt * ast->len)) > 1e-6)
+				return -1;
+		}
+
+		ast->cnt += nb;
+	}
+
+	return (ast->cnt > 0) ? 0 : -1;
+}
+
+// copy the scanned records, in the same order as _ast_scan
+static int _ast_copy(const struct spk_s *spl, int m, const struct eph_native_ast *ast, FILE *fp)
+{
+	const struct spk_seg *seg;
+	const double *val;
+	double rec[2 + 3 * _SPK_NCF + EPH_NATIVE_ALIGN / sizeof(double)];
+	double t;
+	int n, b, c, p, cnt;
+
+	for (cnt = 0, n = 0; n < spl->ind[m] && cnt < ast->cnt; n++) {
+		seg = &spl->seg[m][n];
+
+		// first record at or after the next one we expect
+		t = ast->beg + cnt * ast->len;
+		b = (int)floor((t - seg->beg) / seg->len + 0.5);
+
+		if (b < 0) b = 0;
+
+		for (; b < seg->cnt && cnt < ast->cnt; b++) {
+			t = seg->beg + b * seg->len;
+
+			if (fabs(t - (ast->beg + cnt * ast->len)) > 1e-6)
+				break;
+
+			val = (const double *)spl->map + seg->one + (size_t)b * seg->rsz;
+			memset(rec, 0, sizeof(rec));
+			rec[0] = val[0];
+			rec[1] = val[1];
+
+			for (c = 0; c < 3; c++)
+				for (p = 0; p < ast->ncf; p++)
+					rec[2 + c * ast->ncf + p] = val[2 + c * seg->ncf + p] * spl->scl;
+
+			if (fwrite(rec, sizeof(double), ast->rsz, fp) != (size_t)ast->rsz)
+				return -1;
+			cnt++;
+		}
+	}
+
+	return (cnt == ast->cnt) ? 0 : -1;
+}
+
+int eph_native_write(struct _jpl_s *pl, struct spk_s *spl, int nast, double beg, double end, const char *path)
+{
+	struct eph_native_hdr hdr;
+	double *rec, *z;
+	size_t rsz, num, b, b0, b1;
+	uint64_t pos;
+	FILE *fp;
+	int m, p, k, n;
+
+	if (pl == NULL || pl->au || path == NULL)
+		return -1;
+	if (nast < 0 || nast > _SPK_MAX || (nast > 0 && (spl == NULL || nast > spl->num)))
+		return -1;
+
+	if (beg > end)
+		{ double x = beg; beg = end; end = x; }
+
+	if (beg < pl->beg) beg = pl->beg;
+	if (end > pl->end) end = pl->end;
+	if (beg > end)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, EPH_NATIVE_MAGIC, sizeof(hdr.magic));
+	hdr.ver = EPH_NATIVE_VER;
+	hdr.de = pl->ver;
+	hdr.nast = nast;
+	hdr.inc = pl->inc;
+	hdr.cau = pl->cau;
+	hdr.cem = pl->cem;
+
+	// the planet window, in whole records
+	num = (size_t)((pl->end - pl->beg) / pl->inc + 0.5);
+	b0 = (size_t)((beg - pl->beg) / pl->inc);
+	b1 = (size_t)((end - pl->beg) / pl->inc);
+
+	if (b1 >= num) b1 = num - 1;
+	if (b0 > b1)
+		return -1;
+
+	hdr.beg = pl->beg + b0 * pl->inc;
+	hdr.end = pl->beg + (b1 + 1) * pl->inc;
+	hdr.nrec = b1 - b0 + 1;
+
+	rsz = _jpl_pack(pl, &hdr);
+	hdr.rec = rsz * sizeof(double);
+	hdr.poff = _pad((sizeof(hdr) + sizeof(double) - 1) / sizeof(double)) * sizeof(double);
+
+	// asteroids over the same window
+	for (m = 0; m < nast; m++)
+		if (_ast_scan(spl, m, hdr.beg, hdr.end, &hdr.ast[m]) < 0)
+			{ errno = EILSEQ; return -1; }
+
+	if ((rec = calloc(rsz, sizeof(double))) == NULL)
+		return -1;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		{ free(rec); return -1; }
+
+	// header is written last, once the offsets are known
+	pos = hdr.poff;
+
+	if (fseek(fp, (long)pos, SEEK_SET) < 0)
+		goto err;
+
+	for (b = b0; b <= b1; b++) {
+		z = (double *)((char *)pl->dat + b * pl->rec);
+		rec[0] = z[0];
+		rec[1] = z[1];
+
+		for (p = 0; p < JPL_NUT; p++) {
+			n = pl->ncf[p] * pl->niv[p] * pl->ncm[p];
+
+			for (k = 0; k < n; k++)
+				rec[hdr.off[p] + k] = z[pl->off[p] + k] / pl->cau;
+		}
+
+		if (fwrite(rec, sizeof(double), rsz, fp) != rsz)
+			goto err;
+	}
+
+	pos += hdr.nrec * hdr.rec;
+
+	for (m = 0; m < nast; m++) {
+		if (_align(fp, &pos) < 0)
+			goto err;
+
+		hdr.ast[m].off = pos;
+
+		if (_ast_copy(spl, m, &hdr.ast[m], fp) < 0)
+			goto err;
+
+		pos += (uint64_t)hdr.ast[m].cnt * hdr.ast[m].rsz * sizeof(double);
+	}
+
+	if (fseek(fp, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto err;
+
+	free(rec);
+	return fclose(fp) == 0 ? 0 : -1;
+
+err:	free(rec);
+	fclose(fp);
+	remove(path);
+	return -1;
+}
+
+
+/*
+ *  eph_native_open
+ *
+ *  Map a file written by eph_native_write.  The planet and asteroid sides
+ *  each hold their own mapping and are freed with jpl_free and spk_free.
+ *  spl may be NULL, and is set to NULL if the file has no asteroids.
+ *
+ */
+
+// the planet side, records used in place
+static struct _jpl_s *_jpl_open(const struct eph_native_hdr *hdr, int fd, size_t len)
+{
+	struct _jpl_s *jpl;
+
+	if ((jpl = calloc(1, sizeof(struct _jpl_s))) == NULL)
+		return NULL;
+
+	jpl->beg = hdr->beg;
+	jpl->end = hdr->end;
+	jpl->inc = hdr->inc;
+	jpl->cau = hdr->cau;
+	jpl->cem = hdr->cem;
+	jpl->ver = hdr->de;
+	memcpy(jpl->off, hdr->off, sizeof(jpl->off));
+	memcpy(jpl->ncf, hdr->ncf, sizeof(jpl->ncf));
+	memcpy(jpl->niv, hdr->niv, sizeof(jpl->niv));
+	memcpy(jpl->ncm, hdr->ncm, sizeof(jpl->ncm));
+
+	// coefficients are in AU, derivatives per day
+	jpl->tpd = 1.0;
+	jpl->au = 1;
+	jpl->len = len;
+	jpl->rec = hdr->rec;
+
+	jpl->map = mmap(NULL, jpl->len, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (jpl->map == MAP_FAILED)
+		{ free(jpl); return NULL; }
+
+	jpl->dat = (char *)jpl->map + hdr->poff;
+
+	if (madvise(jpl->map, jpl->len, MADV_RANDOM) < 0)
+		{ ; }
+
+	return jpl;
+}
+
+// the asteroid side, one segment per target
+static struct spk_s *_spk_open(const struct eph_native_hdr *hdr, int fd, size_t len)
+{
+	const struct eph_native_ast *ast;
+	struct spk_seg *seg;
+	struct spk_s *pl;
+	int m;
+
+	if ((pl = calloc(1, sizeof(struct spk_s))) == NULL)
+		return NULL;
+
+	pl->scl = 1.0;
+	pl->len = len;
+	pl->map = mmap(NULL, pl->len, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (pl->map == MAP_FAILED)
+		{ free(pl); return NULL; }
+
+	if (madvise(pl->map, pl->len, MADV_RANDOM) < 0)
+		{ ; }
+
+	for (m = 0; m < hdr->nast; m++) {
+		ast = &hdr->ast[m];
+
+		if ((seg = calloc(1, sizeof(struct spk_seg))) == NULL)
+			{ spk_free(pl); return NULL; }
+
+		seg->beg = ast->beg;
+		seg->len = ast->len;
+		seg->cnt = ast->cnt;
+		seg->end = seg->beg + seg->cnt * seg->len;
+		seg->rsz = ast->rsz;
+		seg->ncf = ast->ncf;
+		seg->one = (size_t)(ast->off / sizeof(double));
+
+		pl->seg[m] = seg;
+		pl->ind[m] = 1;
+		pl->tar[m] = ast->tar;
+		pl->cen[m] = ast->cen;
+		pl->beg[m] = seg->beg;
+		pl->res[m] = seg->end - seg->beg;
+		pl->num++;
+	}
+
+	return pl;
+}
+
+// check the header against the file it came from
+static int _valid(const struct eph_native_hdr *hdr, size_t len)
+{
+	const struct eph_native_ast *ast;
+	int m;
+
+	if (memcmp(hdr->magic, EPH_NATIVE_MAGIC, sizeof(hdr->magic)) != 0)
+		return 0;
+	if (hdr->ver != EPH_NATIVE_VER)
+		return 0;
+	if (hdr->nast < 0 || hdr->nast > _SPK_MAX)
+		return 0;
+	if (hdr->poff % EPH_NATIVE_ALIGN || hdr->rec % EPH_NATIVE_ALIGN || hdr->nrec == 0)
+		return 0;
+	if (hdr->poff + hdr->nrec * hdr->rec > len)
+		return 0;
+
+	for (m = 0; m < hdr->nast; m++) {
+		ast = &hdr->ast[m];
+
+		if (ast->ncf < 1 || ast->ncf > _SPK_NCF || ast->rsz < 2 + 3 * ast->ncf || ast->cnt < 1)
+			return 0;
+		if (ast->off % EPH_NATIVE_ALIGN || ast->off + (uint64_t)ast->cnt * ast->rsz * sizeof(double) > len)
+			return 0;
+	}
+
+	return 1;
+}
+
+int eph_native_open(const char *path, struct _jpl_s **pl, struct spk_s **spl)
+{
+	struct eph_native_hdr hdr;
+	struct stat sb;
+	int fd;
+
+	if (pl == NULL)
+		return -1;
+
+	*pl = NULL;
+	if (spl != NULL)
+		*spl = NULL;
+
+	if (path == NULL || (fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &sb) < 0 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto err;
+
+	if (!_valid(&hdr, (size_t)sb.st_size))
+		{ errno = EILSEQ; goto err; }
+
+	if ((*pl = _jpl_open(&hdr, fd, (size_t)sb.st_size)) == NULL)
+		goto err;
+
+	if (spl != NULL && hdr.nast > 0 && (*spl = _spk_open(&hdr, fd, (size_t)sb.st_size)) == NULL) {
+		jpl_free(*pl);
+		*pl = NULL;
+		goto err;
+	}
+
+	// the mappings keep the file
+	close(fd);
+	return 0;
+
+err:	close(fd);
+	return -1;
+}
@@ -0,0 +1,55 @@
+// ephem_native.h - pre-converted planet and asteroid ephemeris file
+
+// One file holds a window of the planetary (DE) and asteroid (SPK) kernels
+// with every coefficient already in [AU] and every record padded to a
+// 64 byte boundary, so that it can be mapped and used without conversion.
+// The layout is the host's; a file is not portable between byte orders.
+//
+// Needs spk.h and planets.h.
+
+#ifndef _EPHEM_NATIVE_H
+#define _EPHEM_NATIVE_H
+
+#include <stdint.h>
+
+#define EPH_NATIVE_MAGIC	"REBXEPH1"
+#define EPH_NATIVE_VER		1
+#define EPH_NATIVE_ALIGN	64	// record alignment [bytes]
+
+// one asteroid, its records contiguous in time
+struct eph_native_ast {
+	int32_t tar;			// target code
+	int32_t cen;			// centre target
+	int32_t ncf;			// coefficients per coordinate
+	int32_t rsz;			// record size [doubles], padded
+	int32_t cnt;			// number of records
+	int32_t pad;
+	double beg;			// first record epoch, julian day
+	double len;			// record interval [days]
+	uint64_t off;			// first record [bytes]
+};
+
+struct eph_native_hdr {
+	char magic[8];
+	int32_t ver;			// format version
+	int32_t de;			// planetary ephemeris version
+	int32_t nast;			// number of asteroids
+	int32_t pad;
+	double beg, end;		// planet window, julian day
+	double inc;			// planet record interval [days]
+	double cau;			// definition of AU [km]
+	double cem;			// Earth/Moon mass ratio
+	int32_t off[_NUM_JPL];		// indexing offset, 0 if dropped
+	int32_t ncf[_NUM_JPL];		// number of chebyshev coefficients
+	int32_t niv[_NUM_JPL];		// number of interpolation intervals
+	int32_t ncm[_NUM_JPL];		// number of components / dimension
+	uint64_t rec;			// planet record size [bytes], padded
+	uint64_t nrec;			// number of planet records
+	uint64_t poff;			// first planet record [bytes]
+	struct eph_native_ast ast[_SPK_MAX];
+};
+
+int eph_native_write(struct _jpl_s *pl, struct spk_s *spl, int nast, double beg, double end, const char *path);
+int eph_native_open(const char *path, struct _jpl_s **pl, struct spk_s **spl);
+
+#endif // _EPHEM_NATIVE_H
@@ -38,7 +38,7 @@
  *    span of the integration, and the time step come from a file.  We probably want to 
  *    allow the user to specific barycentric or geocentric. DONE.
  * 
- * 2. Rearrange the ephem() function so that it returns all the positions in one shot.
+ * 2. Rearrange the ephem() function so that it returns all the positions in one shot.  DONE.
  * 
  * 3. Check position of the moon.  DONE.
  * 
@@ -62,11 +62,37 @@
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "rebound.h"
 #include "reboundx.h"
 
 #include "spk.h"
 #include "planets.h"
+#include "ephem_native.h"
+#include "chebyshev.h"
+#include "core.h"
+
+// With REBX_OPENMP the particle loops are shared out between threads;
+// otherwise the pragmas expand to nothing and the code runs serially.
+#ifdef REBX_OPENMP
+#include <omp.h>
+#define REBX_OMP(x) _Pragma(#x)
+#else
+#define REBX_OMP(x)
+#endif
+
+// With REBX_OPENMP_OFFLOAD the force parameter "device" moves the point-mass
+// and oblateness terms to the default OpenMP target device, e.g. a GPU.
+// Without a device the target regions run on the host.
+#ifdef REBX_OPENMP_OFFLOAD
+#include <omp.h>
+#define REBX_OMP_TARGET(x) _Pragma(#x)
+#else
+#define REBX_OMP_TARGET(x)
+#endif
 
 int ebody[11] = {
         PLAN_SOL,                       // Sun (in barycentric)
@@ -83,6 +109,333 @@ int ebody[11] = {
 };
 
 
+// The values below are G*mass, so we need to divide by G.
+// Units are solar masses, au, days.
+static const double JPL_GM[11] =
+    {
+	0.295912208285591100E-03, // 0  sun  
+	0.491248045036476000E-10, // 1  mercury
+	0.724345233264412000E-09, // 2  venus
+	0.888769244512563400E-09, // 3  earth
+	0.109318945074237400E-10, // 4  moon
+	0.954954869555077000E-10, // 5  mars
+	0.282534584083387000E-06, // 6  jupiter
+	0.845970607324503000E-07, // 7  saturn
+	0.129202482578296000E-07, // 8  uranus
+	0.152435734788511000E-07, // 9  neptune
+	0.217844105197418000E-11, // 10 pluto
+    };
+
+// 1 Ceres, 4 Vesta, 2 Pallas, 10 Hygiea, 31 Euphrosyne, 704 Interamnia,
+// 511 Davida, 15 Eunomia, 3 Juno, 16 Psyche, 65 Cybele, 88 Thisbe, 
+// 48 Doris, 52 Europa, 451 Patientia, 87 Sylvia
+static const double JPL_AST_GM[16] =
+    {
+	1.400476556172344e-13, // ceres
+	3.854750187808810e-14, // vesta
+	3.104448198938713e-14, // pallas
+	1.235800787294125e-14, // hygiea
+	6.343280473648602e-15, // euphrosyne
+	5.256168678493662e-15, // interamnia
+	5.198126979457498e-15, // davida
+	4.678307418350905e-15, // eunomia
+	3.617538317147937e-15, // juno
+	3.411586826193812e-15, // psyche
+	3.180659282652541e-15, // cybele
+	2.577114127311047e-15, // thisbe
+	2.531091726015068e-15, // doris
+	2.476788101255867e-15, // europa
+	2.295559390637462e-15, // patientia
+	2.199295173574073e-15, // sylvia
+    };
+
+// NAIF IDs of the asteroids above, in the same order.
+static const int JPL_AST_NAIF[16] =
+    {
+	SPK_NAIF_CERES, SPK_NAIF_VESTA, SPK_NAIF_PALLAS, SPK_NAIF_HYGIEA,
+	SPK_NAIF_EUPHROSYNE, SPK_NAIF_INTERAMNIA, SPK_NAIF_DAVIDA, SPK_NAIF_EUNOMIA,
+	SPK_NAIF_JUNO, SPK_NAIF_PSYCHE, SPK_NAIF_CYBELE, SPK_NAIF_THISBE,
+	SPK_NAIF_DORIS, SPK_NAIF_EUROPA, SPK_NAIF_PATIENTIA, SPK_NAIF_SYLVIA,
+    };
+
+// NAIF IDs accepted for each of the eleven bodies of ebody[].  The 
+// planets beyond the Moon are their system barycentres in DE430, so both
+// the barycentre and the planet code map to them.
+static const int JPL_NAIF[11][2] =
+    {
+	{SPK_NAIF_SUN, SPK_NAIF_SUN},
+	{SPK_NAIF_MER, SPK_NAIF_MER___},
+	{SPK_NAIF_VEN, SPK_NAIF_VEN___},
+	{SPK_NAIF_EAR___, SPK_NAIF_EAR___},
+	{SPK_NAIF_MOON, SPK_NAIF_MOON},
+	{SPK_NAIF_MAR, 499},
+	{SPK_NAIF_JUP, 599},
+	{SPK_NAIF_SAT, 699},
+	{SPK_NAIF_URA, 799},
+	{SPK_NAIF_NEP, 899},
+	{SPK_NAIF_PLU, 999},
+    };
+
+#define REBX_EPHEM_MAX_BODIES (11 + _SPK_MAX)
+
+// A perturber: a planet of ebody[] or an asteroid of the SPK kernel.
+struct rebx_ephem_perturber {
+    int naif;
+    int asteroid;               // 1 if index is an SPK target
+    int index;
+    double GM;                  // au^3/day^2
+    double r_max;               // au, 0 for no limit
+    double a_min;               // au/day^2, 0 for no limit
+};
+
+struct rebx_ephem_perturbers {
+    const struct rebx_ephemeris* eph;
+    int n;
+    int n_ast;                  // asteroids to evaluate (highest index + 1)
+    struct rebx_ephem_perturber body[REBX_EPHEM_MAX_BODIES];
+};
+
+// A loaded planet (DE430) and asteroid (SPK) kernel pair.  One context
+// can be shared by any number of simulations and forces.
+struct rebx_ephemeris {
+    struct _jpl_s *pl;
+    struct spk_s *spl;          // NULL if no asteroid kernel was loaded
+    int refcount;               // only changed atomically
+    struct rebx_ephem_perturbers* perturbers;   // default set, or NULL
+};
+
+struct rebx_ephemeris* rebx_ephemeris_load(const char* const planets_path, const char* const asteroids_path){
+    struct rebx_ephemeris* const eph = calloc(1, sizeof(*eph));
+    if (eph == NULL){
+        return NULL;
+    }
+
+    if ((eph->pl = jpl_init(planets_path)) == NULL){
+        fprintf(stderr, "REBOUNDx Error: Could not load planetary ephemeris file '%s'.\n", planets_path);
+        free(eph);
+        return NULL;
+    }
+
+    if (asteroids_path != NULL){
+        if ((eph->spl = spk_init(asteroids_path)) == NULL){
+            fprintf(stderr, "REBOUNDx Error: Could not load asteroid ephemeris file '%s'.\n", asteroids_path);
+            jpl_free(eph->pl);
+            free(eph);
+            return NULL;
+        }
+    }
+
+    eph->refcount = 1;
+    return eph;
+}
+
+struct rebx_ephemeris* rebx_ephemeris_load_native(const char* const path){
+    struct rebx_ephemeris* const eph = calloc(1, sizeof(*eph));
+    if (eph == NULL){
+        return NULL;
+    }
+
+    if (eph_native_open(path, &eph->pl, &eph->spl) < 0){
+        fprintf(stderr, "REBOUNDx Error: Could not load native ephemeris file '%s'.\n", path);
+        free(eph);
+        return NULL;
+    }
+
+    eph->refcount = 1;
+    return eph;
+}
+
+int rebx_ephemeris_write_native(const struct rebx_ephemeris* const eph, const char* const path, const double jde_begin, const double jde_end, const int n_asteroids){
+    if (eph == NULL){
+        return 0;
+    }
+    if (eph->pl->au){
+        fprintf(stderr, "REBOUNDx Error: Ephemeris is already in the native format.\n");
+        return 0;
+    }
+    if (eph_native_write(eph->pl, eph->spl, n_asteroids, jde_begin, jde_end, path) < 0){
+        fprintf(stderr, "REBOUNDx Error: Could not write native ephemeris file '%s'.\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+struct rebx_ephemeris* rebx_ephemeris_retain(struct rebx_ephemeris* const eph){
+    if (eph != NULL){
+        __atomic_add_fetch(&eph->refcount, 1, __ATOMIC_RELAXED);
+    }
+    return eph;
+}
+
+void rebx_ephemeris_release(struct rebx_ephemeris* const eph){
+    if (eph == NULL){
+        return;
+    }
+    // The last release must see every other thread's use of eph.
+    if (__atomic_sub_fetch(&eph->refcount, 1, __ATOMIC_ACQ_REL) > 0){
+        return;
+    }
+    jpl_free(eph->pl);
+    spk_free(eph->spl);
+    free(eph->perturbers);
+    free(eph);
+}
+
+struct rebx_ephem_perturbers* rebx_ephem_perturbers_create(const struct rebx_ephemeris* const eph, const int n, const int* const naif_ids){
+    if (eph == NULL || n < 0 || n > REBX_EPHEM_MAX_BODIES){
+        return NULL;
+    }
+    struct rebx_ephem_perturbers* const set = calloc(1, sizeof(*set));
+    if (set == NULL){
+        return NULL;
+    }
+    set->eph = eph;
+
+    for (int k=0; k<n; k++){
+        struct rebx_ephem_perturber* const b = &set->body[set->n];
+        b->naif = naif_ids[k];
+        b->index = -1;
+
+        for (int i=0; i<11; i++){
+            if (JPL_NAIF[i][0] == b->naif || JPL_NAIF[i][1] == b->naif){
+                b->index = i;
+                b->GM = JPL_GM[i];
+            }
+        }
+        if (b->index < 0){
+            const int m = spk_find(eph->spl, b->naif);
+            for (int i=0; i<16 && m >= 0; i++){
+                if (JPL_AST_NAIF[i] == b->naif){
+                    b->asteroid = 1;
+                    b->index = m;
+                    b->GM = JPL_AST_GM[i];
+                }
+            }
+        }
+        if (b->index < 0){
+            fprintf(stderr, "REBOUNDx Error: NAIF ID %d is not a perturber of the ephemeris, or has no known mass.\n", b->naif);
+            free(set);
+            return NULL;
+        }
+
+        // Listing a body twice would count it twice.
+        for (int i=0; i<set->n; i++){
+            if (set->body[i].asteroid == b->asteroid && set->body[i].index == b->index){
+                b->index = -1;
+            }
+        }
+        if (b->index < 0){
+            continue;
+        }
+        if (b->asteroid && b->index + 1 > set->n_ast){
+            set->n_ast = b->index + 1;
+        }
+        set->n++;
+    }
+    return set;
+}
+
+int rebx_ephem_perturbers_set_cutoff(struct rebx_ephem_perturbers* const set, const int naif_id, const double r_max, const double a_min){
+    if (set == NULL || r_max < 0. || a_min < 0.){
+        return 0;
+    }
+    int found = 0;
+    for (int i=0; i<set->n; i++){
+        if (naif_id == REBX_EPHEM_ALL_PERTURBERS || set->body[i].naif == naif_id){
+            set->body[i].r_max = r_max;
+            set->body[i].a_min = a_min;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+void rebx_ephem_perturbers_free(struct rebx_ephem_perturbers* const set){
+    free(set);
+}
+
+int rebx_ephemeris_set_perturbers(struct rebx_ephemeris* const eph, const struct rebx_ephem_perturbers* const set){
+    if (eph == NULL || (set != NULL && set->eph != eph)){
+        return 0;
+    }
+    struct rebx_ephem_perturbers* copy = NULL;
+    if (set != NULL){
+        if ((copy = malloc(sizeof(*copy))) == NULL){
+            return 0;
+        }
+        *copy = *set;
+    }
+    free(eph->perturbers);
+    eph->perturbers = copy;
+    return 1;
+}
+
+int rebx_ephemeris_warmup(struct rebx_ephemeris* const eph, const double jde_begin, const double jde_end){
+    if (eph == NULL){
+        return 0;
+    }
+    const double t0 = jde_begin < jde_end ? jde_begin : jde_end;
+    const double t1 = jde_begin < jde_end ? jde_end : jde_begin;
+    
+    if (jpl_prefetch(eph->pl, t0, t1) < 0){
+        return 0;
+    }
+    if (eph->spl != NULL && spk_prefetch(eph->spl, t0, t1) < 0){
+        return 0;
+    }
+    return 1;
+}
+
+int rebx_ephemeris_preload(struct rebx_ephemeris* const eph, const double jde_begin, const double jde_end, const int flags){
+    if (eph == NULL){
+        return 0;
+    }
+    const int jpl_flags = ((flags & REBX_EPHEMERIS_HUGEPAGES) ? JPL_LOAD_HUGE : 0) | ((flags & REBX_EPHEMERIS_MLOCK) ? JPL_LOAD_LOCK : 0);
+    const int spk_flags = ((flags & REBX_EPHEMERIS_HUGEPAGES) ? SPK_LOAD_HUGE : 0) | ((flags & REBX_EPHEMERIS_MLOCK) ? SPK_LOAD_LOCK : 0);
+
+    if (jpl_preload(eph->pl, jde_begin, jde_end, jpl_flags) < 0){
+        return 0;
+    }
+    if (eph->spl != NULL && spk_preload(eph->spl, jde_begin, jde_end, spk_flags) < 0){
+        return 0;
+    }
+    return 1;
+}
+
+int rebx_ephemeris_readahead(struct rebx_ephemeris* const eph, const double jde_begin, const double jde_end){
+    if (eph == NULL){
+        return 0;
+    }
+    const double t0 = jde_begin < jde_end ? jde_begin : jde_end;
+    const double t1 = jde_begin < jde_end ? jde_end : jde_begin;
+
+    if (jpl_sequential(eph->pl, t0, t1) < 0){
+        return 0;
+    }
+    if (eph->spl != NULL && spk_sequential(eph->spl, t0, t1) < 0){
+        return 0;
+    }
+    return 1;
+}
+
+// Context used by forces without an "ephemeris" parameter: the kernels 
+// in the working directory, loaded on first use and kept for the life of
+// the process.  Threads starting simulations at once all wait for the one
+// load; if it fails, it is not retried.
+static const char* const rebx_ephemeris_default_planets = "linux_p1550p2650.430";
+static const char* const rebx_ephemeris_default_asteroids = "sb431-n16s.bsp";
+static struct rebx_ephemeris* rebx_ephemeris_default_context;
+static pthread_once_t rebx_ephemeris_default_once = PTHREAD_ONCE_INIT;
+
+static void ephem_default_load(void){
+    rebx_ephemeris_default_context = rebx_ephemeris_load(rebx_ephemeris_default_planets, rebx_ephemeris_default_asteroids);
+}
+
+static struct rebx_ephemeris* ephem_default(void){
+    pthread_once(&rebx_ephemeris_default_once, ephem_default_load);
+    return rebx_ephemeris_default_context;
+}
+
 // Added gravitational constant G (2020 Feb 26)
 // Added vx, vy, vz for GR stuff (2020 Feb 27)
 // Consolidated the routine, removing the if block.
@@ -92,60 +445,25 @@ void ephem(const double G, const int i, const double jde, double* const m,
 	   double* const vx, double* const vy, double* const vz,
 	   double* const ax, double* const ay, double* const az){
 
-    static int initialized = 0;
-
-    static struct _jpl_s *pl;
     struct mpos_s now;
-
-    static double M[11];
-
-    if(i<0 || i>10){
-      fprintf(stderr, "body out of range\n");
-      exit(EXIT_FAILURE);
-    }
-
-    if (initialized == 0){
-      
-      if ((pl = jpl_init()) == NULL) {
-	fprintf(stderr, "could not load DE430 file, fool!\n");
-	exit(EXIT_FAILURE);
-      }
-
-      // The values below are G*mass, so we need to divide by G.
-      // Units are solar masses, au, days.
-      const static double JPL_GM[11] =
-	{
-	  0.295912208285591100E-03, // 0  sun  
-	  0.491248045036476000E-10, // 1  mercury
-	  0.724345233264412000E-09, // 2  venus
-	  0.888769244512563400E-09, // 3  earth
-	  0.109318945074237400E-10, // 4  moon
-	  0.954954869555077000E-10, // 5  mars
-	  0.282534584083387000E-06, // 6  jupiter
-	  0.845970607324503000E-07, // 7  saturn
-	  0.129202482578296000E-07, // 8  uranus
-	  0.152435734788511000E-07, // 9  neptune
-	  0.217844105197418000E-11, // 10 pluto
-	};
-
-      for(int k=0; k<11; k++){
-	M[k] = JPL_GM[k]/G;
-      }
-      
-      initialized = 1;
-
-    }
+    const struct rebx_ephemeris* const eph = ephem_default();
 
     // Get position, velocity, and mass of body i in barycentric coords. 
     
-    *m = M[i];
+    if(i<0 || i>10 || eph == NULL || jpl_calc(eph->pl, &now, jde, ebody[i], PLAN_BAR) < 0){
+      fprintf(stderr, "REBOUNDx Error: Could not evaluate the ephemeris for body %d at %f.\n", i, jde);
+      *m = *x = *y = *z = *vx = *vy = *vz = *ax = *ay = *az = NAN;
+      return;
+    }
 
-    jpl_calc(pl, &now, jde, ebody[i], PLAN_BAR); 
+    *m = JPL_GM[i]/G;
 
-    // Convert to au/day and au/day^2
-    vecpos_div(now.u, pl->cau);
-    vecpos_div(now.v, pl->cau/86400.);
-    vecpos_div(now.w, pl->cau/(86400.*86400.));
+    // Convert to au/day and au/day^2, unless the kernel was stored that way
+    if (!eph->pl->au){
+        vecpos_div(now.u, eph->pl->cau);
+        vecpos_div(now.v, eph->pl->cau/86400.);
+        vecpos_div(now.w, eph->pl->cau/(86400.*86400.));
+    }
 
     *x = now.u[0];
     *y = now.u[1];
@@ -159,137 +477,481 @@ void ephem(const double G, const int i, const double jde, double* const m,
     
 }
 
-static void ast_ephem(const double G, const int i, const double jde, double* const m, double* const x, double* const y, double* const z){
-
-    static int initialized = 0;
-
-    static struct spk_s *spl;
-    struct mpos_s pos;
-
-    static double M[16];    
-
-    if(i<0 || i>15){
-      fprintf(stderr, "asteroid out of range\n");
-      exit(EXIT_FAILURE);
-    }
-
-    if (initialized == 0){
-      
-      if ((spl = spk_init("sb431-n16s.bsp")) == NULL) {
-	fprintf(stderr, "could not load sb431-n16 file, fool!\n");
-	exit(EXIT_FAILURE);
-      }
-
-      // 1 Ceres, 4 Vesta, 2 Pallas, 10 Hygiea, 31 Euphrosyne, 704 Interamnia,
-      // 511 Davida, 15 Eunomia, 3 Juno, 16 Psyche, 65 Cybele, 88 Thisbe, 
-      // 48 Doris, 52 Europa, 451 Patientia, 87 Sylvia
-
-      // The values below are G*mass, so we need to divide by G.
-      // Units are solar masses, au, days.      
-      const static double JPL_GM[16] =
-	{
-	  1.400476556172344e-13, // ceres
-	  3.854750187808810e-14, // vesta
-	  3.104448198938713e-14, // pallas
-	  1.235800787294125e-14, // hygiea
-	  6.343280473648602e-15, // euphrosyne
-	  5.256168678493662e-15, // interamnia
-	  5.198126979457498e-15, // davida
-	  4.678307418350905e-15, // eunomia
-	  3.617538317147937e-15, // juno
-	  3.411586826193812e-15, // psyche
-	  3.180659282652541e-15, // cybele
-	  2.577114127311047e-15, // thisbe
-	  2.531091726015068e-15, // doris
-	  2.476788101255867e-15, // europa
-	  2.295559390637462e-15, // patientia
-	  2.199295173574073e-15, // sylvia
-	};
-      
-      for(int k=0; k<16; k++){
-	M[k] = JPL_GM[i]/ G;
-      }
-      
-      initialized = 1;
-
-    }
-
-    *m = M[i];
-    spk_calc(spl, i, jde, &pos);          
-    *x = pos.u[0];
-    *y = pos.u[1];
-    *z = pos.u[2];
-    
+// Get the masses and barycentric positions, velocities and accelerations 
+// of all eleven bodies in ebody[] order from a single record lookup.
+int ephem_all(const struct rebx_ephemeris* const eph, const double G, const double jde, double* const m, struct mpos_s* const pos){
+
+    struct mpos_s now[_NUM_TEST];
+
+    if (eph == NULL || jpl_calc_all(eph->pl, jde, now) < 0){
+        return 0;
+    }
+
+    for(int i=0; i<11; i++){
+	m[i] = JPL_GM[i]/G;
+	pos[i] = now[ebody[i]];
+
+	// Convert to au/day and au/day^2, unless the kernel was stored that way
+	if (!eph->pl->au){
+	    vecpos_div(pos[i].u, eph->pl->cau);
+	    vecpos_div(pos[i].v, eph->pl->cau/86400.);
+	    vecpos_div(pos[i].w, eph->pl->cau/(86400.*86400.));
+	}
+    }
+
+    return 1;
 }
 
-void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
+// Get the masses and heliocentric positions of the first n massive 
+// asteroids in one pass over the SPK targets.  ch holds the last SPK
+// record of each asteroid; it may be NULL.
+static int ast_ephem_all(const struct rebx_ephemeris* const eph, const double G, const int n, const double jde, double* const m, struct mpos_s* const pos, struct spk_cache* const ch){
 
-    const double G = sim->G;
-    const double t = sim->t;
+    if (n == 0){
+        return 1;
+    }
 
-    const int* const N_ephem = rebx_get_param(sim->extras, force->ap, "N_ephem");
-    if (N_ephem == NULL){
-        fprintf(stderr, "REBOUNDx Error: Need to set N_ephem for ephemeris_forces\n");
-        return;
+    if (eph->spl == NULL || spk_calc_all(eph->spl, ch, n, jde, pos) < 0){
+        return 0;
+    }
+
+    for(int i=0; i<n; i++){
+	m[i] = i < 16 ? JPL_AST_GM[i]/G : 0.0;
     }
     
-    const int* const N_ast = rebx_get_param(sim->extras, force->ap, "N_ast");
-    if (N_ephem == NULL){
-        fprintf(stderr, "REBOUNDx Error: Need to set N_ast for ephemeris_forces\n");
-        return;
+    return 1;
+}
+
+// IAS15 evaluates the force at the same Gauss-Radau sub-times on every 
+// predictor-corrector iteration, so the states of the massive bodies
+// are kept for the most recently used epochs.
+#define REBX_EPHEM_CACHE_SIZE 16
+
+struct rebx_ephem_cache_entry {
+    const struct rebx_ephemeris* eph;
+    double jde;
+    double G;
+    int n_ast;                  // number of asteroids filled in
+    double m[11];
+    double m_ast[_SPK_MAX];     // by kernel position, 0 past the 16 known
+    struct mpos_s pos[11];      // barycentric planets
+    struct mpos_s pos_ast[_SPK_MAX];    // heliocentric asteroids
+};
+
+// Orientation of a body's rotation pole as right ascension and
+// declination at J2000, plus linear rates in radians per Julian century.
+// R is the rotation from the simulation frame to the body equatorial
+// frame.  It is computed lazily, and only recomputed for a moving pole
+// when asked for a new epoch.
+struct rebx_ephem_pole {
+    double ra0, dec0;
+    double ra_rate, dec_rate;
+    int valid;
+    double jde;                 // epoch of R
+    double R[3][3];
+};
+
+static void ephem_pole_init(struct rebx_ephem_pole* const p, const double ra0, const double dec0){
+    *p = (struct rebx_ephem_pole){.ra0 = ra0, .dec0 = dec0};
+}
+
+static void ephem_pole_set_rates(struct rebx_ephem_pole* const p, const double ra_rate, const double dec_rate){
+    if (ra_rate != p->ra_rate || dec_rate != p->dec_rate){
+        p->ra_rate = ra_rate;
+        p->dec_rate = dec_rate;
+        p->valid = 0;
     }
+}
 
-    double* c = rebx_get_param(sim->extras, force->ap, "c");
-    if (c == NULL){
-        reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
-        return;
+// Fills R with the rotation that takes the unit pole (xp, yp, zp) to the
+// z axis: a rotation about z by -longnode followed by one about x by -incl,
+// where incl = acos(zp) and longnode = atan2(xp, -yp).  The sines and
+// cosines of both angles follow directly from the pole components.
+static void ephem_pole_rotation(const double xp, const double yp, const double zp, double R[3][3]){
+    const double rho = sqrt(xp*xp + yp*yp);     // sin(incl)
+    double sinO = 0.0, cosO = 1.0;              // of longnode
+    if (rho > 0.0){
+        sinO =  xp/rho;
+        cosO = -yp/rho;
+    }
+    R[0][0] = cosO;         R[0][1] = sinO;         R[0][2] = 0.0;
+    R[1][0] = -zp*sinO;     R[1][1] = zp*cosO;      R[1][2] = rho;
+    R[2][0] = xp;           R[2][1] = yp;           R[2][2] = zp;
+}
+
+static const double (*ephem_pole_matrix(struct rebx_ephem_pole* const p, const double jde))[3]{
+    const int fixed = (p->ra_rate == 0.0 && p->dec_rate == 0.0);
+    if (!p->valid || (!fixed && p->jde != jde)){
+        const double T = fixed ? 0.0 : (jde - 2451545.0)/36525.;
+        const double ra = p->ra0 + p->ra_rate*T;
+        const double dec = p->dec0 + p->dec_rate*T;
+        ephem_pole_rotation(cos(dec)*cos(ra), cos(dec)*sin(ra), sin(dec), p->R);
+        p->jde = jde;
+        p->valid = 1;
+    }
+    return (const double (*)[3])p->R;
+}
+
+struct rebx_ephem_cache {
+    int n;                      // number of valid entries
+    int last;                   // most recently used entry
+    int next;                   // entry to overwrite on the next miss
+    unsigned long hits;
+    unsigned long misses;
+    struct rebx_ephem_cache_entry entry[REBX_EPHEM_CACHE_SIZE];
+    struct rebx_ephem_pole pole[2];     // Earth, Sun
+    struct spk_cache spk;               // last asteroid records
+};
+
+// Aligned structure-of-arrays copies of the particle positions and
+// accelerations used by the blocked kernel.
+struct rebx_ephem_workspace {
+    int N_alloc;
+    size_t device_size;         // doubles of buf mapped to the device, 0 if none
+    void* buf;
+    double* x;
+    double* y;
+    double* z;
+    double* ax;
+    double* ay;
+    double* az;
+};
+
+// Drops the device copy of the workspace, before it is resized or freed.
+static void ephem_workspace_unmap(struct rebx_ephem_workspace* const ws){
+#ifdef REBX_OPENMP_OFFLOAD
+    if (ws->device_size > 0){
+        REBX_OMP_TARGET(omp target exit data map(delete: ws->x[0:ws->device_size]))
+        ws->device_size = 0;
+    }
+#endif
+}
+
+void rebx_ephemeris_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_ephem_cache* const cache = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_ephem_cache));
+    free(cache);
+    struct rebx_ephem_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_ephem_workspace));
+    if (ws){
+        ephem_workspace_unmap(ws);
+        free(ws->buf);
+        free(ws);
+    }
+}
+
+static struct rebx_ephem_cache* ephem_cache_get(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_ephem_cache* cache = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_ephem_cache));
+    if (cache == NULL){
+        cache = calloc(1, sizeof(*cache));
+        if (cache == NULL){
+            return NULL;
+        }
+
+        // Unit vector to the Earth's equatorial pole at the epoch.
+        const double xp =  0.0019111736356920146;
+        const double yp = -1.2513100974355823e-05;
+        const double zp =   0.9999981736277104;
+        ephem_pole_init(&cache->pole[0], atan2(yp, xp), atan2(zp, sqrt(xp*xp + yp*yp)));
+        ephem_pole_init(&cache->pole[1], 268.13*M_PI/180., 63.87*M_PI/180.);
+
+        rebx_set_param_pointer(rebx, &force->ap, "ephem_cache", cache);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_ephemeris_free_arrays);
+    }
+    return cache;
+}
+
+#define REBX_EPHEM_ALIGN 64     // bytes, enough for AVX-512 loads
+
+static struct rebx_ephem_workspace* ephem_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force, const int N){
+    struct rebx_ephem_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_ephem_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "ephem_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_ephemeris_free_arrays);
+    }
+    if (N > ws->N_alloc){
+        // Pad each array to a whole number of cache lines so they all stay aligned.
+        const int per_line = REBX_EPHEM_ALIGN/sizeof(double);
+        const size_t stride = (size_t)((N + per_line - 1)/per_line)*per_line;
+        void* const buf = malloc(6*stride*sizeof(double) + REBX_EPHEM_ALIGN);
+        if (buf == NULL){
+            return NULL;
+        }
+        ephem_workspace_unmap(ws);
+        free(ws->buf);
+        ws->buf = buf;
+        double* const base = (double*)(((uintptr_t)ws->buf + REBX_EPHEM_ALIGN - 1) & ~(uintptr_t)(REBX_EPHEM_ALIGN - 1));
+        ws->x  = base;
+        ws->y  = base + stride;
+        ws->z  = base + 2*stride;
+        ws->ax = base + 3*stride;
+        ws->ay = base + 4*stride;
+        ws->az = base + 5*stride;
+        ws->N_alloc = N;
+    }
+    return ws;
+}
+
+// Returns the states of all massive bodies at jde, evaluating the
+// ephemeris only if the epoch is not already cached.  Returns NULL if 
+// jde is outside the kernels' time span.
+static const struct rebx_ephem_cache_entry* ephem_cache_lookup(struct rebx_ephem_cache* const cache, const struct rebx_ephemeris* const eph, const double G, const int n_ast, const double jde){
+    // Search backwards from the most recently used entry, since 
+    // consecutive calls usually ask for the same or the next epoch.
+    for (int k=0; k<cache->n; k++){
+        const int idx = (cache->last - k + REBX_EPHEM_CACHE_SIZE) % REBX_EPHEM_CACHE_SIZE;
+        const struct rebx_ephem_cache_entry* const e = &cache->entry[idx];
+        if (e->jde == jde && e->G == G && e->eph == eph && e->n_ast >= n_ast){
+            cache->hits++;
+            cache->last = idx;
+            return e;
+        }
+    }
+
+    cache->misses++;
+    struct rebx_ephem_cache_entry* const e = &cache->entry[cache->next];
+    if (!ephem_all(eph, G, jde, e->m, e->pos) || !ast_ephem_all(eph, G, n_ast, jde, e->m_ast, e->pos_ast, &cache->spk)){
+        e->eph = NULL;      // leave the slot unusable until it is refilled
+        return NULL;
+    }
+    e->eph = eph;
+    e->jde = jde;
+    e->G = G;
+    e->n_ast = n_ast;
+
+    cache->last = cache->next;
+    cache->next = (cache->next + 1) % REBX_EPHEM_CACHE_SIZE;
+    if (cache->n < REBX_EPHEM_CACHE_SIZE){
+        cache->n++;
+    }
+    return e;
+}
+
+void rebx_ephemeris_cache_stats(struct rebx_extras* const rebx, struct rebx_force* const force, unsigned long* const hits, unsigned long* const misses){
+    const struct rebx_ephem_cache* const cache = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_ephem_cache));
+    *hits = cache ? cache->hits : 0;
+    *misses = cache ? cache->misses : 0;
+}
+
+// The integration frame at one epoch: the barycentric state of the
+// origin, its acceleration, which is subtracted from every particle since
+// only the barycentre is inertial, and the offsets of the origin from the
+// Sun used by the GR term.
+struct rebx_ephem_frame {
+    double x, y, z;
+    double vx, vy, vz;
+    double ax, ay, az;
+    double sx, sy, sz;          // origin minus Sun
+    double svx, svy, svz;
+};
+
+// Finds the origin naif, the solar system barycentre or a planet or
+// asteroid of eph, setting index to its position in ebody[] or the SPK
+// kernel (-1 for the barycentre).  Returns 0 if eph does not have it.
+static int ephem_origin_find(const struct rebx_ephemeris* const eph, const int naif, int* const asteroid, int* const index){
+    *asteroid = 0;
+    *index = -1;
+    if (naif == SPK_NAIF_SSB){
+        return 1;
+    }
+    for (int i=0; i<11; i++){
+        if (JPL_NAIF[i][0] == naif || JPL_NAIF[i][1] == naif){
+            *index = i;
+            return 1;
+        }
+    }
+    if (eph->spl != NULL && (*index = spk_find(eph->spl, naif)) >= 0){
+        *asteroid = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void ephem_frame_setup(const struct rebx_ephem_cache_entry* const e, const int asteroid, const int index, struct rebx_ephem_frame* const f){
+    const struct mpos_s* const sun = &e->pos[0];
+    *f = (struct rebx_ephem_frame){0};
+    if (index >= 0 && !asteroid){
+        const struct mpos_s* const o = &e->pos[index];
+        f->x  = o->u[0]; f->y  = o->u[1]; f->z  = o->u[2];
+        f->vx = o->v[0]; f->vy = o->v[1]; f->vz = o->v[2];
+        f->ax = o->w[0]; f->ay = o->w[1]; f->az = o->w[2];
+    }
+    else if (index >= 0){
+        // Asteroids are heliocentric.
+        const struct mpos_s* const o = &e->pos_ast[index];
+        f->x  = o->u[0] + sun->u[0]; f->y  = o->u[1] + sun->u[1]; f->z  = o->u[2] + sun->u[2];
+        f->vx = o->v[0] + sun->v[0]; f->vy = o->v[1] + sun->v[1]; f->vz = o->v[2] + sun->v[2];
+        f->ax = o->w[0] + sun->w[0]; f->ay = o->w[1] + sun->w[1]; f->az = o->w[2] + sun->w[2];
+    }
+    f->sx  = f->x - sun->u[0];  f->sy  = f->y - sun->u[1];  f->sz  = f->z - sun->u[2];
+    f->svx = f->vx - sun->v[0]; f->svy = f->vy - sun->v[1]; f->svz = f->vz - sun->v[2];
+}
+
+// An axisymmetric body with J2 (and optionally J4), with R taking
+// vectors to its equatorial frame.
+struct rebx_ephem_oblateness {
+    double GM;
+    double J2, J4;
+    double R_eq;
+    double ox, oy, oz;          // origin offset minus body position
+    double R[3][3];
+};
+
+// Hard-coded constants.  BEWARE!
+static void ephem_oblateness_setup(const double G, const struct rebx_ephem_cache_entry* const e, const struct rebx_ephem_frame* const f, const double R_earth[3][3], const double R_sun[3][3], struct rebx_ephem_oblateness* const earth, struct rebx_ephem_oblateness* const sun){
+    const double au = 149597870.700;
+
+    // The geocenter is the reference for the J2/J4 calculations.
+    earth->GM = G*(0.888769244512563400E-09/G);
+    earth->J2 = 0.00108262545*1.001;
+    earth->J4 = -0.000001616;
+    earth->R_eq = 6378.1263/au;
+    earth->ox = f->x - e->pos[3].u[0];
+    earth->oy = f->y - e->pos[3].u[1];
+    earth->oz = f->z - e->pos[3].u[2];
+    memcpy(earth->R, R_earth, sizeof(earth->R));
+
+    // The Sun center is reference for its J2.
+    sun->GM = G*1.0;            // mass of sun in solar masses
+    sun->J2 = 2.1106088532726840e-07;
+    sun->J4 = 0.0;
+    sun->R_eq = 696000.0/au;
+    sun->ox = f->sx;
+    sun->oy = f->sy;
+    sun->oz = f->sz;
+    memcpy(sun->R, R_sun, sizeof(sun->R));
+}
+
+// Adds the J2/J4 acceleration of o on a particle at (dx, dy, dz) from the
+// body center.  Borrowed code from gravitational_harmonics; the rotation
+// into the body frame and back is a single matrix product each way.
+REBX_OMP_TARGET(omp declare target)
+static inline void ephem_oblateness_accel(const struct rebx_ephem_oblateness* const o, const double dx, const double dy, const double dz, double* const ax, double* const ay, double* const az){
+    const double (*const R)[3] = o->R;
+
+    const double r2 = dx*dx + dy*dy + dz*dz;
+    const double r = sqrt(r2);
+
+    // Rotate to the body equatorial frame
+    const double bx = R[0][0]*dx + R[0][1]*dy + R[0][2]*dz;
+    const double by = R[1][0]*dx + R[1][1]*dy + R[1][2]*dz;
+    const double bz = R[2][0]*dx + R[2][1]*dy + R[2][2]*dz;
+
+    const double costheta2 = bz*bz/r2;
+    const double J2_prefac = 3.*o->J2*o->R_eq*o->R_eq/r2/r2/r/2.;
+    const double J2_fac = 5.*costheta2-1.;
+
+    double resx = o->GM*J2_prefac*J2_fac*bx;
+    double resy = o->GM*J2_prefac*J2_fac*by;
+    double resz = o->GM*J2_prefac*(J2_fac-2.)*bz;
+
+    const double J4_prefac = 5.*o->J4*o->R_eq*o->R_eq*o->R_eq*o->R_eq/r2/r2/r2/r/8.;
+    const double J4_fac = 63.*costheta2*costheta2-42.*costheta2 + 3.;
+
+    resx += o->GM*J4_prefac*J4_fac*bx;
+    resy += o->GM*J4_prefac*J4_fac*by;
+    resz += o->GM*J4_prefac*(J4_fac+12.-28.*costheta2)*bz;
+
+    // Rotate back to the original frame with the transpose
+    *ax += R[0][0]*resx + R[1][0]*resy + R[2][0]*resz;
+    *ay += R[0][1]*resx + R[1][1]*resy + R[2][1]*resz;
+    *az += R[0][2]*resx + R[1][2]*resy + R[2][2]*resz;
+}
+REBX_OMP_TARGET(omp end declare target)
+
+// The point-mass perturbers at one epoch, as offsets of the origin from
+// each body so that x[j] + bx[i] is the position of particle j relative
+// to body i, with GM and the squared distance beyond which the body is
+// skipped (infinite if it never is).  The acceleration of the origin is
+// subtracted in the same pass.
+struct rebx_ephem_bodies {
+    int n;
+    int cut;                    // 1 if any body has a finite cutoff
+    double fax, fay, faz;       // acceleration of the origin
+    double bx[REBX_EPHEM_MAX_BODIES];
+    double by[REBX_EPHEM_MAX_BODIES];
+    double bz[REBX_EPHEM_MAX_BODIES];
+    double gm[REBX_EPHEM_MAX_BODIES];
+    double rc2[REBX_EPHEM_MAX_BODIES];
+};
+
+static void ephem_bodies_add(struct rebx_ephem_bodies* const b, const double x, const double y, const double z, const double gm, const double r_max, const double a_min){
+    double rc2 = INFINITY;
+    if (r_max > 0.){
+        rc2 = r_max*r_max;
+    }
+    if (a_min > 0. && gm/a_min < rc2){
+        rc2 = gm/a_min;         // GM/r^2 < a_min beyond this
     }
+    b->bx[b->n] = x;
+    b->by[b->n] = y;
+    b->bz[b->n] = z;
+    b->gm[b->n] = gm;
+    b->rc2[b->n] = rc2;
+    b->cut |= (rc2 < INFINITY);
+    b->n++;
+}
 
-    int* geo = rebx_get_param(sim->extras, force->ap, "geocentric"); // Make sure there is a default set.
-    if (geo == NULL){
-        reb_error(sim, "REBOUNDx Error: Need to set geo flag.  See examples in documentation.\n");
+// The first N_ephem planets and N_ast asteroids, or the bodies of set if
+// it is not NULL.
+static void ephem_bodies_setup(const double G, const struct rebx_ephem_cache_entry* const e, const struct rebx_ephem_perturbers* const set, const int N_ephem, const int N_ast, const struct rebx_ephem_frame* const f, struct rebx_ephem_bodies* const b){
+    const double xs = e->pos[0].u[0], ys = e->pos[0].u[1], zs = e->pos[0].u[2];
+    const double xo = f->x, yo = f->y, zo = f->z;
+    b->n = 0;
+    b->cut = 0;
+    b->fax = f->ax;
+    b->fay = f->ay;
+    b->faz = f->az;
+
+    if (set == NULL){
+        for (int i=0; i<N_ephem; i++){
+            ephem_bodies_add(b, xo - e->pos[i].u[0], yo - e->pos[i].u[1], zo - e->pos[i].u[2], G*e->m[i], 0., 0.);
+        }
+        // Translate massive asteroids from heliocentric to barycentric.
+        for (int i=0; i<N_ast; i++){
+            ephem_bodies_add(b, xo - (e->pos_ast[i].u[0] + xs), yo - (e->pos_ast[i].u[1] + ys), zo - (e->pos_ast[i].u[2] + zs), G*e->m_ast[i], 0., 0.);
+        }
         return;
     }
 
-    const double C2 = (*c)*(*c);  // This could be stored as C2.
-    
-    double m, x, y, z, vx, vy, vz, ax, ay, az;
-    double xs, ys, zs, vxs, vys, vzs, axs, ays, azs;
-    double xe, ye, ze, vxe, vye, vze, axe, aye, aze;
-    double xo, yo, zo, vxo, vyo, vzo;
-    double xr, yr, zr, vxr, vyr, vzr;
-
-    // Get mass, position, velocity, and acceleration of the Earth and Sun
-    // for later use
-    ephem(G, 3, t, &m, &xe, &ye, &ze, &vxe, &vye, &vze, &axe, &aye, &aze);
-    ephem(G, 0, t, &m, &xs, &ys, &zs, &vxs, &vys, &vzs, &axs, &ays, &azs);     
-
-    // The offset position is used to adjust the particle positions.
-    if(*geo == 1){
-      xo = xe;    yo = ye;    zo = ze;
-      vxo = vxe;  vyo = vye;  vzo = vze;
-    }else{
-      xo = 0.0;  yo = 0.0;  zo = 0.0;
-      vxo = 0.0; vyo = 0.0; vzo = 0.0;      
+    for (int k=0; k<set->n; k++){
+        const struct rebx_ephem_perturber* const p = &set->body[k];
+        const int i = p->index;
+        if (p->asteroid){
+            ephem_bodies_add(b, xo - (e->pos_ast[i].u[0] + xs), yo - (e->pos_ast[i].u[1] + ys), zo - (e->pos_ast[i].u[2] + zs), G*(p->GM/G), p->r_max, p->a_min);
+        }else{
+            ephem_bodies_add(b, xo - e->pos[i].u[0], yo - e->pos[i].u[1], zo - e->pos[i].u[2], G*e->m[i], p->r_max, p->a_min);
+        }
     }
+}
+
+// Point-mass accelerations from the perturbers, plus the Earth J2/J4 and 
+// solar J2 terms and the frame term, on particles stored in the
+// simulation's particle array.
+static void ephem_direct_oblate(struct reb_particle* const particles, const int N, const struct rebx_ephem_bodies* const bodies, const struct rebx_ephem_oblateness* const obl){
 
-    // Calculate acceleration due to sun and planets
-    // Rearrange to get all the planet positions at once
-    for (int i=0; i<*N_ephem; i++){
+    // Calculate acceleration due to sun, planets and massive asteroids
+    for (int i=0; i<bodies->n; i++){
 
-        // Get position and mass of massive body i.
-        ephem(G, i, t, &m, &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az); 
+        const double ox = bodies->bx[i], oy = bodies->by[i], oz = bodies->bz[i];
+        const double GM = bodies->gm[i];
+        const double rc2 = bodies->rc2[i];
 
+        REBX_OMP(omp for schedule(static) nowait)
         for (int j=0; j<N; j++){
   	  // Compute position vector of test particle j relative to massive body i.
-	  const double dx =  particles[j].x + (xo - x); 
-	  const double dy =  particles[j].y + (yo - y);
-	  const double dz =  particles[j].z + (zo - z);
-	  const double _r = sqrt(dx*dx + dy*dy + dz*dz);
-	  const double prefac = G*m/(_r*_r*_r);
-
-	  //printf("%le %le %le\n", dx, dy, dz);
-	  
+	  const double dx = particles[j].x + ox;
+	  const double dy = particles[j].y + oy;
+	  const double dz = particles[j].z + oz;
+	  const double r2 = dx*dx + dy*dy + dz*dz;
+	  if (r2 > rc2){
+	      continue;
+	  }
+	  const double _r = sqrt(r2);
+	  const double prefac = GM/(_r*_r*_r);
+
 	  particles[j].ax -= prefac*dx;
 	  particles[j].ay -= prefac*dy;
 	  particles[j].az -= prefac*dz;
@@ -297,309 +959,634 @@ void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force*
         }
     }
 
-    // Calculate acceleration due to massive asteroids
-    // Rearrange to get all the asteroid positions at once
-    for (int i=0; i<*N_ast; i++){
+    // Here is the treatment of the Earth's J2 and J4 and the Sun's J2.
+    // The pole orientations are in the rotation matrices of obl.
+    REBX_OMP(omp for schedule(static) nowait)
+    for (int j=0; j<N; j++){
+        for (int k=0; k<2; k++){
+            const struct rebx_ephem_oblateness* const o = &obl[k];
+            ephem_oblateness_accel(o, particles[j].x + o->ox, particles[j].y + o->oy, particles[j].z + o->oz, &particles[j].ax, &particles[j].ay, &particles[j].az);
+        }
+        particles[j].ax -= bodies->fax;
+        particles[j].ay -= bodies->fay;
+        particles[j].az -= bodies->faz;
+    }
+}
 
-        ast_ephem(G, i, t, &m, &x, &y, &z); // Get position and mass of asteroid i.
+// Number of particles processed against every body before moving on,
+// chosen so the block's positions and accelerations stay in L1.
+#define REBX_EPHEM_BLOCK 64
+
+// Squared distance from (px, py, pz) to the box [lo, hi] in each axis.
+static inline double ephem_box_dist2(const double* const lo, const double* const hi, const double px, const double py, const double pz){
+    const double p[3] = {px, py, pz};
+    double d2 = 0.0;
+    for (int k=0; k<3; k++){
+        const double d = (p[k] < lo[k]) ? lo[k] - p[k] : ((p[k] > hi[k]) ? p[k] - hi[k] : 0.0);
+        d2 += d*d;
+    }
+    return d2;
+}
 
-	// Translate massive asteroids from heliocentric to barycentric.
-	x += xs; y += ys; z += zs;
-	
-        for (int j=0; j<N; j++){
-  	  // Compute position vector of test particle j relative to massive body i.
-	    const double dx = particles[j].x + (xo - x);
-	    const double dy = particles[j].y + (yo - y);
-	    const double dz = particles[j].z + (zo - z); 	    	    
-            const double _r = sqrt(dx*dx + dy*dy + dz*dz);
-	    
-            const double prefac = G*m/(_r*_r*_r);
-            particles[j].ax -= prefac*dx;
-            particles[j].ay -= prefac*dy;
-            particles[j].az -= prefac*dz;
-        }
-    }
-
-    // Here is the treatment of the Earth's J2 and J4.
-    // Borrowed code from gravitational_harmonics example.
-    // Assumes the coordinates are geocentric.
-    // Also assuming that Earth's pole is along the z
-    // axis.  This is only precisely true at the J2000
-    // epoch.
-    //
+static void ephem_soa_kernel(const int n, const double* restrict const x, const double* restrict const y, const double* restrict const z, double* restrict const ax, double* restrict const ay, double* restrict const az, const struct rebx_ephem_bodies* const bodies, const int n_obl, const struct rebx_ephem_oblateness* const obl){
+
+    const int n_blocks = (n + REBX_EPHEM_BLOCK - 1)/REBX_EPHEM_BLOCK;
+    REBX_OMP(omp for schedule(static))
+    for (int b=0; b<n_blocks; b++){
+        const int j0 = b*REBX_EPHEM_BLOCK;
+        const int j1 = (j0 + REBX_EPHEM_BLOCK < n) ? j0 + REBX_EPHEM_BLOCK : n;
+
+        // Bounding box of the block, so that a body beyond its cutoff
+        // from all of it is skipped without touching the particles.
+        double lo[3] = {INFINITY, INFINITY, INFINITY};
+        double hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+        if (bodies->cut){
+            for (int j=j0; j<j1; j++){
+                lo[0] = fmin(lo[0], x[j]); hi[0] = fmax(hi[0], x[j]);
+                lo[1] = fmin(lo[1], y[j]); hi[1] = fmax(hi[1], y[j]);
+                lo[2] = fmin(lo[2], z[j]); hi[2] = fmax(hi[2], z[j]);
+            }
+        }
 
-    // The geocenter is the reference for the J2/J4 calculations.
-    xr = xe;  yr = ye;  zr = ze;
+        for (int i=0; i<bodies->n; i++){
+            const double ox = bodies->bx[i], oy = bodies->by[i], oz = bodies->bz[i];
+            const double GM = bodies->gm[i];
+            const double rc2 = bodies->rc2[i];
+
+            if (rc2 == INFINITY){
+                for (int j=j0; j<j1; j++){
+                    const double dx = x[j] + ox;
+                    const double dy = y[j] + oy;
+                    const double dz = z[j] + oz;
+                    const double _r = sqrt(dx*dx + dy*dy + dz*dz);
+                    const double prefac = GM/(_r*_r*_r);
+                    ax[j] -= prefac*dx;
+                    ay[j] -= prefac*dy;
+                    az[j] -= prefac*dz;
+                }
+                continue;
+            }
 
-    // Hard-coded constants.  BEWARE!
-    // Clean up on aisle 3!
-    const double Mearth = 0.888769244512563400E-09/G;
-    const double J2e = 0.00108262545*1.001;
-    const double J4e = -0.000001616;
-    const double au = 149597870.700;
-    const double Re_eq = 6378.1263/au;
+            // The particles sit at -(ox, oy, oz) from the body.
+            if (ephem_box_dist2(lo, hi, -ox, -oy, -oz) > rc2){
+                continue;
+            }
+            for (int j=j0; j<j1; j++){
+                const double dx = x[j] + ox;
+                const double dy = y[j] + oy;
+                const double dz = z[j] + oz;
+                const double r2 = dx*dx + dy*dy + dz*dz;
+                const double _r = sqrt(r2);
+                const double prefac = (r2 > rc2) ? 0.0 : GM/(_r*_r*_r);
+                ax[j] -= prefac*dx;
+                ay[j] -= prefac*dy;
+                az[j] -= prefac*dz;
+            }
+        }
+
+        for (int k=0; k<n_obl; k++){
+            const struct rebx_ephem_oblateness* const o = &obl[k];
+            for (int j=j0; j<j1; j++){
+                ephem_oblateness_accel(o, x[j] + o->ox, y[j] + o->oy, z[j] + o->oz, &ax[j], &ay[j], &az[j]);
+            }
+        }
+        for (int j=j0; j<j1; j++){
+            ax[j] -= bodies->fax;
+            ay[j] -= bodies->fay;
+            az[j] -= bodies->faz;
+        }
+    }
+}
 
-    // Unit vector to equatorial pole at the epoch
-    // Clean this up!
+// Same terms as ephem_direct_oblate, but the particles are first gathered
+// into aligned arrays so the inner loops are contiguous and vectorizable.
+// The workspace must be resized before entering any parallel region.
+static void ephem_direct_oblate_soa(struct rebx_ephem_workspace* const ws, struct reb_particle* const particles, const int N, const struct rebx_ephem_bodies* const bodies, const struct rebx_ephem_oblateness* const obl){
 
-    double RAs =  359.87123273*M_PI/180.;
-    double Decs =  89.88809752*M_PI/180.;
+    double* const x = ws->x;
+    double* const y = ws->y;
+    double* const z = ws->z;
+    double* const ax = ws->ax;
+    double* const ay = ws->ay;
+    double* const az = ws->az;
 
-    //double xp = cos(Decs)*cos(RAs);
-    //double yp = cos(Decs)*sin(RAs);
-    //double zp = sin(Decs);
+    REBX_OMP(omp for schedule(static))
+    for (int j=0; j<N; j++){
+        x[j] = particles[j].x;
+        y[j] = particles[j].y;
+        z[j] = particles[j].z;
+        ax[j] = particles[j].ax;
+        ay[j] = particles[j].ay;
+        az[j] = particles[j].az;
+    }
 
-    //printf("%lf %lf %lf\n", xp, yp, zp);
+    ephem_soa_kernel(N, x, y, z, ax, ay, az, bodies, 2, obl);
 
-    double xp =  0.0019111736356920146;
-    double yp = -1.2513100974355823e-05;
-    double zp =   0.9999981736277104;
+    REBX_OMP(omp for schedule(static))
+    for (int j=0; j<N; j++){
+        particles[j].ax = ax[j];
+        particles[j].ay = ay[j];
+        particles[j].az = az[j];
+    }
+}
 
-    //xp = 0.0;
-    //yp = 0.0;
-    //zp = 1.0;
-    
-    double incl = acos(zp);
-    double longnode;
-    if(xp != 0.0 || yp !=0.0) {    
-      longnode = atan2(xp, -yp);
-    } else {
-      longnode = 0.0;
+#ifdef REBX_OPENMP_OFFLOAD
+// Same terms as ephem_direct_oblate_soa, on the target device.  The
+// workspace is allocated on the device once and kept there, and each call
+// moves only the positions up, the perturbers with the kernel, and the
+// accelerations down.  The GR and variational terms stay on the host.
+// Must be called outside any parallel region.
+static void ephem_direct_oblate_device(struct rebx_ephem_workspace* const ws, struct reb_particle* const particles, const int N, const struct rebx_ephem_bodies* const bodies, const struct rebx_ephem_oblateness* const obl){
+
+    double* const x = ws->x;
+    double* const y = ws->y;
+    double* const z = ws->z;
+    double* const ax = ws->ax;
+    double* const ay = ws->ay;
+    double* const az = ws->az;
+
+    if (ws->device_size == 0){
+        const size_t size = (size_t)(ws->az - ws->x) + ws->N_alloc;
+        REBX_OMP_TARGET(omp target enter data map(alloc: x[0:size]))
+        ws->device_size = size;
     }
 
-    // Rearrange this loop for efficiency
     for (int j=0; j<N; j++){
-        const struct reb_particle p = particles[j];
-        double dx = p.x + (xo - xr);
-        double dy = p.y + (yo - yr);
-        double dz = p.z + (zo - zr);
+        x[j] = particles[j].x;
+        y[j] = particles[j].y;
+        z[j] = particles[j].z;
+    }
+    REBX_OMP_TARGET(omp target update to(x[0:N], y[0:N], z[0:N]))
 
-        const double r2 = dx*dx + dy*dy + dz*dz;
-        const double r = sqrt(r2);
+    REBX_OMP_TARGET(omp target teams distribute parallel for map(to: bodies[0:1], obl[0:2]))
+    for (int j=0; j<N; j++){
+        double axj = -bodies->fax;
+        double ayj = -bodies->fay;
+        double azj = -bodies->faz;
+        for (int i=0; i<bodies->n; i++){
+            const double dx = x[j] + bodies->bx[i];
+            const double dy = y[j] + bodies->by[i];
+            const double dz = z[j] + bodies->bz[i];
+            const double r2 = dx*dx + dy*dy + dz*dz;
+            const double _r = sqrt(r2);
+            const double prefac = (r2 > bodies->rc2[i]) ? 0.0 : bodies->gm[i]/(_r*_r*_r);
+            axj -= prefac*dx;
+            ayj -= prefac*dy;
+            azj -= prefac*dz;
+        }
+        for (int k=0; k<2; k++){
+            ephem_oblateness_accel(&obl[k], x[j] + obl[k].ox, y[j] + obl[k].oy, z[j] + obl[k].oz, &axj, &ayj, &azj);
+        }
+        ax[j] = axj;
+        ay[j] = ayj;
+        az[j] = azj;
+    }
+
+    REBX_OMP_TARGET(omp target update from(ax[0:N], ay[0:N], az[0:N]))
+    for (int j=0; j<N; j++){
+        particles[j].ax += ax[j];
+        particles[j].ay += ay[j];
+        particles[j].az += az[j];
+    }
+}
+#endif
+
+// The velocity iteration of the solar GR terms is hard-coded.
+#define EPHEM_GR_MAX_ITERATIONS 10
+
+// Here is the Solar GR treatment, in the frame f.  The particles hold
+// the accelerations of the other terms, which it needs without the frame
+// term.  The velocities are solved for blocks of particles at once with
+// rebx_gr_solve_lanes.  Returns the number of particles for which the
+// velocity iteration did not converge, so that the caller can warn once,
+// and adds the iterations to *iterations, which must be private to the
+// thread.
+static int ephem_solar_gr(struct reb_particle* const particles, const int N, const double mu, const double C2, const struct rebx_ephem_frame* const f, uint64_t* const iterations){
+
+    int n_unconverged = 0;
+    REBX_OMP(omp for schedule(static))
+    for (int j0=0; j0<N; j0+=REBX_GR_LANES){
+        struct rebx_gr_lanes b;
+        struct reb_particle ps[REBX_GR_LANES];
+        double ri[REBX_GR_LANES];
+        b.n = (N - j0 < REBX_GR_LANES) ? N - j0 : REBX_GR_LANES;
+        for (int l=0; l<b.n; l++){
+            struct reb_particle* const p = &ps[l];
+            *p = particles[j0+l];
+
+	    p->x += f->sx;
+	    p->y += f->sy;
+	    p->z += f->sz;
+	    p->vx += f->svx;
+	    p->vy += f->svy;
+	    p->vz += f->svz;
+	    p->ax += f->ax;
+	    p->ay += f->ay;
+	    p->az += f->az;
+
+            ri[l] = sqrt(p->x*p->x + p->y*p->y + p->z*p->z);
+            b.vx[l] = p->vx;
+            b.vy[l] = p->vy;
+            b.vz[l] = p->vz;
+            b.phi[l] = 3.*mu/ri[l];
+        }
+        n_unconverged += rebx_gr_solve_lanes(&b, C2, EPHEM_GR_MAX_ITERATIONS, iterations);
+
+        for (int l=0; l<b.n; l++){
+            const struct reb_particle p = ps[l];
+            const double A = b.A[l];
+            const struct reb_vec3d vi = {.x = b.vix[l], .y = b.viy[l], .z = b.viz[l]};
+            const double vi2 = vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
+  
+            const double B = (mu/ri[l] - 1.5*vi2)*mu/(ri[l]*ri[l]*ri[l])/C2;
+            const double rdotrdot = p.x*p.vx + p.y*p.vy + p.z*p.vz;
+        
+            struct reb_vec3d vidot;
+            vidot.x = p.ax + B*p.x;
+            vidot.y = p.ay + B*p.y;
+            vidot.z = p.az + B*p.z;
+        
+            const double vdotvdot = vi.x*vidot.x + vi.y*vidot.y + vi.z*vidot.z;
+            const double D = (vdotvdot - 3.*mu/(ri[l]*ri[l]*ri[l])*rdotrdot)/C2;
 	
-	// Rotate to Earth equatorial frame
-	// This could be a single rotation
+            particles[j0+l].ax += B*(1.-A)*p.x - A*p.ax - D*vi.x;
+            particles[j0+l].ay += B*(1.-A)*p.y - A*p.ay - D*vi.y;
+            particles[j0+l].az += B*(1.-A)*p.z - A*p.az - D*vi.z;
+        }
+    }
 
-	// Rotate around z by RA
-	double cosr = cos(-longnode);
-	double sinr = sin(-longnode);
+    return n_unconverged;
+}
 
-	double dxp =  dx * cosr - dy * sinr;
-	double dyp =  dx * sinr + dy * cosr;
-	double dzp =  dz;
+// Tangent of ephem_oblateness_accel: adds to (dax, day, daz) the change
+// in the J2/J4 acceleration for a displacement (ddx, ddy, ddz) of the 
+// particle at (dx, dy, dz) from the body center.
+static inline void ephem_oblateness_tangent(const struct rebx_ephem_oblateness* const o, const double dx, const double dy, const double dz, const double ddx, const double ddy, const double ddz, double* const dax, double* const day, double* const daz){
+    const double (*const R)[3] = o->R;
+
+    const double r2 = dx*dx + dy*dy + dz*dz;
+    const double r = sqrt(r2);
+    const double dr2 = 2.*(dx*ddx + dy*ddy + dz*ddz);
+
+    const double bx = R[0][0]*dx + R[0][1]*dy + R[0][2]*dz;
+    const double by = R[1][0]*dx + R[1][1]*dy + R[1][2]*dz;
+    const double bz = R[2][0]*dx + R[2][1]*dy + R[2][2]*dz;
+    const double dbx = R[0][0]*ddx + R[0][1]*ddy + R[0][2]*ddz;
+    const double dby = R[1][0]*ddx + R[1][1]*ddy + R[1][2]*ddz;
+    const double dbz = R[2][0]*ddx + R[2][1]*ddy + R[2][2]*ddz;
+
+    const double costheta2 = bz*bz/r2;
+    const double dcostheta2 = 2.*bz*dbz/r2 - costheta2*dr2/r2;
+
+    // The prefactors go as r^-5 and r^-7.
+    const double J2_prefac = 3.*o->J2*o->R_eq*o->R_eq/r2/r2/r/2.;
+    const double dJ2_prefac = -2.5*J2_prefac*dr2/r2;
+    const double J2_fac = 5.*costheta2-1.;
+    const double dJ2_fac = 5.*dcostheta2;
+
+    double resx = o->GM*(dJ2_prefac*J2_fac*bx + J2_prefac*dJ2_fac*bx + J2_prefac*J2_fac*dbx);
+    double resy = o->GM*(dJ2_prefac*J2_fac*by + J2_prefac*dJ2_fac*by + J2_prefac*J2_fac*dby);
+    double resz = o->GM*(dJ2_prefac*(J2_fac-2.)*bz + J2_prefac*dJ2_fac*bz + J2_prefac*(J2_fac-2.)*dbz);
+
+    const double J4_prefac = 5.*o->J4*o->R_eq*o->R_eq*o->R_eq*o->R_eq/r2/r2/r2/r/8.;
+    const double dJ4_prefac = -3.5*J4_prefac*dr2/r2;
+    const double J4_fac = 63.*costheta2*costheta2-42.*costheta2 + 3.;
+    const double dJ4_fac = (126.*costheta2 - 42.)*dcostheta2;
+    const double J4_facz = J4_fac + 12. - 28.*costheta2;
+    const double dJ4_facz = dJ4_fac - 28.*dcostheta2;
+
+    resx += o->GM*(dJ4_prefac*J4_fac*bx + J4_prefac*dJ4_fac*bx + J4_prefac*J4_fac*dbx);
+    resy += o->GM*(dJ4_prefac*J4_fac*by + J4_prefac*dJ4_fac*by + J4_prefac*J4_fac*dby);
+    resz += o->GM*(dJ4_prefac*J4_facz*bz + J4_prefac*dJ4_facz*bz + J4_prefac*J4_facz*dbz);
+
+    *dax += R[0][0]*resx + R[1][0]*resy + R[2][0]*resz;
+    *day += R[0][1]*resx + R[1][1]*resy + R[2][1]*resz;
+    *daz += R[0][2]*resx + R[1][2]*resy + R[2][2]*resz;
+}
 
-	// Rotate around x by Dec
-	double cosd = cos(-incl);
-	double sind = sin(-incl);
-	
-	dx =  dxp;
-	dy =  dyp * cosd - dzp * sind;
-	dz =  dyp * sind + dzp * cosd;
+// Tangent of the solar GR term of ephem_solar_gr for particle p, whose
+// acceleration so far is in p, moved by the variation dp, whose 
+// acceleration so far is in dp.
+static void ephem_solar_gr_tangent(struct reb_particle p, const struct reb_particle* const dp, const double mu, const double C2, const struct rebx_ephem_frame* const f, double* const dax, double* const day, double* const daz){
+    struct reb_vec3d vi;
+    double A;
+
+    p.x += f->sx;
+    p.y += f->sy;
+    p.z += f->sz;
+    p.vx += f->svx;
+    p.vy += f->svy;
+    p.vz += f->svz;
+    p.ax += f->ax;
+    p.ay += f->ay;
+    p.az += f->az;
+
+    const double ri = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+    const double dri = (p.x*dp->x + p.y*dp->y + p.z*dp->z)/ri;
+    struct rebx_gr_lanes b = {.n = 1, .vx = {p.vx}, .vy = {p.vy}, .vz = {p.vz}, .phi = {3.*mu/ri}};
+    rebx_gr_solve_lanes(&b, C2, EPHEM_GR_MAX_ITERATIONS, NULL);
+    vi = (struct reb_vec3d){.x = b.vix[0], .y = b.viy[0], .z = b.viz[0]};
+    A = b.A[0];
+    const double vi2 = vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
+
+    // vi = v/(1-A(vi)) is a contraction of order v^2/c^2, so a couple of
+    // passes converge its tangent.
+    struct reb_vec3d dvi = {dp->vx, dp->vy, dp->vz};
+    double dA = 0.;
+    for (int q=0; q<3; q++){
+        dA = (vi.x*dvi.x + vi.y*dvi.y + vi.z*dvi.z - 3.*mu*dri/(ri*ri))/C2;
+        dvi.x = dp->vx/(1.-A) + p.vx*dA/((1.-A)*(1.-A));
+        dvi.y = dp->vy/(1.-A) + p.vy*dA/((1.-A)*(1.-A));
+        dvi.z = dp->vz/(1.-A) + p.vz*dA/((1.-A)*(1.-A));
+    }
+    dA = (vi.x*dvi.x + vi.y*dvi.y + vi.z*dvi.z - 3.*mu*dri/(ri*ri))/C2;
+
+    const double ri3 = ri*ri*ri;
+    const double B = (mu/ri - 1.5*vi2)*mu/ri3/C2;
+    const double dB = ((-mu*dri/(ri*ri) - 3.*(vi.x*dvi.x + vi.y*dvi.y + vi.z*dvi.z))*mu/ri3 - 3.*(mu/ri - 1.5*vi2)*mu*dri/(ri3*ri))/C2;
+
+    const double rdotrdot = p.x*p.vx + p.y*p.vy + p.z*p.vz;
+    const double drdotrdot = dp->x*p.vx + dp->y*p.vy + dp->z*p.vz + p.x*dp->vx + p.y*dp->vy + p.z*dp->vz;
+
+    struct reb_vec3d vidot, dvidot;
+    vidot.x = p.ax + B*p.x;
+    vidot.y = p.ay + B*p.y;
+    vidot.z = p.az + B*p.z;
+    dvidot.x = dp->ax + dB*p.x + B*dp->x;
+    dvidot.y = dp->ay + dB*p.y + B*dp->y;
+    dvidot.z = dp->az + dB*p.z + B*dp->z;
+
+    const double vdotvdot = vi.x*vidot.x + vi.y*vidot.y + vi.z*vidot.z;
+    const double dvdotvdot = dvi.x*vidot.x + dvi.y*vidot.y + dvi.z*vidot.z + vi.x*dvidot.x + vi.y*dvidot.y + vi.z*dvidot.z;
+    const double D = (vdotvdot - 3.*mu/ri3*rdotrdot)/C2;
+    const double dD = (dvdotvdot - 3.*mu/ri3*drdotrdot + 9.*mu/(ri3*ri)*rdotrdot*dri)/C2;
+
+    *dax += (dB*(1.-A) - B*dA)*p.x + B*(1.-A)*dp->x - dA*p.ax - A*dp->ax - dD*vi.x - D*dvi.x;
+    *day += (dB*(1.-A) - B*dA)*p.y + B*(1.-A)*dp->y - dA*p.ay - A*dp->ay - dD*vi.y - D*dvi.y;
+    *daz += (dB*(1.-A) - B*dA)*p.z + B*(1.-A)*dp->z - dA*p.az - A*dp->az - dD*vi.z - D*dvi.z;
+}
 
-	// Calculate acceleration in body frame
-	
-        const double costheta2 = dz*dz/r2;
-        const double J2e_prefac = 3.*J2e*Re_eq*Re_eq/r2/r2/r/2.;
-        const double J2e_fac = 5.*costheta2-1.;
-
-	double resx = G*Mearth*J2e_prefac*J2e_fac*dx;
-	double resy = G*Mearth*J2e_prefac*J2e_fac*dy;
-	double resz = G*Mearth*J2e_prefac*(J2e_fac-2.)*dz;	
-
-        const double J4e_prefac = 5.*J4e*Re_eq*Re_eq*Re_eq*Re_eq/r2/r2/r2/r/8.;
-        const double J4e_fac = 63.*costheta2*costheta2-42.*costheta2 + 3.;
-
-        resx += G*Mearth*J4e_prefac*J4e_fac*dx;
-        resy += G*Mearth*J4e_prefac*J4e_fac*dy;
-        resz += G*Mearth*J4e_prefac*(J4e_fac+12.-28.*costheta2)*dz;
-
-	// Rotate back to original frame
-	// Rotate around x by -Dec
-	double resxp =  resx;
-	double resyp =  resy * cosd + resz * sind;
-	double reszp = -resy * sind + resz * cosd;
-	
-	// Rotate around z by -RA
-	resx =  resxp * cosr + resyp * sinr;
-	resy = -resxp * sinr + resyp * cosr;
-	resz =  reszp;
-
-	particles[j].ax += resx;
-        particles[j].ay += resy; 
-        particles[j].az += resz;
-	
+// First order variational accelerations: the tangent of every term of
+// the force for the variational particles of the simulation.  Call after
+// the point-mass and oblateness terms and before the GR term have been
+// added to the real particles, whose accelerations are read.  The frame
+// term is the same for every particle, so it has no tangent.
+static void ephem_variational(struct reb_simulation* const sim, const int N, const struct rebx_ephem_bodies* const bodies, const struct rebx_ephem_oblateness* const obl, const double mu, const double C2, const struct rebx_ephem_frame* const f){
+    struct reb_particle* const particles = sim->particles;
+    const int reset = (sim->gravity == REB_GRAVITY_NONE);   // REBOUND leaves them stale then
+
+    for (int v=0; v<sim->var_config_N; v++){
+        const struct reb_variational_configuration* const vc = &sim->var_config[v];
+        if (vc->order != 1){
+            continue;
+        }
+        // One variation of one particle, or one of each.
+        const int first = vc->testparticle >= 0 ? vc->testparticle : 0;
+        const int n = vc->testparticle >= 0 ? 1 : N;
+
+        REBX_OMP(omp for schedule(static) nowait)
+        for (int i=0; i<n; i++){
+            const struct reb_particle* const p = &particles[first + i];
+            struct reb_particle* const dp = &particles[vc->index + i];
+            if (reset){
+                dp->ax = dp->ay = dp->az = 0.;
+            }
+
+            double dax = 0., day = 0., daz = 0.;
+            for (int k=0; k<bodies->n; k++){
+                const double dx = p->x + bodies->bx[k];
+                const double dy = p->y + bodies->by[k];
+                const double dz = p->z + bodies->bz[k];
+                const double r2 = dx*dx + dy*dy + dz*dz;
+                if (r2 > bodies->rc2[k]){
+                    continue;
+                }
+                const double _r = sqrt(r2);
+                const double prefac = bodies->gm[k]/(_r*_r*_r);
+                const double rdx = 3.*(dx*dp->x + dy*dp->y + dz*dp->z)/r2;
+                dax -= prefac*(dp->x - rdx*dx);
+                day -= prefac*(dp->y - rdx*dy);
+                daz -= prefac*(dp->z - rdx*dz);
+            }
+            for (int k=0; k<2; k++){
+                const struct rebx_ephem_oblateness* const o = &obl[k];
+                ephem_oblateness_tangent(o, p->x + o->ox, p->y + o->oy, p->z + o->oz, dp->x, dp->y, dp->z, &dax, &day, &daz);
+            }
+            dp->ax += dax;
+            dp->ay += day;
+            dp->az += daz;
+
+            dax = day = daz = 0.;
+            ephem_solar_gr_tangent(*p, dp, mu, C2, f, &dax, &day, &daz);
+            dp->ax += dax;
+            dp->ay += day;
+            dp->az += daz;
+        }
     }
+}
 
-    // Here is the treatment of the Sun's J2.
-    // Borrowed code from gravitational_harmonics.
-    // Also assuming that Sun's pole is along the z
-    // axis.  This is not true.  Will correct soon.
+void rebx_ephemeris_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
 
-    // The Sun center is reference for these calculations.
-    xr = xs;  yr = ys;  zr = zs;
+    const double G = sim->G;
+    const double t = sim->t;
 
-    // Hard-coded constants.  BEWARE!
-    // Clean up on aisle 3!
-    // Mass of sun in solar masses.    
-    const double Msun = 1.0;  // hard-code parameter.
-    const double Rs_eq = 696000.0/au;
-    const double J2s = 2.1106088532726840e-07;
+    double* c = rebx_get_param_double_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_c));
+    if (c == NULL){
+        reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
+        return;
+    }
 
-    RAs = 268.13*M_PI/180.;
-    Decs = 63.87*M_PI/180.;
+    // The frame is centred on the NAIF body "origin", or else the 
+    // geocenter or the barycentre as the geo flag says.
+    int origin;
+    const int* const origin_param = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_origin));
+    if (origin_param != NULL){
+        origin = *origin_param;
+    }else{
+        int* geo = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_geocentric)); // Make sure there is a default set.
+        if (geo == NULL){
+            reb_error(sim, "REBOUNDx Error: Need to set geo flag.  See examples in documentation.\n");
+            return;
+        }
+        origin = (*geo == 1) ? SPK_NAIF_EAR___ : SPK_NAIF_SSB;
+    }
 
-    xp = cos(Decs)*cos(RAs);
-    yp = cos(Decs)*sin(RAs);
-    zp = sin(Decs);
+    const double C2 = (*c)*(*c);  // This could be stored as C2.
 
-    incl = acos(zp);
-    if(xp != 0.0 || yp !=0.0) {    
-      longnode = atan2(xp, -yp);
-    } else {
-      longnode = 0.0;
+    // Kernels attached to the force, or the default files otherwise.
+    struct rebx_ephemeris* eph = rebx_get_param_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_ephemeris));
+    if (eph == NULL){
+        eph = ephem_default();
+        if (eph == NULL){
+            reb_error(sim, "REBOUNDx Error: Could not load the default ephemeris files for ephemeris_forces. Load them with rebx_ephemeris_load and set the 'ephemeris' parameter.\n");
+            return;
+        }
     }
-    
-    for (int j=0; j<N; j++){
-        const struct reb_particle p = particles[j];
-        double dx = p.x + (xo - xr);
-        double dy = p.y + (yo - yr);
-        double dz = p.z + (zo - zr);
 
-        const double r2 = dx*dx + dy*dy + dz*dz;
-        const double r = sqrt(r2);
+    // The perturbers: the force's set, the context's default set, or
+    // else the first N_ephem planets and N_ast asteroids.
+    const struct rebx_ephem_perturbers* set = rebx_get_param_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_perturbers));
+    if (set == NULL){
+        set = eph->perturbers;
+    }
+    int N_ephem = 0;
+    int N_ast = 0;
+    if (set != NULL){
+        if (set->eph != eph){
+            reb_error(sim, "REBOUNDx Error: The perturber set was created for a different ephemeris than the one used by ephemeris_forces.\n");
+            return;
+        }
+        N_ast = set->n_ast;
+    }else{
+        const int* const N_ephem_param = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_N_ephem));
+        if (N_ephem_param == NULL){
+            fprintf(stderr, "REBOUNDx Error: Need to set N_ephem for ephemeris_forces\n");
+            return;
+        }
 
-	// Rotate to solar equatorial frame
+        const int* const N_ast_param = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_N_ast));
+        if (N_ast_param == NULL){
+            fprintf(stderr, "REBOUNDx Error: Need to set N_ast for ephemeris_forces\n");
+            return;
+        }
+        N_ephem = *N_ephem_param;
+        N_ast = *N_ast_param;
 
-	// Rotate around z by RA
-	double cosr = cos(-longnode);
-	double sinr = sin(-longnode);
-	
-	// Rotate around z by RA
-	double dxp =  dx * cosr - dy * sinr;
-	double dyp =  dx * sinr + dy * cosr;
-	double dzp =  dz;
-
-	// Rotate around x by Dec
-	double cosd = cos(-incl);
-	double sind = sin(-incl);
-
-	dx =  dxp;
-	dy =  dyp * cosd - dzp * sind;
-	dz =  dyp * sind + dzp * cosd;
-
-	const double costheta2 = dz*dz/r2;
-        const double J2s_prefac = 3.*J2s*Rs_eq*Rs_eq/r2/r2/r/2.;
-        const double J2s_fac = 5.*costheta2-1.;
-
-	// Calculate acceleration
-	double resx = G*Msun*J2s_prefac*J2s_fac*dx;
-	double resy = G*Msun*J2s_prefac*J2s_fac*dy;
-	double resz = G*Msun*J2s_prefac*(J2s_fac-2.)*dz;
-
-	// Rotate back to original frame
-	// Rotate around x by -Dec
-	double resxp =  resx;
-	double resyp =  resy * cosd + resz * sind;
-	double reszp = -resy * sind + resz * cosd;
-	
-	// Rotate around z by -RA
-	resx =  resxp * cosr + resyp * sinr;
-	resy = -resxp * sinr + resyp * cosr;
-	resz =  reszp;
-
-        particles[j].ax += resx;
-        particles[j].ay += resy;
-        particles[j].az += resz;
-	
+        if (N_ephem < 0 || N_ephem > 11){
+            reb_error(sim, "REBOUNDx Error: N_ephem must be between 0 and 11 for ephemeris_forces.\n");
+            return;
+        }
+
+        if (N_ast < 0 || N_ast > 16){
+            reb_error(sim, "REBOUNDx Error: N_ast must be between 0 and 16 for ephemeris_forces.\n");
+            return;
+        }
+
+        if (N_ast > 0 && (eph->spl == NULL || N_ast > eph->spl->num)){
+            reb_error(sim, "REBOUNDx Error: N_ast is larger than the number of asteroids in the ephemeris for ephemeris_forces.\n");
+            return;
+        }
+    }
+
+    int origin_asteroid, origin_index;
+    if (!ephem_origin_find(eph, origin, &origin_asteroid, &origin_index)){
+        reb_error(sim, "REBOUNDx Error: The origin of ephemeris_forces is not a body of the ephemeris.\n");
+        return;
     }
 
-    // Here is the Solar GR treatment
-    // The Sun is the reference for these calculations.    
-    xr  = xs;  yr  = ys;  zr = zs;
-    vxr = vxs; vyr = vys; vzr = vzs;
+    // Get the masses and states of all the planets and asteroids
+    // for this epoch at once.
+    struct rebx_ephem_cache* const cache = ephem_cache_get(sim->extras, force);
+    if (cache == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for ephemeris_forces.\n");
+        return;
+    }
+    const int n_ast = (origin_asteroid && origin_index >= N_ast) ? origin_index + 1 : N_ast;
+    const struct rebx_ephem_cache_entry* const e = ephem_cache_lookup(cache, eph, G, n_ast, t);
+    if (e == NULL){
+        reb_error(sim, "REBOUNDx Error: Simulation time is outside the span of the ephemeris for ephemeris_forces.\n");
+        return;
+    }
+
+    // Every perturber and the GR and oblateness centres are taken
+    // relative to the origin once, here.
+    struct rebx_ephem_frame frame;
+    ephem_frame_setup(e, origin_asteroid, origin_index, &frame);
+
+    // Earth and Sun oblateness, with the body frames at this epoch.
+    const double* const ra_rate = rebx_get_param_double_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_earth_pole_ra_rate));
+    const double* const dec_rate = rebx_get_param_double_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_earth_pole_dec_rate));
+    ephem_pole_set_rates(&cache->pole[0], ra_rate ? *ra_rate : 0.0, dec_rate ? *dec_rate : 0.0);
+    struct rebx_ephem_oblateness obl[2];
+    ephem_oblateness_setup(G, e, &frame, ephem_pole_matrix(&cache->pole[0], t), ephem_pole_matrix(&cache->pole[1], t), &obl[0], &obl[1]);
 
-    //xr = 0.0;  yr = 0.0;  zr = 0.0;
-    //vxr = 0.0; vyr = 0.0; vzr = 0.0;      
+    struct rebx_ephem_bodies bodies;
+    ephem_bodies_setup(G, e, set, N_ephem, N_ast, &frame, &bodies);
 
+    const double Msun = 1.0;  // hard-code parameter.
     const double mu = G*Msun; 
-    const int max_iterations = 10; // hard-coded parameter.
-    for (int j=0; j<N; j++){
-        struct reb_particle p = particles[j];
-        struct reb_vec3d vi;
-
-	p.x += (xo - xr);
-	p.y += (yo - yr);
-	p.z += (zo - zr);
-	p.vx += (vxo - vxr);
-	p.vy += (vyo - vyr);
-	p.vz += (vzo - vzr);
-	
-        vi.x = p.vx;
-        vi.y = p.vy;
-        vi.z = p.vz;
-        double vi2=vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
-        const double ri = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
-	
-        int q = 0;
-        double A = (0.5*vi2 + 3.*mu/ri)/C2;
-        struct reb_vec3d old_v;
-        for(q=0; q<max_iterations; q++){
-            old_v.x = vi.x;
-            old_v.y = vi.y;
-            old_v.z = vi.z;
-            vi.x = p.vx/(1.-A);
-            vi.y = p.vy/(1.-A);
-            vi.z = p.vz/(1.-A);
-            vi2 =vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
-            A = (0.5*vi2 + 3.*mu/ri)/C2;
-            const double dvx = vi.x - old_v.x;
-            const double dvy = vi.y - old_v.y;
-            const double dvz = vi.z - old_v.z;
-            if ((dvx*dvx + dvy*dvy + dvz*dvz)/vi2 < DBL_EPSILON*DBL_EPSILON){
-                break;
+
+    // Builds without REBX_OPENMP ignore "n_threads" and run serially.
+#ifdef REBX_OPENMP
+    int n_threads = 1;
+    const int* const n_threads_param = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_n_threads));
+    if (n_threads_param != NULL && *n_threads_param > 1){
+        n_threads = *n_threads_param;
+    }
+#endif
+
+    // Variational particles are only found in the simulation's own
+    // array, not in the copies some rebx integrators pass in.
+    int variational = 0;
+    if (sim->N_var > 0 && particles == sim->particles){
+        for (int v=0; v<sim->var_config_N; v++){
+            if (sim->var_config[v].order != 1){
+                reb_error(sim, "REBOUNDx Error: ephemeris_forces only supports first order variational equations.\n");
+                return;
             }
         }
-        const int default_max_iterations = 10;
-        if(q==default_max_iterations){
-            reb_warning(sim, "REBOUNDx Warning: 10 iterations in ephemeris forces failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+        variational = 1;
+    }
+
+    const int* const soa = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_soa));
+    const int use_soa = (soa != NULL && *soa == 1);
+    // Builds without REBX_OPENMP_OFFLOAD ignore "device" and stay on the CPU.
+#ifdef REBX_OPENMP_OFFLOAD
+    const int* const device = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_device));
+    const int use_device = (device != NULL && *device == 1);
+#else
+    const int use_device = 0;
+#endif
+    struct rebx_ephem_workspace* const ws = (use_soa || use_device) ? ephem_workspace_get(sim->extras, force, N) : NULL;
+    if ((use_soa || use_device) && ws == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for ephemeris_forces.\n");
+        return;
+    }
+#ifdef REBX_OPENMP_OFFLOAD
+    if (use_device){
+        ephem_direct_oblate_device(ws, particles, N, &bodies, obl);
+    }
+#endif
+
+    // The ephemeris states above are shared; only the particle loops
+    // are split between threads.
+    int n_unconverged = 0;
+    uint64_t iterations = 0;
+    REBX_OMP(omp parallel num_threads(n_threads) if(n_threads > 1) reduction(+:n_unconverged,iterations))
+    {
+        if (use_device){
+            // already added
+        }else if (use_soa){
+            ephem_direct_oblate_soa(ws, particles, N, &bodies, obl);
+        }else{
+            ephem_direct_oblate(particles, N, &bodies, obl);
+        }
+        REBX_OMP(omp barrier)
+
+        if (variational){
+            ephem_variational(sim, N, &bodies, obl, mu, C2, &frame);
+            REBX_OMP(omp barrier)
         }
-  
-        const double B = (mu/ri - 1.5*vi2)*mu/(ri*ri*ri)/C2;
-        const double rdotrdot = p.x*p.vx + p.y*p.vy + p.z*p.vz;
-        
-        struct reb_vec3d vidot;
-        vidot.x = p.ax + B*p.x;
-        vidot.y = p.ay + B*p.y;
-        vidot.z = p.az + B*p.z;
-        
-        const double vdotvdot = vi.x*vidot.x + vi.y*vidot.y + vi.z*vidot.z;
-        const double D = (vdotvdot - 3.*mu/(ri*ri*ri)*rdotrdot)/C2;
-	
-        particles[j].ax += B*(1.-A)*p.x - A*p.ax - D*vi.x;
-        particles[j].ay += B*(1.-A)*p.y - A*p.ay - D*vi.y;
-        particles[j].az += B*(1.-A)*p.z - A*p.az - D*vi.z;
 
+        // The Sun is the reference for the GR calculations.    
+        n_unconverged += ephem_solar_gr(particles, N, mu, C2, &frame, &iterations);
     }
 
+    const struct rebx_extras* const rebx = sim->extras;
+    if (rebx->stats_enabled){
+        force->stats.iterations += iterations;
+    }
+    if (n_unconverged > 0){
+        reb_warning(sim, "REBOUNDx Warning: 10 iterations in ephemeris forces failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+    }
 
     // The expressions below are in here for another purpose.
     /*
-    double ae = sqrt(axe*axe + aye*aye + aze*aze);
+    const double* const we = e->pos[3].w;
+    double ae = sqrt(we[0]*we[0] + we[1]*we[1] + we[2]*we[2]);
     double rho = sqrt(G*Msun/ae);
     */
 
-    if(*geo == 1){
-
-      for (int j=0; j<N; j++){    
-
-	particles[j].ax -= axe;
-	particles[j].ay -= aye;
-	particles[j].az -= aze;
-
-      }
-
-    }
-
 }
 
 /**
@@ -628,28 +1615,160 @@ static struct reb_dpconst7 dpcast(struct reb_dp7 dp){
     return dpc;
 }
 
-typedef struct {
-  double t, x, y, z, vx, vy, vz, ax, ay, az;
-} tstate;
+// Gauss Radau spacings
+static const double h[9]    = { 0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780, 0.352624717113169637373907769648, 0.547153626330555383001448554766, 0.734210177215410531523210605558, 0.885320946839095768090359771030, 0.977520613561287501891174488626, 1.0};
+
+// Dense output of IAS15 at the Gauss-Radau nodes of each step.  The engine
+// keeps the state at the start of the step in flat 3*N arrays and the
+// h[n]-dependent parts of the interpolation coefficients, so a step only
+// costs the polynomial evaluations.  Scratch is reused across steps and
+// across propagations; it only grows.
+struct ephem_dense {
+    int N_alloc;
+    double* x0;         // positions at the start of the step
+    double* v0;         // velocities
+    double* a0;         // accelerations
+    double t0;
+    double t[8];        // times of the 8 samples of the current step
+    double* state;      // 8 rows of N 6-vectors
+    double cx[8][9];    // position coefficients at node n, without dt powers
+    double cv[8][8];    // velocity coefficients at node n, without dt
+};
+
+// Coefficients of the IAS15 position and velocity polynomials at the
+// fraction hh of a step.  cx[0] and all of cv multiply dt, the rest of cx
+// multiplies dt^2.
+static void ephem_dense_coefficients(const double hh, double* const cx, double* const cv){
+    cx[0] = hh;
+    cx[1] = hh * hh / 2.;
+    cx[2] = cx[1] * hh / 3.;
+    cx[3] = cx[2] * hh / 2.;
+    cx[4] = 3. * cx[3] * hh / 5.;
+    cx[5] = 2. * cx[4] * hh / 3.;
+    cx[6] = 5. * cx[5] * hh / 7.;
+    cx[7] = 3. * cx[6] * hh / 4.;
+    cx[8] = 7. * cx[7] * hh / 9.;
+
+    cv[0] = hh;
+    cv[1] =      cv[0] * hh / 2.;
+    cv[2] = 2. * cv[1] * hh / 3.;
+    cv[3] = 3. * cv[2] * hh / 4.;
+    cv[4] = 4. * cv[3] * hh / 5.;
+    cv[5] = 5. * cv[4] * hh / 6.;
+    cv[6] = 6. * cv[5] * hh / 7.;
+    cv[7] = 7. * cv[6] * hh / 8.;
+}
+
+static void ephem_dense_init(struct ephem_dense* const d){
+    *d = (struct ephem_dense){0};
+    for (int n=1; n<8; n++){
+        ephem_dense_coefficients(h[n], d->cx[n], d->cv[n]);
+    }
+}
+
+static void ephem_dense_free(struct ephem_dense* const d){
+    free(d->x0);
+    free(d->v0);
+    free(d->a0);
+    free(d->state);
+    d->x0 = d->v0 = d->a0 = d->state = NULL;
+    d->N_alloc = 0;
+}
+
+static int ephem_dense_reserve(struct ephem_dense* const d, const int N){
+    if (N <= d->N_alloc){
+        return 1;
+    }
+    ephem_dense_free(d);
+    d->x0 = malloc(3*N*sizeof(double));
+    d->v0 = malloc(3*N*sizeof(double));
+    d->a0 = malloc(3*N*sizeof(double));
+    d->state = malloc(8*6*N*sizeof(double));
+    if (d->x0 == NULL || d->v0 == NULL || d->a0 == NULL || d->state == NULL){
+        ephem_dense_free(d);
+        return 0;
+    }
+    d->N_alloc = N;
+    return 1;
+}
+
+// Records the state at the start of a step; call before reb_step, after
+// the accelerations have been updated.
+static void ephem_dense_begin(struct ephem_dense* const d, const struct reb_simulation* const r){
+    const struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    d->t0 = r->t;
+    for (int j=0; j<N; j++){
+        d->x0[3*j+0] = particles[j].x;
+        d->x0[3*j+1] = particles[j].y;
+        d->x0[3*j+2] = particles[j].z;
+        d->v0[3*j+0] = particles[j].vx;
+        d->v0[3*j+1] = particles[j].vy;
+        d->v0[3*j+2] = particles[j].vz;
+        d->a0[3*j+0] = particles[j].ax;
+        d->a0[3*j+1] = particles[j].ay;
+        d->a0[3*j+2] = particles[j].az;
+    }
+}
+
+// Fills d->t and d->state with the start of the step just taken and the
+// interpolated states at the 7 following Gauss-Radau nodes.
+static void ephem_dense_eval(struct ephem_dense* const d, const struct reb_simulation* const r){
+    const int N = r->N;
+    const double dt = r->dt_last_done;
+    const double dt2 = dt*dt;
+    const double* const restrict x0 = d->x0;
+    const double* const restrict v0 = d->v0;
+    const double* const restrict a0 = d->a0;
+    double* const restrict out = d->state;
 
-typedef struct {
-    double* t;
-    double* state;
-    int n_out;
-    int n_particles;
-} timestate;
+    // Convenience variable.  The 'br' field contains the 
+    // set of coefficients from the last completed step.
+    const struct reb_dpconst7 b  = dpcast(r->ri_ias15.br);
 
-// Gauss Radau spacings
-static const double h[9]    = { 0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780, 0.352624717113169637373907769648, 0.547153626330555383001448554766, 0.734210177215410531523210605558, 0.885320946839095768090359771030, 0.977520613561287501891174488626, 1.0};
+    d->t[0] = d->t0;
+    for (int j=0; j<N; j++){
+        for (int c=0; c<3; c++){
+            out[6*j+c] = x0[3*j+c];
+            out[6*j+3+c] = v0[3*j+c];
+        }
+    }
 
-int integration_function(double tstart, double tstep, double trange,
-			 int geocentric,
-			 int n_particles,
-			 double* instate,
-			 timestate *ts){
+    // Loop over interval using Gauss-Radau spacings      
+    for (int n=1; n<8; n++){
+        double s[9];    // position summation coefficients
+        double u[8];    // velocity summation coefficients
+        s[0] = dt * d->cx[n][0];
+        for (int k=1; k<9; k++){
+            s[k] = dt2 * d->cx[n][k];
+        }
+        for (int k=0; k<8; k++){
+            u[k] = dt * d->cv[n][k];
+        }
+
+        d->t[n] = r->t + dt * (h[n] - 1.0);
+
+        // Predict positions and velocities at interval n using b values
+        double* const restrict row = &out[n*6*N];
+        for (int j=0; j<N; j++){
+            for (int c=0; c<3; c++){
+                const int k = 3*j+c;
+                row[6*j+c] = x0[k] + (s[8]*b.p6[k] + s[7]*b.p5[k] + s[6]*b.p4[k] + s[5]*b.p3[k] + s[4]*b.p2[k] + s[3]*b.p1[k] + s[2]*b.p0[k] + s[1]*a0[k] + s[0]*v0[k] );
+                row[6*j+3+c] = v0[k] + u[7]*b.p6[k] + u[6]*b.p5[k] + u[5]*b.p4[k] + u[4]*b.p3[k] + u[3]*b.p2[k] + u[2]*b.p1[k] + u[1]*b.p0[k] + u[0]*a0[k];
+            }
+        }
+    }
+}
+
+// Creates a simulation with REBOUNDx and ephemeris_forces attached, ready
+// to propagate test particles.  If eph is NULL the force uses the default
+// ephemeris files.  Returns NULL if the simulation can't be allocated.
+static struct reb_simulation* ephem_sim_create(const int geocentric, struct rebx_ephemeris* const eph){
 
-    void store_function(struct reb_simulation* r, int n_out, int n_particles, tstate* last, double* outtime, double* outstate);
     struct reb_simulation* r = reb_create_simulation();
+    if (r == NULL){
+        return NULL;
+    }
 
     // Set up simulation constants
     r->G = 0.295912208285591100E-03; // Gravitational constant (AU, solar masses, days)
@@ -678,14 +1797,493 @@ int integration_function(double tstart, double tstep, double trange,
     // Here we use default units of AU/(yr/2pi)
     rebx_set_param_double(rebx, &ephem_forces->ap, "c", 173.144632674);
 
-    int fac = 5;
-    int n_out = (int)fac*8*fabs(trange/tstep);
-    
-    double* outstate = (double *) malloc(n_out*n_particles*6*sizeof(double));
-    double* outtime  = (double *) malloc(n_out*sizeof(double));    
+    if (eph != NULL){
+        rebx_set_param_pointer(rebx, &ephem_forces->ap, "ephemeris", eph);
+    }
+
+    return r;
+}
+
+static void ephem_sim_free(struct reb_simulation* const r){
+    // Free the simulation first: its extras_cleanup callback still
+    // dereferences r->extras.
+    struct rebx_extras* const rebx = r->extras;
+    reb_free_simulation(r);
+    rebx_free(rebx);    // this explicitly frees all the memory allocated by REBOUNDx 
+}
+
+// Output of a propagation is kept in fixed-size blocks of rows, so that
+// the store grows with the number of steps IAS15 actually takes rather than
+// with a guess made up front.  Only the table of block pointers is ever
+// reallocated.  A row is one sample time and n_particles 6-vectors.
+#define REBX_EPHEM_STORE_ROWS 512
+
+struct ephem_store {
+    int n_particles;
+    int n_out;          // rows stored
+    int n_blocks;
+    int n_blocks_alloc;
+    double** t;         // n_blocks blocks of REBX_EPHEM_STORE_ROWS times
+    double** state;     // and the matching rows of 6*n_particles doubles
+};
+
+static void ephem_store_init(struct ephem_store* const s, const int n_particles){
+    *s = (struct ephem_store){.n_particles = n_particles};
+}
+
+static void ephem_store_free(struct ephem_store* const s){
+    for (int b=0; b<s->n_blocks; b++){
+        free(s->t[b]);
+        free(s->state[b]);
+    }
+    free(s->t);
+    free(s->state);
+    ephem_store_init(s, s->n_particles);
+}
+
+// Appends n rows taken from t and state, where state has src_particles
+// 6-vectors per row and the store takes s->n_particles of them starting at
+// first.  Returns 0 if memory runs out.
+static int ephem_store_append(struct ephem_store* const s, const int n, const double* const t, const double* const state, const int src_particles, const int first){
+    const int width = 6*s->n_particles;
+    for (int i=0; i<n; i++){
+        const int row = s->n_out % REBX_EPHEM_STORE_ROWS;
+        if (row == 0){
+            if (s->n_blocks == s->n_blocks_alloc){
+                const int n_alloc = s->n_blocks_alloc ? 2*s->n_blocks_alloc : 8;
+                double** const tb = realloc(s->t, n_alloc*sizeof(double*));
+                if (tb == NULL){
+                    return 0;
+                }
+                s->t = tb;
+                double** const sb = realloc(s->state, n_alloc*sizeof(double*));
+                if (sb == NULL){
+                    return 0;
+                }
+                s->state = sb;
+                s->n_blocks_alloc = n_alloc;
+            }
+            s->t[s->n_blocks] = malloc(REBX_EPHEM_STORE_ROWS*sizeof(double));
+            s->state[s->n_blocks] = malloc(REBX_EPHEM_STORE_ROWS*width*sizeof(double));
+            if (s->t[s->n_blocks] == NULL || s->state[s->n_blocks] == NULL){
+                free(s->t[s->n_blocks]);
+                free(s->state[s->n_blocks]);
+                return 0;
+            }
+            s->n_blocks++;
+        }
+        s->t[s->n_blocks-1][row] = t[i];
+        memcpy(&s->state[s->n_blocks-1][row*width], &state[6*(i*src_particles + first)], width*sizeof(double));
+        s->n_out++;
+    }
+    return 1;
+}
+
+// Moves the stored rows into the contiguous, exactly sized arrays of a
+// timestate and empties the store.  Returns 0 if memory runs out, in which
+// case the store is left intact.
+static int ephem_store_finish(struct ephem_store* const s, timestate* const ts){
+    const int width = 6*s->n_particles;
+    double* const t = malloc(s->n_out*sizeof(double));
+    double* const state = malloc((size_t)s->n_out*width*sizeof(double));
+    if (s->n_out > 0 && (t == NULL || state == NULL)){
+        free(t);
+        free(state);
+        return 0;
+    }
+    for (int b=0; b<s->n_blocks; b++){
+        const int first = b*REBX_EPHEM_STORE_ROWS;
+        const int rows = (s->n_out - first < REBX_EPHEM_STORE_ROWS) ? s->n_out - first : REBX_EPHEM_STORE_ROWS;
+        memcpy(&t[first], s->t[b], rows*sizeof(double));
+        memcpy(&state[(size_t)first*width], s->state[b], (size_t)rows*width*sizeof(double));
+        free(s->t[b]);
+        free(s->state[b]);
+    }
+    ts->t = t;
+    ts->state = state;
+    ts->n_out = s->n_out;
+    ts->n_particles = s->n_particles;
+    free(s->t);
+    free(s->state);
+    ephem_store_init(s, s->n_particles);
+    return 1;
+}
+
+static int ephem_store_step(void* const data, const int n_samples, const int n_particles, const double* const t, const double* const state){
+    struct ephem_store* const s = data;
+    return ephem_store_append(s, n_samples, t, state, n_particles, 0);
+}
+
+// Everything needed to evaluate the IAS15 interpolant of every step of a
+// propagation: the step start time, its length, and for all particles the
+// start state, acceleration and the 7 br coefficients.  A step's record is
+// 10 flat arrays of 3*N doubles, in the order x0, v0, a0, p0..p6.
+struct rebx_ephem_trajectory {
+    int n_particles;
+    int geocentric;
+    int n_steps;
+    int n_alloc;
+    double* t0;
+    double* dt;
+    double* coef;
+};
+
+static int ephem_trajectory_append(struct rebx_ephem_trajectory* const traj, const struct ephem_dense* const d, const struct reb_simulation* const r){
+    const int N3 = 3*traj->n_particles;
+    if (traj->n_steps == traj->n_alloc){
+        const int n_alloc = traj->n_alloc ? 2*traj->n_alloc : 64;
+        double* const t0 = realloc(traj->t0, n_alloc*sizeof(double));
+        if (t0 == NULL){
+            return 0;
+        }
+        traj->t0 = t0;
+        double* const dt = realloc(traj->dt, n_alloc*sizeof(double));
+        if (dt == NULL){
+            return 0;
+        }
+        traj->dt = dt;
+        double* const coef = realloc(traj->coef, (size_t)n_alloc*10*N3*sizeof(double));
+        if (coef == NULL){
+            return 0;
+        }
+        traj->coef = coef;
+        traj->n_alloc = n_alloc;
+    }
+
+    const struct reb_dpconst7 b = dpcast(r->ri_ias15.br);
+    const double* const src[10] = {d->x0, d->v0, d->a0, b.p0, b.p1, b.p2, b.p3, b.p4, b.p5, b.p6};
+    double* const rec = &traj->coef[(size_t)traj->n_steps*10*N3];
+    for (int k=0; k<10; k++){
+        memcpy(&rec[k*N3], src[k], N3*sizeof(double));
+    }
+    traj->t0[traj->n_steps] = d->t0;
+    traj->dt[traj->n_steps] = r->dt_last_done;
+    traj->n_steps++;
+    return 1;
+}
+
+// Index of the step containing t, searching steps lo..n_steps-1.  Steps are
+// ordered along the direction of integration.
+static int ephem_trajectory_find(const struct rebx_ephem_trajectory* const traj, const double t, int lo){
+    const double sign = copysign(1., traj->dt[0]);
+    int hi = traj->n_steps - 1;
+    while (lo < hi){
+        const int mid = (lo + hi + 1)/2;
+        if ((traj->t0[mid] - t)*sign <= 0.){
+            lo = mid;
+        }
+        else{
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Evaluates step i at t into state (n_particles 6-vectors).
+static void ephem_trajectory_eval(const struct rebx_ephem_trajectory* const traj, const int i, const double t, double* const state){
+    const int N3 = 3*traj->n_particles;
+    const double dt = traj->dt[i];
+    const double dt2 = dt*dt;
+    const double* const rec = &traj->coef[(size_t)i*10*N3];
+    const double* const x0 = rec;
+    const double* const v0 = rec + N3;
+    const double* const a0 = rec + 2*N3;
+    const double* const p[7] = {rec + 3*N3, rec + 4*N3, rec + 5*N3, rec + 6*N3, rec + 7*N3, rec + 8*N3, rec + 9*N3};
+
+    double cx[9], cv[8];
+    ephem_dense_coefficients((t - traj->t0[i])/dt, cx, cv);
+    double s[9], u[8];
+    s[0] = dt * cx[0];
+    for (int k=1; k<9; k++){
+        s[k] = dt2 * cx[k];
+    }
+    for (int k=0; k<8; k++){
+        u[k] = dt * cv[k];
+    }
+
+    for (int k=0; k<N3; k++){
+        const int j = k/3;
+        const int c = k - 3*j;
+        state[6*j+c] = x0[k] + (s[8]*p[6][k] + s[7]*p[5][k] + s[6]*p[4][k] + s[5]*p[3][k] + s[4]*p[2][k] + s[3]*p[1][k] + s[2]*p[0][k] + s[1]*a0[k] + s[0]*v0[k] );
+        state[6*j+3+c] = v0[k] + u[7]*p[6][k] + u[6]*p[5][k] + u[5]*p[4][k] + u[4]*p[3][k] + u[3]*p[2][k] + u[2]*p[1][k] + u[1]*p[0][k] + u[0]*a0[k];
+    }
+}
+
+static int ephem_trajectory_contains(const struct rebx_ephem_trajectory* const traj, const double t){
+    if (traj->n_steps == 0){
+        return 0;
+    }
+    const double sign = copysign(1., traj->dt[0]);
+    const double t_end = traj->t0[traj->n_steps-1] + traj->dt[traj->n_steps-1];
+    return (t - traj->t0[0])*sign >= 0. && (t_end - t)*sign >= 0.;
+}
+
+void rebx_ephem_trajectory_free(struct rebx_ephem_trajectory* const traj){
+    if (traj == NULL){
+        return;
+    }
+    free(traj->t0);
+    free(traj->dt);
+    free(traj->coef);
+    free(traj);
+}
+
+int rebx_ephem_trajectory_span(const struct rebx_ephem_trajectory* const traj, double* const t_begin, double* const t_end){
+    if (traj->n_steps == 0){
+        return 0;
+    }
+    *t_begin = traj->t0[0];
+    *t_end = traj->t0[traj->n_steps-1] + traj->dt[traj->n_steps-1];
+    return 1;
+}
+
+int rebx_ephem_trajectory_state(const struct rebx_ephem_trajectory* const traj, const double t, double* const state){
+    if (!ephem_trajectory_contains(traj, t)){
+        for (int k=0; k<6*traj->n_particles; k++){
+            state[k] = NAN;
+        }
+        return 0;
+    }
+    ephem_trajectory_eval(traj, ephem_trajectory_find(traj, t, 0), t, state);
+    return 1;
+}
+
+int rebx_ephem_trajectory_states(const struct rebx_ephem_trajectory* const traj, const int n_times, const double* const t, double* const state){
+    int success = 1;
+    int lo = 0;
+    for (int i=0; i<n_times; i++){
+        double* const out = &state[(size_t)i*6*traj->n_particles];
+        if (!ephem_trajectory_contains(traj, t[i])){
+            for (int k=0; k<6*traj->n_particles; k++){
+                out[k] = NAN;
+            }
+            success = 0;
+            continue;
+        }
+        // The times are sorted, so each search starts at the last step found.
+        lo = ephem_trajectory_find(traj, t[i], lo);
+        ephem_trajectory_eval(traj, lo, t[i], out);
+    }
+    return success;
+}
+
+// Chebyshev fits of a trajectory for rebx_ephem_trajectory_write_spk.
+// Each record is fitted with _SPK_NCF coefficients at the Chebyshev
+// nodes, and cut to the fewest that still meet the tolerance at the
+// extrema of the last term, including both ends of the record.
+#define EPHEM_SPK_CHECK (_SPK_NCF + 1)
+#define EPHEM_SPK_MAX_SPLITS 10         // times the records are halved before giving up on the tolerance
+
+// Heliocentric states of all particles at t, as in the asteroid kernels.
+static int ephem_spk_states(const struct rebx_ephem_trajectory* const traj, const struct rebx_ephemeris* const eph, const double t, double* const state){
+    double m[11];
+    struct mpos_s pos[11];
+    if (!rebx_ephem_trajectory_state(traj, t, state) || !ephem_all(eph, 1., t, m, pos)){
+        return 0;
+    }
+    double o[6] = {0};
+    for (int k=0; k<3; k++){
+        const double origin_u = traj->geocentric ? pos[3].u[k] : 0.;
+        const double origin_v = traj->geocentric ? pos[3].v[k] : 0.;
+        o[k] = origin_u - pos[0].u[k];
+        o[3+k] = origin_v - pos[0].v[k];
+    }
+    for (int j=0; j<traj->n_particles; j++){
+        for (int k=0; k<6; k++){
+            state[6*j+k] += o[k];
+        }
+    }
+    return 1;
+}
+
+// Whether the first ncf coefficients of c (strided by _SPK_NCF) match the
+// states of particle j at the check points of a record of half length rad.
+static int ephem_spk_fits(const double* const c, const int ncf, const double rad, const double* const check, const int n_particles, const int j, const double tolerance){
+    for (int i=0; i<EPHEM_SPK_CHECK; i++){
+        const double x = cos(M_PI*i/(EPHEM_SPK_CHECK - 1));
+        const double* const s = &check[(size_t)i*6*n_particles + 6*j];
+        double u[3], v[3];
+        cheb_eval3(c, _SPK_NCF, ncf, x, u, v, NULL);
+        for (int k=0; k<3; k++){
+            if (!(fabs(u[k] - s[k]) <= tolerance && fabs(v[k]/rad - s[3+k]) <= tolerance)){
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Fits every particle over cnt records of length len from beg into coef,
+// _SPK_NCF coefficients of x, y and z per record, and the fewest
+// coefficients each particle needs into ncf.  Returns 0 if a record needs
+// more than _SPK_NCF, and -1 if the trajectory or ephemeris failed.
+static int ephem_spk_fit(const struct rebx_ephem_trajectory* const traj, const struct rebx_ephemeris* const eph, const double beg, const double end, const double len, const int cnt, const double tolerance, double* const coef, int* const ncf, double* const nodes, double* const check){
+    const int n = traj->n_particles;
+    const int P = _SPK_NCF;
+    double T[_SPK_NCF][_SPK_NCF];       // T_q at node i
+    for (int q=0; q<P; q++){
+        for (int i=0; i<P; i++){
+            T[q][i] = cos(M_PI*q*(i + 0.5)/P);
+        }
+    }
+    for (int j=0; j<n; j++){
+        ncf[j] = 1;
+    }
+    for (int b=0; b<cnt; b++){
+        const double mid = beg + (b + 0.5)*len;
+        const double rad = 0.5*len;
+        for (int i=0; i<P; i++){
+            const double t = mid + rad*cos(M_PI*(i + 0.5)/P);
+            if (!ephem_spk_states(traj, eph, t, &nodes[(size_t)i*6*n])){
+                return -1;
+            }
+        }
+        for (int i=0; i<EPHEM_SPK_CHECK; i++){
+            double t = mid + rad*cos(M_PI*i/(EPHEM_SPK_CHECK - 1));
+            t = (t < beg) ? beg : (t > end) ? end : t;
+            if (!ephem_spk_states(traj, eph, t, &check[(size_t)i*6*n])){
+                return -1;
+            }
+        }
+        for (int j=0; j<n; j++){
+            double* const c = &coef[((size_t)j*cnt + b)*3*P];
+            for (int k=0; k<3; k++){
+                for (int q=0; q<P; q++){
+                    double sum = 0.;
+                    for (int i=0; i<P; i++){
+                        sum += nodes[(size_t)i*6*n + 6*j + k]*T[q][i];
+                    }
+                    c[k*P + q] = (q == 0 ? 1. : 2.)*sum/P;
+                }
+            }
+            if (!ephem_spk_fits(c, P, rad, check, n, j, tolerance)){
+                return 0;
+            }
+            // The fewest coefficients that fit, by bisection
+            int lo = 1;
+            int hi = P;
+            while (lo < hi){
+                const int q = (lo + hi)/2;
+                if (ephem_spk_fits(c, q, rad, check, n, j, tolerance)){
+                    hi = q;
+                }
+                else{
+                    lo = q + 1;
+                }
+            }
+            if (lo > ncf[j]){
+                ncf[j] = lo;
+            }
+        }
+    }
+    return 1;
+}
+
+int rebx_ephem_trajectory_write_spk(const struct rebx_ephem_trajectory* const traj, struct rebx_ephemeris* eph, const char* const path, const int* const naif_ids, const double window, const double tolerance){
+    const int n = traj->n_particles;
+    if (traj->n_steps == 0 || n < 1){
+        fprintf(stderr, "REBOUNDx Error: Trajectory is empty.\n");
+        return 0;
+    }
+    if (n > _SPK_MAX){
+        fprintf(stderr, "REBOUNDx Error: An SPK file holds at most %d objects. Write the trajectory in groups.\n", _SPK_MAX);
+        return 0;
+    }
+    if (!(window > 0.) || !(tolerance > 0.)){
+        fprintf(stderr, "REBOUNDx Error: window and tolerance must be positive.\n");
+        return 0;
+    }
+    if (eph == NULL){
+        eph = ephem_default();
+        if (eph == NULL){
+            fprintf(stderr, "REBOUNDx Error: Could not load the default ephemeris files for rebx_ephem_trajectory_write_spk.\n");
+            return 0;
+        }
+    }
+
+    double beg = 0., end = 0.;
+    rebx_ephem_trajectory_span(traj, &beg, &end);
+    if (beg > end){
+        const double t = beg;
+        beg = end;
+        end = t;
+    }
+    int cnt = (int)ceil((end - beg)/window);
+    cnt = cnt < 1 ? 1 : cnt;
+
+    int* const ncf = malloc(n*sizeof(*ncf));
+    double* const nodes = malloc((size_t)_SPK_NCF*6*n*sizeof(double));
+    double* const check = malloc((size_t)EPHEM_SPK_CHECK*6*n*sizeof(double));
+    double* coef = NULL;
+    int fit = (ncf != NULL && nodes != NULL && check != NULL) ? 0 : -1;
+    for (int split=0; fit == 0 && split <= EPHEM_SPK_MAX_SPLITS; split++){
+        if (split > 0){
+            cnt *= 2;
+        }
+        free(coef);
+        coef = malloc((size_t)n*cnt*3*_SPK_NCF*sizeof(double));
+        fit = (coef == NULL) ? -1 : ephem_spk_fit(traj, eph, beg, end, (end - beg)/cnt, cnt, tolerance, coef, ncf, nodes, check);
+    }
+    free(nodes);
+    free(check);
+    if (fit <= 0){
+        if (fit == 0){
+            fprintf(stderr, "REBOUNDx Error: Could not fit the trajectory to a tolerance of %g au.\n", tolerance);
+        }
+        else{
+            fprintf(stderr, "REBOUNDx Error: Could not evaluate the trajectory for SPK file '%s'.\n", path);
+        }
+        free(ncf);
+        free(coef);
+        return 0;
+    }
+
+    // Each particle keeps only the coefficients it needs, packed in place
+    struct spk_out out[_SPK_MAX];
+    for (int j=0; j<n; j++){
+        double* const c = &coef[(size_t)j*cnt*3*_SPK_NCF];
+        for (int b=0; b<cnt; b++){
+            for (int k=0; k<3; k++){
+                memmove(&c[((size_t)b*3 + k)*ncf[j]], &c[((size_t)b*3 + k)*_SPK_NCF], ncf[j]*sizeof(double));
+            }
+        }
+        out[j] = (struct spk_out){
+            .tar = naif_ids != NULL ? naif_ids[j] : -(j + 1),
+            .cen = SPK_NAIF_SUN,
+            .beg = beg,
+            .len = (end - beg)/cnt,
+            .cnt = cnt,
+            .ncf = ncf[j],
+            .c = c,
+        };
+    }
+    const int written = (spk_write(path, n, out) == 0);
+    free(ncf);
+    free(coef);
+    if (!written){
+        fprintf(stderr, "REBOUNDx Error: Could not write SPK file '%s'.\n", path);
+        return 0;
+    }
+    return 1;
+}
 
-    rebx_set_param_int(rebx, &ephem_forces->ap, "n_out", 0);
-    rebx_set_param_pointer(rebx, &ephem_forces->ap, "outstate", outstate);
+// Propagates n_particles test particles from tstart over trange in a 
+// simulation made by ephem_sim_create, replacing any particles and 
+// integrator state left from a previous run, using the scratch in d.  
+// After every step the 8 samples it covers are handed to callback, and
+// the step's interpolant is recorded in traj; either may be NULL.  The
+// propagation stops and returns 0 if the callback returns 0 or memory
+// runs out.  With variational set, each particle i also gets the 6 first
+// order variational particles n_particles + 6*i + k, started on the unit
+// vectors e_k, and the callback and traj see all r->N particles.
+static int ephem_sim_propagate(struct reb_simulation* const r, struct ephem_dense* const d, const double tstart, const double tstep, const double trange, const int n_particles, const double* const instate, const int variational, rebx_ephem_step_callback callback, void* const data, struct rebx_ephem_trajectory* const traj){
+
+    reb_remove_all(r);
+    reb_integrator_ias15_reset(r);
+
+    if (!ephem_dense_reserve(d, variational ? 7*n_particles : n_particles)){
+        return 0;
+    }
 
     for(int i=0; i<n_particles; i++){
 
@@ -701,182 +2299,447 @@ int integration_function(double tstart, double tstep, double trange,
 	reb_add(r, tp);
     }
 
-    int N = r->N;
-    
-    r->t = tstart;    // set simulation internal time to the time of test particle initial conditions.
-    r->dt = tstep;    // time step in days
-
-    outtime[0] = r->t;	
-    
-    for(int j=0; j<N; j++){
-	int offset = j*6;
-	outstate[offset+0] = r->particles[j].x;
-	outstate[offset+1] = r->particles[j].y;
-	outstate[offset+2] = r->particles[j].z;
-	outstate[offset+3] = r->particles[j].vx;
-	outstate[offset+4] = r->particles[j].vy;
-	outstate[offset+5] = r->particles[j].vz;
+    if (variational){
+	for(int i=0; i<n_particles; i++){
+	    for(int k=0; k<6; k++){
+		const int index = reb_add_var_1st_order(r, i);   // may move r->particles
+		struct reb_particle* const dp = &r->particles[index];
+		double* const e[6] = {&dp->x, &dp->y, &dp->z, &dp->vx, &dp->vy, &dp->vz};
+		*e[k] = 1.;
+	    }
+	}
     }
 
-    tstate last[n_particles];
+    r->t = tstart;    // set simulation internal time to the time of test particle initial conditions.
+    r->dt = tstep;    // time step in days
 
     //reb_integrate(r, times[0]); // Not sure this is needed.
     reb_update_acceleration(r); // This is needed to save the acceleration.
  
     double tmax = tstart+trange;
-    int i = 1;
+    int success = 1;
     const double dtsign = copysign(1.,r->dt);   // Used to determine integration direction
 
     while((r->t)*dtsign<tmax*dtsign){ 
 
-	// This could be a helper function
-	for(int j=0; j<N; j++){
-	    last[j].t = r->t;	
-	    last[j].x = r->particles[j].x;
-	    last[j].y = r->particles[j].y;
-	    last[j].z = r->particles[j].z;
-	    last[j].vx = r->particles[j].vx;
-	    last[j].vy = r->particles[j].vy;
-	    last[j].vz = r->particles[j].vz;
-	    last[j].ax = r->particles[j].ax;
-	    last[j].ay = r->particles[j].ay;
-	    last[j].az = r->particles[j].az;
-	}
+	ephem_dense_begin(d, r);
 
 	reb_step(r);
 
-	store_function(r, 8*(i-1), n_particles, last, outtime, outstate);
+	if (traj != NULL && !ephem_trajectory_append(traj, d, r)){
+	    success = 0;
+	    break;
+	}
+	if (callback != NULL){
+	    ephem_dense_eval(d, r);
+	    if (!callback(data, 8, r->N, d->t, d->state)){
+		success = 0;
+		break;
+	    }
+	}
 	reb_update_acceleration(r); // This is needed to save the acceleration.
 
-	i++;
+    }
+
+    return success;
+}
+
+int integration_function(double tstart, double tstep, double trange,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 timestate *ts){
+
+    struct reb_simulation* r = ephem_sim_create(geocentric, NULL);
 
+    // Page in the part of the kernels this run needs before stepping.
+    rebx_ephemeris_warmup(ephem_default(), tstart, tstart + trange);
+
+    struct ephem_dense dense;
+    ephem_dense_init(&dense);
+    struct ephem_store store;
+    ephem_store_init(&store, n_particles);
+    int success = ephem_sim_propagate(r, &dense, tstart, tstep, trange, n_particles, instate, 0, ephem_store_step, &store, NULL);
+    if (success){
+        success = ephem_store_finish(&store, ts);
     }
+    ephem_store_free(&store);
+    ephem_dense_free(&dense);
 
-    ts->t = outtime;
-    ts->state = outstate;
-    ts->n_particles = n_particles;
-    ts->n_out = (i-1)*8;
-    //*nout =  n_out;
+    ephem_sim_free(r);
 
+    return success;
+}
 
-    rebx_free(rebx);    // this explicitly frees all the memory allocated by REBOUNDx 
-    reb_free_simulation(r);
+void rebx_ephem_free_output(void* const array){
+    free(array);
+}
+
+int integration_function_stream(double tstart, double tstep, double trange,
+				int geocentric,
+				int n_particles,
+				double* instate,
+				rebx_ephem_step_callback callback,
+				void* data){
+
+    struct reb_simulation* r = ephem_sim_create(geocentric, NULL);
 
+    rebx_ephemeris_warmup(ephem_default(), tstart, tstart + trange);
 
-    return(1);
+    struct ephem_dense dense;
+    ephem_dense_init(&dense);
+    const int success = ephem_sim_propagate(r, &dense, tstart, tstep, trange, n_particles, instate, 0, callback, data, NULL);
+    ephem_dense_free(&dense);
+
+    ephem_sim_free(r);
+
+    return success;
 }
 
-void store_function(struct reb_simulation* r, int n_out, int n_particles, tstate* last, double* outtime, double* outstate){
-    
-    int N = r->N;
-    int N3 = 3*N;
-    double s[9]; // Summation coefficients
+// Output of integration_function_stm: the states, and the 6 variational
+// particles of every particle as n_particles*6 more 6-vectors per row.
+struct ephem_stm_store {
+    struct ephem_store state;
+    struct ephem_store var;
+};
 
-    outtime[n_out] = last[0].t;    
+static int ephem_stm_step(void* const data, const int n_samples, const int n_particles, const double* const t, const double* const state){
+    struct ephem_stm_store* const s = data;
+    return ephem_store_append(&s->state, n_samples, t, state, n_particles, 0)
+        && ephem_store_append(&s->var, n_samples, t, state, n_particles, s->state.n_particles);
+}
 
-    for(int j=0; j<n_particles; j++){
-	int offset = (n_out*n_particles+j)*6;
-	outstate[offset+0] = last[j].x;
-	outstate[offset+1] = last[j].y;	
-	outstate[offset+2] = last[j].z;
-	outstate[offset+3] = last[j].vx;	
-	outstate[offset+4] = last[j].vy;
-	outstate[offset+5] = last[j].vz;	
+int integration_function_stm(double tstart, double tstep, double trange,
+			     int geocentric,
+			     int n_particles,
+			     double* instate,
+			     timestate *ts,
+			     double** stm){
+
+    struct reb_simulation* r = ephem_sim_create(geocentric, NULL);
+
+    rebx_ephemeris_warmup(ephem_default(), tstart, tstart + trange);
+
+    struct ephem_dense dense;
+    ephem_dense_init(&dense);
+    struct ephem_stm_store store;
+    ephem_store_init(&store.state, n_particles);
+    ephem_store_init(&store.var, 6*n_particles);
+    int success = ephem_sim_propagate(r, &dense, tstart, tstep, trange, n_particles, instate, 1, ephem_stm_step, &store, NULL);
+
+    timestate var = {0};
+    double* phi = NULL;
+    if (success){
+        phi = malloc((size_t)store.var.n_out*n_particles*36*sizeof(double));
+        success = (phi != NULL || store.var.n_out == 0) && ephem_store_finish(&store.var, &var);
     }
-    
-    // Convenience variable.  The 'br' field contains the 
-    // set of coefficients from the last completed step.
-    const struct reb_dpconst7 b  = dpcast(r->ri_ias15.br);
+    if (success){
+        // Variational particle k of particle j holds column k of its
+        // matrix; the output is row-major.
+        for (int i=0; i<var.n_out; i++){
+            for (int j=0; j<n_particles; j++){
+                const double* const src = &var.state[((size_t)i*6*n_particles + 6*j)*6];
+                double* const dst = &phi[((size_t)i*n_particles + j)*36];
+                for (int a=0; a<6; a++){
+                    for (int b=0; b<6; b++){
+                        dst[6*a+b] = src[6*b+a];
+                    }
+                }
+            }
+        }
+        success = ephem_store_finish(&store.state, ts);
+    }
+    if (success){
+        *stm = phi;
+    }
+    else{
+        free(phi);
+    }
+    free(var.t);
+    free(var.state);
+    ephem_store_free(&store.state);
+    ephem_store_free(&store.var);
+    ephem_dense_free(&dense);
+
+    ephem_sim_free(r);
+
+    return success;
+}
 
-    double* x0 = malloc(sizeof(double)*N3);
-    double* v0 = malloc(sizeof(double)*N3);
-    double* a0 = malloc(sizeof(double)*N3);
+struct rebx_ephem_trajectory* integration_function_trajectory(double tstart, double tstep, double trange,
+							      int geocentric,
+							      int n_particles,
+							      double* instate){
 
-    for(int j=0;j<N;j++) {
+    struct rebx_ephem_trajectory* traj = calloc(1, sizeof(*traj));
+    if (traj == NULL){
+        return NULL;
+    }
+    traj->n_particles = n_particles;
+    traj->geocentric = geocentric;
 
-	const int k0 = 3*j+0;
-	const int k1 = 3*j+1;
-	const int k2 = 3*j+2;
+    struct reb_simulation* r = ephem_sim_create(geocentric, NULL);
 
-	x0[k0] = last[j].x;
-	x0[k1] = last[j].y;
-	x0[k2] = last[j].z;	
+    rebx_ephemeris_warmup(ephem_default(), tstart, tstart + trange);
 
-	v0[k0] = last[j].vx;
-	v0[k1] = last[j].vy;
-	v0[k2] = last[j].vz;	
+    struct ephem_dense dense;
+    ephem_dense_init(&dense);
+    const int success = ephem_sim_propagate(r, &dense, tstart, tstep, trange, n_particles, instate, 0, NULL, NULL, traj);
+    ephem_dense_free(&dense);
 
-	a0[k0] = last[j].ax;
-	a0[k1] = last[j].ay;
-	a0[k2] = last[j].az;
+    ephem_sim_free(r);
 
+    if (!success){
+        rebx_ephem_trajectory_free(traj);
+        return NULL;
     }
+    return traj;
+}
 
-    // Loop over interval using Gauss-Radau spacings      
-    for(int n=1;n<8;n++) {                          
-
-	s[0] = r->dt_last_done * h[n];
-
-	s[1] = s[0] * s[0] / 2.;
-	s[2] = s[1] * h[n] / 3.;
-	s[3] = s[2] * h[n] / 2.;
-	s[4] = 3. * s[3] * h[n] / 5.;
-	s[5] = 2. * s[4] * h[n] / 3.;
-	s[6] = 5. * s[5] * h[n] / 7.;
-	s[7] = 3. * s[6] * h[n] / 4.;
-	s[8] = 7. * s[7] * h[n] / 9.;
-
-	// Predict positions at interval n using b values	
-	for(int j=0;j<N;j++) {  
-	  //int mj = j;
-	  const int k0 = 3*j+0;
-	  const int k1 = 3*j+1;
-	  const int k2 = 3*j+2;
-
-	  double xx0 = x0[k0] + (s[8]*b.p6[k0] + s[7]*b.p5[k0] + s[6]*b.p4[k0] + s[5]*b.p3[k0] + s[4]*b.p2[k0] + s[3]*b.p1[k0] + s[2]*b.p0[k0] + s[1]*a0[k0] + s[0]*v0[k0] );
-	  double xy0 = x0[k1] + (s[8]*b.p6[k1] + s[7]*b.p5[k1] + s[6]*b.p4[k1] + s[5]*b.p3[k1] + s[4]*b.p2[k1] + s[3]*b.p1[k1] + s[2]*b.p0[k1] + s[1]*a0[k1] + s[0]*v0[k1] );
-	  double xz0 = x0[k2] + (s[8]*b.p6[k2] + s[7]*b.p5[k2] + s[6]*b.p4[k2] + s[5]*b.p3[k2] + s[4]*b.p2[k2] + s[3]*b.p1[k2] + s[2]*b.p0[k2] + s[1]*a0[k2] + s[0]*v0[k2] );
-
-	  double t = r->t + r->dt_last_done * (h[n] - 1.0);
-
-	  int offset = ((n_out+n)*n_particles+j)*6;	  
-	  outtime[n_out+n] = t;
-	  outstate[offset+0] = xx0;
-	  outstate[offset+1] = xy0;	  	  
-	  outstate[offset+2] = xz0;
-	  
-	}
+// Work shared by the threads of integration_function_batch.  Groups of
+// particles are handed out one at a time, so that a slow group (e.g. a
+// close approach) does not hold up the others.
+struct ephem_batch {
+    double tstart, tstep, trange;
+    int geocentric;
+    int n_particles;
+    int group_size;
+    int n_groups;
+    const double* instate;
+    struct rebx_ephemeris* eph;
+    timestate* ts;
+    int next_group;
+    int n_failed;
+    pthread_mutex_t lock;
+};
 
-	s[0] = r->dt_last_done * h[n];
-	s[1] =      s[0] * h[n] / 2.;
-	s[2] = 2. * s[1] * h[n] / 3.;
-	s[3] = 3. * s[2] * h[n] / 4.;
-	s[4] = 4. * s[3] * h[n] / 5.;
-	s[5] = 5. * s[4] * h[n] / 6.;
-	s[6] = 6. * s[5] * h[n] / 7.;
-	s[7] = 7. * s[6] * h[n] / 8.;
+// Splits each step of a group's output into per-object stores.
+struct ephem_group {
+    int n;
+    struct ephem_store* stores;
+};
 
-	// Predict velocities at interval n using b values	
-	for(int j=0;j<N;j++) {
+static int ephem_group_step(void* const data, const int n_samples, const int n_particles, const double* const t, const double* const state){
+    struct ephem_group* const group = data;
+    for (int k=0; k<group->n; k++){
+        if (!ephem_store_append(&group->stores[k], n_samples, t, state, n_particles, k)){
+            return 0;
+        }
+    }
+    return 1;
+}
 
-	  const int k0 = 3*j+0;
-	  const int k1 = 3*j+1;
-	  const int k2 = 3*j+2;
+static void* ephem_batch_worker(void* const arg){
+    struct ephem_batch* const batch = arg;
+
+    // Each worker keeps one simulation and dense output scratch for all of
+    // its groups.
+    struct reb_simulation* const r = ephem_sim_create(batch->geocentric, batch->eph);
+    struct ephem_dense dense;
+    ephem_dense_init(&dense);
+
+    while (1){
+        pthread_mutex_lock(&batch->lock);
+        const int g = batch->next_group++;
+        pthread_mutex_unlock(&batch->lock);
+        if (g >= batch->n_groups){
+            break;
+        }
 
-	  double vx0 = v0[k0] + s[7]*b.p6[k0] + s[6]*b.p5[k0] + s[5]*b.p4[k0] + s[4]*b.p3[k0] + s[3]*b.p2[k0] + s[2]*b.p1[k0] + s[1]*b.p0[k0] + s[0]*a0[k0];
-	  double vy0 = v0[k1] + s[7]*b.p6[k1] + s[6]*b.p5[k1] + s[5]*b.p4[k1] + s[4]*b.p3[k1] + s[3]*b.p2[k1] + s[2]*b.p1[k1] + s[1]*b.p0[k1] + s[0]*a0[k1];
-	  double vz0 = v0[k2] + s[7]*b.p6[k2] + s[6]*b.p5[k2] + s[5]*b.p4[k2] + s[4]*b.p3[k2] + s[3]*b.p2[k2] + s[2]*b.p1[k2] + s[1]*b.p0[k2] + s[0]*a0[k2];
+        const int first = g*batch->group_size;
+        const int n = (first + batch->group_size < batch->n_particles) ? batch->group_size : batch->n_particles - first;
 
-	  int offset = ((n_out+n)*n_particles+j)*6;	  
-	  outstate[offset+3] = vx0;
-	  outstate[offset+4] = vy0;	  	  
-	  outstate[offset+5] = vz0;
+        // Each object of the group goes straight into its own store.
+        struct ephem_group group = {.n = n, .stores = malloc(n*sizeof(struct ephem_store))};
+        int success = group.stores != NULL;
+        if (success){
+            for (int k=0; k<n; k++){
+                ephem_store_init(&group.stores[k], 1);
+            }
+            success = ephem_sim_propagate(r, &dense, batch->tstart, batch->tstep, batch->trange, n, batch->instate + 6*first, 0, ephem_group_step, &group, NULL);
+            for (int k=0; k<n; k++){
+                if (success){
+                    success = ephem_store_finish(&group.stores[k], &batch->ts[first + k]);
+                }
+                ephem_store_free(&group.stores[k]);
+            }
+            free(group.stores);
+        }
 
-	}
+        if (!success){
+            pthread_mutex_lock(&batch->lock);
+            batch->n_failed++;
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+
+    ephem_dense_free(&dense);
+    ephem_sim_free(r);
+    return NULL;
+}
+
+int integration_function_batch(double tstart, double tstep, double trange,
+			       int geocentric,
+			       int n_particles,
+			       double* instate,
+			       int group_size,
+			       int n_threads,
+			       struct rebx_ephemeris* eph,
+			       timestate* ts){
+
+    if (n_particles <= 0){
+        return 1;
+    }
+
+    // Resolve the shared context here, so the workers never race to load it.
+    if (eph == NULL){
+        eph = ephem_default();
+        if (eph == NULL){
+            fprintf(stderr, "REBOUNDx Error: Could not load the default ephemeris files for integration_function_batch.\n");
+            return 0;
+        }
+    }
+    rebx_ephemeris_retain(eph);
+    rebx_ephemeris_warmup(eph, tstart, tstart + trange);
+
+    if (group_size < 1){
+        group_size = 1;
+    }
+    if (n_threads < 1){
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_threads < 1){
+            n_threads = 1;
+        }
+    }
+
+    memset(ts, 0, n_particles*sizeof(*ts));
+
+    struct ephem_batch batch = {
+        .tstart = tstart,
+        .tstep = tstep,
+        .trange = trange,
+        .geocentric = geocentric,
+        .n_particles = n_particles,
+        .group_size = group_size,
+        .n_groups = (n_particles + group_size - 1)/group_size,
+        .instate = instate,
+        .eph = eph,
+        .ts = ts,
+        .next_group = 0,
+        .n_failed = 0,
+    };
+    pthread_mutex_init(&batch.lock, NULL);
+
+    if (n_threads > batch.n_groups){
+        n_threads = batch.n_groups;
     }
 
-    free(x0);
-    free(v0);
-    free(a0);
+    // Without the handles, the calling thread runs every group on its own.
+    pthread_t* const threads = malloc(n_threads*sizeof(*threads));
+    if (threads == NULL){
+        n_threads = 1;
+    }
+    int n_started = 0;
+    for (int i=1; i<n_threads; i++){
+        if (pthread_create(&threads[n_started], NULL, ephem_batch_worker, &batch) == 0){
+            n_started++;
+        }
+    }
+    ephem_batch_worker(&batch);     // the calling thread works too
+    for (int i=0; i<n_started; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&batch.lock);
+    rebx_ephemeris_release(eph);
+
+    return batch.n_failed == 0;
+}
+
+// A simulation kept between propagations, with its IAS15 workspace, the
+// dense output scratch and the output rows, which only ever grow.
+struct rebx_ephem_propagator {
+    struct reb_simulation* r;
+    struct rebx_ephemeris* eph;     // retained
+    struct ephem_dense dense;
+    int n_out;
+    size_t t_alloc;                 // doubles
+    size_t state_alloc;
+    double* t;
+    double* state;
+};
+
+// Makes room for n doubles in *buf, which holds *n_alloc.
+static int ephem_reserve(double** const buf, size_t* const n_alloc, const size_t n){
+    if (n <= *n_alloc){
+        return 1;
+    }
+    const size_t n_new = (2*(*n_alloc) > n) ? 2*(*n_alloc) : n;
+    double* const b = realloc(*buf, n_new*sizeof(double));
+    if (b == NULL){
+        return 0;
+    }
+    *buf = b;
+    *n_alloc = n_new;
+    return 1;
+}
 
+struct rebx_ephem_propagator* rebx_ephem_propagator_create(int geocentric, struct rebx_ephemeris* eph){
+    if (eph == NULL){
+        eph = ephem_default();
+        if (eph == NULL){
+            return NULL;
+        }
+    }
+    struct rebx_ephem_propagator* const p = calloc(1, sizeof(*p));
+    if (p == NULL){
+        return NULL;
+    }
+    p->eph = rebx_ephemeris_retain(eph);
+    p->r = ephem_sim_create(geocentric, eph);
+    if (p->r == NULL){
+        rebx_ephemeris_release(p->eph);
+        free(p);
+        return NULL;
+    }
+    ephem_dense_init(&p->dense);
+    return p;
+}
+
+void rebx_ephem_propagator_free(struct rebx_ephem_propagator* const p){
+    if (p == NULL){
+        return;
+    }
+    ephem_sim_free(p->r);
+    ephem_dense_free(&p->dense);
+    rebx_ephemeris_release(p->eph);
+    free(p->t);
+    free(p->state);
+    free(p);
+}
+
+static int ephem_propagator_step(void* const data, const int n_samples, const int n_particles, const double* const t, const double* const state){
+    struct rebx_ephem_propagator* const p = data;
+    const size_t width = 6*(size_t)n_particles;
+    const size_t n_rows = (size_t)p->n_out + n_samples;
+    if (!ephem_reserve(&p->t, &p->t_alloc, n_rows) || !ephem_reserve(&p->state, &p->state_alloc, n_rows*width)){
+        return 0;
+    }
+    memcpy(&p->t[p->n_out], t, n_samples*sizeof(double));
+    memcpy(&p->state[p->n_out*width], state, n_samples*width*sizeof(double));
+    p->n_out += n_samples;
+    return 1;
+}
+
+int rebx_ephem_propagate(struct rebx_ephem_propagator* const p, const double tstart, const double tstep, const double trange, const int n_particles, const double* const instate, timestate* const ts){
+    p->n_out = 0;
+
+    const int success = ephem_sim_propagate(p->r, &p->dense, tstart, tstep, trange, n_particles, instate, 0, ephem_propagator_step, p, NULL);
+
+    ts->t = p->t;
+    ts->state = p->state;
+    ts->n_out = p->n_out;
+    ts->n_particles = n_particles;
+    return success;
 }
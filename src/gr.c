@@ -46,6 +46,7 @@
  * Field (C type)               Required    Description
  * ============================ =========== ==================================================================
  * c (double)                   Yes         Speed of light in the units used for the simulation.
+ * newtonian_from_sim (int)     No          If set to 1, use the accelerations REBOUND already computed as the Newtonian ones rather than recomputing the O(N^2) sum.  Only valid if gr is the first force applied and REBOUND's gravity includes all pairs of particles.
  * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
@@ -69,137 +70,338 @@
 #include "rebound.h"
 #include "reboundx.h"
 #include "rebxtools.h"
+#include "core.h"
 
-static void rebx_calculate_gr(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations){
-    
-    struct reb_particle* const ps = malloc(N*sizeof(*ps));
-    struct reb_particle* const ps_j = malloc(N*sizeof(*ps_j));
-    memcpy(ps, particles, N*sizeof(*ps));
-    
-    // Calculate Newtonian accelerations 
-    for(int i=0; i<N; i++){
-        ps[i].ax = 0.;
-        ps[i].ay = 0.;
-        ps[i].az = 0.;
+// The fields of a particle that rebx_calculate_gr reads, so the scratch copy stays small.
+struct rebx_gr_body {
+    double x, y, z;
+    double vx, vy, vz;
+    double ax, ay, az;
+    double m;
+};
+
+// Kept on the force between calls and grown as needed.
+struct rebx_gr_workspace {
+    int N_alloc;
+    struct rebx_gr_body* ps;
+};
+
+void rebx_gr_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_gr_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_gr_workspace));
+    if (ws){
+        free(ws->ps);
+        free(ws);
     }
+}
 
-    for(int i=0; i<N; i++){
-        const struct reb_particle pi = ps[i];
-        for(int j=i+1; j<N; j++){
-            const struct reb_particle pj = ps[j];
-            const double dx = pi.x - pj.x;
-            const double dy = pi.y - pj.y;
-            const double dz = pi.z - pj.z;
-            const double r2 = dx*dx + dy*dy + dz*dz;
-            const double r = sqrt(r2);
-            const double prefac = G/(r2*r);
-            ps[i].ax -= prefac*pj.m*dx;
-            ps[i].ay -= prefac*pj.m*dy;
-            ps[i].az -= prefac*pj.m*dz;
-            ps[j].ax += prefac*pi.m*dx;
-            ps[j].ay += prefac*pi.m*dy;
-            ps[j].az += prefac*pi.m*dz;
+static struct rebx_gr_workspace* rebx_gr_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force, const int N){
+    struct rebx_gr_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_gr_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
         }
+        rebx_set_param_pointer(rebx, &force->ap, "gr_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_gr_free_arrays);
     }
-   
-    // Transform to Jacobi coordinates
-    const struct reb_particle source = ps[0];
-	const double mu = G*source.m;
-    reb_transformations_inertial_to_jacobi_posvelacc(ps, ps_j, ps, N);
-    
+    if (N > ws->N_alloc){
+        struct rebx_gr_body* const ps = malloc(N*sizeof(*ps));
+        if (ps == NULL){
+            return NULL;
+        }
+        free(ws->ps);
+        ws->ps = ps;
+        ws->N_alloc = N;
+    }
+    return ws;
+}
+
+// Same as reb_transformations_inertial_to_jacobi_posvelacc, in place.  Only the Jacobi coordinates of bodies 1 to N-1 are computed.
+static void rebx_gr_inertial_to_jacobi(struct rebx_gr_body* const ps, const int N){
+    double eta = ps[0].m;
+    double sx = eta*ps[0].x, sy = eta*ps[0].y, sz = eta*ps[0].z;
+    double svx = eta*ps[0].vx, svy = eta*ps[0].vy, svz = eta*ps[0].vz;
+    double sax = eta*ps[0].ax, say = eta*ps[0].ay, saz = eta*ps[0].az;
     for (int i=1; i<N; i++){
-        struct reb_particle p = ps_j[i];
-        struct reb_vec3d vi;
-        vi.x = p.vx;
-        vi.y = p.vy;
-        vi.z = p.vz;
-        double vi2=vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
-        const double ri = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
-        int q = 0;
-        double A = (0.5*vi2 + 3.*mu/ri)/C2;
-        struct reb_vec3d old_v;
-        for(q=0; q<max_iterations; q++){
-            old_v.x = vi.x;
-            old_v.y = vi.y;
-            old_v.z = vi.z;
-            vi.x = p.vx/(1.-A);
-            vi.y = p.vy/(1.-A);
-            vi.z = p.vz/(1.-A);
-            vi2 =vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
-            A = (0.5*vi2 + 3.*mu/ri)/C2;
-            const double dvx = vi.x - old_v.x;
-            const double dvy = vi.y - old_v.y;
-            const double dvz = vi.z - old_v.z;
-            if ((dvx*dvx + dvy*dvy + dvz*dvz)/vi2 < DBL_EPSILON*DBL_EPSILON){
-                break;
+        struct rebx_gr_body* const p = &ps[i];
+        const double ei = 1./eta;
+        eta += p->m;
+        const double pme = eta*ei;
+        p->x -= sx*ei;
+        p->y -= sy*ei;
+        p->z -= sz*ei;
+        p->vx -= svx*ei;
+        p->vy -= svy*ei;
+        p->vz -= svz*ei;
+        p->ax -= sax*ei;
+        p->ay -= say*ei;
+        p->az -= saz*ei;
+        sx = sx*pme + p->m*p->x;
+        sy = sy*pme + p->m*p->y;
+        sz = sz*pme + p->m*p->z;
+        svx = svx*pme + p->m*p->vx;
+        svy = svy*pme + p->m*p->vy;
+        svz = svz*pme + p->m*p->vz;
+        sax = sax*pme + p->m*p->ax;
+        say = say*pme + p->m*p->ay;
+        saz = saz*pme + p->m*p->az;
+    }
+}
+
+// Same as reb_transformations_jacobi_to_inertial_acc, in place
+static void rebx_gr_jacobi_to_inertial_acc(struct rebx_gr_body* const ps, const int N){
+    double eta = ps[0].m;
+    for (int i=1; i<N; i++){
+        eta += ps[i].m;
+    }
+    double sax = eta*ps[0].ax, say = eta*ps[0].ay, saz = eta*ps[0].az;
+    for (int i=N-1; i>0; i--){
+        struct rebx_gr_body* const p = &ps[i];
+        const double ei = 1./eta;
+        sax = (sax - p->m*p->ax)*ei;
+        say = (say - p->m*p->ay)*ei;
+        saz = (saz - p->m*p->az)*ei;
+        p->ax += sax;
+        p->ay += say;
+        p->az += saz;
+        eta -= p->m;
+        sax *= eta;
+        say *= eta;
+        saz *= eta;
+    }
+    ps[0].ax = sax/eta;
+    ps[0].ay = say/eta;
+    ps[0].az = saz/eta;
+}
+
+// Index into particles of body k.  The source comes first, the others keep their order.
+static inline int rebx_gr_index(const int k, const int source_index){
+    return k == 0 ? source_index : (k <= source_index ? k - 1 : k);
+}
+
+// The first particle with gr_source set, or else particle 0
+static int rebx_gr_source_index(struct rebx_extras* const rebx, const struct reb_particle* const particles, const int N){
+    const rebx_param_handle source_h = rebx_default_param(rebx, REBX_PARAM_gr_source);
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_h(particles[i].ap, source_h) != NULL){
+            return i;
+        }
+    }
+    return 0;
+}
+
+int rebx_gr_solve_lanes(struct rebx_gr_lanes* const b, const double C2, const int max_iterations, uint64_t* const iterations){
+    // Lanes past n get a velocity that converges at once, and are never active.
+    for (int l=b->n; l<REBX_GR_LANES; l++){
+        b->vx[l] = 1.;
+        b->vy[l] = 0.;
+        b->vz[l] = 0.;
+        b->phi[l] = 0.;
+    }
+    int active[REBX_GR_LANES];
+    for (int l=0; l<REBX_GR_LANES; l++){
+        active[l] = l < b->n;
+        b->vix[l] = b->vx[l];
+        b->viy[l] = b->vy[l];
+        b->viz[l] = b->vz[l];
+        const double vi2 = b->vix[l]*b->vix[l] + b->viy[l]*b->viy[l] + b->viz[l]*b->viz[l];
+        b->A[l] = (0.5*vi2 + b->phi[l])/C2;
+    }
+
+    // Each pass updates every lane with no branches, then keeps the new
+    // values of the lanes still active, so converged lanes stay as they were.
+    int n_active = b->n;
+    uint64_t n_iterations = 0;
+    for (int q=0; q<max_iterations && n_active > 0; q++){
+        double vix[REBX_GR_LANES], viy[REBX_GR_LANES], viz[REBX_GR_LANES];
+        double A[REBX_GR_LANES], dv2[REBX_GR_LANES];
+        for (int l=0; l<REBX_GR_LANES; l++){
+            vix[l] = b->vx[l]/(1.-b->A[l]);
+            viy[l] = b->vy[l]/(1.-b->A[l]);
+            viz[l] = b->vz[l]/(1.-b->A[l]);
+            const double vi2 = vix[l]*vix[l] + viy[l]*viy[l] + viz[l]*viz[l];
+            A[l] = (0.5*vi2 + b->phi[l])/C2;
+            const double dvx = vix[l] - b->vix[l];
+            const double dvy = viy[l] - b->viy[l];
+            const double dvz = viz[l] - b->viz[l];
+            dv2[l] = (dvx*dvx + dvy*dvy + dvz*dvz)/vi2;
+        }
+
+        n_iterations += n_active;
+        n_active = 0;
+        for (int l=0; l<REBX_GR_LANES; l++){
+            if (active[l]){
+                b->vix[l] = vix[l];
+                b->viy[l] = viy[l];
+                b->viz[l] = viz[l];
+                b->A[l] = A[l];
+                active[l] = !(dv2[l] < DBL_EPSILON*DBL_EPSILON);
+                n_active += active[l];
             }
         }
-        const int default_max_iterations = 10;
-        if(q==default_max_iterations){
-            reb_warning(sim, "REBOUNDx Warning: 10 iterations in gr.c failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+    }
+
+    if (iterations != NULL){
+        *iterations += n_iterations;
+    }
+    return n_active;
+}
+
+// Returns the iterations for the velocities, summed over the particles
+static uint64_t rebx_calculate_gr(struct reb_simulation* const sim, struct rebx_gr_workspace* const ws, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations, const int source_index, const int newtonian_from_sim){
+    uint64_t iterations = 0;
+
+    struct rebx_gr_body* const ps = ws->ps;
+    for (int k=0; k<N; k++){
+        const struct reb_particle* const p = &particles[rebx_gr_index(k, source_index)];
+        ps[k].x = p->x;
+        ps[k].y = p->y;
+        ps[k].z = p->z;
+        ps[k].vx = p->vx;
+        ps[k].vy = p->vy;
+        ps[k].vz = p->vz;
+        ps[k].m = p->m;
+        if (newtonian_from_sim){    // already computed by REBOUND
+            ps[k].ax = p->ax;
+            ps[k].ay = p->ay;
+            ps[k].az = p->az;
+        }
+        else{
+            ps[k].ax = 0.;
+            ps[k].ay = 0.;
+            ps[k].az = 0.;
         }
-  
-        const double B = (mu/ri - 1.5*vi2)*mu/(ri*ri*ri)/C2;
-        const double rdotrdot = p.x*p.vx + p.y*p.vy + p.z*p.vz;
-        
-        struct reb_vec3d vidot;
-        vidot.x = p.ax + B*p.x;
-        vidot.y = p.ay + B*p.y;
-        vidot.z = p.az + B*p.z;
-        
-        const double vdotvdot = vi.x*vidot.x + vi.y*vidot.y + vi.z*vidot.z;
-        const double D = (vdotvdot - 3.*mu/(ri*ri*ri)*rdotrdot)/C2;
-        
-        ps_j[i].ax = B*(1.-A)*p.x - A*p.ax - D*vi.x;
-        ps_j[i].ay = B*(1.-A)*p.y - A*p.ay - D*vi.y;
-        ps_j[i].az = B*(1.-A)*p.z - A*p.az - D*vi.z;
     }
     
-    ps_j[0].ax = 0.;
-    ps_j[0].ay = 0.;
-    ps_j[0].az = 0.;
+    // Calculate Newtonian accelerations 
+    if (!newtonian_from_sim){
+        for(int i=0; i<N; i++){
+            const struct rebx_gr_body pi = ps[i];
+            for(int j=i+1; j<N; j++){
+                const struct rebx_gr_body pj = ps[j];
+                const double dx = pi.x - pj.x;
+                const double dy = pi.y - pj.y;
+                const double dz = pi.z - pj.z;
+                const double r2 = dx*dx + dy*dy + dz*dz;
+                const double r = sqrt(r2);
+                const double prefac = G/(r2*r);
+                ps[i].ax -= prefac*pj.m*dx;
+                ps[i].ay -= prefac*pj.m*dy;
+                ps[i].az -= prefac*pj.m*dz;
+                ps[j].ax += prefac*pi.m*dx;
+                ps[j].ay += prefac*pi.m*dy;
+                ps[j].az += prefac*pi.m*dz;
+            }
+        }
+    }
+   
+    // Transform to Jacobi coordinates
+	const double mu = G*ps[0].m;
+    rebx_gr_inertial_to_jacobi(ps, N);
+    
+    int n_unconverged = 0;
+    struct rebx_gr_lanes b;
+    for (int i0=1; i0<N; i0+=REBX_GR_LANES){
+        b.n = (N - i0 < REBX_GR_LANES) ? N - i0 : REBX_GR_LANES;
+        double ri[REBX_GR_LANES];
+        for (int l=0; l<b.n; l++){
+            const struct rebx_gr_body* const p = &ps[i0+l];
+            b.vx[l] = p->vx;
+            b.vy[l] = p->vy;
+            b.vz[l] = p->vz;
+            ri[l] = sqrt(p->x*p->x + p->y*p->y + p->z*p->z);
+            b.phi[l] = 3.*mu/ri[l];
+        }
+        n_unconverged += rebx_gr_solve_lanes(&b, C2, max_iterations, &iterations);
 
-    reb_transformations_jacobi_to_inertial_acc(ps, ps_j, ps, N);
-    for (int i=0; i<N; i++){
-        particles[i].ax += ps[i].ax;
-        particles[i].ay += ps[i].ay;
-        particles[i].az += ps[i].az;
+        for (int l=0; l<b.n; l++){
+            const struct rebx_gr_body p = ps[i0+l];
+            const double A = b.A[l];
+            const struct reb_vec3d vi = {.x = b.vix[l], .y = b.viy[l], .z = b.viz[l]};
+            const double vi2 = vi.x*vi.x + vi.y*vi.y + vi.z*vi.z;
+
+            const double B = (mu/ri[l] - 1.5*vi2)*mu/(ri[l]*ri[l]*ri[l])/C2;
+            const double rdotrdot = p.x*p.vx + p.y*p.vy + p.z*p.vz;
+
+            struct reb_vec3d vidot;
+            vidot.x = p.ax + B*p.x;
+            vidot.y = p.ay + B*p.y;
+            vidot.z = p.az + B*p.z;
+
+            const double vdotvdot = vi.x*vidot.x + vi.y*vidot.y + vi.z*vidot.z;
+            const double D = (vdotvdot - 3.*mu/(ri[l]*ri[l]*ri[l])*rdotrdot)/C2;
+
+            ps[i0+l].ax = B*(1.-A)*p.x - A*p.ax - D*vi.x;
+            ps[i0+l].ay = B*(1.-A)*p.y - A*p.ay - D*vi.y;
+            ps[i0+l].az = B*(1.-A)*p.z - A*p.az - D*vi.z;
+        }
+    }
+    if (n_unconverged > 0 && max_iterations > 0){
+        char warning[256];
+        snprintf(warning, sizeof(warning), "REBOUNDx Warning: %d iterations in gr.c failed to converge for %d particles. This is typically because the perturbation is too strong for the current implementation.", max_iterations, n_unconverged);
+        reb_warning(sim, warning);
     }
     
-    free(ps);
-    free(ps_j);
+    ps[0].ax = 0.;
+    ps[0].ay = 0.;
+    ps[0].az = 0.;
+
+    rebx_gr_jacobi_to_inertial_acc(ps, N);
+    for (int k=0; k<N; k++){
+        struct reb_particle* const p = &particles[rebx_gr_index(k, source_index)];
+        p->ax += ps[k].ax;
+        p->ay += ps[k].ay;
+        p->az += ps[k].az;
+    }
+    return iterations;
 }
 
 void rebx_gr(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
-    double* c = rebx_get_param(sim->extras, force->ap, "c");
+    struct rebx_extras* const rebx = sim->extras;
+    double* c = rebx_get_param_double_h(force->ap, rebx_default_param(rebx, REBX_PARAM_c));
     if (c == NULL){
         reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
         return;
     }
+    struct rebx_gr_workspace* const ws = rebx_gr_workspace_get(rebx, force, N);
+    if (ws == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for gr.\n");
+        return;
+    }
     const double C2 = (*c)*(*c);
-    int* max_iterations = rebx_get_param(sim->extras, force->ap, "max_iterations");
+    
+    const int source_index = rebx_gr_source_index(rebx, particles, N);
+    
+    // REBOUND's accelerations are only the Newtonian ones when the force is called on the simulation's particles
+    const int* const from_sim = rebx_get_param_int_h(force->ap, rebx_default_param(rebx, REBX_PARAM_newtonian_from_sim));
+    const int newtonian_from_sim = from_sim != NULL && *from_sim && particles == sim->particles;
+    
+    int* max_iterations = rebx_get_param_int_h(force->ap, rebx_default_param(rebx, REBX_PARAM_max_iterations));
+    uint64_t iterations;
     if(max_iterations != NULL){
-        rebx_calculate_gr(sim, particles, N, C2, sim->G, *max_iterations);
+        iterations = rebx_calculate_gr(sim, ws, particles, N, C2, sim->G, *max_iterations, source_index, newtonian_from_sim);
     }
     else{
         const int default_max_iterations = 10;
-        rebx_calculate_gr(sim, particles, N, C2, sim->G, default_max_iterations);
+        iterations = rebx_calculate_gr(sim, ws, particles, N, C2, sim->G, default_max_iterations, source_index, newtonian_from_sim);
+    }
+    if (rebx->stats_enabled){
+        force->stats.iterations += iterations;
     }
 }
 
-static double rebx_calculate_gr_hamiltonian(struct rebx_extras* const rebx, struct reb_simulation* const sim, const double C2){
+static double rebx_calculate_gr_hamiltonian(struct reb_simulation* const sim, struct rebx_gr_workspace* const ws, const double C2, const int source_index){
     const int N = sim->N - sim->N_var;
     const double G = sim->G;
 
-    struct reb_particle* const ps_j = malloc(N*sizeof(*ps_j));
-    struct reb_particle* const ps = sim->particles; 
+    struct reb_particle* const particles = sim->particles; 
     // Calculate Newtonian potentials
 
     double V_newt = 0.;
     for(int i=0; i<N; i++){
-        const struct reb_particle pi = ps[i];
+        const struct reb_particle pi = particles[i];
         for(int j=i+1; j<N; j++){
-            const struct reb_particle pj = ps[j];
+            const struct reb_particle pj = particles[j];
             const double dx = pi.x - pj.x;
             const double dy = pi.y - pj.y;
             const double dz = pi.z - pj.z;
@@ -209,17 +411,28 @@ static double rebx_calculate_gr_hamiltonian(struct rebx_extras* const rebx, stru
         }
     }
    
-    // Transform to Jacobi coordinates
-    const struct reb_particle source = ps[0];
-	const double mu = G*source.m;
-    double* const m_j = malloc(N*sizeof(*m_j));
-    rebx_calculate_jacobi_masses(ps, m_j, N);
-    reb_transformations_inertial_to_jacobi_posvel(ps, ps_j, ps, N);
+    // Transform to Jacobi coordinates, in the order rebx_calculate_gr uses
+    struct rebx_gr_body* const ps = ws->ps;
+    double M = 0.;
+    double vcx = 0., vcy = 0., vcz = 0.;
+    for (int k=0; k<N; k++){
+        const struct reb_particle* const p = &particles[rebx_gr_index(k, source_index)];
+        ps[k] = (struct rebx_gr_body){.x = p->x, .y = p->y, .z = p->z, .vx = p->vx, .vy = p->vy, .vz = p->vz, .m = p->m};
+        M += p->m;
+        vcx += p->m*p->vx;
+        vcy += p->m*p->vy;
+        vcz += p->m*p->vz;
+    }
+	const double mu = G*ps[0].m;
+    rebx_gr_inertial_to_jacobi(ps, N);
 
-    double T = 0.5*m_j[0]*(ps_j[0].vx*ps_j[0].vx + ps_j[0].vy*ps_j[0].vy + ps_j[0].vz*ps_j[0].vz);
+    double T = 0.5*(vcx*vcx + vcy*vcy + vcz*vcz)/M;
     double V_PN = 0.;
+    double eta = ps[0].m;
     for (int i=1; i<N; i++){
-        struct reb_particle p = ps_j[i];
+        const struct rebx_gr_body p = ps[i];
+        const double m_j = p.m*eta/(eta + p.m);  // as rebx_calculate_jacobi_masses
+        eta += p.m;
         const double rdoti2 = p.vx*p.vx + p.vy*p.vy + p.vz*p.vz;
         double vtildei2 = rdoti2;
         double A, old_vtildei2;
@@ -234,19 +447,16 @@ static double rebx_calculate_gr_hamiltonian(struct rebx_extras* const rebx, stru
             }
         }
 
-        V_PN += m_j[i]*(0.5*mu*mu/(ri*ri) - 0.125*vtildei2*vtildei2 - 1.5*mu*vtildei2/ri);
-        T += 0.5*m_j[i]*vtildei2;
+        V_PN += m_j*(0.5*mu*mu/(ri*ri) - 0.125*vtildei2*vtildei2 - 1.5*mu*vtildei2/ri);
+        T += 0.5*m_j*vtildei2;
     }
     V_PN /= C2;
     
-    free(ps_j);
-    free(m_j);
-    
 	return T + V_newt + V_PN;
 }
 
 double rebx_gr_hamiltonian(struct rebx_extras* const rebx, const struct rebx_force* const gr){
-    double* c = rebx_get_param(rebx, gr->ap, "c");
+    double* c = rebx_get_param_double_h(gr->ap, rebx_default_param(rebx, REBX_PARAM_c));
     if (c == NULL){
         rebx_error(rebx, "Need to set speed of light in gr effect.  See examples in documentation.\n");
         return 0;
@@ -256,6 +466,13 @@ double rebx_gr_hamiltonian(struct rebx_extras* const rebx, const struct rebx_for
         rebx_error(rebx, ""); // rebx_error gives meaningful err
         return 0;
     }
-    return rebx_calculate_gr_hamiltonian(rebx, rebx->sim, C2);
+    struct reb_simulation* const sim = rebx->sim;
+    const int N = sim->N - sim->N_var;
+    struct rebx_gr_workspace* const ws = rebx_gr_workspace_get(rebx, (struct rebx_force*)gr, N);   // scratch, not state of the force
+    if (ws == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for gr.\n");
+        return 0;
+    }
+    return rebx_calculate_gr_hamiltonian(sim, ws, C2, rebx_gr_source_index(rebx, sim->particles, N));
 }
 
@@ -57,150 +57,282 @@
 #include <string.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
 
-static void rebx_calculate_gr_full(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations, const int gravity_ignore_10){
-    
-    double a_const[N][3]; // array that stores the value of the constant term
-    double a_newton[N][3]; // stores the Newtonian term
-    double a_new[N][3]; // stores the newly calculated term
-    double rs[N][N];
-    double drs[N][N][3];
+// Scratch for rebx_calculate_gr_full, kept on the force between calls and grown as needed.
+struct rebx_gr_full_workspace {
+    int N_alloc;
+    double* buf;
+    double* x;              // positions, velocities and G*m of the bodies as arrays
+    double* y;
+    double* z;
+    double* vx;
+    double* vy;
+    double* vz;
+    double* Gm;
+    double* v2;             // speed squared
+    double* phi;            // sum over k != i of G*m_k/r_ik
+    double (*a_const)[3];   // stores the value of the constant term
+    double (*a_newton)[3];  // stores the Newtonian term
+    double (*a_new)[3];     // stores the newly calculated term
+    double (*a_old)[3];     // stores the term from the previous substitution
+    double (*a_sum)[3];     // a_newton + a_old
+};
 
-    for (int i=0; i<N; i++){
-        // compute the Newtonian term 
-        a_newton[i][0] = particles[i].ax;
-        a_newton[i][1] = particles[i].ay;
-        a_newton[i][2] = particles[i].az;
-        a_new[i][0] = 0.;
-        a_new[i][1] = 0.;
-        a_new[i][2] = 0.;
+// Pairs are visited in BLOCK x BLOCK tiles of the upper triangle, so the
+// bodies of both tiles stay in cache while each pair is computed once and
+// added to both bodies.
+#define REBX_GR_FULL_BLOCK 64
 
-        for(int j=i+1; j<N; j++){
-            if (j!=i){
-                drs[i][j][0] = particles[i].x - particles[j].x;
-                drs[i][j][1] = particles[i].y - particles[j].y;
-                drs[i][j][2] = particles[i].z - particles[j].z;
-                drs[j][i][0] = -drs[i][j][0];
-                drs[j][i][1] = -drs[i][j][1];
-                drs[j][i][2] = -drs[i][j][2];
-                rs[i][j] = sqrt(drs[i][j][0]*drs[i][j][0] + drs[i][j][1]*drs[i][j][1] + drs[i][j][2]*drs[i][j][2]);
-                rs[j][i] = rs[i][j];
-            }
-        }
+void rebx_gr_full_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_gr_full_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_gr_full_workspace));
+    if (ws){
+        free(ws->buf);
+        free(ws);
     }
+}
 
-    if (gravity_ignore_10){
-        const double prefact = -G/(rs[0][1]*rs[0][1]*rs[0][1]);
-        const double prefact0 = prefact*particles[0].m;
-        const double prefact1 = prefact*particles[1].m;
-        a_newton[0][0] += prefact1*drs[0][1][0];
-        a_newton[0][1] += prefact1*drs[0][1][1];
-        a_newton[0][2] += prefact1*drs[0][1][2];
-        a_newton[1][0] -= prefact0*drs[0][1][0];
-        a_newton[1][1] -= prefact0*drs[0][1][1];
-        a_newton[1][2] -= prefact0*drs[0][1][2];
+static struct rebx_gr_full_workspace* rebx_gr_full_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force, const int N){
+    struct rebx_gr_full_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_gr_full_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        rebx_set_param_pointer(rebx, &force->ap, "gr_full_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_gr_full_free_arrays);
+    }
+    if (N > ws->N_alloc){
+        double* const buf = malloc((size_t)N*24*sizeof(double));
+        if (buf == NULL){
+            return NULL;
+        }
+        free(ws->buf);
+        ws->buf = buf;
+        ws->x = buf;
+        ws->y = buf + N;
+        ws->z = buf + 2*N;
+        ws->vx = buf + 3*N;
+        ws->vy = buf + 4*N;
+        ws->vz = buf + 5*N;
+        ws->Gm = buf + 6*N;
+        ws->v2 = buf + 7*N;
+        ws->phi = buf + 8*N;
+        ws->a_const = (double (*)[3])(buf + 9*N);
+        ws->a_newton = (double (*)[3])(buf + 12*N);
+        ws->a_new = (double (*)[3])(buf + 15*N);
+        ws->a_old = (double (*)[3])(buf + 18*N);
+        ws->a_sum = (double (*)[3])(buf + 21*N);
+        ws->N_alloc = N;
     }
+    return ws;
+}
 
+// phi_i = sum over k != i of G*m_k/r_ik, for all i in O(N^2)
+static void rebx_gr_full_potentials(struct rebx_gr_full_workspace* const ws, const int N){
+    const double* const x = ws->x;
+    const double* const y = ws->y;
+    const double* const z = ws->z;
+    const double* const Gm = ws->Gm;
+    double* const phi = ws->phi;
     for (int i=0; i<N; i++){
-        // then compute the constant terms:
-        double a_constx = 0.;
-        double a_consty = 0.;
-        double a_constz = 0.;
-        // 1st constant part
-        for (int j = 0; j< N; j++){
-            if (j != i){
-                const double dxij = drs[i][j][0];
-                const double dyij = drs[i][j][1];
-                const double dzij = drs[i][j][2];
-                const double rij2 = rs[i][j]*rs[i][j];
-                const double rij3 = rij2*rs[i][j];
-                
-                double a1 = 0.;
-                for (int k = 0; k< N; k++){
-                    if (k != i){
-                        a1 += (4./(C2)) * G*particles[k].m/rs[i][k];
-                    }
-                }
-
-                double a2 = 0.;
-                for (int l = 0; l< N; l++){
-                    if (l != j){
-                        a2 += (1./(C2)) * G*particles[l].m/rs[l][j];
-                    }
+        phi[i] = 0.;
+    }
+    for (int ib=0; ib<N; ib+=REBX_GR_FULL_BLOCK){
+        const int ie = ib + REBX_GR_FULL_BLOCK < N ? ib + REBX_GR_FULL_BLOCK : N;
+        for (int jb=ib; jb<N; jb+=REBX_GR_FULL_BLOCK){
+            const int je = jb + REBX_GR_FULL_BLOCK < N ? jb + REBX_GR_FULL_BLOCK : N;
+            for (int i=ib; i<ie; i++){
+                double phii = 0.;
+                for (int j=(jb > i ? jb : i+1); j<je; j++){
+                    const double dx = x[i] - x[j];
+                    const double dy = y[i] - y[j];
+                    const double dz = z[i] - z[j];
+                    const double rinv = 1./sqrt(dx*dx + dy*dy + dz*dz);
+                    phii += Gm[j]*rinv;
+                    phi[j] += Gm[i]*rinv;
                 }
+                phi[i] += phii;
+            }
+        }
+    }
+}
 
-                double a3;
-                double vi2 = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
-                a3 = -vi2/(C2);
+// a_const, the terms that do not depend on the accelerations.  Both pairs (i,j) and (j,i) are added with the same separation.
+static void rebx_gr_full_constant_terms(struct rebx_gr_full_workspace* const ws, const int N, const double C2){
+    const double* const x = ws->x;
+    const double* const y = ws->y;
+    const double* const z = ws->z;
+    const double* const vx = ws->vx;
+    const double* const vy = ws->vy;
+    const double* const vz = ws->vz;
+    const double* const Gm = ws->Gm;
+    const double* const v2 = ws->v2;
+    const double* const phi = ws->phi;
+    double (*const a_const)[3] = ws->a_const;
+    for (int i=0; i<N; i++){
+        a_const[i][0] = 0.;
+        a_const[i][1] = 0.;
+        a_const[i][2] = 0.;
+    }
+    for (int ib=0; ib<N; ib+=REBX_GR_FULL_BLOCK){
+        const int ie = ib + REBX_GR_FULL_BLOCK < N ? ib + REBX_GR_FULL_BLOCK : N;
+        for (int jb=ib; jb<N; jb+=REBX_GR_FULL_BLOCK){
+            const int je = jb + REBX_GR_FULL_BLOCK < N ? jb + REBX_GR_FULL_BLOCK : N;
+            for (int i=ib; i<ie; i++){
+                double a_constx = 0.;
+                double a_consty = 0.;
+                double a_constz = 0.;
+                for (int j=(jb > i ? jb : i+1); j<je; j++){
+                    const double dxij = x[i] - x[j];
+                    const double dyij = y[i] - y[j];
+                    const double dzij = z[i] - z[j];
+                    const double rij2 = dxij*dxij + dyij*dyij + dzij*dzij;
+                    const double rij = sqrt(rij2);
+                    const double rij3 = rij2*rij;
 
-                double a4;
-                double vj2 = particles[j].vx*particles[j].vx + particles[j].vy*particles[j].vy + particles[j].vz*particles[j].vz;
-                a4 = -2.*vj2/(C2);
+                    const double vidotvj = vx[i]*vx[j] + vy[i]*vy[j] + vz[i]*vz[j];
+                    const double rijdotvi = dxij*vx[i] + dyij*vy[i] + dzij*vz[i];
+                    const double rijdotvj = dxij*vx[j] + dyij*vy[j] + dzij*vz[j];
+                    const double dvxij = vx[i] - vx[j];
+                    const double dvyij = vy[i] - vy[j];
+                    const double dvzij = vz[i] - vz[j];
 
-                double a5;
-                a5 = (4./(C2)) * (particles[i].vx*particles[j].vx + particles[i].vy*particles[j].vy + particles[i].vz*particles[j].vz); 
-                
-                double a6;
-                double a6_0 = dxij*particles[j].vx + dyij*particles[j].vy + dzij*particles[j].vz;
-                a6 = (3./(2.*C2)) * a6_0*a6_0/rij2;
-                
-                double factor1 = a1 + a2 + a3 + a4 + a5 + a6;
-                 
-                a_constx += G*particles[j].m*dxij*factor1/rij3;
-                a_consty += G*particles[j].m*dyij*factor1/rij3;
-                a_constz += G*particles[j].m*dzij*factor1/rij3;
-        
-                // 2nd constant part
-                
-                const double dvxij = particles[i].vx - particles[j].vx;
-                const double dvyij = particles[i].vy - particles[j].vy;
-                const double dvzij = particles[i].vz - particles[j].vz;
-                    
-                double factor2 = dxij*(4.*particles[i].vx-3.*particles[j].vx)+dyij*(4.*particles[i].vy-3.*particles[j].vy)+dzij*(4.*particles[i].vz-3.*particles[j].vz);
+                    // on i from j.  1st constant part: a1 = 4 phi_i/c^2, a2 = phi_j/c^2, a3 = -v_i^2/c^2, a4 = -2 v_j^2/c^2, a5, a6
+                    const double factor1ij = (4.*phi[i] + phi[j] - v2[i] - 2.*v2[j] + 4.*vidotvj + 1.5*rijdotvj*rijdotvj/rij2)/C2;
+                    // 2nd constant part
+                    const double factor2ij = (4.*rijdotvi - 3.*rijdotvj)/C2;
+                    const double pj = Gm[j]/rij3;
+                    a_constx += pj*(dxij*factor1ij + factor2ij*dvxij);
+                    a_consty += pj*(dyij*factor1ij + factor2ij*dvyij);
+                    a_constz += pj*(dzij*factor1ij + factor2ij*dvzij);
 
-                a_constx += G*particles[j].m*factor2*dvxij/rij3/(C2);
-                a_consty += G*particles[j].m*factor2*dvyij/rij3/(C2);
-                a_constz += G*particles[j].m*factor2*dvzij/rij3/(C2);
+                    // on j from i, with r_ji = -r_ij and v_j - v_i = -dv_ij.  factor2ji has the sign of both flips
+                    const double factor1ji = (4.*phi[j] + phi[i] - v2[j] - 2.*v2[i] + 4.*vidotvj + 1.5*rijdotvi*rijdotvi/rij2)/C2;
+                    const double factor2ji = (4.*rijdotvj - 3.*rijdotvi)/C2;
+                    const double pi = Gm[i]/rij3;
+                    a_const[j][0] += pi*(factor2ji*dvxij - dxij*factor1ji);
+                    a_const[j][1] += pi*(factor2ji*dvyij - dyij*factor1ji);
+                    a_const[j][2] += pi*(factor2ji*dvzij - dzij*factor1ji);
+                }
+                a_const[i][0] += a_constx;
+                a_const[i][1] += a_consty;
+                a_const[i][2] += a_constz;
             }
-        }  
+        }
+    }
+}
 
-        a_const[i][0] = a_constx;
-        a_const[i][1] = a_consty;
-        a_const[i][2] = a_constz;
+// a_new = a_const + the terms in the accelerations a_sum = a_newton + a_old of the other bodies
+static void rebx_gr_full_substitute(struct rebx_gr_full_workspace* const ws, const int N, const double C2){
+    const double* const x = ws->x;
+    const double* const y = ws->y;
+    const double* const z = ws->z;
+    const double* const Gm = ws->Gm;
+    double (*const a_sum)[3] = ws->a_sum;
+    double (*const a_new)[3] = ws->a_new;
+    for (int i=0; i<N; i++){
+        a_sum[i][0] = ws->a_newton[i][0] + ws->a_old[i][0];
+        a_sum[i][1] = ws->a_newton[i][1] + ws->a_old[i][1];
+        a_sum[i][2] = ws->a_newton[i][2] + ws->a_old[i][2];
+        a_new[i][0] = ws->a_const[i][0];
+        a_new[i][1] = ws->a_const[i][1];
+        a_new[i][2] = ws->a_const[i][2];
     }
+    const double c1 = 1./(2.*C2);
+    const double c7 = 7./(2.*C2);
+    for (int ib=0; ib<N; ib+=REBX_GR_FULL_BLOCK){
+        const int ie = ib + REBX_GR_FULL_BLOCK < N ? ib + REBX_GR_FULL_BLOCK : N;
+        for (int jb=ib; jb<N; jb+=REBX_GR_FULL_BLOCK){
+            const int je = jb + REBX_GR_FULL_BLOCK < N ? jb + REBX_GR_FULL_BLOCK : N;
+            for (int i=ib; i<ie; i++){
+                double non_constx = 0.;
+                double non_consty = 0.;
+                double non_constz = 0.;
+                for (int j=(jb > i ? jb : i+1); j<je; j++){
+                    const double dxij = x[i] - x[j];
+                    const double dyij = y[i] - y[j];
+                    const double dzij = z[i] - z[j];
+                    const double rij2 = dxij*dxij + dyij*dyij + dzij*dzij;
+                    const double rinv = 1./sqrt(rij2);
+                    const double rinv3 = rinv*rinv*rinv;
 
-    // Now running the substitution again and again through the loop below
-    for (int k=0; k<10; k++){ // you can set k as how many substitution you want to make
-        double a_old[N][3]; // initialize an arry that stores the information of previousu calculated accleration
-        for (int i =0; i <N; i++){
-            a_old[i][0] = a_new[i][0]; // when k = 0, a_new is the Newtownian term which calculated before
-            a_old[i][1] = a_new[i][1];
-            a_old[i][2] = a_new[i][2];
-        }
-        // now add on the non-constant term
-        for (int i = 0; i < N; i++){ // a_j is used to update a_i and vice versa
-            double non_constx = 0.;
-            double non_consty = 0.;
-            double non_constz = 0.;
-            for (int j = 0; j < N; j++){
-                if (j != i){
-                    const double dxij = drs[i][j][0];
-                    const double dyij = drs[i][j][1];
-                    const double dzij = drs[i][j][2];
-                    const double rij = rs[i][j];
-                    const double rij3 = rij*rij*rij;
-                    non_constx += (G*particles[j].m*dxij/rij3)*(dxij*(a_newton[j][0]+a_old[j][0])+dyij*(a_newton[j][1]+a_old[j][1])+\
-                                dzij*(a_newton[j][2]+a_old[j][2]))/(2.*C2) + (7./(2.*C2))*G*particles[j].m*(a_newton[j][0]+a_old[j][0])/rij;
-                    non_consty += (G*particles[j].m*dyij/rij3)*(dxij*(a_newton[j][0]+a_old[j][0])+dyij*(a_newton[j][1]+a_old[j][1])+\
-                                dzij*(a_newton[j][2]+a_old[j][2]))/(2.*C2) + (7./(2.*C2))*G*particles[j].m*(a_newton[j][1]+a_old[j][1])/rij;
-                    non_constz += (G*particles[j].m*dzij/rij3)*(dxij*(a_newton[j][0]+a_old[j][0])+dyij*(a_newton[j][1]+a_old[j][1])+\
-                                dzij*(a_newton[j][2]+a_old[j][2]))/(2.*C2) + (7./(2.*C2))*G*particles[j].m*(a_newton[j][2]+a_old[j][2])/rij;
+                    // on i from a_j
+                    const double rdotaj = dxij*a_sum[j][0] + dyij*a_sum[j][1] + dzij*a_sum[j][2];
+                    const double fj = Gm[j]*rdotaj*rinv3*c1;
+                    const double gj = c7*Gm[j]*rinv;
+                    non_constx += fj*dxij + gj*a_sum[j][0];
+                    non_consty += fj*dyij + gj*a_sum[j][1];
+                    non_constz += fj*dzij + gj*a_sum[j][2];
+
+                    // on j from a_i.  The two sign flips of r_ji cancel
+                    const double rdotai = dxij*a_sum[i][0] + dyij*a_sum[i][1] + dzij*a_sum[i][2];
+                    const double fi = Gm[i]*rdotai*rinv3*c1;
+                    const double gi = c7*Gm[i]*rinv;
+                    a_new[j][0] += fi*dxij + gi*a_sum[i][0];
+                    a_new[j][1] += fi*dyij + gi*a_sum[i][1];
+                    a_new[j][2] += fi*dzij + gi*a_sum[i][2];
                 }
+                a_new[i][0] += non_constx;
+                a_new[i][1] += non_consty;
+                a_new[i][2] += non_constz;
             }
-            a_new[i][0] = (a_const[i][0] + non_constx);
-            a_new[i][1] = (a_const[i][1] + non_consty);
-            a_new[i][2] = (a_const[i][2] + non_constz);
         }
+    }
+}
+
+// Returns the number of substitutions made
+static int rebx_calculate_gr_full(struct reb_simulation* const sim, struct rebx_gr_full_workspace* const ws, struct reb_particle* const particles, const int N, const double C2, const double G, const int max_iterations, const int gravity_ignore_10){
+    int iterations = 0;
+    for (int i=0; i<N; i++){
+        ws->x[i] = particles[i].x;
+        ws->y[i] = particles[i].y;
+        ws->z[i] = particles[i].z;
+        ws->vx[i] = particles[i].vx;
+        ws->vy[i] = particles[i].vy;
+        ws->vz[i] = particles[i].vz;
+        ws->Gm[i] = G*particles[i].m;
+        ws->v2[i] = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
+        // the Newtonian term
+        ws->a_newton[i][0] = particles[i].ax;
+        ws->a_newton[i][1] = particles[i].ay;
+        ws->a_newton[i][2] = particles[i].az;
+        ws->a_new[i][0] = 0.;
+        ws->a_new[i][1] = 0.;
+        ws->a_new[i][2] = 0.;
+    }
+    double (*a_new)[3] = ws->a_new;
+    double (*a_old)[3] = ws->a_old;
+
+    if (gravity_ignore_10){
+        const double dx = particles[0].x - particles[1].x;
+        const double dy = particles[0].y - particles[1].y;
+        const double dz = particles[0].z - particles[1].z;
+        const double r01 = sqrt(dx*dx + dy*dy + dz*dz);
+        const double prefact = -G/(r01*r01*r01);
+        const double prefact0 = prefact*particles[0].m;
+        const double prefact1 = prefact*particles[1].m;
+        ws->a_newton[0][0] += prefact1*dx;
+        ws->a_newton[0][1] += prefact1*dy;
+        ws->a_newton[0][2] += prefact1*dz;
+        ws->a_newton[1][0] -= prefact0*dx;
+        ws->a_newton[1][1] -= prefact0*dy;
+        ws->a_newton[1][2] -= prefact0*dz;
+    }
+
+    rebx_gr_full_potentials(ws, N);
+    rebx_gr_full_constant_terms(ws, N, C2);
+
+    // Now running the substitution again and again through the loop below
+    for (int k=0; k<10; k++){ // you can set k as how many substitution you want to make
+        // a_new becomes a_old.  When k = 0 it is zero
+        double (*const tmp)[3] = a_old;
+        a_old = a_new;
+        a_new = tmp;
+        ws->a_old = a_old;
+        ws->a_new = a_new;
+        rebx_gr_full_substitute(ws, N, C2);
+        iterations++;
         
         // break out loop if a_new is converging
         double maxdev = 0.;
@@ -228,23 +360,34 @@ static void rebx_calculate_gr_full(struct reb_simulation* const sim, struct reb_
         particles[i].ay += a_new[i][1];
         particles[i].az += a_new[i][2];
     }
+    return iterations;
 }
 
 void rebx_gr_full(struct reb_simulation* const sim, struct rebx_force* const gr_full, struct reb_particle* const particles, const int N){
-    double* c = rebx_get_param(sim->extras, gr_full->ap, "c");
+    double* c = rebx_get_param_double_h(gr_full->ap, rebx_default_param(sim->extras, REBX_PARAM_c));
     if (c == NULL){
         reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
         return;
     }
+    struct rebx_gr_full_workspace* const ws = rebx_gr_full_workspace_get(sim->extras, gr_full, N);
+    if (ws == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for gr_full.\n");
+        return;
+    }
     const double C2 = (*c)*(*c);
     const unsigned int gravity_ignore_10 = sim->gravity_ignore_terms==1;
-    int* max_iterations = rebx_get_param(sim->extras, gr_full->ap, "max_iterations");
+    int* max_iterations = rebx_get_param_int_h(gr_full->ap, rebx_default_param(sim->extras, REBX_PARAM_max_iterations));
+    int iterations;
     if(max_iterations != NULL){
-        rebx_calculate_gr_full(sim, particles, N, C2, sim->G, *max_iterations, gravity_ignore_10);
+        iterations = rebx_calculate_gr_full(sim, ws, particles, N, C2, sim->G, *max_iterations, gravity_ignore_10);
     }
     else{
         const int default_max_iterations = 10;
-        rebx_calculate_gr_full(sim, particles, N, C2, sim->G, default_max_iterations, gravity_ignore_10);
+        iterations = rebx_calculate_gr_full(sim, ws, particles, N, C2, sim->G, default_max_iterations, gravity_ignore_10);
+    }
+    const struct rebx_extras* const rebx = sim->extras;
+    if (rebx->stats_enabled){
+        gr_full->stats.iterations += iterations;
     }
 }
 
@@ -254,7 +397,7 @@ double rebx_gr_full_hamiltonian(struct rebx_extras* const rebx, const struct reb
         return 0;
     }
     struct reb_simulation* sim = rebx->sim;
-    double* c = rebx_get_param(rebx, force->ap, "c");
+    double* c = rebx_get_param_double_h(force->ap, rebx_default_param(rebx, REBX_PARAM_c));
     if (c == NULL){
         reb_error(sim, "Need to set speed of light in gr effect.  See examples in documentation.\n");
     }
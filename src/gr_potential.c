@@ -46,6 +46,7 @@
  * Field (C type)               Required    Description
  * ============================ =========== ==================================================================
  * c (double)                   Yes         Speed of light in the units used for the simulation.
+ * fused (int)                  No          If nonzero, evaluated in one pass over the particles with the other fused forces
  * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
@@ -65,6 +66,7 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
 
 static void rebx_calculate_gr_potential(struct reb_particle* const particles, const int N, const double C2, const double G){
     const struct reb_particle source = particles[0];
@@ -87,7 +89,7 @@ static void rebx_calculate_gr_potential(struct reb_particle* const particles, co
 }
 
 void rebx_gr_potential(struct reb_simulation* const sim, struct rebx_force* const gr_potential, struct reb_particle* const particles, const int N){
-    double* c = rebx_get_param(sim->extras, gr_potential->ap, "c");
+    double* c = rebx_get_param_double_h(gr_potential->ap, rebx_default_param(sim->extras, REBX_PARAM_c));
     if (c == NULL){
         reb_error(sim, "REBOUNDx Error: Need to set speed of light in gr effect.  See examples in documentation.\n");
     }
@@ -97,6 +99,49 @@ void rebx_gr_potential(struct reb_simulation* const sim, struct rebx_force* cons
     }
 }
 
+struct rebx_gr_potential_state {
+    double prefac1;
+    double m0;
+};
+
+static int rebx_gr_potential_begin(struct reb_simulation* const sim, struct rebx_force* const gr_potential, struct reb_particle* const particles, const int N, void* const state){
+    const double* const c = rebx_get_param_double_h(gr_potential->ap, rebx_default_param(sim->extras, REBX_PARAM_c));
+    if (c == NULL || N < 1){
+        return 0;   // rebx_gr_potential reports the error
+    }
+    struct rebx_gr_potential_state* const st = state;
+    const double C2 = (*c)*(*c);
+    const double G = sim->G;
+    st->prefac1 = 6.*(G*particles[0].m)*(G*particles[0].m)/C2;
+    st->m0 = particles[0].m;
+    return 1;
+}
+
+static void rebx_gr_potential_block(struct reb_simulation* const sim, struct rebx_force* const gr_potential, struct reb_particle* const particles, struct rebx_fused_block* const b, void* const state){
+    const struct rebx_gr_potential_state* const st = state;
+    const double sx = particles[0].x, sy = particles[0].y, sz = particles[0].z;
+    double rx = 0., ry = 0., rz = 0.;
+    for (int k=b->i0 == 0 ? 1 : 0; k<b->n; k++){
+        const double dx = b->x[k] - sx;
+        const double dy = b->y[k] - sy;
+        const double dz = b->z[k] - sz;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double prefac = st->prefac1/(r2*r2);
+
+        b->ax[k] -= prefac*dx;
+        b->ay[k] -= prefac*dy;
+        b->az[k] -= prefac*dz;
+        rx += b->m[k]/st->m0*prefac*dx;
+        ry += b->m[k]/st->m0*prefac*dy;
+        rz += b->m[k]/st->m0*prefac*dz;
+    }
+    particles[0].ax += rx;
+    particles[0].ay += ry;
+    particles[0].az += rz;
+}
+
+const struct rebx_fused_kernel rebx_gr_potential_fused = {rebx_gr_potential, sizeof(struct rebx_gr_potential_state), rebx_gr_potential_begin, rebx_gr_potential_block};
+
 static double rebx_calculate_gr_potential_potential(struct reb_simulation* const sim, const double C2){
     const struct reb_particle* const particles = sim->particles;
 	const int _N_real = sim->N - sim->N_var;
@@ -119,7 +164,7 @@ static double rebx_calculate_gr_potential_potential(struct reb_simulation* const
 }
 
 double rebx_gr_potential_potential(struct rebx_extras* const rebx, const struct rebx_force* const gr_potential){
-    double* c = rebx_get_param(rebx, gr_potential->ap, "c");
+    double* c = rebx_get_param_double_h(gr_potential->ap, rebx_default_param(rebx, REBX_PARAM_c));
     if (c == NULL){
         rebx_error(rebx, "Need to set speed of light in gr effect.  See examples in documentation.\n");
     }
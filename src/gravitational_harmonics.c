@@ -37,7 +37,11 @@
  *
  * **Effect Parameters**
  * 
- * None
+ * ============================ =========== ==================================================================
+ * Field (C type)               Required    Description
+ * ============================ =========== ==================================================================
+ * fused (int)                  No          If nonzero, evaluated in one pass over the particles with the other fused forces
+ * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
  *
@@ -57,6 +61,83 @@
 #include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
+
+// Indices of the particles with J2 and R_eq, and with J4 and R_eq, in increasing order.  Kept on the force and
+// rebuilt when rebx->param_generation or the number of particles changes.
+struct rebx_gravitational_harmonics_workspace {
+    uint64_t param_generation;
+    int N;
+    int n_J2;
+    int* J2;
+    int n_J4;
+    int* J4;
+};
+
+void rebx_gravitational_harmonics_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_gravitational_harmonics_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_gravitational_harmonics_workspace));
+    if (ws){
+        free(ws->J2);
+        free(ws->J4);
+        free(ws);
+    }
+}
+
+static struct rebx_gravitational_harmonics_workspace* rebx_gravitational_harmonics_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_gravitational_harmonics_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_gravitational_harmonics_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        ws->N = -1;
+        rebx_set_param_pointer(rebx, &force->ap, "gravitational_harmonics_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_gravitational_harmonics_free_arrays);
+    }
+    return ws;
+}
+
+static int rebx_gravitational_harmonics_build(struct rebx_extras* const rebx, struct rebx_gravitational_harmonics_workspace* const ws, const struct reb_particle* const particles, const int N){
+    const rebx_param_handle J2_h = rebx_default_param(rebx, REBX_PARAM_J2);
+    const rebx_param_handle J4_h = rebx_default_param(rebx, REBX_PARAM_J4);
+    const rebx_param_handle R_eq_h = rebx_default_param(rebx, REBX_PARAM_R_eq);
+    int n_J2 = 0;
+    int n_J4 = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_h(particles[i].ap, R_eq_h) != NULL){
+            n_J2 += rebx_get_param_h(particles[i].ap, J2_h) != NULL;
+            n_J4 += rebx_get_param_h(particles[i].ap, J4_h) != NULL;
+        }
+    }
+    int* const J2 = malloc((n_J2 > 0 ? n_J2 : 1)*sizeof(*J2));
+    int* const J4 = malloc((n_J4 > 0 ? n_J4 : 1)*sizeof(*J4));
+    if (J2 == NULL || J4 == NULL){
+        free(J2);
+        free(J4);
+        return 0;
+    }
+    n_J2 = 0;
+    n_J4 = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_h(particles[i].ap, R_eq_h) != NULL){
+            if (rebx_get_param_h(particles[i].ap, J2_h) != NULL){
+                J2[n_J2++] = i;
+            }
+            if (rebx_get_param_h(particles[i].ap, J4_h) != NULL){
+                J4[n_J4++] = i;
+            }
+        }
+    }
+    free(ws->J2);
+    free(ws->J4);
+    ws->J2 = J2;
+    ws->n_J2 = n_J2;
+    ws->J4 = J4;
+    ws->n_J4 = n_J4;
+    ws->N = N;
+    ws->param_generation = rebx->param_generation;
+    return 1;
+}
 
 static void rebx_calculate_J2_force(struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const double J2, const double R_eq, const int source_index){
     const struct reb_particle source = particles[source_index];
@@ -84,11 +165,14 @@ static void rebx_calculate_J2_force(struct reb_simulation* const sim, struct reb
     }
 }
 
-static void rebx_J2(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
-    for (int i=0; i<N; i++){
-        const double* const J2 = rebx_get_param(rebx, particles[i].ap, "J2");
+static void rebx_J2(struct rebx_extras* const rebx, struct reb_simulation* const sim, const struct rebx_gravitational_harmonics_workspace* const ws, struct reb_particle* const particles, const int N){
+    const rebx_param_handle J2_h = rebx_default_param(rebx, REBX_PARAM_J2);
+    const rebx_param_handle R_eq_h = rebx_default_param(rebx, REBX_PARAM_R_eq);
+    for (int k=0; k<ws->n_J2; k++){
+        const int i = ws->J2[k];
+        const double* const J2 = rebx_get_param_double_h(particles[i].ap, J2_h);   // the list is a superset if an ap was changed behind rebx_set_param, so check again
         if (J2 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+            const double* const R_eq = rebx_get_param_double_h(particles[i].ap, R_eq_h);
             if (R_eq != NULL){
                 rebx_calculate_J2_force(sim, particles, N, *J2, *R_eq,i); 
             }
@@ -122,11 +206,14 @@ static void rebx_calculate_J4_force(struct reb_simulation* const sim, struct reb
     }
 }
 
-static void rebx_J4(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
-    for (int i=0; i<N; i++){
-        const double* const J4 = rebx_get_param(rebx, particles[i].ap, "J4");
+static void rebx_J4(struct rebx_extras* const rebx, struct reb_simulation* const sim, const struct rebx_gravitational_harmonics_workspace* const ws, struct reb_particle* const particles, const int N){
+    const rebx_param_handle J4_h = rebx_default_param(rebx, REBX_PARAM_J4);
+    const rebx_param_handle R_eq_h = rebx_default_param(rebx, REBX_PARAM_R_eq);
+    for (int k=0; k<ws->n_J4; k++){
+        const int i = ws->J4[k];
+        const double* const J4 = rebx_get_param_double_h(particles[i].ap, J4_h);   // the list is a superset if an ap was changed behind rebx_set_param, so check again
         if (J4 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+            const double* const R_eq = rebx_get_param_double_h(particles[i].ap, R_eq_h);
             if (R_eq != NULL){
                 rebx_calculate_J4_force(sim, particles, N, *J4, *R_eq,i); 
             }
@@ -135,10 +222,118 @@ static void rebx_J4(struct rebx_extras* const rebx, struct reb_simulation* const
 }
 
 void rebx_gravitational_harmonics(struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N){
-    rebx_J2(sim->extras, sim, gh, particles, N);
-    rebx_J4(sim->extras, sim, gh, particles, N);
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_gravitational_harmonics_workspace* const ws = rebx_gravitational_harmonics_workspace_get(rebx, gh);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_gravitational_harmonics_build(rebx, ws, particles, N))){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for gravitational_harmonics.\n");
+        return;
+    }
+    rebx_J2(rebx, sim, ws, particles, N);
+    rebx_J4(rebx, sim, ws, particles, N);
+}
+
+struct rebx_gravitational_harmonics_state {
+    const struct rebx_gravitational_harmonics_workspace* ws;
+    rebx_param_handle J2_h;
+    rebx_param_handle J4_h;
+    rebx_param_handle R_eq_h;
+};
+
+static int rebx_gravitational_harmonics_begin(struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, const int N, void* const state){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_gravitational_harmonics_workspace* const ws = rebx_gravitational_harmonics_workspace_get(rebx, gh);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_gravitational_harmonics_build(rebx, ws, particles, N))){
+        return 0;   // rebx_gravitational_harmonics reports the error
+    }
+    struct rebx_gravitational_harmonics_state* const st = state;
+    st->ws = ws;
+    st->J2_h = rebx_default_param(rebx, REBX_PARAM_J2);
+    st->J4_h = rebx_default_param(rebx, REBX_PARAM_J4);
+    st->R_eq_h = rebx_default_param(rebx, REBX_PARAM_R_eq);
+    return 1;
+}
+
+static void rebx_J2_block(struct reb_simulation* const sim, struct reb_particle* const particles, struct rebx_fused_block* const b, const double J2, const double R_eq, const int source_index){
+    const struct reb_particle source = particles[source_index];
+    const double G = sim->G;
+    double rx = 0., ry = 0., rz = 0.;
+    for (int k=0; k<b->n; k++){
+        if (b->i0 + k == source_index){
+            continue;
+        }
+        const double dx = b->x[k] - source.x;
+        const double dy = b->y[k] - source.y;
+        const double dz = b->z[k] - source.z;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double r = sqrt(r2);
+        const double costheta2 = dz*dz/r2;
+        const double prefac = 3.*J2*R_eq*R_eq/r2/r2/r/2.;
+        const double fac = 5.*costheta2-1.;
+
+        b->ax[k] += G*source.m*prefac*fac*dx;
+        b->ay[k] += G*source.m*prefac*fac*dy;
+        b->az[k] += G*source.m*prefac*(fac-2.)*dz;
+        rx -= G*b->m[k]*prefac*fac*dx;
+        ry -= G*b->m[k]*prefac*fac*dy;
+        rz -= G*b->m[k]*prefac*(fac-2.)*dz;
+    }
+    particles[source_index].ax += rx;
+    particles[source_index].ay += ry;
+    particles[source_index].az += rz;
+}
+
+static void rebx_J4_block(struct reb_simulation* const sim, struct reb_particle* const particles, struct rebx_fused_block* const b, const double J4, const double R_eq, const int source_index){
+    const struct reb_particle source = particles[source_index];
+    const double G = sim->G;
+    double rx = 0., ry = 0., rz = 0.;
+    for (int k=0; k<b->n; k++){
+        if (b->i0 + k == source_index){
+            continue;
+        }
+        const double dx = b->x[k] - source.x;
+        const double dy = b->y[k] - source.y;
+        const double dz = b->z[k] - source.z;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double r = sqrt(r2);
+        const double costheta2 = dz*dz/r2;
+        const double prefac = 5.*J4*R_eq*R_eq*R_eq*R_eq/r2/r2/r2/r/8.;
+        const double fac = 63.*costheta2*costheta2-42.*costheta2 + 3.;
+
+        b->ax[k] += G*source.m*prefac*fac*dx;
+        b->ay[k] += G*source.m*prefac*fac*dy;
+        b->az[k] += G*source.m*prefac*(fac+12.-28.*costheta2)*dz;
+        rx -= G*b->m[k]*prefac*fac*dx;
+        ry -= G*b->m[k]*prefac*fac*dy;
+        rz -= G*b->m[k]*prefac*(fac+12.-28.*costheta2)*dz;
+    }
+    particles[source_index].ax += rx;
+    particles[source_index].ay += ry;
+    particles[source_index].az += rz;
+}
+
+static void rebx_gravitational_harmonics_block(struct reb_simulation* const sim, struct rebx_force* const gh, struct reb_particle* const particles, struct rebx_fused_block* const b, void* const state){
+    const struct rebx_gravitational_harmonics_state* const st = state;
+    const struct rebx_gravitational_harmonics_workspace* const ws = st->ws;
+    for (int k=0; k<ws->n_J2; k++){
+        const int i = ws->J2[k];
+        const double* const J2 = rebx_get_param_double_h(particles[i].ap, st->J2_h);
+        const double* const R_eq = rebx_get_param_double_h(particles[i].ap, st->R_eq_h);
+        if (J2 != NULL && R_eq != NULL){
+            rebx_J2_block(sim, particles, b, *J2, *R_eq, i);
+        }
+    }
+    for (int k=0; k<ws->n_J4; k++){
+        const int i = ws->J4[k];
+        const double* const J4 = rebx_get_param_double_h(particles[i].ap, st->J4_h);
+        const double* const R_eq = rebx_get_param_double_h(particles[i].ap, st->R_eq_h);
+        if (J4 != NULL && R_eq != NULL){
+            rebx_J4_block(sim, particles, b, *J4, *R_eq, i);
+        }
+    }
 }
 
+const struct rebx_fused_kernel rebx_gravitational_harmonics_fused = {rebx_gravitational_harmonics, sizeof(struct rebx_gravitational_harmonics_state), rebx_gravitational_harmonics_begin, rebx_gravitational_harmonics_block};
+
 static double rebx_calculate_J2_potential(struct reb_simulation* const sim, const double J2, const double R_eq, const int source_index){
     const struct reb_particle* const particles = sim->particles;
 	const int _N_real = sim->N - sim->N_var;
@@ -166,11 +361,13 @@ static double rebx_calculate_J2_potential(struct reb_simulation* const sim, cons
 static double rebx_J2_potential(struct rebx_extras* const rebx, struct reb_simulation* const sim){
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
+    const rebx_param_handle J2_h = rebx_default_param(rebx, REBX_PARAM_J2);
+    const rebx_param_handle R_eq_h = rebx_default_param(rebx, REBX_PARAM_R_eq);
     double Htot = 0.;
     for (int i=0; i<N_real; i++){
-        const double* const J2 = rebx_get_param(rebx, particles[i].ap, "J2");
+        const double* const J2 = rebx_get_param_double_h(particles[i].ap, J2_h);
         if (J2 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+            const double* const R_eq = rebx_get_param_double_h(particles[i].ap, R_eq_h);
             if (R_eq != NULL){
                 Htot += rebx_calculate_J2_potential(sim, *J2, *R_eq, i);
             }
@@ -207,11 +404,13 @@ static double rebx_calculate_J4_potential(struct reb_simulation* const sim, cons
 static double rebx_J4_potential(struct rebx_extras* const rebx, struct reb_simulation* const sim){
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
+    const rebx_param_handle J4_h = rebx_default_param(rebx, REBX_PARAM_J4);
+    const rebx_param_handle R_eq_h = rebx_default_param(rebx, REBX_PARAM_R_eq);
     double Htot = 0.;
     for (int i=0; i<N_real; i++){
-        const double* const J4 = rebx_get_param(rebx, particles[i].ap, "J4");
+        const double* const J4 = rebx_get_param_double_h(particles[i].ap, J4_h);
         if (J4 != NULL){
-            const double* const R_eq = rebx_get_param(rebx, particles[i].ap, "R_eq");
+            const double* const R_eq = rebx_get_param_double_h(particles[i].ap, R_eq_h);
             if (R_eq != NULL){
                 Htot += rebx_calculate_J4_potential(sim, *J4, *R_eq, i);
             }
@@ -23,6 +23,13 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // madvise with -std=c99
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,26 +38,71 @@
 #include "reboundx.h"
 #include "core.h"
 
+/*  The binary is mapped into memory and the fields are parsed in place, so names and values don't need their own allocations.  pos is where the next field starts.*/
+struct rebx_input_buffer {
+    const char* data;
+    long size;
+    long pos;
+};
+
+static int rebx_input_read_field(struct rebx_input_buffer* const in, struct rebx_binary_field* const field){
+    if (in->size - in->pos < (long)sizeof(*field)){
+        return 0;
+    }
+    memcpy(field, in->data + in->pos, sizeof(*field));
+    in->pos += sizeof(*field);
+    return 1;
+}
+
+// Returns the size bytes that follow and moves past them, or NULL if the binary ends first
+static const char* rebx_input_data(struct rebx_input_buffer* const in, const long size){
+    if (size < 0 || in->size - in->pos < size){
+        in->pos = in->size;
+        return NULL;
+    }
+    const char* const data = in->data + in->pos;
+    in->pos += size;
+    return data;
+}
+
+// NULL unless the field holds a NUL terminated string
+static const char* rebx_input_string(struct rebx_input_buffer* const in, const long size){
+    const char* const str = rebx_input_data(in, size);
+    if (str == NULL || size == 0 || str[size-1] != '\0'){
+        return NULL;
+    }
+    return str;
+}
+
+// Moves to the end of the object of size bytes that starts at start, wherever its loader stopped
+static void rebx_input_skip_object(struct rebx_input_buffer* const in, const long start, const long size){
+    if (size < 0 || size > in->size - start){
+        in->pos = in->size;
+    }
+    else if (start + size > in->pos){
+        in->pos = start + size;
+    }
+}
+
 // Macro to read a single field from a binary file.
 #define CASE(typename, valueref) case REBX_BINARY_FIELD_TYPE_##typename: \
 {\
-if(!fread(valueref, field.size, 1, inf)){\
+const char* const data = rebx_input_data(in, field.size);\
+if(data == NULL || field.size != sizeof(*valueref)){\
 *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;\
 }\
+else{\
+memcpy(valueref, data, sizeof(*valueref));\
+}\
 break;\
 }\
 
-#define CASE_MALLOC(typename, valueref) case REBX_BINARY_FIELD_TYPE_##typename: \
+// Strings are not copied.  They point into the binary
+#define CASE_STRING(typename, valueref) case REBX_BINARY_FIELD_TYPE_##typename: \
 {\
-valueref = malloc(field.size);\
+valueref = rebx_input_string(in, field.size);\
 if(valueref == NULL){\
-*warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;\
-}\
-else{\
-if(!fread(valueref, field.size, 1, inf)){\
 *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;\
-free(valueref);\
-}\
 }\
 break;\
 }\
@@ -59,51 +111,102 @@ void rebx_input_skip_binary_field(FILE* inf, long field_size){
     fseek(inf, field_size, SEEK_CUR);
 }
 
-static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, FILE* inf, enum rebx_input_binary_messages* warnings);
+static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings);
 
-static struct rebx_param* rebx_read_param(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+// For FORCE params, value is left pointing to the name of the force in the binary
+static struct rebx_param* rebx_read_param(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     
-    struct rebx_param* param = malloc(sizeof(*param));
-    if (param == NULL){
-        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
-        return NULL;
-    }
-    param->value = NULL;
-    param->name = NULL;
-    param->type = REBX_TYPE_NONE;
+    enum rebx_param_type type = REBX_TYPE_NONE;
+    const char* name = NULL;
+    const char* value = NULL;
+    long value_size = 0;
     
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){ // means we didn't reach an END field. Corrupt
+        if (!rebx_input_read_field(in, &field)){ // means we didn't reach an END field. Corrupt
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
         switch (field.type){
-            CASE(PARAM_TYPE,                  &param->type);
-            CASE_MALLOC(NAME,                 param->name);
-            CASE_MALLOC(PARAM_VALUE,          param->value);
+            CASE(PARAM_TYPE,                  &type);
+            CASE_STRING(NAME,                 name);
+            case REBX_BINARY_FIELD_TYPE_PARAM_VALUE:
+            {
+                value = rebx_input_data(in, field.size);
+                value_size = field.size;
+                if (value == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                }
+                break;
+            }
             case REBX_BINARY_FIELD_TYPE_END:
                 reading_fields=0;
                 break;
             default: // Might have added new fields, saved with new version and loaded with old version
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+                rebx_input_data(in, field.size);
                 break;
             }
         }
     }
     // Check type and name after param has been loaded. Check value later (registered params should have value=NULL)
-    if (param->type == REBX_TYPE_NONE || param->name == NULL){
+    if (type == REBX_TYPE_NONE || name == NULL){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-        rebx_free_param(param);
         return NULL;
     }
+    
+    struct rebx_param* param = rebx_create_param(rebx, name, type);
+    if (param == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+        return NULL;
+    }
+    if (value != NULL){
+        // Small values are stored in the param, like rebx_set_param_double etc.
+        switch (type){
+            case REBX_TYPE_DOUBLE:
+                if (value_size == sizeof(double)){
+                    memcpy(&param->storage.d, value, sizeof(double));
+                    param->value = &param->storage.d;
+                }
+                break;
+            case REBX_TYPE_INT:
+                if (value_size == sizeof(int)){
+                    memcpy(&param->storage.i, value, sizeof(int));
+                    param->value = &param->storage.i;
+                }
+                break;
+            case REBX_TYPE_UINT32:
+                if (value_size == sizeof(uint32_t)){
+                    memcpy(&param->storage.u, value, sizeof(uint32_t));
+                    param->value = &param->storage.u;
+                }
+                break;
+            case REBX_TYPE_FORCE:
+                if (value_size > 0 && value[value_size-1] == '\0'){
+                    param->value = (char*)value;
+                }
+                break;
+            default:
+                param->value = malloc(value_size);
+                if (param->value == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+                }
+                else{
+                    memcpy(param->value, value, value_size);
+                }
+                break;
+        }
+        if (param->value == NULL){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        }
+    }
     return param;
 }
 
-static int rebx_load_param(struct rebx_extras* rebx, struct rebx_node** ap, FILE* inf, enum rebx_input_binary_messages* warnings){
-    struct rebx_param* param = rebx_read_param(rebx, inf, warnings);
+static int rebx_load_param(struct rebx_extras* rebx, struct rebx_node** ap, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
+    struct rebx_param* param = rebx_read_param(rebx, in, warnings);
     
     if(param == NULL){
         return 0;
@@ -132,8 +235,8 @@ static int rebx_load_param(struct rebx_extras* rebx, struct rebx_node** ap, FILE
     
 }
 
-static int rebx_load_registered_param(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
-    struct rebx_param* param = rebx_read_param(rebx, inf, warnings);
+static int rebx_load_registered_param(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
+    struct rebx_param* param = rebx_read_param(rebx, in, warnings);
     
     if(param == NULL){
         return 0;
@@ -141,14 +244,15 @@ static int rebx_load_registered_param(struct rebx_extras* rebx, FILE* inf, enum
     
     int success = rebx_add_param(rebx, &rebx->registered_params, param);
     if(!success){
+        rebx_free_param(param);
         return 0;
     }
     return 1;
 }
 
-static char* rebx_load_name(FILE* inf, enum rebx_input_binary_messages* warnings){
+static const char* rebx_load_name(struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
-    if (!fread(&field, sizeof(field), 1, inf)){
+    if (!rebx_input_read_field(in, &field)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return NULL;
     }
@@ -156,28 +260,21 @@ static char* rebx_load_name(FILE* inf, enum rebx_input_binary_messages* warnings
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return NULL;
     }
-    char* name = malloc(field.size);
+    const char* const name = rebx_input_string(in, field.size);
     if (name == NULL){
-        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
-        return NULL;
-    }
-    if (!fread(name, field.size, 1, inf)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-        free(name);
-        return NULL;
     }
     return name;
 }
 
-static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_force_field(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     
     // Name of force always comes first so that we can load it
-    char* name = rebx_load_name(inf, warnings);
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_force* force = rebx_load_force(rebx, name);
-    free(name);
     if(force == NULL){
         *warnings |= REBX_INPUT_BINARY_WARNING_FORCE_NOT_LOADED;
         return 0;
@@ -186,14 +283,14 @@ static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             return 0;
         }
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM_LIST:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &force->ap, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &force->ap, in, warnings)){
                     return 0;
                 }
                 break;
@@ -206,7 +303,7 @@ static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -216,14 +313,13 @@ static int rebx_load_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_
 }
 
 // Force is already loaded in allocated_forces. Need to get from that list and add to sim
-static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_additional_force_field(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     
-    char* name = rebx_load_name(inf, warnings);
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_force* force = rebx_get_force(rebx, name);
-    free(name);
     if(force == NULL){
         return 0;
     }
@@ -232,7 +328,7 @@ static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf,
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             return 0;
         }
@@ -245,7 +341,7 @@ static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf,
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -255,14 +351,13 @@ static int rebx_load_additional_force_field(struct rebx_extras* rebx, FILE* inf,
     return success;
 }
 
-static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_operator_field(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     // Name of force always comes first so that we can load it
-    char* name = rebx_load_name(inf, warnings);
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_operator* operator = rebx_load_operator(rebx, name);
-    free(name);
     if(operator == NULL){
         *warnings |= REBX_INPUT_BINARY_WARNING_OPERATOR_NOT_LOADED;
         return 0;
@@ -271,14 +366,14 @@ static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum re
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM_LIST:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &operator->ap, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &operator->ap, in, warnings)){
                     return 0;
                 }
                 break;
@@ -291,7 +386,7 @@ static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum re
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -300,13 +395,12 @@ static int rebx_load_operator_field(struct rebx_extras* rebx, FILE* inf, enum re
     return 1;
 }
 
-static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings, struct rebx_node** ap){
-    char* name = rebx_load_name(inf, warnings);
+static int rebx_load_step_field(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings, struct rebx_node** ap){
+    const char* name = rebx_load_name(in, warnings);
     if(name == NULL){
         return 0;
     }
     struct rebx_operator* operator = rebx_get_operator(rebx, name);
-    free(name);
     if(operator == NULL){
         *warnings |= REBX_INPUT_BINARY_WARNING_OPERATOR_NOT_LOADED;
         return 0;
@@ -316,7 +410,7 @@ static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_i
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
@@ -328,6 +422,7 @@ static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_i
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -347,10 +442,10 @@ static int rebx_load_step_field(struct rebx_extras* rebx, FILE* inf, enum rebx_i
     return success;
 }
 
-static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_particle(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     struct reb_particle* p = NULL;
     struct rebx_binary_field field;
-    if (!fread(&field, sizeof(field), 1, inf)){
+    if (!rebx_input_read_field(in, &field)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return 0;
     }
@@ -360,23 +455,29 @@ static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
         return 0;
     }
     int index;
-    if(!fread(&index, field.size, 1, inf)){
+    const char* const data = rebx_input_data(in, field.size);
+    if(data == NULL || field.size != sizeof(index)){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        return 0;
+    }
+    memcpy(&index, data, sizeof(index));
+    if(index < 0 || index >= rebx->sim->N){ // checked sim is valid in init_from_binary
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return 0;
     }
     
-    p = &rebx->sim->particles[index]; // checked sim is valid in init_from_binary
+    p = &rebx->sim->particles[index];
     
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             return 0;
         }
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM_LIST:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &p->ap, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM, &p->ap, in, warnings)){
                     return 0;
                 }
                 break;
@@ -389,7 +490,7 @@ static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -397,14 +498,78 @@ static int rebx_load_particle(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
     return 1;
 }
 
-static int rebx_load_rebx(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+// Column values are written for the N rows in use, and N can be 0.  They are copied from the binary in bulk
+static int rebx_load_param_column(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
+    enum rebx_param_type type = REBX_TYPE_NONE;
+    const char* name = NULL;
+    const char* values = NULL;
+    const char* present = NULL;
+    long values_size = 0;
+    long present_size = 0;
+    
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
+        switch (field.type){
+            CASE(PARAM_TYPE,                  &type);
+            CASE_STRING(NAME,                 name);
+            case REBX_BINARY_FIELD_TYPE_PARAM_VALUE:
+            {
+                values = rebx_input_data(in, field.size);
+                values_size = field.size;
+                if (values == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                    values_size = 0;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_COLUMN_PRESENT:
+            {
+                present = rebx_input_data(in, field.size);
+                present_size = field.size;
+                if (present == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                    present_size = 0;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_END:
+                reading_fields=0;
+                break;
+            default:
+            {
+                *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+                rebx_input_data(in, field.size);
+                break;
+            }
+        }
+    }
+    
+    int success = 0;
+    if (name != NULL && (type == REBX_TYPE_DOUBLE || type == REBX_TYPE_INT) && rebx_get_type(rebx, name) == type){
+        const size_t size = rebx_sizeof(rebx, type);
+        const int N = values_size/size;
+        if ((long)((N + 63)/64*sizeof(uint64_t)) <= present_size){
+            struct rebx_param_column* const column = rebx_add_param_column(rebx, name);
+            success = column != NULL && rebx_set_param_column_rows(rebx, column, values, present, N);
+        }
+    }
+    return success;
+}
+
+static int rebx_load_rebx(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
+    struct rebx_binary_field field;
+    int reading_fields = 1;
+    while (reading_fields){
+        if (!rebx_input_read_field(in, &field)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            break;
+        }
+        const long start = in->pos;
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_END:
             {
@@ -413,56 +578,56 @@ static int rebx_load_rebx(struct rebx_extras* rebx, FILE* inf, enum rebx_input_b
             }
             case REBX_BINARY_FIELD_TYPE_REGISTERED_PARAMETERS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM, &rebx->registered_params, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM, &rebx->registered_params, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ALLOCATED_FORCES:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_FORCE, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_FORCE, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ALLOCATED_OPERATORS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_OPERATOR, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_OPERATOR, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCES:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PRE_TIMESTEP_MODIFICATIONS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->pre_timestep_modifications, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->pre_timestep_modifications, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_POST_TIMESTEP_MODIFICATIONS:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->post_timestep_modifications, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_STEP, &rebx->post_timestep_modifications, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -470,9 +635,9 @@ static int rebx_load_rebx(struct rebx_extras* rebx, FILE* inf, enum rebx_input_b
     return 1;
 }
 
-static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_snapshot(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
-    if (!fread(&field, sizeof(field), 1, inf)){
+    if (!rebx_input_read_field(in, &field)){
         *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
         return 0;
     }
@@ -483,24 +648,33 @@ static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
 
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
             break;
         }
+        const long start = in->pos;
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_REBX_STRUCTURE:
             {
-                if (!rebx_load_rebx(rebx, inf, warnings)){
+                if (!rebx_load_rebx(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_REBX_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PARTICLES:
             {
-                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARTICLE, NULL, inf, warnings)){
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARTICLE, NULL, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARAM_COLUMNS:
+            {
+                if (!rebx_load_list(rebx, REBX_BINARY_FIELD_TYPE_PARAM_COLUMN, NULL, in, warnings)){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
@@ -512,7 +686,7 @@ static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
             default:
             {
                 *warnings |= REBX_INPUT_BINARY_WARNING_LIST_UNKNOWN;
-                rebx_input_skip_binary_field(inf, field.size);
+                rebx_input_data(in, field.size);
                 break;
             }
         }
@@ -522,11 +696,11 @@ static int rebx_load_snapshot(struct rebx_extras* rebx, FILE* inf, enum rebx_inp
 }
 
 // Only fails (returns 0) if binary is in wrong format
-static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, FILE* inf, enum rebx_input_binary_messages* warnings){
+static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type expected_type, struct rebx_node** ap, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
     struct rebx_binary_field field;
     int reading_fields = 1;
     while (reading_fields){
-        if (!fread(&field, sizeof(field), 1, inf)){
+        if (!rebx_input_read_field(in, &field)){
             return 0;
         }
         
@@ -540,60 +714,68 @@ static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type
         }
         
         // Only will have fields of expected_type, check function to call
+        const long start = in->pos;
         switch (field.type){
             case REBX_BINARY_FIELD_TYPE_PARAM:
             {
-                if(!rebx_load_param(rebx, ap, inf, warnings)){
+                if(!rebx_load_param(rebx, ap, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_PARAM_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM:
             {
-                if(!rebx_load_registered_param(rebx, inf, warnings)){
+                if(!rebx_load_registered_param(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_ERROR_REGISTERED_PARAM_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_FORCE:
             {
-                if (!rebx_load_force_field(rebx, inf, warnings)){
+                if (!rebx_load_force_field(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_FORCE_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE:
             {
-                if (!rebx_load_additional_force_field(rebx, inf, warnings)){
+                if (!rebx_load_additional_force_field(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_ADDITIONAL_FORCE_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_OPERATOR:
             {
-                if (!rebx_load_operator_field(rebx, inf, warnings)){
+                if (!rebx_load_operator_field(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_OPERATOR_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_STEP:
             {
-                if (!rebx_load_step_field(rebx, inf, warnings, ap)){
+                if (!rebx_load_step_field(rebx, in, warnings, ap)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_STEP_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
                 }
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PARTICLE:
             {
-                if (!rebx_load_particle(rebx, inf, warnings)){
+                if (!rebx_load_particle(rebx, in, warnings)){
                     *warnings |= REBX_INPUT_BINARY_WARNING_PARTICLE_PARAMS_NOT_LOADED;
-                    rebx_input_skip_binary_field(inf, field.size);
+                    rebx_input_skip_object(in, start, field.size);
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARAM_COLUMN:
+            {
+                if (!rebx_load_param_column(rebx, in, warnings)){
+                    *warnings |= REBX_INPUT_BINARY_WARNING_PARAM_COLUMN_NOT_LOADED;
                 }
                 break;
             }
@@ -607,21 +789,56 @@ static int rebx_load_list(struct rebx_extras* rebx, enum rebx_binary_field_type
     return 1;
 }
 
-static void rebx_input_read_header(FILE* inf, enum rebx_input_binary_messages* warnings){
-    long objects = 0;
+// Returns 0 if the header is not of the type of file in str
+static int rebx_input_read_header(struct rebx_input_buffer* const in, const char* const str, enum rebx_input_binary_messages* warnings){
     // Input header.
-    const char str[] = "REBOUNDx Binary File. Version: ";
     const char zero = '\0';
-    char readbuf[65], curvbuf[65];
+    char readbuf[65] = {0}, curvbuf[65];
     sprintf(curvbuf,"%s%s",str,rebx_version_str);
     memcpy(curvbuf+strlen(curvbuf)+1,rebx_githash_str,sizeof(char)*(62-strlen(curvbuf)));
     curvbuf[63] = zero;
     
-    objects += fread(readbuf,sizeof(*str),64,inf);
+    const char* const header = rebx_input_data(in, 64);
+    if (header != NULL){
+        memcpy(readbuf, header, 64);
+    }
     // Note: following compares version, but ignores githash.
     if(strcmp(readbuf,curvbuf)!=0){
         *warnings |= REBX_INPUT_BINARY_WARNING_VERSION;
     }
+    return strncmp(readbuf, str, strlen(str)) == 0;
+}
+
+// Maps the whole file into in.  Returns the map to be passed to munmap, NULL if the file is empty
+static void* rebx_input_map(const char* const filename, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
+    in->data = NULL;
+    in->size = 0;
+    in->pos = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NOFILE;
+        return NULL;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0){
+        close(fd);
+        *warnings |= REBX_INPUT_BINARY_ERROR_NOFILE;
+        return NULL;
+    }
+    void* map = NULL;
+    if (sb.st_size > 0){
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED){
+            close(fd);
+            *warnings |= REBX_INPUT_BINARY_ERROR_NOFILE;
+            return NULL;
+        }
+        in->data = map;
+        in->size = sb.st_size;
+    }
+    // the file descriptor is no longer needed since we are memory mapped
+    close(fd);
+    return map;
 }
 
 void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const filename, enum rebx_input_binary_messages* warnings){
@@ -629,30 +846,25 @@ void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const fi
         rebx_error(rebx, ""); // rebx_error gives meaningful err
         return;
     }
-    FILE* inf = fopen(filename,"rb");
-    if (!inf){
-        *warnings |= REBX_INPUT_BINARY_ERROR_NOFILE;
+    struct rebx_input_buffer in;
+    void* const map = rebx_input_map(filename, &in, warnings);
+    if (*warnings & REBX_INPUT_BINARY_ERROR_NOFILE){
         return;
     }
+    if (map != NULL){
+        madvise(map, in.size, MADV_SEQUENTIAL);
+    }
     
-    rebx_input_read_header(inf, warnings);
-    rebx_load_snapshot(rebx, inf, warnings);
+    rebx_input_read_header(&in, "REBOUNDx Binary File. Version: ", warnings);
+    rebx_load_snapshot(rebx, &in, warnings);
     
-    fclose(inf);
+    if (map != NULL){
+        munmap(map, in.size);
+    }
     return;
 }
 
-struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, const char* const filename){
-    if (sim == NULL){
-        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_binary was NULL.\n");
-        return NULL;
-    }
-    enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
-    // create manually so that default registered parameters not loaded
-    struct rebx_extras* rebx = malloc(sizeof(*rebx));
-    rebx_initialize(sim, rebx);
-    rebx_init_extras_from_binary(rebx, filename, &warnings);
-    
+static void rebx_input_report(struct reb_simulation* sim, const enum rebx_input_binary_messages warnings){
     if (warnings & REBX_INPUT_BINARY_ERROR_NOFILE){
         reb_error(sim,"REBOUNDx: Cannot open binary file. Check filename.");
     }
@@ -701,6 +913,298 @@ struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, c
     if (warnings & REBX_INPUT_BINARY_WARNING_FORCE_PARAM_NOT_LOADED){
         reb_warning(sim,"REBOUNDx: A force parameter failed to load from the list of REBOUNDx implemented forces. Custom forces can't be saved to a REBOUNDx binary, and function points must be reset when a simulation is reloaded.");
     }
+    if (warnings & REBX_INPUT_BINARY_WARNING_PARAM_COLUMN_NOT_LOADED){
+        reb_warning(sim,"REBOUNDx: At least one parameter column was not loaded fully from the binary file.");
+    }
+}
+
+struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, const char* const filename){
+    if (sim == NULL){
+        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_binary was NULL.\n");
+        return NULL;
+    }
+    enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
+    // create manually so that default registered parameters not loaded
+    struct rebx_extras* rebx = malloc(sizeof(*rebx));
+    rebx_initialize(sim, rebx);
+    rebx_init_extras_from_binary(rebx, filename, &warnings);
+    rebx_input_report(sim, warnings);
+    return rebx;
+}
+
+/************************************************************
+ Archive.  See output.c for the format
+ ************************************************************/
+
+static void rebx_load_changes(struct rebx_extras* rebx, const char* const data, const long size, const char* const* const names, const int N_names, enum rebx_input_binary_messages* warnings){
+    struct reb_simulation* const sim = rebx->sim;
+    long pos = 0;
+    while (pos < size){
+        struct rebx_archive_change change;
+        if (size - pos < (long)sizeof(change)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            return;
+        }
+        memcpy(&change, data + pos, sizeof(change));
+        pos += sizeof(change);
+        if (change.size < 0 || change.size > size - pos || change.name < 0 || change.name >= N_names){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            return;
+        }
+        const char* const name = names[change.name];
+        const char* const value = data + pos;
+        pos += change.size;
+        
+        void* dest = NULL;
+        size_t dest_size = 0;
+        struct rebx_node* ap = NULL;
+        switch (change.kind){
+            case REBX_ARCHIVE_CHANGE_PARTICLE:
+            {
+                if (change.owner >= 0 && change.owner < sim->N){
+                    ap = sim->particles[change.owner].ap;
+                }
+                break;
+            }
+            case REBX_ARCHIVE_CHANGE_FORCE:
+            {
+                struct rebx_force* const force = change.owner >= 0 && change.owner < N_names ? rebx_get_force(rebx, names[change.owner]) : NULL;
+                if (force != NULL){
+                    ap = force->ap;
+                }
+                break;
+            }
+            case REBX_ARCHIVE_CHANGE_OPERATOR:
+            {
+                struct rebx_operator* const operator = change.owner >= 0 && change.owner < N_names ? rebx_get_operator(rebx, names[change.owner]) : NULL;
+                if (operator != NULL){
+                    ap = operator->ap;
+                }
+                break;
+            }
+            case REBX_ARCHIVE_CHANGE_COLUMN:
+            {
+                struct rebx_param_column* const column = rebx_get_param_column(rebx, rebx_param_resolve(rebx, name));
+                if (change.owner >= 0 && rebx_param_column_present(column, change.owner)){
+                    dest_size = rebx_sizeof(rebx, column->type);
+                    dest = (char*)column->values + change.owner*dest_size;
+                }
+                break;
+            }
+        }
+        if (ap != NULL){
+            struct rebx_param* const param = rebx_get_param_struct(rebx, ap, name);
+            if (param != NULL && param->type != REBX_TYPE_POINTER && param->type != REBX_TYPE_FORCE){
+                dest = param->value;
+                dest_size = rebx_sizeof(rebx, param->type);
+            }
+        }
+        if (dest == NULL || dest_size != (size_t)change.size){
+            *warnings |= REBX_INPUT_BINARY_WARNING_PARAM_NOT_LOADED;
+            continue;
+        }
+        memcpy(dest, value, change.size);
+    }
+}
+
+// The names the changes refer to come before them
+static void rebx_load_delta(struct rebx_extras* rebx, struct rebx_input_buffer* const in, enum rebx_input_binary_messages* warnings){
+    const char** names = NULL;
+    int N_names = 0;
+    struct rebx_binary_field field;
+    int reading_fields = 1;
+    while (reading_fields){
+        if (!rebx_input_read_field(in, &field)){
+            *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            break;
+        }
+        switch (field.type){
+            case REBX_BINARY_FIELD_TYPE_NAME:
+            {
+                const char* const name = rebx_input_string(in, field.size);
+                const char** const p = realloc(names, (N_names + 1)*sizeof(*names));
+                if (name == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                }
+                else if (p == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+                }
+                else{
+                    names = p;
+                    names[N_names++] = name;
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_ARCHIVE_CHANGES:
+            {
+                const char* const data = rebx_input_data(in, field.size);
+                if (data == NULL){
+                    *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                }
+                else{
+                    rebx_load_changes(rebx, data, field.size, names, N_names, warnings);
+                }
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_END:
+                reading_fields=0;
+                break;
+            default:
+            {
+                *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+                rebx_input_data(in, field.size);
+                break;
+            }
+        }
+    }
+    free(names);
+}
+
+void rebx_free_archive(struct rebx_archive* archive){
+    if (archive == NULL){
+        return;
+    }
+    if (archive->map != NULL){
+        munmap(archive->map, archive->size);
+    }
+    free(archive->t);
+    free(archive->offsets);
+    free(archive->keyframes);
+    free(archive);
+}
+
+// Hops from record to record, so only the time of each is read.  A last record that is cut short, e.g. because the run was killed while appending, is left out
+struct rebx_archive* rebx_open_archive(const char* const filename, enum rebx_input_binary_messages* warnings){
+    struct rebx_archive* const archive = calloc(1, sizeof(*archive));
+    if (archive == NULL){
+        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+        return NULL;
+    }
+    struct rebx_input_buffer in;
+    archive->map = rebx_input_map(filename, &in, warnings);
+    archive->size = in.size;
+    if (*warnings & REBX_INPUT_BINARY_ERROR_NOFILE){
+        free(archive);
+        return NULL;
+    }
+    if (!rebx_input_read_header(&in, "REBOUNDx Archive File. Version: ", warnings)){
+        *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+        rebx_free_archive(archive);
+        return NULL;
+    }
+    madvise(archive->map, archive->size, MADV_RANDOM);
+    
+    int N_alloc = 0;
+    int keyframe = -1;
+    struct rebx_binary_field field;
+    while (rebx_input_read_field(&in, &field)){
+        const long start = in.pos;
+        if (field.size < 0 || field.size > in.size - start){
+            break;
+        }
+        if (field.type == REBX_BINARY_FIELD_TYPE_ARCHIVE_KEYFRAME || field.type == REBX_BINARY_FIELD_TYPE_ARCHIVE_DELTA){
+            struct rebx_binary_field time;
+            const char* t = NULL;
+            if (rebx_input_read_field(&in, &time) && time.type == REBX_BINARY_FIELD_TYPE_ARCHIVE_TIME && time.size == sizeof(double)){
+                t = rebx_input_data(&in, sizeof(double));
+            }
+            if (t == NULL){
+                *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+                break;
+            }
+            if (field.type == REBX_BINARY_FIELD_TYPE_ARCHIVE_KEYFRAME){
+                keyframe = archive->N;
+            }
+            if (keyframe < 0){      // deltas need a keyframe before them
+                *warnings |= REBX_INPUT_BINARY_ERROR_CORRUPT;
+            }
+            else{
+                if (archive->N == N_alloc){
+                    N_alloc = N_alloc ? 2*N_alloc : 64;
+                    double* const ts = realloc(archive->t, N_alloc*sizeof(*ts));
+                    if (ts != NULL){
+                        archive->t = ts;
+                    }
+                    long* const offsets = realloc(archive->offsets, N_alloc*sizeof(*offsets));
+                    if (offsets != NULL){
+                        archive->offsets = offsets;
+                    }
+                    int* const keyframes = realloc(archive->keyframes, N_alloc*sizeof(*keyframes));
+                    if (keyframes != NULL){
+                        archive->keyframes = keyframes;
+                    }
+                    if (ts == NULL || offsets == NULL || keyframes == NULL){
+                        *warnings |= REBX_INPUT_BINARY_ERROR_NO_MEMORY;
+                        break;
+                    }
+                }
+                memcpy(&archive->t[archive->N], t, sizeof(double));
+                archive->offsets[archive->N] = start - sizeof(field);
+                archive->keyframes[archive->N] = keyframe;
+                archive->N++;
+            }
+        }
+        else{
+            *warnings |= REBX_INPUT_BINARY_WARNING_FIELD_UNKNOWN;
+        }
+        in.pos = start + field.size;
+    }
+    return archive;
+}
+
+int rebx_archive_find(const struct rebx_archive* const archive, const double t){
+    int lo = -1;                // t[lo] <= t < t[hi]
+    int hi = archive->N;
+    while (hi - lo > 1){
+        const int mid = lo + (hi - lo)/2;
+        if (archive->t[mid] <= t){
+            lo = mid;
+        }
+        else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Loads the keyframe the snapshot starts from, and applies the deltas after it in order
+void rebx_init_extras_from_archive(struct rebx_extras* rebx, const struct rebx_archive* const archive, const int snapshot, enum rebx_input_binary_messages* warnings){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return;
+    }
+    if (archive == NULL || snapshot < 0 || snapshot >= archive->N){
+        rebx_error(rebx, "REBOUNDx Error: Snapshot passed to rebx_init_extras_from_archive is out of range.\n");
+        return;
+    }
+    struct rebx_input_buffer in = {.data = archive->map, .size = archive->size, .pos = 0};
+    for (int i=archive->keyframes[snapshot]; i<=snapshot; i++){
+        in.pos = archive->offsets[i];
+        struct rebx_binary_field field;
+        struct rebx_binary_field time;
+        rebx_input_read_field(&in, &field);     // both checked when the archive was opened
+        rebx_input_read_field(&in, &time);
+        rebx_input_data(&in, time.size);
+        if (field.type == REBX_BINARY_FIELD_TYPE_ARCHIVE_KEYFRAME){
+            rebx_load_snapshot(rebx, &in, warnings);
+        }
+        else{
+            rebx_load_delta(rebx, &in, warnings);
+        }
+    }
+}
+
+struct rebx_extras* rebx_create_extras_from_archive(struct reb_simulation* sim, const struct rebx_archive* const archive, const int snapshot){
+    if (sim == NULL){
+        fprintf(stderr, "REBOUNDx Error: Simulation pointer passed to rebx_create_extras_from_archive was NULL.\n");
+        return NULL;
+    }
+    enum rebx_input_binary_messages warnings = REBX_INPUT_BINARY_WARNING_NONE;
+    // create manually so that default registered parameters not loaded
+    struct rebx_extras* rebx = malloc(sizeof(*rebx));
+    rebx_initialize(sim, rebx);
+    rebx_init_extras_from_archive(rebx, archive, snapshot, &warnings);
+    rebx_input_report(sim, warnings);
     return rebx;
 }
 
@@ -711,7 +1215,9 @@ FILE* rebx_input_inspect_binary(const char* const filename, enum rebx_input_bina
         return NULL;
     }
     
-    rebx_input_read_header(inf, warnings);
+    char header[64];
+    struct rebx_input_buffer in = {.data = header, .size = fread(header, 1, sizeof(header), inf), .pos = 0};
+    rebx_input_read_header(&in, "REBOUNDx Binary File. Version: ", warnings);
     return inf;
 }
 
@@ -33,12 +33,12 @@
 
 void rebx_integrate_force(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
     struct rebx_extras* rebx = sim->extras;
-    struct rebx_force* force = rebx_get_param(rebx, operator->ap, "force");
+    struct rebx_force* force = rebx_get_param_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_force));
     if (force == NULL){
         reb_error(sim, "REBOUNDx Error: Force parameter not set in rebx_integrate operator. See examples for how to add as a parameter.\n");
     }
     enum rebx_integrator integrator = REBX_INTEGRATOR_EULER; // default
-    enum rebx_integrator* integratorparam = rebx_get_param(rebx, operator->ap, "integrator");
+    enum rebx_integrator* integratorparam = rebx_get_param_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_integrator));
     if (integratorparam != NULL){
         integrator = *integratorparam;
     }
@@ -48,7 +48,7 @@ void rebx_integrate_force(struct reb_simulation* const sim, struct rebx_operator
     switch(integrator){
         case REBX_INTEGRATOR_IMPLICIT_MIDPOINT:
         {
-            rebx_integrator_implicit_midpoint_integrate(sim, dt, force);
+            rebx_integrator_implicit_midpoint_integrate(sim, operator, dt, force);
             break;
         }
         case REBX_INTEGRATOR_RK2:
@@ -61,6 +61,11 @@ void rebx_integrate_force(struct reb_simulation* const sim, struct rebx_operator
             rebx_integrator_rk4_integrate(sim, dt, force);
             break;
         }
+        case REBX_INTEGRATOR_DOPRI5:
+        {
+            rebx_integrator_dopri5_integrate(sim, operator, dt, force);
+            break;
+        }
         case REBX_INTEGRATOR_EULER:
         {
             rebx_integrator_euler_integrate(sim, dt, force);
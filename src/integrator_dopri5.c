@@ -0,0 +1,186 @@
+/**
+ * @file    dopri5.c
+ * @brief   Adaptive Dormand-Prince 5(4) Runge Kutta method
+ * @author  Dan Tamayo <tamayo.daniel@gmail.com>, Hanno Rein
+ *
+ * @section LICENSE
+ *
+ * This file is part of reboundx.
+ *
+ * reboundx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * reboundx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Sub-steps across the operator's timestep, with the sub-step set by the 4th order embedded error estimate (Dormand & Prince 1980).
+ * The last stage of an accepted sub-step is the first of the next.  Optional parameters of the integrate_force operator used with this integrator:
+ *
+ * ============================ =========== ==================================================================
+ * Name (C type)                Required    Description
+ * ============================ =========== ==================================================================
+ * tolerance (double)           No          Error per sub-step relative to the velocities (default 1e-10)
+ * max_iterations (int)         No          Maximum number of sub-steps, accepted or not, per timestep (default 100000)
+ * force_evaluations (int)      No          Set by the integrator to the number of force evaluations in the last timestep (added on the first timestep, which costs one schedule rebuild)
+ * ============================ =========== ==================================================================
+ *
+ * The sub-step is kept between timesteps, so the first sub-step of a timestep is the last accepted one of the previous timestep.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "rebound.h"
+#include "reboundx.h"
+#include "core.h"
+
+static const double rebx_dopri5_a[7][6] = {
+    {0.},
+    {1./5.},
+    {3./40., 9./40.},
+    {44./45., -56./15., 32./9.},
+    {19372./6561., -25360./2187., 64448./6561., -212./729.},
+    {9017./3168., -355./33., 46732./5247., 49./176., -5103./18656.},
+    {35./384., 0., 500./1113., 125./192., -2187./6784., 11./84.},   // 5th order solution
+};
+
+// 5th minus 4th order weights
+static const double rebx_dopri5_e[7] = {71./57600., 0., -71./16695., 71./1920., -17253./339200., 22./525., -1./40.};
+
+// ps.v = v0 + h*sum_j a[s][j]*k[j].  ps.a is reset for the force.
+static void rebx_dopri5_stage(struct reb_particle* const ps, const struct reb_particle* const ps0, double* const k[7], const int stride, const int N, const int s, const double h){
+    const double* const a = rebx_dopri5_a[s];
+    for(int i=0; i<N; i++){
+        double dvx = 0., dvy = 0., dvz = 0.;
+        for(int j=0; j<s; j++){
+            dvx += a[j]*k[j][i];
+            dvy += a[j]*k[j][stride+i];
+            dvz += a[j]*k[j][2*stride+i];
+        }
+        ps[i].vx = ps0[i].vx + h*dvx;
+        ps[i].vy = ps0[i].vy + h*dvy;
+        ps[i].vz = ps0[i].vz + h*dvz;
+        ps[i].ax = 0.;
+        ps[i].ay = 0.;
+        ps[i].az = 0.;
+    }
+}
+
+static void rebx_dopri5_store(double* const k, const struct reb_particle* const ps, const int stride, const int N){
+    for(int i=0; i<N; i++){
+        k[i] = ps[i].ax;
+        k[stride+i] = ps[i].ay;
+        k[2*stride+i] = ps[i].az;
+    }
+}
+
+void rebx_integrator_dopri5_integrate(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt, struct rebx_force* const force){
+    struct rebx_extras* rebx = sim->extras;
+    const int N = sim->N - sim->N_var;
+    struct rebx_integrator_workspace* const ws = rebx_integrator_workspace_get(rebx, N);
+    struct rebx_integrator_history* const history = rebx_integrator_history_get(rebx, force, N);
+    if (ws == NULL || history == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for dopri5 integrator.\n");
+        return;
+    }
+    int max_iterations = 100000;
+    double tolerance = 1e-10;
+    if (operator != NULL){
+        const int* const max_iterations_ptr = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_max_iterations));
+        if (max_iterations_ptr != NULL){
+            max_iterations = *max_iterations_ptr;
+        }
+        const double* const tolerance_ptr = rebx_get_param_double_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_tolerance));
+        if (tolerance_ptr != NULL){
+            tolerance = *tolerance_ptr;
+        }
+    }
+    
+    const int stride = ws->N_alloc;
+    struct reb_particle* const ps = ws->ps;     // positions stay those of sim->particles, which hold the velocities at the start of the sub-step
+    struct reb_particle* const ps0 = sim->particles;
+    double* k[7];
+    for(int s=0; s<7; s++){
+        k[s] = ws->vec[s];
+    }
+    memcpy(ps, sim->particles, N*sizeof(*ps));
+    
+    // Sub-steps have the sign of dt, for integrating backwards
+    double h = history->h != 0. && history->h*dt > 0. ? history->h : dt;
+    double t = 0.;
+    int evaluations = 0;
+    int n;
+    
+    rebx_dopri5_stage(ps, ps0, k, stride, N, 0, 0.);
+    force->update_accelerations(sim, force, ps, N);
+    evaluations++;
+    rebx_dopri5_store(k[0], ps, stride, N);
+    
+    for(n=0; n<max_iterations && fabs(t) < fabs(dt); n++){
+        const int last = fabs(h) >= fabs(dt - t);
+        const double h_sub = last ? dt - t : h;
+        for(int s=1; s<7; s++){
+            rebx_dopri5_stage(ps, ps0, k, stride, N, s, h_sub);
+            force->update_accelerations(sim, force, ps, N);
+            evaluations++;
+            rebx_dopri5_store(k[s], ps, stride, N);
+        }
+        // ps.v is now the 5th order solution
+        double err2 = 0.;
+        double v2 = 0.;
+        for(int i=0; i<N; i++){
+            double ex = 0., ey = 0., ez = 0.;
+            for(int s=0; s<7; s++){
+                ex += rebx_dopri5_e[s]*k[s][i];
+                ey += rebx_dopri5_e[s]*k[s][stride+i];
+                ez += rebx_dopri5_e[s]*k[s][2*stride+i];
+            }
+            err2 += ex*ex + ey*ey + ez*ez;
+            v2 += ps[i].vx*ps[i].vx + ps[i].vy*ps[i].vy + ps[i].vz*ps[i].vz;
+        }
+        const double err = v2 > 0. ? fabs(h_sub)*sqrt(err2/v2)/tolerance : 0.;
+        double factor = err > 0. ? 0.9*pow(err, -0.2) : 5.;
+        factor = factor > 5. ? 5. : (factor < 0.2 ? 0.2 : factor);
+        if (err <= 1.){
+            t = last ? dt : t + h_sub;
+            for(int i=0; i<N; i++){
+                ps0[i].vx = ps[i].vx;
+                ps0[i].vy = ps[i].vy;
+                ps0[i].vz = ps[i].vz;
+            }
+            double* const k_last = k[6];        // first same as last
+            k[6] = k[0];
+            k[0] = k_last;
+            if (!last || factor < 1.){          // a sub-step shortened to end the timestep says little about the next one
+                h = h_sub*factor;
+            }
+        }
+        else{
+            h = h_sub*factor;
+        }
+    }
+    if (fabs(t) < fabs(dt)){
+        char str[300];
+        sprintf(str, "REBOUNDx: %d sub-steps in integrator_dopri5.c did not reach the end of the timestep. Increase max_iterations or tolerance.", max_iterations);
+        reb_warning(sim, str);
+    }
+    history->h = h;
+    if (operator != NULL){
+        // Only adding the param bumps param_generation; after that it is written in place.
+        int* const force_evaluations = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_force_evaluations));
+        if (force_evaluations != NULL){
+            *force_evaluations = evaluations;
+        }
+        else{
+            rebx_set_param_int(rebx, &operator->ap, "force_evaluations", evaluations);
+        }
+    }
+}
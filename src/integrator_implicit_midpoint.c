@@ -21,6 +21,17 @@
  * You should have received a copy of the GNU General Public License
  * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
  *
+ * Optional parameters of the integrate_force operator used with this integrator:
+ *
+ * ============================ =========== ==================================================================
+ * Name (C type)                Required    Description
+ * ============================ =========== ==================================================================
+ * max_iterations (int)         No          Maximum number of force evaluations per step (default 10)
+ * tolerance (double)           No          Relative change in the velocities at which the iteration stops (default DBL_EPSILON)
+ * force_evaluations (int)      No          Set by the integrator to the number of force evaluations in the last step (added on the first step, which costs one schedule rebuild)
+ * ============================ =========== ==================================================================
+ *
+ * Each step starts from the change of the velocities over the last step of the same force, scaled to the new timestep.
  */
 
 #include <stdlib.h>
@@ -29,96 +40,145 @@
 #include <float.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
 
-static void avg_particles(struct reb_particle* const ps_avg, struct reb_particle* const ps1, struct reb_particle* const ps2, int N){
+// Only the velocities of the midpoint change between iterations, the rest is a copy of the particles at the start of the step
+static void avg_particles(struct reb_particle* const ps_avg, struct reb_particle* const ps1, const double* const v2, const int stride, int N){
+    const double* const v2x = v2;
+    const double* const v2y = v2 + stride;
+    const double* const v2z = v2 + 2*stride;
     for(int i=0; i<N; i++){
-        ps_avg[i].x = 0.5*(ps1[i].x + ps2[i].x);
-        ps_avg[i].y = 0.5*(ps1[i].y + ps2[i].y);
-        ps_avg[i].z = 0.5*(ps1[i].z + ps2[i].z);
-        ps_avg[i].vx = 0.5*(ps1[i].vx + ps2[i].vx);
-        ps_avg[i].vy = 0.5*(ps1[i].vy + ps2[i].vy);
-        ps_avg[i].vz = 0.5*(ps1[i].vz + ps2[i].vz);
+        ps_avg[i].vx = 0.5*(ps1[i].vx + v2x[i]);
+        ps_avg[i].vy = 0.5*(ps1[i].vy + v2y[i]);
+        ps_avg[i].vz = 0.5*(ps1[i].vz + v2z[i]);
         ps_avg[i].ax = 0.;
         ps_avg[i].ay = 0.;
         ps_avg[i].az = 0.;
-        ps_avg[i].m = 0.5*(ps1[i].m + ps2[i].m);
-    }
-}
-
-static int compare(struct reb_particle* ps1, struct reb_particle* ps2, int N){
-    double tot2 = 0.;
-    double deltatot2 = 0.;
-    for(int i=0; i<N; i++){
-        const double dvx = ps1[i].vx - ps2[i].vx;
-        const double dvy = ps1[i].vy - ps2[i].vy;
-        const double dvz = ps1[i].vz - ps2[i].vz;
-        deltatot2 += dvx*dvx + dvy*dvy + dvz*dvz;
-        tot2 += ps1[i].vx*ps1[i].vx + ps1[i].vy*ps1[i].vy + ps1[i].vz*ps1[i].vz;
-    }
-    if (deltatot2/tot2 < DBL_EPSILON*DBL_EPSILON){
-        return 1;
     }
-    else{
-        return 0;
-    }
-}
-
-void rebx_im_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
-    struct reb_particle* const ps_final = rebx_get_param(rebx, force->ap, "ps_final");
-    free(ps_final);
-    struct reb_particle* const ps_prev = rebx_get_param(rebx, force->ap, "ps_prev");
-    free(ps_prev);
-    struct reb_particle* const ps_avg = rebx_get_param(rebx, force->ap, "ps_avg");
-    free(ps_avg);
 }
 
-static struct reb_particle* setup(struct rebx_extras* rebx, struct rebx_force* force, const int N){
-    rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_im_free_arrays);
-    struct reb_particle* const ps_final = malloc(N*sizeof(*ps_final));
-    rebx_set_param_pointer(rebx, &force->ap, "im_ps_final", ps_final);
-    struct reb_particle* const ps_prev = malloc(N*sizeof(*ps_prev));
-    rebx_set_param_pointer(rebx, &force->ap, "im_ps_prev", ps_prev);
-    struct reb_particle* const ps_avg = malloc(N*sizeof(*ps_avg));
-    rebx_set_param_pointer(rebx, &force->ap, "im_ps_avg", ps_avg);
-    
-    return ps_final;
-}
-
-void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force){
+void rebx_integrator_implicit_midpoint_integrate(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt, struct rebx_force* const force){
     struct rebx_extras* rebx = sim->extras;
     const int N = sim->N - sim->N_var;
-    struct reb_particle* ps_final = rebx_get_param(rebx, force->ap, "im_ps_final");
-    if (ps_final == NULL){
-        ps_final = setup(rebx, force, N);
+    struct rebx_integrator_workspace* const ws = rebx_integrator_workspace_get(rebx, N);
+    struct rebx_integrator_history* const history = rebx_integrator_history_get(rebx, force, N);
+    if (ws == NULL || history == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for implicit midpoint integrator.\n");
+        return;
+    }
+    int max_iterations = 10;
+    double tolerance = DBL_EPSILON;
+    if (operator != NULL){
+        const int* const max_iterations_ptr = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_max_iterations));
+        if (max_iterations_ptr != NULL){
+            max_iterations = *max_iterations_ptr;
+        }
+        const double* const tolerance_ptr = rebx_get_param_double_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_tolerance));
+        if (tolerance_ptr != NULL){
+            tolerance = *tolerance_ptr;
+        }
     }
-    // These should not fail since we check above and setup if not there
-    struct reb_particle* const ps_prev = rebx_get_param(rebx, force->ap, "im_ps_prev");
-    struct reb_particle* const ps_avg = rebx_get_param(rebx, force->ap, "im_ps_avg");
+    
+    // Fixed point iteration for the final velocities v = v0 + dt*a((v0 + v)/2)
+    const int stride = ws->N_alloc;
+    struct reb_particle* const ps_avg = ws->ps;
+    double* const v = ws->vec[0];               // current guess
+    double* g = ws->vec[1];                     // v0 + dt*a at the current guess
+    double* g_prev = ws->vec[2];
+    double* const f_prev = ws->vec[3];          // g - v of the last iteration
     struct reb_particle* const ps_orig = sim->particles;
-    memcpy(ps_final, sim->particles, N*sizeof(*ps_final));
     memcpy(ps_avg, sim->particles, N*sizeof(*ps_orig));
-    int n, converged;
-    for(n=0;n<10;n++){
-        memcpy(ps_prev, ps_final, N*sizeof(*ps_prev));
+    
+    // Start from the change of the velocities over the last step, scaled to this one
+    const double scale = history->N == N && history->dt != 0. ? dt/history->dt : 0.;
+    for(int i=0; i<N; i++){
+        v[i] = ps_orig[i].vx;
+        v[stride+i] = ps_orig[i].vy;
+        v[2*stride+i] = ps_orig[i].vz;
+    }
+    if (scale != 0.){
+        for(int i=0; i<N; i++){
+            v[i] += scale*history->dv[i];
+            v[stride+i] += scale*history->dv[N+i];
+            v[2*stride+i] += scale*history->dv[2*N+i];
+        }
+        avg_particles(ps_avg, ps_orig, v, stride, N);
+    }
+    
+    // After the first iteration each particle's next guess is the combination of its last two iterates that minimizes its linearized
+    // residual (Anderson mixing of depth one, per particle), which Picard iteration approaches slowly for strongly velocity-dependent forces.
+    const double tolerance2 = tolerance*tolerance;
+    double* v_final = g;
+    int n, converged = 0;
+    for(n=0; n<max_iterations; n++){
         force->update_accelerations(sim, force, ps_avg, N);
+        double tot2 = 0.;
+        double deltatot2 = 0.;
         for(int i=0; i<N; i++){
-            ps_final[i].vx = ps_orig[i].vx + dt*ps_avg[i].ax;
-            ps_final[i].vy = ps_orig[i].vy + dt*ps_avg[i].ay;
-            ps_final[i].vz = ps_orig[i].vz + dt*ps_avg[i].az;
+            const int iy = stride+i;
+            const int iz = 2*stride+i;
+            g[i] = ps_orig[i].vx + dt*ps_avg[i].ax;
+            g[iy] = ps_orig[i].vy + dt*ps_avg[i].ay;
+            g[iz] = ps_orig[i].vz + dt*ps_avg[i].az;
+            const double fx = g[i] - v[i];
+            const double fy = g[iy] - v[iy];
+            const double fz = g[iz] - v[iz];
+            deltatot2 += fx*fx + fy*fy + fz*fz;
+            tot2 += g[i]*g[i] + g[iy]*g[iy] + g[iz]*g[iz];
+            double gamma = 0.;
+            if (n > 0){
+                const double dfx = fx - f_prev[i];
+                const double dfy = fy - f_prev[iy];
+                const double dfz = fz - f_prev[iz];
+                const double df2 = dfx*dfx + dfy*dfy + dfz*dfz;
+                if (df2 > 0.){
+                    gamma = (fx*dfx + fy*dfy + fz*dfz)/df2;
+                }
+            }
+            v[i] = g[i] - gamma*(g[i] - g_prev[i]);
+            v[iy] = g[iy] - gamma*(g[iy] - g_prev[iy]);
+            v[iz] = g[iz] - gamma*(g[iz] - g_prev[iz]);
+            f_prev[i] = fx;
+            f_prev[iy] = fy;
+            f_prev[iz] = fz;
         }
-        converged = compare(ps_final, ps_prev, N);
-        if (converged){
+        v_final = g;
+        if (deltatot2/tot2 < tolerance2){
+            converged = 1;
+            n++;
             break;
         }
-        avg_particles(ps_avg, ps_orig, ps_final, N);
+        double* const tmp = g_prev;
+        g_prev = g;
+        g = tmp;
+        avg_particles(ps_avg, ps_orig, v, stride, N);
+    }
+    if (operator != NULL && rebx->stats_enabled){
+        operator->stats.iterations += n;    // force evaluations
     }
-    const int default_max_iterations = 10;
-    if(n==default_max_iterations){
-        reb_warning(sim, "REBOUNDx: 10 iterations in integrator_implicit_midpoint.c failed to converge. This is typically because the perturbation is too strong for the current implementation.");
+    if(!converged){
+        char str[300];
+        sprintf(str, "REBOUNDx: %d iterations in integrator_implicit_midpoint.c failed to converge. This is typically because the perturbation is too strong for the current implementation.", max_iterations);
+        reb_warning(sim, str);
     }
     for(int i=0; i<N; i++){
-        sim->particles[i].vx = ps_final[i].vx;
-        sim->particles[i].vy = ps_final[i].vy;
-        sim->particles[i].vz = ps_final[i].vz;
+        history->dv[i] = v_final[i] - ps_orig[i].vx;
+        history->dv[N+i] = v_final[stride+i] - ps_orig[i].vy;
+        history->dv[2*N+i] = v_final[2*stride+i] - ps_orig[i].vz;
+        sim->particles[i].vx = v_final[i];
+        sim->particles[i].vy = v_final[stride+i];
+        sim->particles[i].vz = v_final[2*stride+i];
+    }
+    history->N = N;
+    history->dt = dt;
+    if (operator != NULL){
+        // Only adding the param bumps param_generation; after that it is written in place.
+        int* const force_evaluations = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_force_evaluations));
+        if (force_evaluations != NULL){
+            *force_evaluations = n;
+        }
+        else{
+            rebx_set_param_int(rebx, &operator->ap, "force_evaluations", n);
+        }
     }
 }
@@ -30,21 +30,15 @@
 #include "reboundx.h"
 #include "core.h"
 
-void rebx_rk2_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
-    struct reb_particle* const k2 = rebx_get_param(rebx, force->ap, "rk2_k2");
-    free(k2);
-}
-
 void rebx_integrator_rk2_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force){
     struct rebx_extras* rebx = sim->extras;
     const int N = sim->N - sim->N_var;
-    struct reb_particle* k2 = rebx_get_param(rebx, force->ap, "rk2_k2");
-    if (k2 == NULL){
-        k2 = malloc(N*sizeof(*k2));
-        rebx_set_param_pointer(rebx, &force->ap, "rk2_k2", k2);
-        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_rk2_free_arrays);
-        
+    struct rebx_integrator_workspace* const ws = rebx_integrator_workspace_get(rebx, N);
+    if (ws == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for rk2 integrator.\n");
+        return;
     }
+    struct reb_particle* const k2 = ws->ps;
     memcpy(k2, sim->particles, N*sizeof(*k2));
 
     force->update_accelerations(sim, force, sim->particles, N);
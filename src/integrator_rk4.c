@@ -30,62 +30,57 @@
 #include "reboundx.h"
 #include "core.h"
 
-void rebx_rk4_free_arrays(struct rebx_extras* rebx, struct rebx_force* force){
-    struct reb_particle* const k2 = rebx_get_param(rebx, force->ap, "rk4_k2");
-    free(k2);
-    struct reb_particle* const k3 = rebx_get_param(rebx, force->ap, "rk4_k3");
-    free(k3);
-}
-
 void rebx_integrator_rk4_integrate(struct reb_simulation* const sim, const double dt, struct rebx_force* const force){
     struct rebx_extras* rebx = sim->extras;
     const int N = sim->N - sim->N_var;
-    rebx_reset_accelerations(sim->particles, N);
-    struct reb_particle* k2 = rebx_get_param(rebx, force->ap, "rk4_k2");
-    if (k2 == NULL){
-        k2 = malloc(N*sizeof(*k2));
-        struct reb_particle* k3 = malloc(N*sizeof(*k3));
-        rebx_set_param_pointer(rebx, &force->ap, "rk4_k2", k2);
-        rebx_set_param_pointer(rebx, &force->ap, "rk4_k3", k3);
-        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_rk4_free_arrays);
-        
+    struct rebx_integrator_workspace* const ws = rebx_integrator_workspace_get(rebx, N);
+    if (ws == NULL){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for rk4 integrator.\n");
+        return;
     }
-    struct reb_particle* k3 = rebx_get_param(rebx, force->ap, "rk4_k3");
-    memcpy(k2, sim->particles, N*sizeof(*k2));
-    memcpy(k3, sim->particles, N*sizeof(*k3));
+    struct reb_particle* const ps = ws->ps;     // k2, k3 and k4 in turn
+    double* const a23x = ws->vec[0];            // k2+k3
+    double* const a23y = a23x + ws->N_alloc;
+    double* const a23z = a23y + ws->N_alloc;
+    rebx_reset_accelerations(sim->particles, N);
+    memcpy(ps, sim->particles, N*sizeof(*ps));
     
     const double dt2 = dt/2.;
     force->update_accelerations(sim, force, sim->particles, N);  // k1 = sim.particles.a
     
     for(int i=0; i<N; i++){
-        k2[i].vx = sim->particles[i].vx + dt2*sim->particles[i].ax;
-        k2[i].vy = sim->particles[i].vy + dt2*sim->particles[i].ay;
-        k2[i].vz = sim->particles[i].vz + dt2*sim->particles[i].az;
+        ps[i].vx = sim->particles[i].vx + dt2*sim->particles[i].ax;
+        ps[i].vy = sim->particles[i].vy + dt2*sim->particles[i].ay;
+        ps[i].vz = sim->particles[i].vz + dt2*sim->particles[i].az;
     }
-    force->update_accelerations(sim, force, k2, N);
+    force->update_accelerations(sim, force, ps, N);
     
     for(int i=0; i<N; i++){
-        k3[i].vx = sim->particles[i].vx + dt2*k2[i].ax;
-        k3[i].vy = sim->particles[i].vy + dt2*k2[i].ay;
-        k3[i].vz = sim->particles[i].vz + dt2*k2[i].az;
+        a23x[i] = ps[i].ax;
+        a23y[i] = ps[i].ay;
+        a23z[i] = ps[i].az;
+        ps[i].vx = sim->particles[i].vx + dt2*ps[i].ax;
+        ps[i].vy = sim->particles[i].vy + dt2*ps[i].ay;
+        ps[i].vz = sim->particles[i].vz + dt2*ps[i].az;
     }
-    force->update_accelerations(sim, force, k3, N);
+    rebx_reset_accelerations(ps, N);
+    force->update_accelerations(sim, force, ps, N);
     
-    for(int i=0; i<N; i++){     // store k2+k3 in k3 and reuse k2 for k4 to avoid a memcpy
-        k2[i].vx = sim->particles[i].vx + dt*k3[i].ax;
-        k2[i].vy = sim->particles[i].vy + dt*k3[i].ay;
-        k2[i].vz = sim->particles[i].vz + dt*k3[i].az;
-        k3[i].ax += k2[i].ax;
-        k3[i].ay += k2[i].ay;
-        k3[i].az += k2[i].az;
+    for(int i=0; i<N; i++){
+        a23x[i] += ps[i].ax;
+        a23y[i] += ps[i].ay;
+        a23z[i] += ps[i].az;
+        ps[i].vx = sim->particles[i].vx + dt*ps[i].ax;
+        ps[i].vy = sim->particles[i].vy + dt*ps[i].ay;
+        ps[i].vz = sim->particles[i].vz + dt*ps[i].az;
     }
-    rebx_reset_accelerations(k2, N);
-    force->update_accelerations(sim, force, k2, N);
+    rebx_reset_accelerations(ps, N);
+    force->update_accelerations(sim, force, ps, N);
     
     const double dt6 = dt/6.;
     for(int i=0; i<N; i++){
-        sim->particles[i].vx += dt6*(sim->particles[i].ax + k2[i].ax + 2.*k3[i].ax);
-        sim->particles[i].vy += dt6*(sim->particles[i].ay + k2[i].ay + 2.*k3[i].ay);
-        sim->particles[i].vz += dt6*(sim->particles[i].az + k2[i].az + 2.*k3[i].az);
+        sim->particles[i].vx += dt6*(sim->particles[i].ax + ps[i].ax + 2.*a23x[i]);
+        sim->particles[i].vy += dt6*(sim->particles[i].ay + ps[i].ay + 2.*a23y[i]);
+        sim->particles[i].vz += dt6*(sim->particles[i].az + ps[i].az + 2.*a23z[i]);
     }
 }
@@ -76,7 +76,7 @@ int rebx_remove_node(struct rebx_node** head, void* object){
     struct rebx_node* current = *head;
     if(current->object == object){ // edge case where force is first in list
         *head = current->next;
-        free(current);
+        rebx_free_node(current);
         return 1;
     }
     
@@ -85,7 +85,7 @@ int rebx_remove_node(struct rebx_node** head, void* object){
     while (current != NULL){
         if(current->object == object){
             prev->next = current->next;
-            free(current);
+            rebx_free_node(current);
             return 1;
         }
         prev = current;
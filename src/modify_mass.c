@@ -40,7 +40,16 @@
  * 
  * **Effect Parameters**
  * 
- * *None*
+ * ============================ =========== ==================================================================
+ * Field (C type)               Required    Description
+ * ============================ =========== ==================================================================
+ * mass_exponential (int)       No          If nonzero, masses are multiplied by exp(dt/tau_mass), exact for any operator timestep, instead of the first order update
+ * com_interval (int)           No          If set, shift the simulation to its center of mass every com_interval calls instead of every call (see below)
+ * ============================ =========== ==================================================================
+ * 
+ * Without ``com_interval`` the simulation is moved to its center of mass after every call. With it, the center of mass is
+ * found once and then followed from the mass changes alone, assuming the rest of the dynamics conserves momentum, and the
+ * particles are shifted by it every ``com_interval`` calls. Only the particles with ``tau_mass`` are visited between shifts.
  * 
  * **Particle Parameters**
  * 
@@ -59,16 +68,146 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
+#include "rebxtools.h"
+
+// Indices of the particles with tau_mass, rebuilt when rebx->param_generation or the number of particles changes.
+// With com_interval, com follows the center of mass between corrections.
+struct rebx_modify_mass_workspace {
+    uint64_t param_generation;
+    int N;
+    int n;
+    int* index;
+    int com_valid;
+    int calls;                  // since the last correction of the center of mass
+    double t;                   // sim->t at the last call
+    struct reb_particle com;
+};
+
+void rebx_modify_mass_free_arrays(struct rebx_extras* const rebx, struct rebx_operator* const operator){
+    struct rebx_modify_mass_workspace* const ws = rebx_get_param_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_modify_mass_workspace));
+    if (ws){
+        free(ws->index);
+        free(ws);
+    }
+}
+
+static struct rebx_modify_mass_workspace* rebx_modify_mass_workspace_get(struct rebx_extras* const rebx, struct rebx_operator* const operator){
+    struct rebx_modify_mass_workspace* ws = rebx_get_param_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_modify_mass_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        ws->N = -1;
+        rebx_set_param_pointer(rebx, &operator->ap, "modify_mass_workspace", ws);
+        rebx_set_param_pointer(rebx, &operator->ap, "free_arrays", rebx_modify_mass_free_arrays);
+    }
+    return ws;
+}
+
+static int rebx_modify_mass_build(struct rebx_extras* const rebx, struct rebx_modify_mass_workspace* const ws, struct reb_simulation* const sim, struct rebx_param_column* const column, const rebx_param_handle h, const int N){
+    int n = 0;
+    for (int i=0; i<N; i++){
+        n += rebx_get_particle_param_double(column, i, sim->particles[i].ap, h) != NULL;
+    }
+    int* const index = malloc((n > 0 ? n : 1)*sizeof(*index));
+    if (index == NULL){
+        return 0;
+    }
+    n = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_particle_param_double(column, i, sim->particles[i].ap, h) != NULL){
+            index[n++] = i;
+        }
+    }
+    free(ws->index);
+    ws->index = index;
+    ws->n = n;
+    ws->N = N;
+    ws->param_generation = rebx->param_generation;
+    return 1;
+}
 
 void rebx_modify_mass(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
+    struct rebx_extras* const rebx = sim->extras;
     const int _N_real = sim->N - sim->N_var;
-	for(int i=0; i<_N_real; i++){
-		struct reb_particle* const p = &sim->particles[i];
-        const double* const tau_mass = rebx_get_param(sim->extras, p->ap, "tau_mass");
-        if (tau_mass != NULL){
-		    p->m += p->m*dt/(*tau_mass);
+    const rebx_param_handle tau_mass_h = rebx_default_param(rebx, REBX_PARAM_tau_mass);
+    struct rebx_param_column* const tau_mass_column = rebx_get_param_column(rebx, tau_mass_h);
+    const int* const exponential = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_mass_exponential));
+    const int* const com_interval = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_com_interval));
+    struct rebx_modify_mass_workspace* const ws = rebx_modify_mass_workspace_get(rebx, operator);
+    if (ws == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for modify_mass.\n");
+        return;
+    }
+
+    struct reb_particle* const particles = sim->particles;
+    const int track_com = com_interval != NULL;
+    if (ws->N != _N_real || ws->param_generation != rebx->param_generation){
+        if (!rebx_modify_mass_build(rebx, ws, sim, tau_mass_column, tau_mass_h, _N_real)){
+            rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for modify_mass.\n");
+            return;
         }
-	}
-    reb_move_to_com(sim);
-}
+        ws->com_valid = 0;
+    }
+    if (track_com && !ws->com_valid){
+        ws->com = reb_get_com(sim);
+        ws->com_valid = 1;
+        ws->calls = 0;
+        ws->t = sim->t;
+    }
+    if (track_com){
+        // Between calls the center of mass moves with its velocity, as long as the other effects conserve momentum
+        const double elapsed = sim->t - ws->t;
+        ws->com.x += ws->com.vx*elapsed;
+        ws->com.y += ws->com.vy*elapsed;
+        ws->com.z += ws->com.vz*elapsed;
+    }
+    ws->t = sim->t;
+
+    const int exact = exponential != NULL && *exponential;
+    for (int k=0; k<ws->n; k++){
+        const int i = ws->index[k];
+        struct reb_particle* const p = &particles[i];
+        const double* const tau_mass = rebx_get_particle_param_double(tau_mass_column, i, p->ap, tau_mass_h);
+        if (tau_mass == NULL){      // removed since the list was built
+            continue;
+        }
+        if (track_com){
+            rebxtools_update_com_without_particle(&ws->com, p);
+        }
+        if (exact){
+            p->m *= exp(dt/(*tau_mass));
+        }
+        else{
+            p->m += p->m*dt/(*tau_mass);
+        }
+        if (track_com){
+            rebxtools_update_com_with_particle(&ws->com, p);
+        }
+    }
 
+    if (!track_com){
+        reb_move_to_com(sim);
+        ws->com_valid = 0;
+        return;
+    }
+    if (++ws->calls >= *com_interval){
+        for (int i=0; i<_N_real; i++){
+            particles[i].x -= ws->com.x;
+            particles[i].y -= ws->com.y;
+            particles[i].z -= ws->com.z;
+            particles[i].vx -= ws->com.vx;
+            particles[i].vy -= ws->com.vy;
+            particles[i].vz -= ws->com.vz;
+        }
+        ws->com.x = 0.;
+        ws->com.y = 0.;
+        ws->com.z = 0.;
+        ws->com.vx = 0.;
+        ws->com.vy = 0.;
+        ws->com.vz = 0.;
+        ws->calls = 0;
+    }
+}
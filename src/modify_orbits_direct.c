@@ -58,7 +58,7 @@
  * **Particle Parameters**
  *
  * One can pick and choose which particles have which parameters set.  
- * For each particle, any unset parameter is ignored.
+ * For each particle, any unset parameter is ignored, and particles with none of them set are left untouched.
  *
  * ============================ =========== ==================================================================
  * Field (C type)               Required    Description
@@ -77,56 +77,98 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
+#include "rebxtools.h"
+#include "rebxtools_com.h"
 
-static struct reb_particle rebx_calculate_modify_orbits_direct(struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* primary, const double dt){
+// Steps n particles about their sources. Particles with no tau_* set are left as they are rather than taken through a round trip
+// to orbital elements.
+static void rebx_modify_orbits_direct_batch(struct reb_simulation* const sim, struct rebx_operator* const operator, const int n, const int* const index, struct reb_particle* const ps, const struct reb_particle* const sources, const double dt){
     struct rebx_extras* const rebx = sim->extras;
-    int err=0;
-    struct reb_orbit o = reb_tools_particle_to_orbit_err(sim->G, *p, *primary, &err);
-    if(err){        // mass of primary was 0 or p = primary.  Return same particle without doing anything.
-        return *p;
+    const rebx_param_handle tau_a_h = rebx_default_param(rebx, REBX_PARAM_tau_a);
+    const rebx_param_handle tau_e_h = rebx_default_param(rebx, REBX_PARAM_tau_e);
+    const rebx_param_handle tau_inc_h = rebx_default_param(rebx, REBX_PARAM_tau_inc);
+    const rebx_param_handle tau_omega_h = rebx_default_param(rebx, REBX_PARAM_tau_omega);
+    const rebx_param_handle tau_Omega_h = rebx_default_param(rebx, REBX_PARAM_tau_Omega);
+    struct rebx_param_column* const tau_a_col = rebx_get_param_column(rebx, tau_a_h);
+    struct rebx_param_column* const tau_e_col = rebx_get_param_column(rebx, tau_e_h);
+    struct rebx_param_column* const tau_inc_col = rebx_get_param_column(rebx, tau_inc_h);
+    struct rebx_param_column* const tau_omega_col = rebx_get_param_column(rebx, tau_omega_h);
+    struct rebx_param_column* const tau_Omega_col = rebx_get_param_column(rebx, tau_Omega_h);
+    const double* const p_param = rebx_get_param_double_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_p));
+    const double coupling = p_param != NULL ? *p_param : 0.;
+
+    // Fractional changes over dt of the particles that are modified, which are packed at the front
+    int mod[REBX_COM_BATCH];
+    double da[REBX_COM_BATCH], de[REBX_COM_BATCH], dinc[REBX_COM_BATCH], domega[REBX_COM_BATCH], dOmega[REBX_COM_BATCH];
+    struct reb_particle p[REBX_COM_BATCH];
+    struct reb_particle primary[REBX_COM_BATCH];
+    int m = 0;
+    for (int k=0; k<n; k++){
+        const double* const tau_a = rebx_get_particle_param_double(tau_a_col, index[k], ps[k].ap, tau_a_h);
+        const double* const tau_e = rebx_get_particle_param_double(tau_e_col, index[k], ps[k].ap, tau_e_h);
+        const double* const tau_inc = rebx_get_particle_param_double(tau_inc_col, index[k], ps[k].ap, tau_inc_h);
+        const double* const tau_omega = rebx_get_particle_param_double(tau_omega_col, index[k], ps[k].ap, tau_omega_h);
+        const double* const tau_Omega = rebx_get_particle_param_double(tau_Omega_col, index[k], ps[k].ap, tau_Omega_h);
+        if (tau_a == NULL && tau_e == NULL && tau_inc == NULL && tau_omega == NULL && tau_Omega == NULL){
+            continue;
+        }
+        mod[m] = k;
+        da[m] = tau_a != NULL ? dt/(*tau_a) : 0.;
+        de[m] = tau_e != NULL ? dt/(*tau_e) : 0.;
+        dinc[m] = tau_inc != NULL ? dt/(*tau_inc) : 0.;
+        domega[m] = tau_omega != NULL ? 2.*M_PI*dt/(*tau_omega) : 0.;
+        dOmega[m] = tau_Omega != NULL ? 2.*M_PI*dt/(*tau_Omega) : 0.;
+        p[m] = ps[k];
+        primary[m] = sources[k];
+        m++;
+    }
+    if (m == 0){
+        return;
     }
-    const double* const tau_a = rebx_get_param(rebx, p->ap, "tau_a");
-    const double* const tau_e = rebx_get_param(rebx, p->ap, "tau_e");
-    const double* const tau_inc = rebx_get_param(rebx, p->ap, "tau_inc");
-    const double* const tau_omega = rebx_get_param(rebx, p->ap, "tau_omega");
-    const double* const tau_Omega = rebx_get_param(rebx, p->ap, "tau_Omega");
-    
-    const double a0 = o.a;
-    const double e0 = o.e;
-    const double inc0 = o.inc;
 
-	if(tau_a != NULL){
-    	o.a += a0*dt/(*tau_a);
-	}
-	if(tau_e != NULL){
-    	o.e += e0*dt/(*tau_e);
-	}
-	if(tau_inc != NULL){
-    	o.inc += inc0*dt/(*tau_inc);
-	}
-	if(tau_omega != NULL){
-    	o.omega += 2.*M_PI*dt/(*tau_omega);
-	}
-    if(tau_Omega != NULL){
-		o.Omega += 2.*M_PI*dt/(*tau_Omega);
-	}
-   
-    if(tau_e != NULL){
-        const double* const p_param = rebx_get_param(sim->extras, operator->ap, "p");
-        if(p_param != NULL){
-			o.a += 2.*a0*e0*e0*(*p_param)*dt/(*tau_e); // Coupling term between e and a
-		}
+    double a[REBX_COM_BATCH], e[REBX_COM_BATCH], inc[REBX_COM_BATCH], Omega[REBX_COM_BATCH], omega[REBX_COM_BATCH], f[REBX_COM_BATCH];
+    int err[REBX_COM_BATCH];
+    int err_back[REBX_COM_BATCH];
+    rebx_particles_to_orbits(sim->G, m, p, primary, a, e, inc, Omega, omega, f, err);
+    for (int j=0; j<m; j++){
+        const double a0 = a[j];
+        const double e0 = e[j];
+        a[j] += a0*da[j] + 2.*a0*e0*e0*coupling*de[j];  // second term couples e and a
+        e[j] += e0*de[j];
+        inc[j] += inc[j]*dinc[j];
+        omega[j] += domega[j];
+        Omega[j] += dOmega[j];
+    }
+    rebx_orbits_to_particles(sim->G, m, p, primary, a, e, inc, Omega, omega, f, err_back);
+    for (int j=0; j<m; j++){
+        if (err[j] == 0){       // mass of primary was 0 or p = primary.  Leave the particle as it was.
+            struct reb_particle* const q = &ps[mod[j]];
+            q->x = p[j].x;
+            q->y = p[j].y;
+            q->z = p[j].z;
+            q->vx = p[j].vx;
+            q->vy = p[j].vy;
+            q->vz = p[j].vz;
+        }
     }
-    return reb_tools_orbit_to_particle(sim->G, *primary, p->m, o.a, o.e, o.inc, o.Omega, o.omega, o.f);
 }
 
+static struct reb_particle rebx_calculate_modify_orbits_direct(struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* primary, const double dt, const int index){
+    struct reb_particle modified = *p;
+    rebx_modify_orbits_direct_batch(sim, operator, 1, &index, &modified, primary, dt);
+    return modified;
+}
+
+REBX_COM_PTM_BATCH_KERNEL(rebx_modify_orbits_direct_com, rebx_calculate_modify_orbits_direct, rebx_modify_orbits_direct_batch)
+
 void rebx_modify_orbits_direct(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
-    const int* const ptr = rebx_get_param(sim->extras, operator->ap, "coordinates");
+    const int* const ptr = rebx_get_param_int_h(operator->ap, rebx_default_param(sim->extras, REBX_PARAM_coordinates));
    	enum REBX_COORDINATES coordinates = REBX_COORDINATES_JACOBI;
 	if (ptr != NULL){
 		coordinates = *ptr;
 	}
     const int back_reactions_inclusive = 1;
     const char* reference_name = "primary";
-    rebxtools_com_ptm(sim, operator, coordinates, back_reactions_inclusive, reference_name, rebx_calculate_modify_orbits_direct, dt);
+    rebx_modify_orbits_direct_com(sim, operator, coordinates, back_reactions_inclusive, reference_name, dt);
 }
@@ -72,16 +72,22 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
 #include "rebxtools.h"
+#include "rebxtools_com.h"
 
-static struct reb_vec3d rebx_calculate_modify_orbits_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source){
+static struct reb_vec3d rebx_calculate_modify_orbits_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source, const int index){
+    struct rebx_extras* const rebx = sim->extras;
     double tau_a = INFINITY;
     double tau_e = INFINITY;
     double tau_inc = INFINITY;
     
-    const double* const tau_a_ptr = rebx_get_param(sim->extras, p->ap, "tau_a");
-    const double* const tau_e_ptr = rebx_get_param(sim->extras, p->ap, "tau_e");
-    const double* const tau_inc_ptr = rebx_get_param(sim->extras, p->ap, "tau_inc");
+    const rebx_param_handle tau_a_h = rebx_default_param(rebx, REBX_PARAM_tau_a);
+    const rebx_param_handle tau_e_h = rebx_default_param(rebx, REBX_PARAM_tau_e);
+    const rebx_param_handle tau_inc_h = rebx_default_param(rebx, REBX_PARAM_tau_inc);
+    const double* const tau_a_ptr = rebx_get_particle_param_double(rebx_get_param_column(rebx, tau_a_h), index, p->ap, tau_a_h);
+    const double* const tau_e_ptr = rebx_get_particle_param_double(rebx_get_param_column(rebx, tau_e_h), index, p->ap, tau_e_h);
+    const double* const tau_inc_ptr = rebx_get_particle_param_double(rebx_get_param_column(rebx, tau_inc_h), index, p->ap, tau_inc_h);
 
     const double dvx = p->vx - source->vx;
     const double dvy = p->vy - source->vy;
@@ -117,13 +123,15 @@ static struct reb_vec3d rebx_calculate_modify_orbits_forces(struct reb_simulatio
     return a;
 }
 
+REBX_COM_FORCE_KERNEL(rebx_modify_orbits_forces_com, rebx_calculate_modify_orbits_forces)
+
 void rebx_modify_orbits_forces(struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N){
-    int* ptr = rebx_get_param(sim->extras, force->ap, "coordinates");
+    int* ptr = rebx_get_param_int_h(force->ap, rebx_default_param(sim->extras, REBX_PARAM_coordinates));
     enum REBX_COORDINATES coordinates = REBX_COORDINATES_JACOBI; // Default
     if (ptr != NULL){
         coordinates = *ptr;
     }
     const int back_reactions_inclusive = 1;
     const char* reference_name = "primary";
-    rebx_com_force(sim, force, coordinates, back_reactions_inclusive, reference_name, rebx_calculate_modify_orbits_forces, particles, N);
+    rebx_modify_orbits_forces_com(sim, force, coordinates, back_reactions_inclusive, reference_name, particles, N);
 }
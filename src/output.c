@@ -24,6 +24,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "reboundx.h"
 #include "core.h"
@@ -36,7 +37,7 @@
  
  Each snapshot currently holds the rebx structure and a list of particles, for which we store all  the params attached to them. So each of them would have a rebx_binary_field identifying them and telling you how large they are in case you need to skip it.
  
- In principle, the input.c file would have a different function for reading in each of these different types of objects. Each object can have its own set of objects in this nested fashion. Eventually you reach a basic type, whose data we want to read. In that case we use the size_to_skip as the size_to_read for fread, which is the same. These unambiguous blocks don't have an REBX_FIELD_TYPE_END field struct, only the abstract objects whose length is arbitrary (user could add different number of forces, or we could add fields to various structs with code updates).
+ In principle, the input.c file would have a different function for reading in each of these different types of objects. Each object can have its own set of objects in this nested fashion. Eventually you reach a basic type, whose data we want to read. In that case we use the size_to_skip as the size_to_read, which is the same. These unambiguous blocks don't have an REBX_FIELD_TYPE_END field struct, only the abstract objects whose length is arbitrary (user could add different number of forces, or we could add fields to various structs with code updates).
  
  Clearest in an example,
  
@@ -73,6 +74,19 @@
         ...
         END (PARTICLE)
     END (PARTICLES)
+    PARAM_COLUMNS {type=PARAM_COLUMNS, size=skip_to_END(PARAM_COLUMNS)}    // only if there are columns
+        PARAM_COLUMN {type=PARAM_COLUMN, size=skip_to_next_column}
+            NAME {type=NAME, size=size_to_read}
+            STRING
+            PARAM_TYPE {type=PARAM_TYPE, size=size_to_read}
+            ENUM
+            PARAM_VALUE {type=PARAM_VALUE, size=size_to_read}
+            VALUES (one per row)
+            COLUMN_PRESENT {type=COLUMN_PRESENT, size=size_to_read}
+            BITMAP
+        END (PARAM_COLUMN)
+        ...
+    END (PARAM_COLUMNS)
  END (SNAPSHOT)
  
  // not implemented yet
@@ -85,43 +99,55 @@
 Macros to remove repetition in writing fields.
 *************************************************************/
 
+/*  The binary is written twice into a rebx_output_buffer.  The first pass has no data and only adds up the size, so the second can write into one allocation of the right size, and the file is written with a single fwrite.*/
+struct rebx_output_buffer {
+    char* data;                 // NULL while sizing
+    size_t size;                // bytes written so far
+};
+
+static void rebx_output_write(struct rebx_output_buffer* const buf, const void* const src, const size_t size){
+    if (buf->data != NULL && size > 0){
+        memcpy(buf->data + buf->size, src, size);
+    }
+    buf->size += size;
+}
+
 // Write a data field of binary_field_type typename with size typesize
 // valueptr is a pointer to the memory to write
 #define REBX_WRITE_DATA_FIELD(typename, valueptr, typesize) {\
 struct rebx_binary_field field = {.type = REBX_BINARY_FIELD_TYPE_##typename, .size=typesize};\
-fwrite(&field, sizeof(field), 1, of);\
-fwrite(valueptr,typesize,1,of);\
+rebx_output_write(buf, &field, sizeof(field));\
+rebx_output_write(buf, valueptr, typesize);\
 }
 
-/*  For the arbitrary objects, we write a preliminary field struct without a size (since we don't know it yet), and cache the file position to measure how large the object is later.*/
+/*  For the arbitrary objects, we write a preliminary field struct without a size (since we don't know it yet), and cache the buffer position to measure how large the object is later.*/
 #define REBX_START_OBJECT_FIELD(name, typename)\
-long pos_start_header_##name = ftell(of);\
+size_t pos_start_header_##name = buf->size;\
 struct rebx_binary_field header_##name = {.type = REBX_BINARY_FIELD_TYPE_##typename, .size=0};\
-fwrite(&header_##name, sizeof(header_##name), 1, of);\
-long pos_start_##name = ftell(of);\
+rebx_output_write(buf, &header_##name, sizeof(header_##name));\
+size_t pos_start_##name = buf->size;\
 
-/*  After we write all the data we need for the particular object, we calculate how long this segment is, and update the field struct with this size so we have option of skipping the whole object when reading.*/
+/*  After we write all the data we need for the particular object, we calculate how long this segment is, and update the field struct in the buffer with this size so we have option of skipping the whole object when reading.*/
 
 #define REBX_END_OBJECT_FIELD(name) {\
 REBX_WRITE_DATA_FIELD(END,        NULL,             0);\
-long pos_end_##name = ftell(of);\
-header_##name.size = pos_end_##name - pos_start_##name;\
-fseek(of, pos_start_header_##name, SEEK_SET);\
-fwrite(&header_##name, sizeof(header_##name), 1, of);\
-fseek(of, 0, SEEK_END);\
+header_##name.size = buf->size - pos_start_##name;\
+if (buf->data != NULL){\
+memcpy(buf->data + pos_start_header_##name, &header_##name, sizeof(header_##name));\
+}\
 }
 
 /*  Write a list of listtype (e.g., ALLOCATED_FORCES) with nodes of type nodetype (e.g. ALLOCATED_FORCE), to the passed linkedlist (e.g. rebx->allocated_forces)*/
 
 #define REBX_WRITE_LIST_FIELD(listtype, nodetype, linkedlist) {\
 REBX_START_OBJECT_FIELD(list, listtype);\
-rebx_write_list(rebx, REBX_BINARY_FIELD_TYPE_##nodetype, linkedlist, of);\
+rebx_write_list(rebx, REBX_BINARY_FIELD_TYPE_##nodetype, linkedlist, buf);\
 REBX_END_OBJECT_FIELD(list);\
 }
 
-static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, FILE* of);
+static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, struct rebx_output_buffer* const buf);
 
-static void rebx_write_force_param(struct rebx_extras* rebx, struct rebx_param* param, FILE* of){
+static void rebx_write_force_param(struct rebx_extras* rebx, struct rebx_param* param, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(force_param, PARAM);
     REBX_WRITE_DATA_FIELD(PARAM_TYPE, &param->type,     sizeof(param->type));
     REBX_WRITE_DATA_FIELD(NAME,       param->name,      strlen(param->name) + 1);
@@ -130,13 +156,13 @@ static void rebx_write_force_param(struct rebx_extras* rebx, struct rebx_param*
     REBX_END_OBJECT_FIELD(force_param);
 }
 
-static void rebx_write_param(struct rebx_extras* rebx, struct rebx_param* param, FILE* of){
+static void rebx_write_param(struct rebx_extras* rebx, struct rebx_param* param, struct rebx_output_buffer* const buf){
     if (param->type == REBX_TYPE_POINTER){ // Don't write pointers because we won't know how to load them when we read binary. Need to add type to store in binaries.
         return;
     }
     
     if (param->type == REBX_TYPE_FORCE){ // Force already written to allocated_force list. For parce PARAMETERS we agree to store force name in param->value so that the reallocated force can be linked up when we read binary
-        rebx_write_force_param(rebx, param, of);
+        rebx_write_force_param(rebx, param, buf);
         return;
     }
     REBX_START_OBJECT_FIELD(param, PARAM);
@@ -146,14 +172,14 @@ static void rebx_write_param(struct rebx_extras* rebx, struct rebx_param* param,
     REBX_END_OBJECT_FIELD(param);
 }
 
-static void rebx_write_registered_param(struct rebx_extras* rebx, struct rebx_param* param, FILE* of){
+static void rebx_write_registered_param(struct rebx_extras* rebx, struct rebx_param* param, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(registered_param, REGISTERED_PARAM);
     REBX_WRITE_DATA_FIELD(PARAM_TYPE, &param->type,     sizeof(param->type));
     REBX_WRITE_DATA_FIELD(NAME,       param->name,      strlen(param->name) + 1);
     REBX_END_OBJECT_FIELD(registered_param);
 }
 
-static void rebx_write_force(struct rebx_extras* rebx, struct rebx_force* force, FILE* of){
+static void rebx_write_force(struct rebx_extras* rebx, struct rebx_force* force, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(force, FORCE);
     // must write name first so that force can be loaded on read
     REBX_WRITE_DATA_FIELD(NAME, force->name, strlen(force->name) + 1);
@@ -162,20 +188,20 @@ static void rebx_write_force(struct rebx_extras* rebx, struct rebx_force* force,
 }
 
 // Same as force, but only holds the name for later loading, rather than the whole parameter list
-static void rebx_write_additional_force(struct rebx_extras* rebx, struct rebx_force* force, FILE* of){
+static void rebx_write_additional_force(struct rebx_extras* rebx, struct rebx_force* force, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(additional_force, ADDITIONAL_FORCE);
     REBX_WRITE_DATA_FIELD(NAME, force->name, strlen(force->name) + 1);
     REBX_END_OBJECT_FIELD(additional_force);
 }
 
-static void rebx_write_operator(struct rebx_extras* rebx, struct rebx_operator* operator, FILE* of){
+static void rebx_write_operator(struct rebx_extras* rebx, struct rebx_operator* operator, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(operator, OPERATOR);
     REBX_WRITE_DATA_FIELD(NAME, operator->name, strlen(operator->name) + 1);
     REBX_WRITE_LIST_FIELD(PARAM_LIST, PARAM, operator->ap);
     REBX_END_OBJECT_FIELD(operator);
 }
 
-static void rebx_write_step(struct rebx_extras* rebx, struct rebx_step* step, FILE* of){
+static void rebx_write_step(struct rebx_extras* rebx, struct rebx_step* step, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(step, STEP);
     // Need operator name to load it from source when reading it back in
     REBX_WRITE_DATA_FIELD(NAME, step->operator->name,   strlen(step->operator->name) + 1);
@@ -183,14 +209,14 @@ static void rebx_write_step(struct rebx_extras* rebx, struct rebx_step* step, FI
     REBX_END_OBJECT_FIELD(step);
 }
 
-static void rebx_write_particle(struct rebx_extras* rebx, struct reb_particle* particle, int index, FILE* of){
+static void rebx_write_particle(struct rebx_extras* rebx, struct reb_particle* particle, int index, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(particle, PARTICLE);
     REBX_WRITE_DATA_FIELD(PARTICLE_INDEX,    &index, sizeof(index));
     REBX_WRITE_LIST_FIELD(PARAM_LIST, PARAM, particle->ap);
     REBX_END_OBJECT_FIELD(particle);
 }
 
-static void rebx_write_rebx(struct rebx_extras* rebx, FILE* of){
+static void rebx_write_rebx(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(rebx_structure, REBX_STRUCTURE);
     REBX_WRITE_LIST_FIELD(REGISTERED_PARAMETERS, REGISTERED_PARAM, rebx->registered_params);
     REBX_WRITE_LIST_FIELD(ALLOCATED_FORCES, FORCE, rebx->allocated_forces);
@@ -201,18 +227,28 @@ static void rebx_write_rebx(struct rebx_extras* rebx, FILE* of){
     REBX_END_OBJECT_FIELD(rebx_structure);
 }
 
+// Only the rows in use are written
+static void rebx_write_param_column(struct rebx_extras* rebx, struct rebx_param_column* column, struct rebx_output_buffer* const buf){
+    REBX_START_OBJECT_FIELD(param_column, PARAM_COLUMN);
+    REBX_WRITE_DATA_FIELD(NAME,           column->name,       strlen(column->name) + 1);
+    REBX_WRITE_DATA_FIELD(PARAM_TYPE,     &column->type,      sizeof(column->type));
+    REBX_WRITE_DATA_FIELD(PARAM_VALUE,    column->values,     column->N*rebx_sizeof(rebx, column->type));
+    REBX_WRITE_DATA_FIELD(COLUMN_PRESENT, column->present,    (column->N + 63)/64*sizeof(uint64_t));
+    REBX_END_OBJECT_FIELD(param_column);
+}
+
 // Write a particle field for each particle with a list of its parameters
-static void rebx_write_particles(struct rebx_extras* rebx, FILE* of){
+static void rebx_write_particles(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
     struct reb_simulation* sim = rebx->sim; // checked sim valid in output_binray
     
     REBX_START_OBJECT_FIELD(particle_list, PARTICLES);
     for (int i=0; i<sim->N; i++){
-        rebx_write_particle(rebx, &sim->particles[i], i, of);
+        rebx_write_particle(rebx, &sim->particles[i], i, buf);
     }
     REBX_END_OBJECT_FIELD(particle_list);
 }
 
-static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, FILE* of){
+static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_type list_type, struct rebx_node* list, struct rebx_output_buffer* const buf){
     
     int N = rebx_len(list);
     while (N > 0){
@@ -223,32 +259,37 @@ static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_typ
         switch(list_type){
             case REBX_BINARY_FIELD_TYPE_REGISTERED_PARAM:
             {
-                rebx_write_registered_param(rebx, current->object, of);
+                rebx_write_registered_param(rebx, current->object, buf);
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_FORCE:
             {
-                rebx_write_force(rebx, current->object, of);
+                rebx_write_force(rebx, current->object, buf);
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_ADDITIONAL_FORCE:
             {
-                rebx_write_additional_force(rebx, current->object, of);
+                rebx_write_additional_force(rebx, current->object, buf);
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_OPERATOR:
             {
-                rebx_write_operator(rebx, current->object, of);
+                rebx_write_operator(rebx, current->object, buf);
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_PARAM:
             {
-                rebx_write_param(rebx, current->object, of);
+                rebx_write_param(rebx, current->object, buf);
                 break;
             }
             case REBX_BINARY_FIELD_TYPE_STEP:
             {
-                rebx_write_step(rebx, current->object, of);
+                rebx_write_step(rebx, current->object, buf);
+                break;
+            }
+            case REBX_BINARY_FIELD_TYPE_PARAM_COLUMN:
+            {
+                rebx_write_param_column(rebx, current->object, buf);
                 break;
             }
         }
@@ -256,33 +297,449 @@ static void rebx_write_list(struct rebx_extras* rebx, enum rebx_binary_field_typ
     }
 }
 
-// Could be extended to include time or steps_done to make an archive
-static void rebx_write_snapshot(struct rebx_extras* rebx, FILE* of){
+static void rebx_write_snapshot(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
     REBX_START_OBJECT_FIELD(snapshot, SNAPSHOT);
-    rebx_write_rebx(rebx, of);
-    rebx_write_particles(rebx, of);
+    rebx_write_rebx(rebx, buf);
+    rebx_write_particles(rebx, buf);
+    if (rebx->param_columns != NULL){   // after the particles, so their rows can be set when reading
+        REBX_WRITE_LIST_FIELD(PARAM_COLUMNS, PARAM_COLUMN, rebx->param_columns);
+    }
     REBX_END_OBJECT_FIELD(snapshot);
 }
 
+static void rebx_write_header(struct rebx_output_buffer* const buf, const char* const str){
+    char zero = '\0';
+    size_t lenheader = strlen(str)+strlen(rebx_version_str);
+    rebx_output_write(buf, str, strlen(str));
+    rebx_output_write(buf, rebx_version_str, strlen(rebx_version_str));
+    rebx_output_write(buf, &zero, 1);
+    rebx_output_write(buf, rebx_githash_str, 62-lenheader);
+    rebx_output_write(buf, &zero, 1);
+}
+
+static void rebx_write_binary(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
+    rebx_write_header(buf, "REBOUNDx Binary File. Version: ");
+    rebx_write_snapshot(rebx, buf);
+}
+
+// Runs write twice, first to add up the size and then into one allocation of that size, and writes that with a single fwrite.  0 if it failed
+static int rebx_output_file(struct rebx_extras* rebx, void (*write)(struct rebx_extras* rebx, struct rebx_output_buffer* const buf), FILE* of){
+    struct rebx_output_buffer buf = {.data = NULL, .size = 0};
+    write(rebx, &buf);
+    const size_t size = buf.size;
+    buf.data = malloc(size);
+    if (buf.data == NULL){
+        return 0;
+    }
+    buf.size = 0;
+    write(rebx, &buf);
+    const int success = fwrite(buf.data, 1, size, of) == size;
+    free(buf.data);
+    return success;
+}
+
 void rebx_output_binary(struct rebx_extras* rebx, char* filename){
+    if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return;
+    }
+    rebx_sync_param_columns(rebx);
     FILE* of = fopen(filename,"wb");
     if (of==NULL){
         rebx_error(rebx, "REBOUNDx error: Can not open file passed to rebx_output_binary.");
+        return;
+    }
+    if (!rebx_output_file(rebx, rebx_write_binary, of)){
+        rebx_error(rebx, "REBOUNDx Error: Could not write the file passed to rebx_output_binary.\n");
+    }
+    fclose(of);
+}
+
+/************************************************************
+ Archive.  The file has the header and a list of records, each an ARCHIVE_KEYFRAME with the time and a
+ snapshot as rebx_output_binary writes it, or an ARCHIVE_DELTA with the time, the names its changes use
+ and an ARCHIVE_CHANGES field with the rebx_archive_changes.
+ 
+ To find what changed, every append walks the same items in the same order: the forces and operators
+ with their params, the steps, the particles' params and the columns, and compares them with the values
+ the last append kept in the slots.  Changes to structural items (what a force param points to, the
+ number of particles, the dt fraction of a step, which column rows are present) need a keyframe, as
+ does anything that changes param_generation, i.e. params added or freed.
+*************************************************************/
+
+struct rebx_archive_slot {
+    const void* object;         // param, force, step or column
+    int id;                     // of the param, -1 for the others
+    int structural;
+    size_t offset;              // of the value in values
+    size_t size;
+};
+
+struct rebx_archive_writer {
+    char* filename;
+    double interval;            // of rebx_archive_automate_interval, 0 if not automated
+    double next;                // time of the next automated append
+    int N_deltas;               // since the last keyframe, -1 if the next append has to be a keyframe
+    uint64_t param_generation;  // at the last keyframe
+    int rebuilding;             // the walk fills the slots rather than comparing
+    int stale;                  // the walk found a structural change
+    int failed;                 // out of memory
+    struct rebx_archive_slot* slots;
+    int N_slots;
+    int N_slots_alloc;
+    int i_slot;                 // compared so far
+    char* values;
+    size_t values_size;
+    size_t values_alloc;
+    char* changes;              // of the delta being written
+    size_t changes_size;
+    size_t changes_alloc;
+    const char** names;         // the changes use
+    int N_names;
+    int N_names_alloc;
+};
+
+// What the walk visits.  Values of columns are compared row by row, for the rows that are present
+struct rebx_archive_item {
+    const void* object;
+    int id;
+    int structural;
+    const void* value;
+    size_t size;
+    size_t row_size;            // 0 if not a column
+    const uint64_t* present;
+    enum rebx_archive_change_kind kind;
+    int owner;                  // particle index
+    const char* owner_name;     // force or operator name
+    const char* name;           // param or column name
+};
+
+static int rebx_archive_grow(void** const ptr, size_t* const alloc, const size_t needed, const size_t size){
+    if (needed <= *alloc){
+        return 1;
+    }
+    size_t n = *alloc ? *alloc : 64;
+    while (n < needed){
+        n *= 2;
+    }
+    void* const p = realloc(*ptr, n*size);
+    if (p == NULL){
+        return 0;
+    }
+    *ptr = p;
+    *alloc = n;
+    return 1;
+}
+
+static int rebx_archive_name(struct rebx_archive_writer* const writer, const char* const name){
+    for (int i=0; i<writer->N_names; i++){
+        if (writer->names[i] == name){
+            return i;
+        }
+    }
+    size_t alloc = writer->N_names_alloc;
+    if (!rebx_archive_grow((void**)&writer->names, &alloc, writer->N_names + 1, sizeof(*writer->names))){
+        writer->failed = 1;
+        return -1;
+    }
+    writer->N_names_alloc = alloc;
+    writer->names[writer->N_names] = name;
+    return writer->N_names++;
+}
+
+static void rebx_archive_add_change(struct rebx_archive_writer* const writer, const struct rebx_archive_item* const item, const int owner, const void* const value, const size_t size){
+    struct rebx_archive_change change = {.kind = item->kind, .owner = owner, .name = rebx_archive_name(writer, item->name), .size = size};
+    if (item->owner_name != NULL){
+        change.owner = rebx_archive_name(writer, item->owner_name);
+    }
+    if (writer->failed || !rebx_archive_grow((void**)&writer->changes, &writer->changes_alloc, writer->changes_size + sizeof(change) + size, 1)){
+        writer->failed = 1;
+        return;
+    }
+    memcpy(writer->changes + writer->changes_size, &change, sizeof(change));
+    memcpy(writer->changes + writer->changes_size + sizeof(change), value, size);
+    writer->changes_size += sizeof(change) + size;
+}
+
+static void rebx_archive_visit(struct rebx_archive_writer* const writer, const struct rebx_archive_item* const item){
+    if (writer->stale || writer->failed){
+        return;
+    }
+    if (writer->rebuilding){
+        size_t alloc = writer->N_slots_alloc;
+        if (!rebx_archive_grow((void**)&writer->slots, &alloc, writer->N_slots + 1, sizeof(*writer->slots)) || !rebx_archive_grow((void**)&writer->values, &writer->values_alloc, writer->values_size + item->size, 1)){
+            writer->failed = 1;
+            return;
+        }
+        writer->N_slots_alloc = alloc;
+        struct rebx_archive_slot* const slot = &writer->slots[writer->N_slots++];
+        slot->object = item->object;
+        slot->id = item->id;
+        slot->structural = item->structural;
+        slot->offset = writer->values_size;
+        slot->size = item->size;
+        if (item->size > 0){
+            memcpy(writer->values + writer->values_size, item->value, item->size);
+        }
+        writer->values_size += item->size;
+        return;
+    }
+    if (writer->i_slot >= writer->N_slots){
+        writer->stale = 1;
+        return;
+    }
+    struct rebx_archive_slot* const slot = &writer->slots[writer->i_slot++];
+    if (slot->object != item->object || slot->id != item->id || slot->structural != item->structural || slot->size != item->size){
+        writer->stale = 1;
+        return;
+    }
+    char* const old = writer->values + slot->offset;
+    const char* const value = item->value;
+    if (item->size == 0 || memcmp(old, value, item->size) == 0){
+        return;
+    }
+    if (item->structural){
+        writer->stale = 1;
+        return;
+    }
+    if (item->row_size == 0){
+        rebx_archive_add_change(writer, item, item->owner, value, item->size);
+        memcpy(old, value, item->size);
+        return;
     }
+    const size_t row_size = item->row_size;
+    for (size_t i=0; i<item->size/row_size; i++){
+        if (((item->present[i >> 6] >> (i & 63)) & 1) && memcmp(old + i*row_size, value + i*row_size, row_size) != 0){
+            rebx_archive_add_change(writer, item, i, value + i*row_size, row_size);
+            memcpy(old + i*row_size, value + i*row_size, row_size);
+        }
+    }
+}
+
+// Pointers aren't saved, and force params are saved by name, so a change in what they point to needs a keyframe
+static void rebx_archive_walk_ap(struct rebx_extras* const rebx, struct rebx_archive_writer* const writer, struct rebx_node* ap, const enum rebx_archive_change_kind kind, const int owner, const char* const owner_name){
+    for (struct rebx_node* current = ap; current != NULL; current = current->next){
+        const struct rebx_param* const param = current->object;
+        if (param->type == REBX_TYPE_POINTER){
+            continue;
+        }
+        struct rebx_archive_item item = {.object = param, .id = param->id, .kind = kind, .owner = owner, .owner_name = owner_name, .name = param->name};
+        if (param->type == REBX_TYPE_FORCE){
+            item.structural = 1;
+            item.value = &param->value;
+            item.size = sizeof(param->value);
+        }
+        else{
+            item.value = param->value;
+            item.size = rebx_sizeof(rebx, param->type);
+        }
+        rebx_archive_visit(writer, &item);
+    }
+}
+
+static void rebx_archive_walk(struct rebx_extras* const rebx, struct rebx_archive_writer* const writer){
+    struct reb_simulation* const sim = rebx->sim;
+    struct rebx_archive_item item = {.id = -1, .structural = 1, .value = &sim->N, .size = sizeof(sim->N)};
+    rebx_archive_visit(writer, &item);
+    for (struct rebx_node* current = rebx->allocated_forces; current != NULL; current = current->next){
+        struct rebx_force* const force = current->object;
+        struct rebx_archive_item item = {.object = force, .id = -1, .structural = 1};
+        rebx_archive_visit(writer, &item);
+        rebx_archive_walk_ap(rebx, writer, force->ap, REBX_ARCHIVE_CHANGE_FORCE, 0, force->name);
+    }
+    for (struct rebx_node* current = rebx->allocated_operators; current != NULL; current = current->next){
+        struct rebx_operator* const operator = current->object;
+        struct rebx_archive_item item = {.object = operator, .id = -1, .structural = 1};
+        rebx_archive_visit(writer, &item);
+        rebx_archive_walk_ap(rebx, writer, operator->ap, REBX_ARCHIVE_CHANGE_OPERATOR, 0, operator->name);
+    }
+    for (struct rebx_node* current = rebx->additional_forces; current != NULL; current = current->next){
+        struct rebx_archive_item item = {.object = current->object, .id = -1, .structural = 1};
+        rebx_archive_visit(writer, &item);
+    }
+    struct rebx_node* const* const steps[2] = {&rebx->pre_timestep_modifications, &rebx->post_timestep_modifications};
+    for (int j=0; j<2; j++){
+        struct rebx_archive_item item = {.object = steps[j], .id = -1, .structural = 1};     // between the pre and post steps
+        rebx_archive_visit(writer, &item);
+        for (struct rebx_node* current = *steps[j]; current != NULL; current = current->next){
+            const struct rebx_step* const step = current->object;
+            struct rebx_archive_item item = {.object = step, .id = -1, .structural = 1, .value = &step->dt_fraction, .size = sizeof(step->dt_fraction)};
+            rebx_archive_visit(writer, &item);
+        }
+    }
+    for (int i=0; i<sim->N; i++){
+        rebx_archive_walk_ap(rebx, writer, sim->particles[i].ap, REBX_ARCHIVE_CHANGE_PARTICLE, i, NULL);
+    }
+    for (struct rebx_node* current = rebx->param_columns; current != NULL; current = current->next){
+        const struct rebx_param_column* const column = current->object;
+        struct rebx_archive_item rows = {.object = column, .id = -1, .structural = 1, .value = &column->N, .size = sizeof(column->N)};
+        rebx_archive_visit(writer, &rows);
+        struct rebx_archive_item present = {.object = column, .id = -1, .structural = 1, .value = column->present, .size = (column->N + 63)/64*sizeof(uint64_t)};
+        rebx_archive_visit(writer, &present);
+        const size_t size = rebx_sizeof(rebx, column->type);
+        struct rebx_archive_item values = {.object = column, .id = column->id, .value = column->values, .size = column->N*size, .row_size = size, .present = column->present, .kind = REBX_ARCHIVE_CHANGE_COLUMN, .name = column->name};
+        rebx_archive_visit(writer, &values);
+    }
+}
+
+static void rebx_write_archive_header(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
+    rebx_write_header(buf, "REBOUNDx Archive File. Version: ");
+}
+
+static void rebx_write_keyframe(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
+    REBX_START_OBJECT_FIELD(keyframe, ARCHIVE_KEYFRAME);
+    REBX_WRITE_DATA_FIELD(ARCHIVE_TIME,   &rebx->sim->t,      sizeof(rebx->sim->t));
+    rebx_write_snapshot(rebx, buf);
+    REBX_END_OBJECT_FIELD(keyframe);
+}
+
+static void rebx_write_delta(struct rebx_extras* rebx, struct rebx_output_buffer* const buf){
+    const struct rebx_archive_writer* const writer = rebx->archive_writer;
+    REBX_START_OBJECT_FIELD(delta, ARCHIVE_DELTA);
+    REBX_WRITE_DATA_FIELD(ARCHIVE_TIME,   &rebx->sim->t,      sizeof(rebx->sim->t));
+    for (int i=0; i<writer->N_names; i++){
+        REBX_WRITE_DATA_FIELD(NAME,       writer->names[i],   strlen(writer->names[i]) + 1);
+    }
+    REBX_WRITE_DATA_FIELD(ARCHIVE_CHANGES, writer->changes,   writer->changes_size);
+    REBX_END_OBJECT_FIELD(delta);
+}
+
+void rebx_free_archive_writer(struct rebx_archive_writer* const writer){
+    if (writer == NULL){
+        return;
+    }
+    free(writer->filename);
+    free(writer->slots);
+    free(writer->values);
+    free(writer->changes);
+    free(writer->names);
+    free(writer);
+}
+
+// The writer keeps what was appended to one file, so it starts again with a keyframe when the file changes
+static struct rebx_archive_writer* rebx_archive_writer_get(struct rebx_extras* const rebx, const char* const filename){
+    struct rebx_archive_writer* writer = rebx->archive_writer;
+    if (writer != NULL && strcmp(writer->filename, filename) == 0){
+        return writer;
+    }
+    if (writer == NULL){
+        writer = calloc(1, sizeof(*writer));
+        if (writer == NULL){
+            return NULL;
+        }
+        rebx->archive_writer = writer;
+    }
+    char* const name = malloc(strlen(filename) + 1);
+    if (name == NULL){
+        return NULL;
+    }
+    strcpy(name, filename);
+    free(writer->filename);
+    writer->filename = name;
+    writer->interval = 0.;
+    writer->N_deltas = -1;
+    return writer;
+}
+
+int rebx_archive_append(struct rebx_extras* const rebx, const char* const filename){
     if (rebx->sim == NULL){
+        rebx_error(rebx, ""); // rebx_error gives meaningful err
+        return 0;
+    }
+    struct rebx_archive_writer* const writer = rebx_archive_writer_get(rebx, filename);
+    if (writer == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for rebx_archive_append.\n");
+        return 0;
+    }
+    rebx_sync_param_columns(rebx);
+    
+    int keyframe = writer->N_deltas < 0 || writer->N_deltas >= REBX_ARCHIVE_MAX_DELTAS || writer->param_generation != rebx->param_generation;
+    if (!keyframe){
+        writer->rebuilding = 0;
+        writer->stale = 0;
+        writer->failed = 0;
+        writer->i_slot = 0;
+        writer->changes_size = 0;
+        writer->N_names = 0;
+        rebx_archive_walk(rebx, writer);
+        keyframe = writer->stale || writer->failed || writer->i_slot != writer->N_slots;
+    }
+    if (keyframe){  // if this runs out of memory the keyframe is still written, but the next append has to be one too
+        writer->rebuilding = 1;
+        writer->stale = 0;
+        writer->failed = 0;
+        writer->N_slots = 0;
+        writer->values_size = 0;
+        rebx_archive_walk(rebx, writer);
+        writer->rebuilding = 0;
+    }
+    
+    FILE* of = fopen(filename, "ab");
+    if (of == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Can not open file passed to rebx_archive_append.\n");
+        writer->N_deltas = -1;
+        return 0;
+    }
+    fseek(of, 0, SEEK_END);
+    int success = ftell(of) > 0 || rebx_output_file(rebx, rebx_write_archive_header, of);
+    success = success && rebx_output_file(rebx, keyframe ? rebx_write_keyframe : rebx_write_delta, of);
+    fclose(of);
+    if (!success){
+        rebx_error(rebx, "REBOUNDx Error: Could not write the archive passed to rebx_archive_append.\n");
+        writer->N_deltas = -1;
+        return 0;
+    }
+    if (keyframe){
+        writer->N_deltas = writer->failed ? -1 : 0;
+        writer->param_generation = rebx->param_generation;
+    }
+    else{
+        writer->N_deltas++;
+    }
+    return 1;
+}
+
+void rebx_archive_automate_interval(struct rebx_extras* const rebx, const char* const filename, const double interval){
+    struct reb_simulation* const sim = rebx->sim;
+    if (sim == NULL){
         rebx_error(rebx, ""); // rebx_error gives meaningful err
         return;
     }
-    // Write header.
-    const char str[] = "REBOUNDx Binary File. Version: ";
-    char zero = '\0';
-    size_t lenheader = strlen(str)+strlen(rebx_version_str);
-    fwrite(str,sizeof(char),strlen(str),of);
-    fwrite(rebx_version_str,sizeof(char), strlen(rebx_version_str),of);
-    fwrite(&zero,sizeof(char),1,of);
-    fwrite(rebx_githash_str,sizeof(char),62-lenheader,of);
-    fwrite(&zero,sizeof(char),1,of);
+    if (interval <= 0.){
+        if (rebx->archive_writer != NULL){
+            rebx->archive_writer->interval = 0.;
+        }
+        return;
+    }
+    struct rebx_archive_writer* const writer = rebx_archive_writer_get(rebx, filename);
+    if (writer == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for rebx_archive_automate_interval.\n");
+        return;
+    }
+    remove(filename);
+    writer->N_deltas = -1;
+    if (!rebx_archive_append(rebx, filename)){
+        return;
+    }
+    const double sign = sim->dt > 0. ? 1. : -1.;
+    writer->interval = interval;
+    writer->next = sim->t + sign*interval;
+    if (sim->post_timestep_modifications != NULL && sim->post_timestep_modifications != rebx_post_timestep_modifications){
+        reb_warning(sim, "REBOUNDx Warning: post_timestep_modifications was set in the simulation and is being overwritten by REBOUNDx. To incorporate both, you can add your own custom effects through REBOUNDx.  See https://github.com/dtamayo/reboundx/blob/master/ipython_examples/Custom_Effects.ipynb for a tutorial.\n");
+    }
+    sim->post_timestep_modifications = rebx_post_timestep_modifications;
+}
 
-    rebx_write_snapshot(rebx, of);
-    fclose(of);
+// Same test as the automated snapshots of the REBOUND SimulationArchive, so with the same interval they are written at the same times
+void rebx_archive_heartbeat(struct rebx_extras* const rebx){
+    struct rebx_archive_writer* const writer = rebx->archive_writer;
+    const struct reb_simulation* const sim = rebx->sim;
+    if (writer->interval <= 0.){
+        return;
+    }
+    const double sign = sim->dt > 0. ? 1. : -1.;
+    if (sign*writer->next <= sign*sim->t){
+        writer->next += sign*writer->interval;
+        rebx_archive_append(rebx, writer->filename);
+    }
 }
@@ -1,12 +1,19 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // madvise and MAP_ANONYMOUS with -std=c99
+#endif
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "spk.h"
 #include "planets.h"
+#include "chebyshev.h"
 
 int body[11] = {
         PLAN_SOL,                       // Sun (in barycentric)
@@ -33,66 +40,49 @@ int body[11] = {
  *
  */
 
-void jpl_work(double *P, int ncm, int ncf, int niv, double t0, double t1, double *u, double *v, double *w)
+// evaluate the series of one body at t0 (fraction of the record), with
+// the derivatives scaled by c per interval
+static inline void _jpl_eval(const double *P, int ncm, int ncf, int niv, double t0, double c,
+                             double *u, double *v, double *w)
 {
-        double T[24], S[24];
-        double U[24];
-        double t, c;
-        int p, m, n, b;
+        double t, x;
+        int b, m;
 
         // adjust to correct interval
         t = t0 * (double)niv;
-        t0 = 2.0 * fmod(t, 1.0) - 1.0;
-        c = (double)(niv * 2) / t1 / 86400.0;
-
+        x = 2.0 * fmod(t, 1.0) - 1.0;
         b = (int)t;
 
-        // set up Chebyshev polynomials and derivatives
-        T[0] = 1.0; T[1] = t0;
-        S[0] = 0.0; S[1] = 1.0;
-        U[0] = 0.0; U[1] = 0.0;	U[2] = 4.0;
-
-        for (p = 2; p < ncf; p++) {
-                T[p] = 2.0 * t0 * T[p-1] - T[p-2];
-                S[p] = 2.0 * t0 * S[p-1] + 2.0 * T[p-1] - S[p-2];
-        }
-        for (p = 3; p < ncf; p++) {
-                U[p] = 2.0 * t0 * U[p-1] + 4.0 * S[p-1] - U[p-2];
-        }
+        cheb_eval(&P[ncf * ncm * b], ncf, ncm, ncf, x, u, v, w);
 
-        // compute the position/velocity
         for (m = 0; m < ncm; m++) {
-                u[m] = v[m] = w[m] = 0.0;
-                n = ncf * (m + b * ncm);
-
-                for (p = 0; p < ncf; p++) {
-                        u[m] += T[p] * P[n+p];
-                        v[m] += S[p] * P[n+p] * c;
-                        w[m] += U[p] * P[n+p] * c * c;
-                }
+                v[m] *= c;
+                w[m] *= c * c;
         }
 }
+
+void jpl_work(double *P, int ncm, int ncf, int niv, double t0, double t1, double *u, double *v, double *w)
+{
+        _jpl_eval(P, ncm, ncf, niv, t0, (double)(niv * 2) / t1 / 86400.0, u, v, w);
+}
  
 /*
  *  jpl_init
  *
  *  Initialise everything needed ... probaly not be compatible with a non-430 file.
+ *  The path is that of the binary DE430 file, e.g. "linux_p1550p2650.430".
  *
  */
 
-struct _jpl_s * jpl_init(void)
+struct _jpl_s * jpl_init(const char *path)
 {
         struct _jpl_s *jpl;
         struct stat sb;
-        char buf[256];
         ssize_t ret;
         off_t off;
         int fd, p;
 
-//      snprintf(buf, sizeof(buf), "/home/blah/wherever/linux_p1550p2650.430");
-        snprintf(buf, sizeof(buf), "linux_p1550p2650.430");
-
-        if ((fd = open(buf, O_RDONLY)) < 0)
+        if (path == NULL || (fd = open(path, O_RDONLY)) < 0)
                 return NULL;
 
         jpl = malloc(sizeof(struct _jpl_s));
@@ -153,11 +143,19 @@ struct _jpl_s * jpl_init(void)
         for (p = 0; p < _NUM_JPL; p++)
                 jpl->rec += sizeof(double) * jpl->ncf[p] * jpl->niv[p] * jpl->ncm[p];
 
+        // coefficients are in km, derivatives per second
+        jpl->tpd = 86400.0;
+
         // memory map the file, which makes us thread-safe with kernel caching
         jpl->map = mmap(NULL, jpl->len, PROT_READ, MAP_SHARED, fd, 0);
 
-        if (jpl->map == NULL)
+        if (jpl->map == MAP_FAILED) {
+                jpl->map = NULL;
                 goto err;
+        }
+
+        // the first two records are the header
+        jpl->dat = (char *)jpl->map + 2 * jpl->rec;
 
         // this file descriptor is no longer needed since we are memory mapped
         if (close(fd) < 0)
@@ -173,6 +171,196 @@ err:    close(fd);
         return NULL;
 }
 
+/*
+ *  jpl_prefetch
+ *
+ *  Page in the records covering [beg, end] so that later lookups in that
+ *  span do not fault.
+ *
+ */
+int jpl_prefetch(struct _jpl_s *jpl, double beg, double end)
+{
+        volatile unsigned char sum = 0;
+        const unsigned char *z;
+        size_t b0, b1, off, len, q;
+        long page;
+
+        if (jpl == NULL || jpl->map == NULL)
+                return -1;
+
+        // clamp to the span covered by this file
+        if (beg < jpl->beg) beg = jpl->beg;
+        if (end > jpl->end) end = jpl->end;
+        if (end < beg)
+                return -1;
+
+        b0 = (size_t)((beg - jpl->beg) / jpl->inc);
+        b1 = (size_t)((end - jpl->beg) / jpl->inc);
+
+        off = (size_t)((char *)jpl->dat - (char *)jpl->map) + b0 * jpl->rec;
+        len = (b1 - b0 + 1) * jpl->rec;
+
+        if (off + len > jpl->len)
+                len = jpl->len - off;
+
+        // madvise wants a page aligned address
+        page = sysconf(_SC_PAGESIZE);
+        q = off % (size_t)page;
+
+        if (madvise((char *)jpl->map + off - q, len + q, MADV_WILLNEED) < 0)
+                { ; } // perror ...
+
+        // touch every page so the data is resident before we return
+        z = (const unsigned char *)jpl->map + off;
+        for (q = 0; q < len; q += (size_t)page)
+                sum += z[q];
+
+        return 0;
+}
+
+/*
+ *  jpl_sequential
+ *
+ *  Tell the kernel the records covering [beg, end] will be read in order,
+ *  so it reads ahead of a forward-in-time run instead of faulting on each
+ *  record.  Unlike jpl_prefetch this returns without waiting.
+ *
+ */
+int jpl_sequential(struct _jpl_s *jpl, double beg, double end)
+{
+        size_t b0, b1, off, len, q;
+        long page;
+
+        if (jpl == NULL || jpl->map == NULL)
+                return -1;
+
+        if (beg < jpl->beg) beg = jpl->beg;
+        if (end > jpl->end) end = jpl->end;
+        if (end < beg)
+                return -1;
+
+        b0 = (size_t)((beg - jpl->beg) / jpl->inc);
+        b1 = (size_t)((end - jpl->beg) / jpl->inc);
+
+        off = (size_t)((char *)jpl->dat - (char *)jpl->map) + b0 * jpl->rec;
+        len = (b1 - b0 + 1) * jpl->rec;
+
+        if (off + len > jpl->len)
+                len = jpl->len - off;
+
+        page = sysconf(_SC_PAGESIZE);
+        q = off % (size_t)page;
+
+        if (madvise((char *)jpl->map + off - q, len + q, MADV_SEQUENTIAL) < 0)
+                { ; } // perror ...
+        if (madvise((char *)jpl->map + off - q, len + q, MADV_WILLNEED) < 0)
+                { ; } // perror ...
+
+        return 0;
+}
+
+/*
+ *  jpl_preload
+ *
+ *  Copy the records covering [beg, end] into anonymous memory, reading the
+ *  file sequentially once, so that lookups in that span never touch the
+ *  file again.  Lookups outside the span still go to the memory map.
+ *
+ */
+
+// anonymous read-write memory, from huge pages if asked and available
+static void *_anon(size_t *len, int flags)
+{
+        const size_t huge = 2 * 1024 * 1024;
+        void *p = MAP_FAILED;
+
+        if (flags & JPL_LOAD_HUGE) {
+                *len = (*len + huge - 1) / huge * huge;
+#ifdef MAP_HUGETLB
+                p = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        }
+
+        if (p == MAP_FAILED) {
+                p = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED)
+                        return NULL;
+#ifdef MADV_HUGEPAGE
+                // no reserved huge pages, ask for transparent ones instead
+                if ((flags & JPL_LOAD_HUGE) && madvise(p, *len, MADV_HUGEPAGE) < 0)
+                        { ; } // perror ...
+#endif
+        }
+
+        return p;
+}
+
+int jpl_preload(struct _jpl_s *jpl, double beg, double end, int flags)
+{
+        size_t b0, b1, nb, off, len, q;
+        void *buf;
+
+        if (jpl == NULL || jpl->map == NULL)
+                return -1;
+
+        if (beg > end)
+                { double x = beg; beg = end; end = x; }
+        if (beg < jpl->beg) beg = jpl->beg;
+        if (end > jpl->end) end = jpl->end;
+        if (end < beg)
+                return -1;
+
+        b0 = (size_t)((beg - jpl->beg) / jpl->inc);
+        b1 = (size_t)((end - jpl->beg) / jpl->inc);
+        off = (size_t)((char *)jpl->dat - (char *)jpl->map) + b0 * jpl->rec;
+
+        if (off >= jpl->len)
+                return -1;
+        if (off + (b1 - b0 + 1) * jpl->rec > jpl->len)
+                b1 = b0 + (jpl->len - off) / jpl->rec - 1;
+
+        nb = b1 - b0 + 1;
+        len = nb * jpl->rec;
+
+        if ((buf = _anon(&len, flags)) == NULL)
+                return -1;
+
+        // one sequential pass over the file
+        q = off % (size_t)sysconf(_SC_PAGESIZE);
+
+        if (madvise((char *)jpl->map + off - q, nb * jpl->rec + q, MADV_SEQUENTIAL) < 0)
+                { ; } // perror ...
+
+        memcpy(buf, (char *)jpl->map + off, nb * jpl->rec);
+
+        if (madvise((char *)jpl->map, jpl->len, MADV_RANDOM) < 0)
+                { ; } // perror ...
+
+        if (mprotect(buf, len, PROT_READ) < 0)
+                { ; } // perror ...
+        if ((flags & JPL_LOAD_LOCK) && mlock(buf, len) < 0)
+                { ; } // not fatal, e.g. RLIMIT_MEMLOCK
+
+        if (jpl->blen > 0)
+                munmap(jpl->buf, jpl->blen);
+
+        jpl->buf = buf;
+        jpl->blen = len;
+        jpl->b0 = b0;
+        jpl->nb = nb;
+
+        return 0;
+}
+
+// locate a record, in the preloaded copy if it has it
+static inline double *_blk(struct _jpl_s *jpl, size_t blk)
+{
+        if (jpl->buf != NULL && blk >= jpl->b0 && blk - jpl->b0 < jpl->nb)
+                return (double *)((char *)jpl->buf + (blk - jpl->b0) * jpl->rec);
+
+        return (double *)((char *)jpl->dat + blk * jpl->rec);
+}
+
 /*
  *  jpl_free
  *
@@ -184,6 +372,8 @@ int jpl_free(struct _jpl_s *jpl)
 
         if (munmap(jpl->map, jpl->len) < 0)
                 { ; } // perror...
+        if (jpl->blen > 0 && munmap(jpl->buf, jpl->blen) < 0)
+                { ; } // perror...
 
         memset(jpl, 0, sizeof(struct _jpl_s));
         free(jpl);
@@ -196,34 +386,40 @@ int jpl_free(struct _jpl_s *jpl)
  *
  */
 
+static void _work(struct _jpl_s *jpl, double *z, int n, double t, double *u, double *v, double *w)
+{
+        _jpl_eval(&z[jpl->off[n]], jpl->ncm[n], jpl->ncf[n], jpl->niv[n], t,
+                  (double)(jpl->niv[n] * 2) / jpl->inc / jpl->tpd, u, v, w);
+}
+
 static void _bar(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
         { vecpos_nul(pos->u); vecpos_nul(pos->v); vecpos_nul(pos->w); }
 static void _sun(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_SUN]], jpl->ncm[JPL_SUN], jpl->ncf[JPL_SUN], jpl->niv[JPL_SUN], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_SUN, t, pos->u, pos->v, pos->w); }
 static void _emb(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_EMB]], jpl->ncm[JPL_EMB], jpl->ncf[JPL_EMB], jpl->niv[JPL_EMB], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_EMB, t, pos->u, pos->v, pos->w); }
 static void _mer(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_MER]], jpl->ncm[JPL_MER], jpl->ncf[JPL_MER], jpl->niv[JPL_MER], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_MER, t, pos->u, pos->v, pos->w); }
 static void _ven(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_VEN]], jpl->ncm[JPL_VEN], jpl->ncf[JPL_VEN], jpl->niv[JPL_VEN], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_VEN, t, pos->u, pos->v, pos->w); }
 static void _mar(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_MAR]], jpl->ncm[JPL_MAR], jpl->ncf[JPL_MAR], jpl->niv[JPL_MAR], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_MAR, t, pos->u, pos->v, pos->w); }
 static void _jup(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_JUP]], jpl->ncm[JPL_JUP], jpl->ncf[JPL_JUP], jpl->niv[JPL_JUP], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_JUP, t, pos->u, pos->v, pos->w); }
 static void _sat(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_SAT]], jpl->ncm[JPL_SAT], jpl->ncf[JPL_SAT], jpl->niv[JPL_SAT], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_SAT, t, pos->u, pos->v, pos->w); }
 static void _ura(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_URA]], jpl->ncm[JPL_URA], jpl->ncf[JPL_URA], jpl->niv[JPL_URA], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_URA, t, pos->u, pos->v, pos->w); }
 static void _nep(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_NEP]], jpl->ncm[JPL_NEP], jpl->ncf[JPL_NEP], jpl->niv[JPL_NEP], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_NEP, t, pos->u, pos->v, pos->w); }
 static void _plu(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
-        { jpl_work(&z[jpl->off[JPL_PLU]], jpl->ncm[JPL_PLU], jpl->ncf[JPL_PLU], jpl->niv[JPL_PLU], t, jpl->inc, pos->u, pos->v, pos->w); }
+        { _work(jpl, z, JPL_PLU, t, pos->u, pos->v, pos->w); }
 
 static void _ear(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
 {
         struct mpos_s emb, lun;
-        jpl_work(&z[jpl->off[JPL_EMB]], jpl->ncm[JPL_EMB], jpl->ncf[JPL_EMB], jpl->niv[JPL_EMB], t, jpl->inc, emb.u, emb.v, emb.w);
-        jpl_work(&z[jpl->off[JPL_LUN]], jpl->ncm[JPL_LUN], jpl->ncf[JPL_LUN], jpl->niv[JPL_LUN], t, jpl->inc, lun.u, lun.v, lun.w);
+        _work(jpl, z, JPL_EMB, t, emb.u, emb.v, emb.w);
+        _work(jpl, z, JPL_LUN, t, lun.u, lun.v, lun.w);
 
         vecpos_set(pos->u, emb.u);
         vecpos_off(pos->u, lun.u, -1.0 / (1.0 + jpl->cem));
@@ -241,8 +437,8 @@ static void _lun(struct _jpl_s *jpl, double *z, double t, struct mpos_s *pos)
 {
         struct mpos_s emb, lun;
 
-        jpl_work(&z[jpl->off[JPL_EMB]], jpl->ncm[JPL_EMB], jpl->ncf[JPL_EMB], jpl->niv[JPL_EMB], t, jpl->inc, emb.u, emb.v, emb.w);
-        jpl_work(&z[jpl->off[JPL_LUN]], jpl->ncm[JPL_LUN], jpl->ncf[JPL_LUN], jpl->niv[JPL_LUN], t, jpl->inc, lun.u, lun.v, lun.w);
+        _work(jpl, z, JPL_EMB, t, emb.u, emb.v, emb.w);
+        _work(jpl, z, JPL_LUN, t, lun.u, lun.v, lun.w);
 
         vecpos_set(pos->u, emb.u);
         vecpos_off(pos->u, lun.u, jpl->cem / (1.0 + jpl->cem));
@@ -279,7 +475,12 @@ int jpl_calc(struct _jpl_s *pl, struct mpos_s *now, double jde, int n, int m)
         // compute record number and 'offset' into record
         blk = (u_int32_t)((jde - pl->beg) / pl->inc);
         t = fmod(jde - pl->beg, pl->inc) / pl->inc;
-        z = pl->map + (blk + 2) * pl->rec;
+
+        // the final epoch belongs to the last record
+        if (jde == pl->end && t == 0.0 && blk > 0)
+                { blk--; t = nextafter(1.0, 0.0); }
+
+        z = _blk(pl, blk);
 
         // the magick of function pointers
         _help[n](pl, z, t, &pos);
@@ -294,3 +495,73 @@ int jpl_calc(struct _jpl_s *pl, struct mpos_s *now, double jde, int n, int m)
         now->jde = jde;
         return 0;
 }
+
+
+/*
+ *  jpl_calc_all
+ *
+ *  Calculate the barycentric position+velocity+acceleration of every body
+ *  code in one pass.  The record is located once, and each series is
+ *  summed with the shared Clenshaw kernel of chebyshev.h.
+ *
+ */
+
+int jpl_calc_all(struct _jpl_s *pl, double jde, struct mpos_s *now)
+{
+        struct mpos_s raw[JPL_NUT];
+        double t, *z;
+        u_int32_t blk;
+        int n;
+
+        if (pl == NULL || now == NULL)
+                return -1;
+
+        // check if covered by this file
+        if (jde < pl->beg || jde > pl->end || pl->map == NULL)
+                return -1;
+
+        // compute record number and 'offset' into record
+        blk = (u_int32_t)((jde - pl->beg) / pl->inc);
+        t = fmod(jde - pl->beg, pl->inc) / pl->inc;
+
+        // the final epoch belongs to the last record
+        if (jde == pl->end && t == 0.0 && blk > 0)
+                { blk--; t = nextafter(1.0, 0.0); }
+
+        z = _blk(pl, blk);
+
+        for (n = 0; n < JPL_NUT; n++)
+                _work(pl, z, n, t, raw[n].u, raw[n].v, raw[n].w);
+
+        vecpos_nul(now[PLAN_BAR].u); vecpos_nul(now[PLAN_BAR].v); vecpos_nul(now[PLAN_BAR].w);
+        now[PLAN_SOL] = raw[JPL_SUN];
+        now[PLAN_EMB] = raw[JPL_EMB];
+        now[PLAN_MER] = raw[JPL_MER];
+        now[PLAN_VEN] = raw[JPL_VEN];
+        now[PLAN_MAR] = raw[JPL_MAR];
+        now[PLAN_JUP] = raw[JPL_JUP];
+        now[PLAN_SAT] = raw[JPL_SAT];
+        now[PLAN_URA] = raw[JPL_URA];
+        now[PLAN_NEP] = raw[JPL_NEP];
+        now[PLAN_PLU] = raw[JPL_PLU];
+
+        // Earth and Moon from the Earth-Moon barycentre and geocentric Moon
+        vecpos_set(now[PLAN_EAR].u, raw[JPL_EMB].u);
+        vecpos_off(now[PLAN_EAR].u, raw[JPL_LUN].u, -1.0 / (1.0 + pl->cem));
+        vecpos_set(now[PLAN_EAR].v, raw[JPL_EMB].v);
+        vecpos_off(now[PLAN_EAR].v, raw[JPL_LUN].v, -1.0 / (1.0 + pl->cem));
+        vecpos_set(now[PLAN_EAR].w, raw[JPL_EMB].w);
+        vecpos_off(now[PLAN_EAR].w, raw[JPL_LUN].w, -1.0 / (1.0 + pl->cem));
+
+        vecpos_set(now[PLAN_LUN].u, raw[JPL_EMB].u);
+        vecpos_off(now[PLAN_LUN].u, raw[JPL_LUN].u, pl->cem / (1.0 + pl->cem));
+        vecpos_set(now[PLAN_LUN].v, raw[JPL_EMB].v);
+        vecpos_off(now[PLAN_LUN].v, raw[JPL_LUN].v, pl->cem / (1.0 + pl->cem));
+        vecpos_set(now[PLAN_LUN].w, raw[JPL_EMB].w);
+        vecpos_off(now[PLAN_LUN].w, raw[JPL_LUN].w, pl->cem / (1.0 + pl->cem));
+
+        for (n = 0; n < _NUM_TEST; n++)
+                now[n].jde = jde;
+
+        return 0;
+}
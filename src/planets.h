@@ -1,7 +1,17 @@
-struct _jpl_s * jpl_init(void);
+struct _jpl_s * jpl_init(const char *path);
 int jpl_free(struct _jpl_s *jpl);
+int jpl_prefetch(struct _jpl_s *jpl, double beg, double end);
+int jpl_sequential(struct _jpl_s *jpl, double beg, double end);
+int jpl_preload(struct _jpl_s *jpl, double beg, double end, int flags);
 void jpl_work(double *P, int ncm, int ncf, int niv, double t0, double t1, double *u, double *v, double *w);
 int jpl_calc(struct _jpl_s *jpl, struct mpos_s *now, double jde, int n, int m);
+int jpl_calc_all(struct _jpl_s *jpl, double jde, struct mpos_s *now);
+
+// flags for jpl_preload
+enum {
+        JPL_LOAD_HUGE   = 1,            // back the copy with huge pages
+        JPL_LOAD_LOCK   = 2,            // mlock the copy
+};
 
 // these are the body codes for the user to specify
 enum {
@@ -22,7 +32,7 @@ enum {
         _NUM_TEST,
 };
 
-int body[11];
+extern int body[11];
 
 // these are array indices for the internal interface
 enum {
@@ -57,8 +67,14 @@ struct _jpl_s {
         int32_t niv[_NUM_JPL];          // number of interpolation intervals
         int32_t ncm[_NUM_JPL];          // number of components / dimension
 ///
+        double tpd;                     // derivative time units per day
+        int au;                         // coefficients already in [AU]
         size_t len, rec;                // file and record sizes
         void *map;                      // memory mapped location
+        void *dat;                      // first data record within map
+        void *buf;                      // preloaded records, or NULL
+        size_t blen;                    // length of buf mapping, 0 if not ours
+        size_t b0, nb;                  // first block and block count in buf
 };
 
 // From Weryk's code
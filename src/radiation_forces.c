@@ -46,6 +46,8 @@
  * Field (C type)               Required    Description
  * ============================ =========== ==================================================================
  * c (double)                   Yes         Speed of light in the units used for the simulation.
+ * radiation_float (int)        No          If nonzero, evaluate the forces in single precision, about twice as fast for large numbers of grains
+ * fused (int)                  No          If nonzero, evaluated in one pass over the particles with the other fused forces
  * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
@@ -65,57 +67,342 @@
 #include <math.h>
 #include <stdlib.h>
 #include "reboundx.h"
+#include "core.h"
 
-static void rebx_calculate_radiation_forces(struct rebx_extras* const rebx, struct reb_simulation* const sim, const double c, const int source_index, struct reb_particle* const particles, const int N){
-    const struct reb_particle source = particles[source_index];
-    const double mu = sim->G*source.m;
-
-    for (int i=0;i<N;i++){
-        
-        if(i == source_index) continue;
-        
-        const double* beta = rebx_get_param(rebx, particles[i].ap, "beta");
-        if(beta == NULL) continue; // only particles with beta set feel radiation forces
-        
-        const struct reb_particle p = particles[i];
-        const double dx = p.x - source.x; 
-        const double dy = p.y - source.y;
-        const double dz = p.z - source.z;
+#define REBX_RADIATION_BLOCK 256     ///< Particles gathered into arrays at a time, small enough to stay in cache
+
+// Copy of a source for one call
+struct rebx_radiation_source {
+    int index;
+    double mu;
+    struct reb_particle p;
+};
+
+// Kept on the force between calls.  The lists of sources and of particles with beta are rebuilt when rebx->param_generation
+// or the number of particles changes.
+struct rebx_radiation_workspace {
+    uint64_t param_generation;
+    int N;
+    int n_sources;
+    int* sources;               // indices of the particles with radiation_source, or just 0, in increasing order
+    int source_default;         // no particle has radiation_source
+    int n;
+    int* index;                 // indices of the particles with beta, in increasing order
+    struct rebx_radiation_source* copies;   // n_sources of them
+};
+
+void rebx_radiation_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_radiation_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_radiation_workspace));
+    if (ws){
+        free(ws->sources);
+        free(ws->index);
+        free(ws->copies);
+        free(ws);
+    }
+}
+
+static struct rebx_radiation_workspace* rebx_radiation_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_radiation_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_radiation_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        ws->N = -1;
+        rebx_set_param_pointer(rebx, &force->ap, "radiation_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_radiation_free_arrays);
+    }
+    return ws;
+}
+
+static int rebx_radiation_build(struct rebx_extras* const rebx, struct rebx_radiation_workspace* const ws, struct reb_particle* const particles, const int N, const rebx_param_handle source_h, struct rebx_param_column* const beta_column, const rebx_param_handle beta_h){
+    int n_sources = 0;
+    int n = 0;
+    for (int i=0; i<N; i++){
+        n_sources += rebx_get_param_h(particles[i].ap, source_h) != NULL;
+        n += rebx_get_particle_param_double(beta_column, i, particles[i].ap, beta_h) != NULL;
+    }
+    int* const sources = malloc((n_sources > 0 ? n_sources : 1)*sizeof(*sources));
+    int* const index = malloc((n > 0 ? n : 1)*sizeof(*index));
+    struct rebx_radiation_source* const copies = malloc((n_sources > 0 ? n_sources : 1)*sizeof(*copies));
+    if (sources == NULL || index == NULL || copies == NULL){
+        free(sources);
+        free(index);
+        free(copies);
+        return 0;
+    }
+    int k_source = 0;
+    int k = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_h(particles[i].ap, source_h) != NULL){
+            sources[k_source++] = i;
+        }
+        if (rebx_get_particle_param_double(beta_column, i, particles[i].ap, beta_h) != NULL){
+            index[k++] = i;
+        }
+    }
+    ws->source_default = n_sources == 0;
+    if (ws->source_default){    // default source to index 0 if "radiation_source" not found on any particle
+        sources[0] = 0;
+        n_sources = 1;
+    }
+    free(ws->sources);
+    free(ws->index);
+    free(ws->copies);
+    ws->sources = sources;
+    ws->copies = copies;
+    ws->n_sources = n_sources;
+    ws->index = index;
+    ws->n = n;
+    ws->N = N;
+    ws->param_generation = rebx->param_generation;
+    return 1;
+}
+
+// Equation (5) of Burns, Lamy & Soter (1979), for the gathered particles k0 to k1-1
+static void rebx_radiation_acc(const int k0, const int k1, const double* restrict const x, const double* restrict const y, const double* restrict const z, const double* restrict const vx, const double* restrict const vy, const double* restrict const vz, double* restrict const ax, double* restrict const ay, double* restrict const az, const double* restrict const beta, const struct reb_particle* const source, const double mu, const double c){
+    const double sx = source->x, sy = source->y, sz = source->z;
+    const double svx = source->vx, svy = source->vy, svz = source->vz;
+    for (int k=k0; k<k1; k++){
+        const double dx = x[k] - sx;
+        const double dy = y[k] - sy;
+        const double dz = z[k] - sz;
         const double dr = sqrt(dx*dx + dy*dy + dz*dz); // distance to star
-        
-        const double dvx = p.vx - source.vx;
-        const double dvy = p.vy - source.vy;
-        const double dvz = p.vz - source.vz;
+
+        const double dvx = vx[k] - svx;
+        const double dvy = vy[k] - svy;
+        const double dvz = vz[k] - svz;
         const double rdot = (dx*dvx + dy*dvy + dz*dvz)/dr; // radial velocity
-        const double a_rad = *beta*mu/(dr*dr);
+        const double a_rad = beta[k]*mu/(dr*dr);
 
-        // Equation (5) of Burns, Lamy & Soter (1979)
+        ax[k] += a_rad*((1.-rdot/c)*dx/dr - dvx/c);
+        ay[k] += a_rad*((1.-rdot/c)*dy/dr - dvy/c);
+        az[k] += a_rad*((1.-rdot/c)*dz/dr - dvz/c);
+    }
+}
+
+// Same in single precision, after the positions and velocities are taken relative to the source in double
+static void rebx_radiation_acc_float(const int k0, const int k1, const double* restrict const x, const double* restrict const y, const double* restrict const z, const double* restrict const vx, const double* restrict const vy, const double* restrict const vz, double* restrict const ax, double* restrict const ay, double* restrict const az, const double* restrict const beta, const struct reb_particle* const source, const double mu, const double c){
+    const double sx = source->x, sy = source->y, sz = source->z;
+    const double svx = source->vx, svy = source->vy, svz = source->vz;
+    const float muf = (float)mu;
+    const float cinv = (float)(1./c);
+    for (int k=k0; k<k1; k++){
+        const float dx = (float)(x[k] - sx);
+        const float dy = (float)(y[k] - sy);
+        const float dz = (float)(z[k] - sz);
+        const float dvx = (float)(vx[k] - svx);
+        const float dvy = (float)(vy[k] - svy);
+        const float dvz = (float)(vz[k] - svz);
+        const float dr2 = dx*dx + dy*dy + dz*dz;
+        const float drinv = 1.f/sqrtf(dr2);
+        const float rdot = (dx*dvx + dy*dvy + dz*dvz)*drinv;
+        const float a_rad = (float)beta[k]*muf*drinv*drinv;
+        const float radial = (1.f - rdot*cinv)*drinv;
+
+        ax[k] += (double)(a_rad*(radial*dx - dvx*cinv));
+        ay[k] += (double)(a_rad*(radial*dy - dvy*cinv));
+        az[k] += (double)(a_rad*(radial*dz - dvz*cinv));
+    }
+}
 
-        particles[i].ax += a_rad*((1.-rdot/c)*dx/dr - dvx/c);
-        particles[i].ay += a_rad*((1.-rdot/c)*dy/dr - dvy/c);
-        particles[i].az += a_rad*((1.-rdot/c)*dz/dr - dvz/c);
-	}
+// Fills ws->copies and returns how many sources there are
+static int rebx_radiation_copy_sources(struct reb_simulation* const sim, struct rebx_radiation_workspace* const ws, const struct reb_particle* const particles, const rebx_param_handle source_h){
+    // Sources can lose radiation_source without a rebuild if their ap is changed directly, and then the default applies again
+    struct rebx_radiation_source* const sources = ws->copies;
+    int n_sources = 0;
+    for (int s=0; s<ws->n_sources; s++){
+        const int i = ws->sources[s];
+        if (ws->source_default || rebx_get_param_h(particles[i].ap, source_h) != NULL){
+            sources[n_sources].index = i;
+            sources[n_sources].mu = sim->G*particles[i].m;
+            sources[n_sources].p = particles[i];
+            n_sources++;
+        }
+    }
+    if (n_sources == 0){
+        sources[0].index = 0;
+        sources[0].mu = sim->G*particles[0].m;
+        sources[0].p = particles[0];
+        n_sources = 1;
+    }
+    return n_sources;
 }
 
 void rebx_radiation_forces(struct reb_simulation* const sim, struct rebx_force* const radiation_forces, struct reb_particle* const particles, const int N){
     struct rebx_extras* const rebx = sim->extras;
-    double* c = rebx_get_param(rebx, radiation_forces->ap, "c");
+    double* c = rebx_get_param_double_h(radiation_forces->ap, rebx_default_param(rebx, REBX_PARAM_c));
     if (c == NULL){
         reb_error(sim, "Need to set speed of light in radiation_forces effect.  See examples in documentation.\n");
+        return;
     }
-    
-    int source_found=0;
-    for (int i=0; i<N; i++){
-        if (rebx_get_param(rebx, particles[i].ap, "radiation_source") != NULL){
-            source_found = 1;
-            rebx_calculate_radiation_forces(rebx, sim, *c, i, particles, N);
+    const int* const single = rebx_get_param_int_h(radiation_forces->ap, rebx_default_param(rebx, REBX_PARAM_radiation_float));
+    const rebx_param_handle source_h = rebx_default_param(rebx, REBX_PARAM_radiation_source);
+    const rebx_param_handle beta_h = rebx_default_param(rebx, REBX_PARAM_beta);
+    struct rebx_param_column* const beta_column = rebx_get_param_column(rebx, beta_h);
+    struct rebx_radiation_workspace* const ws = rebx_radiation_workspace_get(rebx, radiation_forces);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_radiation_build(rebx, ws, particles, N, source_h, beta_column, beta_h))){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for radiation_forces.\n");
+        return;
+    }
+
+    struct rebx_radiation_source* const sources = ws->copies;
+    const int n_sources = rebx_radiation_copy_sources(sim, ws, particles, source_h);
+
+    // Blocks of the particles with beta are gathered into arrays and go through each source in turn, so the loops over
+    // them vectorize and every particle adds up the sources in the same order as before
+    double x[REBX_RADIATION_BLOCK], y[REBX_RADIATION_BLOCK], z[REBX_RADIATION_BLOCK];
+    double vx[REBX_RADIATION_BLOCK], vy[REBX_RADIATION_BLOCK], vz[REBX_RADIATION_BLOCK];
+    double ax[REBX_RADIATION_BLOCK], ay[REBX_RADIATION_BLOCK], az[REBX_RADIATION_BLOCK];
+    double beta[REBX_RADIATION_BLOCK];
+    int live[REBX_RADIATION_BLOCK];
+    const int full = rebx_param_column_full(beta_column, N);
+    const int use_float = single != NULL && *single;
+    for (int k_start=0; k_start<ws->n;){
+        int m = 0;
+        for (; k_start<ws->n && m<REBX_RADIATION_BLOCK; k_start++){
+            const int i = ws->index[k_start];
+            const double* const b = full ? &((const double*)beta_column->values)[i] : rebx_get_particle_param_double(beta_column, i, particles[i].ap, beta_h);
+            if (b == NULL){         // removed since the list was built
+                continue;
+            }
+            const struct reb_particle* const p = &particles[i];
+            live[m] = i;
+            x[m] = p->x; y[m] = p->y; z[m] = p->z;
+            vx[m] = p->vx; vy[m] = p->vy; vz[m] = p->vz;
+            ax[m] = p->ax; ay[m] = p->ay; az[m] = p->az;
+            beta[m] = *b;
+            m++;
+        }
+        for (int s=0; s<n_sources; s++){
+            // A source with beta does not feel itself.  The block is evaluated whole, and its own row put back afterwards.
+            int k_self = -1;
+            if (m > 0 && sources[s].index >= live[0] && sources[s].index <= live[m-1]){
+                for (int k=0; k<m; k++){
+                    if (live[k] == sources[s].index){
+                        k_self = k;
+                        break;
+                    }
+                }
+            }
+            const double self[3] = {k_self >= 0 ? ax[k_self] : 0., k_self >= 0 ? ay[k_self] : 0., k_self >= 0 ? az[k_self] : 0.};
+            if (use_float){
+                rebx_radiation_acc_float(0, m, x, y, z, vx, vy, vz, ax, ay, az, beta, &sources[s].p, sources[s].mu, *c);
+            }
+            else{
+                rebx_radiation_acc(0, m, x, y, z, vx, vy, vz, ax, ay, az, beta, &sources[s].p, sources[s].mu, *c);
+            }
+            if (k_self >= 0){
+                ax[k_self] = self[0];
+                ay[k_self] = self[1];
+                az[k_self] = self[2];
+            }
+        }
+        for (int k=0; k<m; k++){
+            struct reb_particle* const p = &particles[live[k]];
+            p->ax = ax[k];
+            p->ay = ay[k];
+            p->az = az[k];
         }
     }
-    if (!source_found){
-        rebx_calculate_radiation_forces(rebx, sim, *c, 0, particles, N);    // default source to index 0 if "radiation_source" not found on any particle
+}
+
+struct rebx_radiation_state {
+    struct rebx_radiation_workspace* ws;
+    double c;
+    int use_float;
+    int n_sources;
+    int next;                   // first entry of ws->index not reached by the blocks so far
+    int full;
+    struct rebx_param_column* beta_column;
+    rebx_param_handle beta_h;
+};
+
+static int rebx_radiation_forces_begin(struct reb_simulation* const sim, struct rebx_force* const radiation_forces, struct reb_particle* const particles, const int N, void* const state){
+    struct rebx_extras* const rebx = sim->extras;
+    const double* const c = rebx_get_param_double_h(radiation_forces->ap, rebx_default_param(rebx, REBX_PARAM_c));
+    if (c == NULL){
+        return 0;   // rebx_radiation_forces reports the error
     }
+    struct rebx_radiation_state* const st = state;
+    const int* const single = rebx_get_param_int_h(radiation_forces->ap, rebx_default_param(rebx, REBX_PARAM_radiation_float));
+    const rebx_param_handle source_h = rebx_default_param(rebx, REBX_PARAM_radiation_source);
+    st->beta_h = rebx_default_param(rebx, REBX_PARAM_beta);
+    st->beta_column = rebx_get_param_column(rebx, st->beta_h);
+    struct rebx_radiation_workspace* const ws = rebx_radiation_workspace_get(rebx, radiation_forces);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_radiation_build(rebx, ws, particles, N, source_h, st->beta_column, st->beta_h))){
+        return 0;
+    }
+    st->ws = ws;
+    st->c = *c;
+    st->use_float = single != NULL && *single;
+    st->n_sources = rebx_radiation_copy_sources(sim, ws, particles, source_h);
+    st->next = 0;
+    st->full = rebx_param_column_full(st->beta_column, N);
+    return 1;
 }
 
+// The particles of the block with beta are gathered again, so the same loops as above apply
+static void rebx_radiation_forces_block(struct reb_simulation* const sim, struct rebx_force* const radiation_forces, struct reb_particle* const particles, struct rebx_fused_block* const b, void* const state){
+    struct rebx_radiation_state* const st = state;
+    const struct rebx_radiation_workspace* const ws = st->ws;
+    double x[REBX_FUSED_BLOCK], y[REBX_FUSED_BLOCK], z[REBX_FUSED_BLOCK];
+    double vx[REBX_FUSED_BLOCK], vy[REBX_FUSED_BLOCK], vz[REBX_FUSED_BLOCK];
+    double ax[REBX_FUSED_BLOCK], ay[REBX_FUSED_BLOCK], az[REBX_FUSED_BLOCK];
+    double beta[REBX_FUSED_BLOCK];
+    int live[REBX_FUSED_BLOCK];     // position in the block
+    int m = 0;
+    for (; st->next<ws->n && ws->index[st->next] < b->i0 + b->n; st->next++){
+        const int i = ws->index[st->next];
+        const double* const bp = st->full ? &((const double*)st->beta_column->values)[i] : rebx_get_particle_param_double(st->beta_column, i, particles[i].ap, st->beta_h);
+        if (bp == NULL || i < b->i0){
+            continue;
+        }
+        const int k = i - b->i0;
+        live[m] = k;
+        x[m] = b->x[k]; y[m] = b->y[k]; z[m] = b->z[k];
+        vx[m] = b->vx[k]; vy[m] = b->vy[k]; vz[m] = b->vz[k];
+        ax[m] = 0.; ay[m] = 0.; az[m] = 0.;
+        beta[m] = *bp;
+        m++;
+    }
+    if (m == 0){
+        return;
+    }
+    const struct rebx_radiation_source* const sources = ws->copies;
+    for (int s=0; s<st->n_sources; s++){
+        int k_self = -1;
+        const int k_source = sources[s].index - b->i0;
+        if (k_source >= live[0] && k_source <= live[m-1]){
+            for (int k=0; k<m; k++){
+                if (live[k] == k_source){
+                    k_self = k;
+                    break;
+                }
+            }
+        }
+        const double self[3] = {k_self >= 0 ? ax[k_self] : 0., k_self >= 0 ? ay[k_self] : 0., k_self >= 0 ? az[k_self] : 0.};
+        if (st->use_float){
+            rebx_radiation_acc_float(0, m, x, y, z, vx, vy, vz, ax, ay, az, beta, &sources[s].p, sources[s].mu, st->c);
+        }
+        else{
+            rebx_radiation_acc(0, m, x, y, z, vx, vy, vz, ax, ay, az, beta, &sources[s].p, sources[s].mu, st->c);
+        }
+        if (k_self >= 0){
+            ax[k_self] = self[0];
+            ay[k_self] = self[1];
+            az[k_self] = self[2];
+        }
+    }
+    for (int k=0; k<m; k++){
+        b->ax[live[k]] += ax[k];
+        b->ay[live[k]] += ay[k];
+        b->az[live[k]] += az[k];
+    }
+}
+
+const struct rebx_fused_kernel rebx_radiation_forces_fused = {rebx_radiation_forces, sizeof(struct rebx_radiation_state), rebx_radiation_forces_begin, rebx_radiation_forces_block};
+
 double rebx_rad_calc_beta(const double G, const double c, const double source_mass, const double source_luminosity, const double radius, const double density, const double Q_pr){
     return 3.*source_luminosity*Q_pr/(16.*M_PI*G*source_mass*c*density*radius);   
 }
@@ -33,6 +33,9 @@
 #include <limits.h>
 #include "rebound.h"
 #include "rebxtools.h"
+#ifdef REBX_MPI
+#include <mpi.h>
+#endif
 #ifndef REBXGITHASH
 #define REBXGITHASH notavailable0000000000000000000000000001 
 #endif // REBXGITHASH
@@ -124,6 +127,13 @@ enum rebx_binary_field_type{
     REBX_BINARY_FIELD_TYPE_PARTICLES=24,
     REBX_BINARY_FIELD_TYPE_FORCE=25,
     REBX_BINARY_FIELD_TYPE_SNAPSHOT=26,
+    REBX_BINARY_FIELD_TYPE_PARAM_COLUMNS=27,
+    REBX_BINARY_FIELD_TYPE_PARAM_COLUMN=28,
+    REBX_BINARY_FIELD_TYPE_COLUMN_PRESENT=29,
+    REBX_BINARY_FIELD_TYPE_ARCHIVE_KEYFRAME=30,
+    REBX_BINARY_FIELD_TYPE_ARCHIVE_DELTA=31,
+    REBX_BINARY_FIELD_TYPE_ARCHIVE_TIME=32,
+    REBX_BINARY_FIELD_TYPE_ARCHIVE_CHANGES=33,
 };
 
 /**
@@ -149,6 +159,7 @@ enum rebx_input_binary_messages {
     REBX_INPUT_BINARY_WARNING_PARAM_VALUE_NULL = 8192,
     REBX_INPUT_BINARY_WARNING_VERSION = 16384,
     REBX_INPUT_BINARY_WARNING_FORCE_PARAM_NOT_LOADED = 32768,
+    REBX_INPUT_BINARY_WARNING_PARAM_COLUMN_NOT_LOADED = 65536,
 };
 
 /**
@@ -160,6 +171,7 @@ enum rebx_integrator {
     REBX_INTEGRATOR_RK4 = 1,
     REBX_INTEGRATOR_EULER = 2,
     REBX_INTEGRATOR_RK2 = 3,
+    REBX_INTEGRATOR_DOPRI5 = 4,
 };
 
 /****************************************
@@ -175,6 +187,13 @@ struct rebx_node{
     struct rebx_node* next;   ///< Pointer to next node in list
 };
 
+struct rebx_param_ids;
+struct rebx_pools;
+struct rebx_column_removal;
+struct rebx_integrator_workspace;
+struct rebx_schedule;
+struct rebx_archive_writer;
+
 /**
  * @brief Main structure used for all parameters added to objects.
  */
@@ -183,6 +202,37 @@ struct rebx_param{
     char* name;                 ///< For searching linked lists and informative errors
     enum rebx_param_type type;  ///< Needed to cast value
     void* value;                ///< Pointer to parameter value
+    int id;                     ///< Index of name among the registered parameters, -1 if it is not registered
+    union {
+        double d;
+        int i;
+        uint32_t u;
+    } storage;                  ///< Where value points for DOUBLE, INT and UINT32 params
+};
+
+/**
+ * @brief Values of one registered DOUBLE or INT parameter for all the particles, indexed by particle index.
+ * @details Where a particle's row is present it takes the place of the parameter in the particle's ap list.  Rows follow the particles when they are removed from the simulation.
+ */
+struct rebx_param_column{
+    const char* name;           ///< Registered name of the parameter
+    int id;                     ///< Id of the registered parameter name
+    enum rebx_param_type type;  ///< REBX_TYPE_DOUBLE or REBX_TYPE_INT
+    int N;                      ///< Number of rows in use.  Rows from N on are not present
+    int N_alloc;                ///< Number of rows allocated
+    int n_present;              ///< Number of rows present
+    void* values;               ///< double or int array of N_alloc values
+    uint64_t* present;          ///< Bitmap of the rows that are present
+};
+
+/**
+ * @brief Counters each force and operator keeps while stats are enabled (see rebx_enable_stats).
+ */
+struct rebx_stats{
+    uint64_t calls;             ///< Calls from rebx_additional_forces or the pre and post timestep modifications
+    uint64_t particles;         ///< Number of particles passed to those calls, summed
+    uint64_t iterations;        ///< Iterations of the fixed-point loops in gr, gr_full and ephemeris_forces (summed over particles), and in the implicit_midpoint integrator
+    double time;                ///< Wall time spent in those calls, in seconds
 };
 
 /**
@@ -195,6 +245,7 @@ struct rebx_force{
     // See comments in params.py in __init__
     enum rebx_force_type force_type;    ///< Force type for internal logic
     void (*update_accelerations) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* const particles, const int N); ///< Function pointer to add additional accelerations
+    struct rebx_stats stats;    ///< Calls and time, counted while stats are enabled
 };
 
 /**
@@ -207,6 +258,7 @@ struct rebx_operator{
     // See comments in params.py in __init__
     enum rebx_operator_type operator_type;  ///< Operator type for internal logic
     void (*step_function) (struct reb_simulation* sim, struct rebx_operator* operator, const double dt);       ///< Function pointer to execute step
+    struct rebx_stats stats;    ///< Calls and time, counted while stats are enabled
 };
 
 /**
@@ -240,6 +292,32 @@ struct rebx_extras {
     struct rebx_node* registered_params;            ///< Linked list of rebx_params with all the parameter names registered with their type (for type safety)
     struct rebx_node* allocated_forces;             ///< For memory management
     struct rebx_node* allocated_operators;          ///< For memory management
+    struct rebx_param_ids* param_ids;               ///< Hash of the registered parameter names to their ids
+    struct rebx_pools* pools;                       ///< Slabs the nodes, params and parameter names are allocated from
+    struct rebx_node* param_columns;                ///< Linked list of rebx_param_columns
+    struct rebx_column_removal* column_removal;     ///< Last particle whose parameters were freed, to move the column rows if it was removed
+    struct rebx_integrator_workspace* integrator_workspace; ///< Scratch particles and state vectors shared by the integrators of all forces
+    struct rebx_schedule* schedule;                 ///< Arrays of the forces and operator steps to call, rebuilt when they change
+    uint64_t param_generation;                      ///< Changes when parameters are added to particles, or freed with them, so effects can tell when cached lists of particles are stale
+    int stats_enabled;                              ///< Forces and operators count their calls and time in their stats.  See rebx_enable_stats
+    struct rebx_archive_writer* archive_writer;     ///< What the last append to an archive wrote, to write only the changes next time.  See rebx_archive_append
+    int passes_running;                             ///< Calls going through the forces or operator steps.  What is removed meanwhile is freed once they return
+    struct rebx_node* removed_forces;               ///< Forces removed while passes_running, still to be freed
+    struct rebx_node* removed_operators;            ///< Operators removed while passes_running, still to be freed
+    struct rebx_node* removed_steps;                ///< rebx_steps removed while passes_running, still to be freed
+};
+
+/**
+ * @brief An archive file opened with rebx_open_archive.
+ * @details Each snapshot is either a keyframe with the whole REBOUNDx state, or a delta with the parameter values that changed since the snapshot before it.
+ */
+struct rebx_archive{
+    int N;                      ///< Number of snapshots
+    double* t;                  ///< Simulation time of each snapshot, in the order they were appended
+    long* offsets;              ///< Where each snapshot starts in the file
+    int* keyframes;             ///< Keyframe each snapshot's deltas start from
+    void* map;                  ///< The file, mapped into memory
+    long size;                  ///< Size of the file in bytes
 };
 
 /****************************************
@@ -271,7 +349,7 @@ void rebx_detach(struct reb_simulation* sim, struct rebx_extras* rebx);
 void rebx_extras_cleanup(struct reb_simulation* sim);
 /**
  * @brief Frees all memory allocated by REBOUNDx instance.
- * @details Should be called after simulation is done if memory is a concern.
+ * @details Should be called after simulation is done if memory is a concern.  The parameters of the particles of an attached simulation are freed with it.
  * @param rebx The rebx_extras pointer returned from the initial call to rebx_attach.
  */
 void rebx_free(struct rebx_extras* rebx);
@@ -300,6 +378,56 @@ struct rebx_extras* rebx_create_extras_from_binary(struct reb_simulation* sim, c
  * @param warnings Pointer to an array of warnings to be populated during loading. 
  */
 void rebx_init_extras_from_binary(struct rebx_extras* rebx, const char* const filename, enum rebx_input_binary_messages* warnings);
+
+/**
+ * @brief Appends the REBOUNDx state to an archive file, to go with the snapshots of a REBOUND SimulationArchive.
+ * @details The first append, or one after effects or parameters were added or removed, writes a keyframe with everything rebx_output_binary saves.  Otherwise only the parameter values that changed since the last append are written.  Can be called from the simulation's heartbeat.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param filename Archive file to append to.  It is created if it doesn't exist.
+ * @return 1 on success, 0 otherwise
+ */
+int rebx_archive_append(struct rebx_extras* const rebx, const char* const filename);
+
+/**
+ * @brief Appends to an archive at regular intervals of simulation time at the end of the timestep, like reb_simulationarchive_automate_interval.
+ * @details The file is deleted, and the first snapshot is written immediately.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param filename Archive file to write.
+ * @param interval Simulation time between snapshots.  0 stops the automatic appends.
+ */
+void rebx_archive_automate_interval(struct rebx_extras* const rebx, const char* const filename, const double interval);
+
+/**
+ * @brief Opens an archive written by rebx_archive_append, indexing its snapshots.
+ * @param filename Archive file to open.
+ * @param warnings Pointer to an array of warnings to be populated while indexing.
+ * @return Pointer to the archive, to be freed with rebx_free_archive, or NULL if it can't be opened.
+ */
+struct rebx_archive* rebx_open_archive(const char* const filename, enum rebx_input_binary_messages* warnings);
+
+/**
+ * @brief Finds the last snapshot at or before a time by bisection, assuming the snapshots were appended in the order of increasing time.
+ * @return Index of the snapshot, or -1 if all snapshots are after t.
+ */
+int rebx_archive_find(const struct rebx_archive* const archive, const double t);
+
+/**
+ * @brief Loads a snapshot of an archive, like rebx_create_extras_from_binary().
+ * @param sim Pointer to the simulation to which the effects and parameters should be added.
+ * @param archive Archive from rebx_open_archive.
+ * @param snapshot Index of the snapshot.
+ */
+struct rebx_extras* rebx_create_extras_from_archive(struct reb_simulation* sim, const struct rebx_archive* const archive, const int snapshot);
+
+/**
+ * @brief Similar to rebx_create_extras_from_archive(), but takes an extras instance (must be attached to a simulation) and allows for manual message handling, like rebx_init_extras_from_binary().
+ */
+void rebx_init_extras_from_archive(struct rebx_extras* rebx, const struct rebx_archive* const archive, const int snapshot, enum rebx_input_binary_messages* warnings);
+
+/**
+ * @brief Closes an archive opened with rebx_open_archive.
+ */
+void rebx_free_archive(struct rebx_archive* archive);
 /** @} */
 /** @} */
 
@@ -368,6 +496,39 @@ struct rebx_operator* rebx_get_operator(struct rebx_extras* const rebx, const ch
 /** @} */
 /** @} */
 
+/****************************************
+  Profiling
+*****************************************/
+/**
+ * \name Functions for timing forces and operators
+ * @{
+ */
+/**
+ * @defgroup Stats
+ * @details While enabled, every force and operator counts its calls, the particles passed to them, the time spent in them and the iterations of its fixed-point loops in its stats field.  When disabled, the counters are left alone and only cost a test per call.
+ * @{
+ */
+/**
+ * @brief Turns the counting on (enable = 1) or off (enable = 0).  The counters keep their values.
+ */
+void rebx_enable_stats(struct rebx_extras* const rebx, const int enable);
+
+/**
+ * @brief Sets the counters of all forces and operators to zero.
+ */
+void rebx_reset_stats(struct rebx_extras* const rebx);
+
+/**
+ * @brief Copies the counters of the force, or else the operator, with the given name.
+ * @param rebx Pointer to the rebx_extras instance
+ * @param name Name of the force or operator
+ * @param stats Pointer to the structure to copy them to
+ * @return 1 if found, 0 otherwise (stats is then left unchanged)
+ */
+int rebx_get_stats(struct rebx_extras* const rebx, const char* const name, struct rebx_stats* const stats);
+/** @} */
+/** @} */
+
 /********************************
  * Parameter manipulation functions
  *******************************/
@@ -537,6 +698,142 @@ double rebx_gravitational_harmonics_potential(struct rebx_extras* const rebx);
  */
 void* rebx_get_param_check(struct reb_simulation* sim, struct rebx_node* ap, const char* const param_name, enum rebx_param_type param_type);
 
+/**
+ * @brief A registered parameter name resolved ahead of time, for lookups inside particle loops.
+ * @detail Handles are only valid for the rebx_extras they were resolved with.
+ */
+typedef struct rebx_param_handle {
+    int id;                         ///< Id of the registered name, -1 if the name is not registered
+    enum rebx_param_type type;      ///< Registered type of the name
+} rebx_param_handle;
+
+/**
+ * @brief Resolves a registered parameter name to a handle.
+ * @detail Resolve a name once, outside loops and per-step calls, and then look it up with rebx_get_param_h or the typed accessors without hashing or comparing strings.  The built-in effects take the handles of the default params from a table filled at registration instead.
+ * @param param_name Name of the parameter (see Effects page at http://reboundx.readthedocs.org)
+ * @return Handle to the name.  Lookups through it find nothing if the name is not registered.
+ */
+rebx_param_handle rebx_param_resolve(struct rebx_extras* const rebx, const char* const param_name);
+
+/**
+ * @brief Gets a parameter from a particle or effect by handle, like rebx_get_param.
+ * @param ap Pointer from which to get the param
+ * @param h Handle from rebx_param_resolve
+ * @return A void pointer to the parameter. NULL if not found.
+ */
+void* rebx_get_param_h(struct rebx_node* ap, const rebx_param_handle h);
+
+/**
+ * @brief Typed versions of rebx_get_param_h.  They return NULL if the registered type of the handle does not match.
+ */
+static inline double* rebx_get_param_double_h(struct rebx_node* ap, const rebx_param_handle h){
+    return h.type == REBX_TYPE_DOUBLE ? (double*)rebx_get_param_h(ap, h) : NULL;
+}
+
+static inline int* rebx_get_param_int_h(struct rebx_node* ap, const rebx_param_handle h){
+    return h.type == REBX_TYPE_INT ? (int*)rebx_get_param_h(ap, h) : NULL;
+}
+
+static inline uint32_t* rebx_get_param_uint32_h(struct rebx_node* ap, const rebx_param_handle h){
+    return h.type == REBX_TYPE_UINT32 ? (uint32_t*)rebx_get_param_h(ap, h) : NULL;
+}
+
+/**
+ * @brief Adds a column for a registered DOUBLE or INT particle parameter.
+ * @detail Effects that support columns read a particle's row where it is present, and the parameter in the particle's ap list otherwise.
+ * @param param_name Name of the parameter (see Effects page at http://reboundx.readthedocs.org)
+ * @return Pointer to the new column, or to the existing one if the parameter already has a column. NULL on error.
+ */
+struct rebx_param_column* rebx_add_param_column(struct rebx_extras* const rebx, const char* const param_name);
+
+/**
+ * @brief Gets the column of a parameter.
+ * @param h Handle from rebx_param_resolve
+ * @return Pointer to the column. NULL if the parameter has no column.
+ */
+struct rebx_param_column* rebx_get_param_column(struct rebx_extras* const rebx, const rebx_param_handle h);
+
+/**
+ * @brief Sets the row of a particle in a column.
+ * @param index Index of the particle in sim->particles
+ * @return 1 on success, 0 otherwise.
+ */
+int rebx_set_param_column_double(struct rebx_extras* const rebx, struct rebx_param_column* const column, const int index, const double val);
+int rebx_set_param_column_int(struct rebx_extras* const rebx, struct rebx_param_column* const column, const int index, const int val);
+
+/**
+ * @brief Clears the row of a particle in a column, so the parameter in its ap list is used again.
+ */
+void rebx_clear_param_column(struct rebx_param_column* const column, const int index);
+
+/**
+ * @brief Removes the column of a parameter.  The parameters in the particles' ap lists are not changed.
+ * @return 1 if the column was found and removed, 0 otherwise.
+ */
+int rebx_remove_param_column(struct rebx_extras* const rebx, const char* const param_name);
+
+/**
+ * @brief Sets a DOUBLE, INT or UINT32 parameter on particles 0 to N-1 in one call.
+ * @detail If the parameter has a column, the values are written to its rows.  Otherwise they are set in the particles' ap lists, adding the parameter where missing.
+ * @param values Array of N values of the registered type of the parameter
+ * @return 1 on success, 0 otherwise.
+ */
+int rebx_set_particle_param_array(struct rebx_extras* const rebx, const char* const param_name, const void* const values, const int N);
+
+/**
+ * @brief Gathers a DOUBLE, INT or UINT32 parameter of particles 0 to N-1 into values, from their rows in its column where present.
+ * @detail Values of particles that do not have the parameter are left as they were.
+ * @return Number of particles that have the parameter.
+ */
+int rebx_get_particle_param_array(struct rebx_extras* const rebx, const char* const param_name, void* const values, const int N);
+
+/**
+ * @brief Gets the values of a parameter's column, if all the rows of particles 0 to N-1 are present, so they can be read and written in place.
+ * @detail The pointer is valid until particles are added or the column is removed.
+ * @return Pointer to the column values. NULL if the parameter has no column or it is not full.
+ */
+void* rebx_get_particle_param_view(struct rebx_extras* const rebx, const char* const param_name, const int N);
+
+/**
+ * @brief Whether the row of a particle is present.  column may be NULL.
+ */
+static inline int rebx_param_column_present(const struct rebx_param_column* const column, const int index){
+    return column != NULL && index < column->N && ((column->present[index >> 6] >> (index & 63)) & 1);
+}
+
+/**
+ * @brief Whether the rows of particles 0 to N-1 are all present, so effects can read column->values directly.
+ */
+static inline int rebx_param_column_full(const struct rebx_param_column* const column, const int N){
+    return column != NULL && column->n_present == column->N && column->N >= N;
+}
+
+/**
+ * @brief Gets a pointer to the row of a particle.  NULL if it is not present.
+ */
+static inline double* rebx_param_column_double(struct rebx_param_column* const column, const int index){
+    return rebx_param_column_present(column, index) ? &((double*)column->values)[index] : NULL;
+}
+
+static inline int* rebx_param_column_int(struct rebx_param_column* const column, const int index){
+    return rebx_param_column_present(column, index) ? &((int*)column->values)[index] : NULL;
+}
+
+/**
+ * @brief Gets a particle parameter from its row in the column if present, and from its ap list otherwise.
+ * @param column Column of the parameter, or NULL
+ * @param index Index of the particle
+ */
+static inline double* rebx_get_particle_param_double(struct rebx_param_column* const column, const int index, struct rebx_node* ap, const rebx_param_handle h){
+    double* const value = rebx_param_column_double(column, index);
+    return value != NULL ? value : rebx_get_param_double_h(ap, h);
+}
+
+static inline int* rebx_get_particle_param_int(struct rebx_param_column* const column, const int index, struct rebx_node* ap, const rebx_param_handle h){
+    int* const value = rebx_param_column_int(column, index);
+    return value != NULL ? value : rebx_get_param_int_h(ap, h);
+}
+
 void rebx_gr_acc(struct rebx_extras* const rebx, double* acc, const double C2);
 double rebx_calculate_energy(struct reb_simulation* const sim);
 int rebx_len(struct rebx_node* head);
@@ -588,7 +885,6 @@ void rebx_input_skip_binary_field(FILE* inf, long field_size);
 /** @} */
 
 void rebx_error(struct rebx_extras* rebx, const char* const msg);
-#endif
 
 // Added gravitational constant G for the GR stuff (2020 Feb 26)
 // Added vx, vy, vz (2020 Feb 27)
@@ -613,3 +909,410 @@ void ephem(const double G, const int i, const double t, double* const m,
 	   double* const vx, double* const vy, double* const vz,
 	   double* const ax, double* const ay, double* const az);
 
+struct mpos_s;
+
+/**
+ * @brief Opaque handle to a loaded pair of ephemeris kernels (a DE430 planetary file and an SPK asteroid file).
+ * @details A context can be shared by any number of simulations. Attach it to an ephemeris_forces force by setting
+ * the force's "ephemeris" pointer parameter with rebx_set_param_pointer. The parameter does not take a reference,
+ * so the context must outlive the force. Forces without the parameter use the default files
+ * linux_p1550p2650.430 and sb431-n16s.bsp from the working directory, loaded once by the first
+ * caller that needs them.
+ *
+ * Concurrency: evaluating a context is reentrant and keeps no state in it, so any number of threads
+ * can run simulations, forces and the integration_function drivers on one context at once; each force
+ * keeps its own cache. rebx_ephemeris_retain and rebx_ephemeris_release are atomic. Calls that change a
+ * context, rebx_ephemeris_preload and rebx_ephemeris_set_perturbers, must not overlap with any other use
+ * of it.
+ */
+struct rebx_ephemeris;
+
+/**
+ * @brief Load an ephemeris context with a reference count of one.
+ * @param planets_path Path to the binary DE430 file.
+ * @param asteroids_path Path to the SPK file with the massive asteroids, or NULL to load planets only.
+ * @return Pointer to the context, or NULL (with a message on stderr) if a file could not be loaded.
+ */
+struct rebx_ephemeris* rebx_ephemeris_load(const char* const planets_path, const char* const asteroids_path);
+
+/**
+ * @brief Load an ephemeris context from a native file written by rebx_ephemeris_write_native.
+ * @details The file is mapped and used in place: it is already in au and days, so no conversion is done when it is evaluated.
+ * Only the time span and asteroids written to it are available.
+ * @param path Path to the native file.
+ * @return Pointer to the context, or NULL (with a message on stderr) if the file could not be loaded.
+ */
+struct rebx_ephemeris* rebx_ephemeris_load_native(const char* const path);
+
+/**
+ * @brief Write the part of a context's kernels covering a time span to a native file, for fast loading with rebx_ephemeris_load_native.
+ * @details The span is rounded out to whole planetary records. Only the series of the bodies used by the ephemeris forces are kept.
+ * @param eph Pointer to a context loaded with rebx_ephemeris_load.
+ * @param path Path of the file to write.
+ * @param jde_begin Start of the span (JD, TDB).
+ * @param jde_end End of the span (JD, TDB).
+ * @param n_asteroids Number of asteroids to keep, in kernel order (0 for none).
+ * @return 1 on success, 0 (with a message on stderr) otherwise.
+ */
+int rebx_ephemeris_write_native(const struct rebx_ephemeris* const eph, const char* const path, const double jde_begin, const double jde_end, const int n_asteroids);
+
+/**
+ * @brief Add a reference to an ephemeris context.
+ * @param eph Pointer to the context.
+ * @return The same pointer, for convenience.
+ */
+struct rebx_ephemeris* rebx_ephemeris_retain(struct rebx_ephemeris* const eph);
+
+/**
+ * @brief Drop a reference to an ephemeris context, unmapping the kernels when the last one is released.
+ * @param eph Pointer to the context.
+ */
+void rebx_ephemeris_release(struct rebx_ephemeris* const eph);
+
+/**
+ * @brief Opaque handle to a set of point-mass perturbers for ephemeris_forces, chosen by NAIF ID.
+ * @details Attach a set to a force with the "perturbers" pointer parameter (the set must outlive the force),
+ * or make it the default of a context with rebx_ephemeris_set_perturbers. A force with a set ignores
+ * N_ephem and N_ast. The Earth and Sun oblateness and the solar GR terms are always included.
+ */
+struct rebx_ephem_perturbers;
+
+/**
+ * @brief Pass as naif_id to rebx_ephem_perturbers_set_cutoff to set the cutoffs of every body in a set.
+ */
+#define REBX_EPHEM_ALL_PERTURBERS (-1)
+
+/**
+ * @brief Create a perturber set from a list of NAIF IDs.
+ * @details Planets are found in the planetary kernel: 10 (Sun), 1 or 199 (Mercury), 2 or 299 (Venus), 399 (Earth),
+ * 301 (Moon), and 4-9 or 499-999 (the system barycentres of Mars to Pluto). Asteroids are found in the SPK
+ * kernel of the context with spk_find, in any file order, and must be one of the 16 with masses from DE431.
+ * Duplicate IDs are ignored.
+ * @param eph Pointer to the context the set will be used with.
+ * @param n Number of IDs.
+ * @param naif_ids Array of n NAIF IDs.
+ * @return Pointer to the set, or NULL (with a message on stderr) if an ID is unknown.
+ */
+struct rebx_ephem_perturbers* rebx_ephem_perturbers_create(const struct rebx_ephemeris* const eph, const int n, const int* const naif_ids);
+
+/**
+ * @brief Set per-particle cutoffs for a body of a set.
+ * @details A body is skipped for a particle farther than r_max from it, or where its point-mass acceleration G*m/r^2
+ * is below a_min. Pass 0 for either to disable it. The cutoffs are evaluated per particle, and whole blocks of particles
+ * are skipped at once with the "soa" layout.
+ * @param set Pointer to the set.
+ * @param naif_id NAIF ID of the body, or REBX_EPHEM_ALL_PERTURBERS.
+ * @param r_max Distance cutoff (au), or 0.
+ * @param a_min Acceleration cutoff (au/day^2), or 0.
+ * @return 1 on success, 0 if the body is not in the set or a cutoff is negative.
+ */
+int rebx_ephem_perturbers_set_cutoff(struct rebx_ephem_perturbers* const set, const int naif_id, const double r_max, const double a_min);
+
+/**
+ * @brief Free a perturber set.
+ * @param set Pointer to the set, or NULL.
+ */
+void rebx_ephem_perturbers_free(struct rebx_ephem_perturbers* const set);
+
+/**
+ * @brief Make a copy of a perturber set the default for forces using a context, including those of the integration_function drivers.
+ * @param eph Pointer to the context.
+ * @param set Pointer to a set created for eph, or NULL to go back to N_ephem and N_ast.
+ * @return 1 on success, 0 if the set was created for another context.
+ */
+int rebx_ephemeris_set_perturbers(struct rebx_ephemeris* const eph, const struct rebx_ephem_perturbers* const set);
+
+/**
+ * @brief Page in the parts of the kernels covering a time span, so later force evaluations in it do not stall.
+ * @param eph Pointer to the context.
+ * @param jde_begin Start of the span (JD, TDB).
+ * @param jde_end End of the span (JD, TDB).
+ * @return 1 on success, 0 on failure.
+ */
+int rebx_ephemeris_warmup(struct rebx_ephemeris* const eph, const double jde_begin, const double jde_end);
+
+/**
+ * @brief Flags for rebx_ephemeris_preload.
+ */
+enum rebx_ephemeris_preload_flags {
+    REBX_EPHEMERIS_HUGEPAGES = 1,   ///< Back the copy with huge pages (reserved ones if available, transparent ones otherwise).
+    REBX_EPHEMERIS_MLOCK = 2,       ///< Lock the copy in RAM. Failure to lock (e.g. RLIMIT_MEMLOCK) is not an error.
+};
+
+/**
+ * @brief Copy the records of the kernels covering a time span into memory, reading the files once in order.
+ * @details Lookups in the span never touch the files afterwards; lookups outside it still use the memory maps.
+ * Call this before the context is shared between threads.
+ * @param eph Pointer to the context.
+ * @param jde_begin Start of the span (JD, TDB).
+ * @param jde_end End of the span (JD, TDB).
+ * @param flags Bitwise or of rebx_ephemeris_preload_flags, or 0.
+ * @return 1 on success, 0 on failure.
+ */
+int rebx_ephemeris_preload(struct rebx_ephemeris* const eph, const double jde_begin, const double jde_end, const int flags);
+
+/**
+ * @brief Ask the kernel to read ahead the records covering a time span, for runs moving forward in time.
+ * @details Unlike rebx_ephemeris_warmup this returns without waiting for the reads.
+ * @return 1 on success, 0 on failure.
+ */
+int rebx_ephemeris_readahead(struct rebx_ephemeris* const eph, const double jde_begin, const double jde_end);
+
+/**
+ * @brief Read the JPL ephemeris for all eleven bodies at one epoch in a single record lookup.
+ * @param eph Pointer to the ephemeris context.
+ * @param G double gravitational constant
+ * @param t double simulation time
+ * @param m Array of 11 doubles for the returned masses.
+ * @param pos Array of 11 mpos_s structs for the returned barycentric positions, velocities and accelerations.
+ * @return 1 on success, 0 if t is outside the span of the ephemeris.
+ */
+int ephem_all(const struct rebx_ephemeris* const eph, const double G, const double t, double* const m, struct mpos_s* const pos);
+
+/**
+ * @brief Get the hit and miss counts of the per-epoch ephemeris cache of an ephemeris_forces force.
+ * @param rebx Pointer to the rebx_extras instance.
+ * @param force Pointer to the ephemeris_forces force.
+ * @param hits Pointer to the returned number of force calls served from the cache.
+ * @param misses Pointer to the returned number of force calls that evaluated the ephemeris.
+ */
+void rebx_ephemeris_cache_stats(struct rebx_extras* const rebx, struct rebx_force* const force, unsigned long* const hits, unsigned long* const misses);
+
+/**
+ * @brief State of a test particle at one time, used while storing dense output.
+ */
+typedef struct {
+  double t, x, y, z, vx, vy, vz, ax, ay, az;
+} tstate;
+
+/**
+ * @brief Output of an ephemeris propagation.
+ * @details state holds n_out rows of n_particles 6-vectors (x, y, z, vx, vy, vz), i.e.
+ * state[(i*n_particles + j)*6 + k], at the times t[i]. Both arrays are malloc'd and owned by the caller.
+ */
+typedef struct {
+    double* t;
+    double* state;
+    int n_out;
+    int n_particles;
+} timestate;
+
+/**
+ * @brief Propagate test particles through the ephemeris model with IAS15, storing 8 samples per step.
+ * @details The output grows in fixed-size blocks as steps are taken and is copied into exactly sized arrays at the end.
+ * @param tstart Initial time (JD, TDB).
+ * @param tstep Initial time step in days (negative to integrate backwards).
+ * @param trange Length of the integration in days.
+ * @param geocentric 1 if the states are geocentric, 0 if barycentric.
+ * @param n_particles Number of test particles.
+ * @param instate Array of 6*n_particles initial positions and velocities.
+ * @param ts Pointer to the timestate filled with the output.
+ * @return 1 on success.
+ */
+int integration_function(double tstart, double tstep, double trange,
+			 int geocentric,
+			 int n_particles,
+			 double* instate,
+			 timestate *ts);
+
+/**
+ * @brief Free one of the arrays of a timestate, or the stm array of integration_function_stm.
+ * @details For callers that do not share the C library's allocator, e.g. Python through ctypes.
+ */
+void rebx_ephem_free_output(void* const array);
+
+/**
+ * @brief Receives the output of a propagation one IAS15 step at a time.
+ * @details t holds n_samples times and state n_samples rows of n_particles 6-vectors, laid out as in timestate.
+ * Both arrays are only valid during the call.
+ * @return 1 to continue the propagation, 0 to stop it.
+ */
+typedef int (*rebx_ephem_step_callback)(void* data, int n_samples, int n_particles, const double* t, const double* state);
+
+/**
+ * @brief Same as integration_function, but hands the 8 samples of each completed step to callback instead of buffering the trajectory.
+ * @param callback Function called after every step.
+ * @param data Pointer passed through to callback.
+ * @return 1 on success, 0 if the callback stopped the propagation.
+ */
+int integration_function_stream(double tstart, double tstep, double trange,
+				int geocentric,
+				int n_particles,
+				double* instate,
+				rebx_ephem_step_callback callback,
+				void* data);
+
+/**
+ * @brief Continuous output of an ephemeris propagation.
+ * @details Holds the IAS15 interpolating polynomial of every step, so states can be evaluated at any time in
+ * the span of the propagation with the same accuracy as the samples of integration_function.
+ */
+struct rebx_ephem_trajectory;
+
+/**
+ * @brief Same as integration_function, but also propagates the state transition matrix of every particle.
+ * @details The matrices come from the first order variational equations of the full force model, integrated with the
+ * states.  stm holds n_out rows of n_particles row-major 6x6 matrices, i.e. stm[((i*n_particles + j)*6 + a)*6 + b] is
+ * the derivative of component a of the state of particle j at t[i] with respect to component b of its initial state.
+ * @param ts Pointer to the timestate filled with the output.
+ * @param stm Set to a malloc'd array of n_out*n_particles*36 doubles owned by the caller.
+ * @return 1 on success.
+ */
+int integration_function_stm(double tstart, double tstep, double trange,
+			     int geocentric,
+			     int n_particles,
+			     double* instate,
+			     timestate *ts,
+			     double** stm);
+
+/**
+ * @brief Same as integration_function, but keeps the interpolant of each step instead of samples.
+ * @return Pointer to the trajectory, to be freed with rebx_ephem_trajectory_free, or NULL on failure.
+ */
+struct rebx_ephem_trajectory* integration_function_trajectory(double tstart, double tstep, double trange,
+							      int geocentric,
+							      int n_particles,
+							      double* instate);
+
+/**
+ * @brief Free a trajectory returned by integration_function_trajectory.
+ */
+void rebx_ephem_trajectory_free(struct rebx_ephem_trajectory* const traj);
+
+/**
+ * @brief Get the times at which a trajectory starts and ends.
+ * @return 0 if the trajectory has no steps, 1 otherwise.
+ */
+int rebx_ephem_trajectory_span(const struct rebx_ephem_trajectory* const traj, double* const t_begin, double* const t_end);
+
+/**
+ * @brief Evaluate the states of all particles of a trajectory at time t.
+ * @param state Array of 6*n_particles doubles filled with x, y, z, vx, vy, vz of each particle.
+ * @return 1 on success, 0 if t is outside the trajectory, in which case state is filled with NaNs.
+ */
+int rebx_ephem_trajectory_state(const struct rebx_ephem_trajectory* const traj, const double t, double* const state);
+
+/**
+ * @brief Evaluate the states of all particles at n_times times, sorted along the direction of integration.
+ * @param state Array of n_times*n_particles*6 doubles, laid out as in timestate.
+ * @return 1 on success, 0 if any time is outside the trajectory (its states are filled with NaNs).
+ */
+int rebx_ephem_trajectory_states(const struct rebx_ephem_trajectory* const traj, const int n_times, const double* const t, double* const state);
+
+/**
+ * @brief Write a trajectory as Chebyshev series to an SPK file, for far smaller output than the samples of integration_function.
+ * @details Each particle becomes a type 2 segment of heliocentric positions, like the asteroid kernels, readable with spk_init
+ * and spk_calc (and SPICE). The span is cut into equal records of at most window days, halved until every record fits,
+ * and each particle gets the fewest coefficients (up to 32) that keep its positions within tolerance au and its velocities
+ * within tolerance au/day at 33 points of each record, including both ends. The file can be passed as the asteroid kernel of rebx_ephemeris_load, so that objects with the
+ * NAIF IDs of the massive asteroids can be used as perturbers.
+ * @param traj Pointer to the trajectory, of at most 32 particles.
+ * @param eph Ephemeris context giving the Sun (and Earth) positions, or NULL for the default files.
+ * @param path Path of the file to write.
+ * @param naif_ids Array of the NAIF IDs of the particles, or NULL to number them -1, -2, ...
+ * @param window Longest record in days, e.g. 32.
+ * @param tolerance Largest error of the records, e.g. 1e-10.
+ * @return 1 on success, 0 (with a message on stderr) otherwise.
+ */
+int rebx_ephem_trajectory_write_spk(const struct rebx_ephem_trajectory* const traj, struct rebx_ephemeris* eph, const char* const path, const int* const naif_ids, const double window, const double tolerance);
+
+/**
+ * @brief Opaque handle to a simulation kept between propagations; see rebx_ephem_propagator_create.
+ */
+struct rebx_ephem_propagator;
+
+/**
+ * @brief Create a propagator for many short propagations.
+ * @details The propagator keeps its simulation, force, IAS15 workspace and output buffers between calls to
+ * rebx_ephem_propagate, so that a call costs only the integration. A propagator must not be used by two threads
+ * at once; use one per thread.
+ * @param geocentric 1 if the states are geocentric, 0 if barycentric.
+ * @param eph Ephemeris context to use, or NULL for the default files. The propagator holds a reference to it.
+ * @return Pointer to the propagator, or NULL if the ephemeris could not be loaded or memory could not be allocated.
+ */
+struct rebx_ephem_propagator* rebx_ephem_propagator_create(int geocentric, struct rebx_ephemeris* eph);
+
+/**
+ * @brief Same as integration_function, with the simulation of a propagator.
+ * @details Any state left from the previous call is discarded. The arrays of ts belong to the propagator and
+ * stay valid until its next call or until it is freed.
+ * @param p Pointer to the propagator.
+ * @param ts Pointer to the timestate filled with the output.
+ * @return 1 on success.
+ */
+int rebx_ephem_propagate(struct rebx_ephem_propagator* const p, const double tstart, const double tstep, const double trange, const int n_particles, const double* const instate, timestate* const ts);
+
+/**
+ * @brief Free a propagator and its output, and drop its reference to the ephemeris.
+ */
+void rebx_ephem_propagator_free(struct rebx_ephem_propagator* const p);
+
+/**
+ * @brief Propagate many independent test particles on a pool of threads.
+ * @details The particles are split into groups of group_size that are integrated together, each with its own
+ * adaptive IAS15 step, so one object with a close approach does not shrink the steps of the others. Each thread
+ * reuses one simulation for all the groups it handles, and all threads share the ephemeris context.
+ * @param tstart Initial time (JD, TDB).
+ * @param tstep Initial time step in days (negative to integrate backwards).
+ * @param trange Length of the integration in days.
+ * @param geocentric 1 if the states are geocentric, 0 if barycentric.
+ * @param n_particles Number of test particles.
+ * @param instate Array of 6*n_particles initial positions and velocities.
+ * @param group_size Number of particles integrated together (1 to integrate every object separately).
+ * @param n_threads Number of threads, or 0 to use one per online processor.
+ * @param eph Ephemeris context to use, or NULL for the default files.
+ * @param ts Array of n_particles timestates, one per object, filled with n_particles = 1 outputs.
+ * @return 1 if every group succeeded, 0 otherwise.
+ */
+int integration_function_batch(double tstart, double tstep, double trange,
+			       int geocentric,
+			       int n_particles,
+			       double* instate,
+			       int group_size,
+			       int n_threads,
+			       struct rebx_ephemeris* eph,
+			       timestate* ts);
+
+/**
+ * @brief Read an ensemble file written by integration_function_mpi.
+ * @param n_particles Set to the number of particles in the file.
+ * @return Array of n_particles timestates, one per particle in the order of the initial states, with n_particles = 1
+ * and n_out = 0 for particles that failed. Free with rebx_ephem_ensemble_free. NULL if the file could not be read.
+ */
+timestate* rebx_ephem_ensemble_read(const char* const filename, int* const n_particles);
+
+/**
+ * @brief Free the timestates returned by rebx_ephem_ensemble_read.
+ */
+void rebx_ephem_ensemble_free(timestate* const ts, const int n_particles);
+
+#ifdef REBX_MPI
+/**
+ * @brief Propagate many independent test particles across the ranks of an MPI communicator, and write the outputs to an ensemble file.
+ * @details Collective over comm. Rank 0 hands out groups of group_size particles to the other ranks as they finish their
+ * last one, so ranks slowed down by close approaches take fewer groups; it propagates particles itself only if it is the
+ * only rank. Each rank reuses one propagator for all its groups. The ranks then write their outputs to filename at once
+ * with MPI-IO, each in one piece, and rank 0 writes the index. Requires a build with REBX_MPI.
+ * @param tstart Initial time (JD, TDB).
+ * @param tstep Initial time step in days (negative to integrate backwards).
+ * @param trange Length of the integration in days.
+ * @param geocentric 1 if the states are geocentric, 0 if barycentric.
+ * @param n_particles Number of test particles. Only used on rank 0, like the other arguments except eph and comm.
+ * @param instate Array of 6*n_particles initial positions and velocities, only needed on rank 0.
+ * @param group_size Number of particles integrated together.
+ * @param eph Ephemeris context of the rank, or NULL for the default files.
+ * @param filename Ensemble file to write, see rebx_ephem_ensemble_read.
+ * @param comm Communicator of the ranks taking part.
+ * @return 1 on every rank if every particle was propagated and the file written, 0 otherwise.
+ */
+int integration_function_mpi(double tstart, double tstep, double trange,
+			     int geocentric,
+			     int n_particles,
+			     double* instate,
+			     int group_size,
+			     struct rebx_ephemeris* eph,
+			     const char* filename,
+			     MPI_Comm comm);
+#endif
+
+#endif
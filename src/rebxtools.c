@@ -2,28 +2,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "rebxtools.h"
+#include "rebxtools_com.h"
 #include "reboundx.h"
 
 /* only accepts one reference particle if coordinates=REBX_COORDINATES_PARTICLE.
  * calculate_effect function should check for edge case where particle and reference are the same
  * (could happen e.g. with barycentric coordinates with test particles and single massive body)
+ * The loops are in rebxtools_com.h, so effects can also generate inlined copies of them.
  */
 
-static inline struct reb_particle rebx_particle_minus(struct reb_particle p1, struct reb_particle p2){
-    struct reb_particle p = {0};
-    p.m = p1.m-p2.m;
-    p.x = p1.x-p2.x;
-    p.y = p1.y-p2.y;
-    p.z = p1.z-p2.z;
-    p.vx = p1.vx-p2.vx;
-    p.vy = p1.vy-p2.vy;
-    p.vz = p1.vz-p2.vz;
-    p.ax = p1.ax-p2.ax;
-    p.ay = p1.ay-p2.ay;
-    p.az = p1.az-p2.az;
-    return p;
-}
-
 void rebx_calculate_jacobi_masses(const struct reb_particle* const ps, double* const m_j, const int N){
     double eta = ps[0].m;
     for (unsigned int i=1;i<N;i++){ // jacobi masses are reduced mass of particle with interior masses
@@ -43,174 +30,130 @@ double rebx_Edot(struct reb_particle* const ps, const int N){
 }
 
 void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_vec3d (*calculate_force) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source), struct reb_particle* const particles, const int N){
-    struct rebx_extras* const rebx = sim->extras;
-    struct reb_particle com = reb_get_com(sim); // Start with full com for jacobi and barycentric coordinates.
-  
-    int refindex = -1;
-    if(coordinates == REBX_COORDINATES_JACOBI){
-        refindex = 0;                           // There is no jacobi coordinate for the 0th particle, so set refindex to skip it in loop below.
-    }
-    else if(coordinates == REBX_COORDINATES_PARTICLE){
-        for (int i=0; i < N; i++){
-			struct reb_particle* p = &particles[i];
-            const int* const reference = rebx_get_param(rebx, p->ap, reference_name);
-            if (reference){
-                com = particles[i];
-                refindex = i;
-                break;
-            }
-            if (i == N-1){
-                char str[200];
-                sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
-                reb_error(sim, str);
-            }
-        }
-    }
-
-    
-    for(int i=N-1; i>=0; i--){ // Run through backwards so each iteration does not depend on previous ones in Jacobi coordinates.
-        if (i==refindex){
-            continue;
-        }
-        struct reb_particle* p = &particles[i];
-        if (coordinates == REBX_COORDINATES_JACOBI){
-            com = reb_get_com_without_particle(com, *p);
-        }
-        
-        struct reb_vec3d a = calculate_force(sim, force, p, &com);
-        p->ax += a.x;
-        p->ay += a.y;
-        p->az += a.z;
-
-        double massratio;
-        switch(coordinates){
-            case REBX_COORDINATES_BARYCENTRIC:
-                massratio = p->m/com.m;
-                for(int j=0; j < N; j++){
-                    particles[j].ax -= massratio*a.x;
-                    particles[j].ay -= massratio*a.y;
-                    particles[j].az -= massratio*a.z;
-                }
-                break;
-            case REBX_COORDINATES_JACOBI:
-                if(back_reactions_inclusive){
-                    massratio = p->m/(com.m + p->m);
-                }
-                else{
-                    massratio = p->m/com.m;
-                }
-                for(int j=0; j < i + back_reactions_inclusive; j++){    // stop at j=i if inclusive, at i-1 if not
-                    particles[j].ax -= massratio*a.x;
-                    particles[j].ay -= massratio*a.y;
-                    particles[j].az -= massratio*a.z;
-                }
-                break;
-            case REBX_COORDINATES_PARTICLE:
-                if(back_reactions_inclusive){
-                    massratio = p->m/(com.m + p->m);
-                    p->ax -= massratio*a.x;
-                    p->ay -= massratio*a.y;
-                    p->az -= massratio*a.z;
-                }
-                else{
-                    massratio = p->m/com.m;
-                }
-                particles[refindex].ax -= massratio*a.x;
-                particles[refindex].ay -= massratio*a.y;
-                particles[refindex].az -= massratio*a.z;
-                break;
-            default:
-                reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
-        }
-    }
+    rebx_com_force_loop(sim, force, coordinates, back_reactions_inclusive, reference_name, calculate_force, NULL, particles, N);
 }
 
-static inline void rebx_subtract_posvel(struct reb_particle* p, struct reb_particle* diff, const double massratio){
-    p->x -= massratio*diff->x;
-    p->y -= massratio*diff->y;
-    p->z -= massratio*diff->z;
-    p->vx -= massratio*diff->vx;
-    p->vy -= massratio*diff->vy;
-    p->vz -= massratio*diff->vz;
+void rebx_com_force_indexed(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_vec3d (*calculate_force) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source, const int index), struct reb_particle* const particles, const int N){
+    rebx_com_force_loop(sim, force, coordinates, back_reactions_inclusive, reference_name, NULL, calculate_force, particles, N);
 }
 
 void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle (*calculate_step) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt), const double dt){
-    struct rebx_extras* const rebx = sim->extras;
-    const int N_real = sim->N - sim->N_var;
-    struct reb_particle com = reb_get_com(sim); // Start with full com for jacobi and barycentric coordinates.
-  
-    int refindex = -1;
-    if(coordinates == REBX_COORDINATES_JACOBI){
-        refindex = 0;                           // There is no jacobi coordinate for the 0th particle, so should skip index 0
+    rebx_com_ptm_loop(sim, operator, coordinates, back_reactions_inclusive, reference_name, calculate_step, NULL, NULL, dt);
+}
+
+void rebxtools_com_ptm_indexed(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle (*calculate_step) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt, const int index), const double dt){
+    rebx_com_ptm_loop(sim, operator, coordinates, back_reactions_inclusive, reference_name, NULL, calculate_step, NULL, dt);
+}
+
+// Counterparts of reb_tools_particle_to_orbit_err and reb_tools_orbit_to_particle_err for whole arrays. The loops have no branches,
+// and all angles come from atan2, so they stay well defined for circular and planar orbits. Omega is 0 for planar orbits, with
+// omega + f measured from the x axis, and omega is 0 for exactly circular ones, with f holding the whole angle.
+void rebx_particles_to_orbits(const double G, const int n, const struct reb_particle* const ps, const struct reb_particle* const primaries, double* restrict const a, double* restrict const e, double* restrict const inc, double* restrict const Omega, double* restrict const omega, double* restrict const f, int* restrict const err){
+    for (int j=0; j<n; j++){
+        const double mu = G*(ps[j].m + primaries[j].m);
+        const double dx = ps[j].x - primaries[j].x;
+        const double dy = ps[j].y - primaries[j].y;
+        const double dz = ps[j].z - primaries[j].z;
+        const double dvx = ps[j].vx - primaries[j].vx;
+        const double dvy = ps[j].vy - primaries[j].vy;
+        const double dvz = ps[j].vz - primaries[j].vz;
+        const double r = sqrt(dx*dx + dy*dy + dz*dz);
+        const double v2 = dvx*dvx + dvy*dvy + dvz*dvz;
+        const double rv = dx*dvx + dy*dvy + dz*dvz;
+        const double hx = dy*dvz - dz*dvy;
+        const double hy = dz*dvx - dx*dvz;
+        const double hz = dx*dvy - dy*dvx;
+        const double hxy = sqrt(hx*hx + hy*hy);
+        const double h = sqrt(hxy*hxy + hz*hz);
+
+        // Ascending node along (cO, sO, 0), the x axis for planar orbits
+        const double cO = hxy > 0. ? -hy/hxy : 1.;
+        const double sO = hxy > 0. ? hx/hxy : 0.;
+        // h times the position along the node and along h x node, for the argument of latitude omega + f
+        const double rn = h*(dx*cO + dy*sO);
+        const double rm = dz*(hx*sO - hy*cO) + hz*(dy*cO - dx*sO);
+        // mu*r*e*cos(f) and mu*r*e*sin(f)
+        const double ecf = h*h - mu*r;
+        const double esf = h*rv;
+
+        const int code = !(primaries[j].m > 0.) ? 1 : (!(r > 0.) ? 2 : 0);
+        const double nan_if_err = code ? NAN : 0.;
+        const double fj = atan2(esf, ecf);
+        const double ej = sqrt(ecf*ecf + esf*esf)/(mu*r);
+        a[j] = mu*r/(2.*mu - r*v2) + nan_if_err;
+        e[j] = ej + nan_if_err;
+        inc[j] = atan2(hxy, hz) + nan_if_err;
+        Omega[j] = atan2(sO, cO) + nan_if_err;
+        omega[j] = (ej > 0. ? remainder(atan2(rm, rn) - fj, 2.*M_PI) : 0.) + nan_if_err;
+        f[j] = (ej > 0. ? fj : atan2(rm, rn)) + nan_if_err;
+        err[j] = code;
     }
-    else if(coordinates == REBX_COORDINATES_PARTICLE){
-        for (int i=0; i < N_real; i++){
-            struct reb_particle* p = &sim->particles[i];
-            const int* const reference = rebx_get_param(rebx, p->ap, reference_name);
-            if (reference){
-                com = sim->particles[i];
-                refindex = i;
-                break;
-            }
-            if (i == N_real-1){                 
-                char str[200];
-                sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
-                reb_error(sim, str);
-            }
-        }
+}
+
+void rebx_orbits_to_particles(const double G, const int n, struct reb_particle* const ps, const struct reb_particle* const primaries, const double* restrict const a, const double* restrict const e, const double* restrict const inc, const double* restrict const Omega, const double* restrict const omega, const double* restrict const f, int* restrict const err){
+    for (int j=0; j<n; j++){
+        const double ej = e[j];
+        const double cf = cos(f[j]);
+        const double sf = sin(f[j]);
+        const double co = cos(omega[j]);
+        const double so = sin(omega[j]);
+        const double cO = cos(Omega[j]);
+        const double sO = sin(Omega[j]);
+        const double ci = cos(inc[j]);
+        const double si = sin(inc[j]);
+
+        // Same codes as rebxtools_orbit_to_particle, where the particle is set to NaN
+        const int code = ej == 1. ? 1 : (ej < 0. ? 2 : (ej > 1. && a[j] > 0. ? 3 : (ej < 1. && a[j] < 0. ? 4 : (ej*cf < -1. ? 5 : 0))));
+        const double nan_if_err = code ? NAN : 0.;
+        const double r = a[j]*(1. - ej*ej)/(1. + ej*cf);
+        const double v0 = sqrt(G*(ps[j].m + primaries[j].m)/a[j]/(1. - ej*ej));   // in this form it works for elliptical and hyperbolic orbits
+        const double cu = co*cf - so*sf;
+        const double su = so*cf + co*sf;
+
+        // Murray & Dermott Eq 2.122 and Eq. 2.36, as in rebxtools_orbit_to_particle
+        ps[j].x = primaries[j].x + r*(cO*cu - sO*su*ci) + nan_if_err;
+        ps[j].y = primaries[j].y + r*(sO*cu + cO*su*ci) + nan_if_err;
+        ps[j].z = primaries[j].z + r*su*si + nan_if_err;
+        ps[j].vx = primaries[j].vx + v0*((ej + cf)*(-ci*co*sO - cO*so) - sf*(co*cO - ci*so*sO)) + nan_if_err;
+        ps[j].vy = primaries[j].vy + v0*((ej + cf)*(ci*co*cO - sO*so) - sf*(co*sO + ci*so*cO)) + nan_if_err;
+        ps[j].vz = primaries[j].vz + v0*((ej + cf)*co*si - sf*si*so) + nan_if_err;
+        err[j] = code;
     }
+}
 
-    
-    for(int i=N_real-1; i>=0; i--){ // Run through backwards so each iteration does not depend on previous ones in Jacobi coordinates.
-        if (i==refindex){
-            continue;
-        }
-        struct reb_particle* p = &sim->particles[i];
-        if (coordinates == REBX_COORDINATES_JACOBI){
-            com = reb_get_com_without_particle(com, *p);
-        }
-        
-        struct reb_particle modified_particle = calculate_step(sim, operator, p, &com, dt);
-        struct reb_particle diff = rebx_particle_minus(modified_particle, *p);
-        p->x = modified_particle.x;
-        p->y = modified_particle.y;
-        p->z = modified_particle.z;
-        p->vx = modified_particle.vx;
-        p->vy = modified_particle.vy;
-        p->vz = modified_particle.vz;
-
-        double massratio;
-        switch(coordinates){
-            case REBX_COORDINATES_BARYCENTRIC:
-                massratio = p->m/com.m;
-                for(int j=0; j < N_real; j++){
-                    rebx_subtract_posvel(&sim->particles[j], &diff, massratio);
-                }
-                break;
-            case REBX_COORDINATES_JACOBI:
-                if(back_reactions_inclusive){
-                    massratio = p->m/(com.m + p->m);
-                }
-                else{
-                    massratio = p->m/com.m;
-                }
-                for(int j=0; j < i + back_reactions_inclusive; j++){    // stop at j=i if inclusive, at i-1 if not
-                    rebx_subtract_posvel(&sim->particles[j], &diff, massratio);
-                }
-                break;
-            case REBX_COORDINATES_PARTICLE:
-                if(back_reactions_inclusive){
-                    massratio = p->m/(com.m + p->m);
-                    rebx_subtract_posvel(p, &diff, massratio);
-                }
-                else{
-                    massratio = p->m/com.m;
-                }
-                rebx_subtract_posvel(&sim->particles[refindex], &diff, massratio);
-                break;
-            default:
-                reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
-        }
+void rebxtools_update_com_with_particle(struct reb_particle* const com, const struct reb_particle* const p){
+    com->x   = com->x*com->m + p->x*p->m;
+    com->y   = com->y*com->m + p->y*p->m;
+    com->z   = com->z*com->m + p->z*p->m;
+    com->vx  = com->vx*com->m + p->vx*p->m;
+    com->vy  = com->vy*com->m + p->vy*p->m;
+    com->vz  = com->vz*com->m + p->vz*p->m;
+    com->m  += p->m;
+    if (com->m>0.){
+        com->x  /= com->m;
+        com->y  /= com->m;
+        com->z  /= com->m;
+        com->vx /= com->m;
+        com->vy /= com->m;
+        com->vz /= com->m;
+    }
+}
+
+void rebxtools_update_com_without_particle(struct reb_particle* const com, const struct reb_particle* const p){
+    com->x   = com->x*com->m - p->x*p->m;
+    com->y   = com->y*com->m - p->y*p->m;
+    com->z   = com->z*com->m - p->z*p->m;
+    com->vx  = com->vx*com->m - p->vx*p->m;
+    com->vy  = com->vy*com->m - p->vy*p->m;
+    com->vz  = com->vz*com->m - p->vz*p->m;
+    com->m  -= p->m;
+    if (com->m>0.){
+        com->x  /= com->m;
+        com->y  /= com->m;
+        com->z  /= com->m;
+        com->vx /= com->m;
+        com->vy /= com->m;
+        com->vz /= com->m;
     }
 }
 
@@ -422,42 +365,6 @@ void rebxtools_move_to_com(struct reb_simulation* const sim){
     }
 }
 
-void rebxtools_update_com_with_particle(struct reb_particle* const com, const struct reb_particle* const p){
-    com->x   = com->x*com->m + p->x*p->m;
-    com->y   = com->y*com->m + p->y*p->m;
-    com->z   = com->z*com->m + p->z*p->m;
-    com->vx  = com->vx*com->m + p->vx*p->m;
-    com->vy  = com->vy*com->m + p->vy*p->m;
-    com->vz  = com->vz*com->m + p->vz*p->m;
-    com->m  += p->m;
-    if (com->m>0.){
-        com->x  /= com->m;
-        com->y  /= com->m;
-        com->z  /= com->m;
-        com->vx /= com->m;
-        com->vy /= com->m;
-        com->vz /= com->m;
-    }
-}
-
-void rebxtools_update_com_without_particle(struct reb_particle* const com, const struct reb_particle* const p){
-    com->x   = com->x*com->m - p->x*p->m;
-    com->y   = com->y*com->m - p->y*p->m;
-    com->z   = com->z*com->m - p->z*p->m;
-    com->vx  = com->vx*com->m - p->vx*p->m;
-    com->vy  = com->vy*com->m - p->vy*p->m;
-    com->vz  = com->vz*com->m - p->vz*p->m;
-    com->m  -= p->m;
-    if (com->m>0.){
-        com->x  /= com->m;
-        com->y  /= com->m;
-        com->z  /= com->m;
-        com->vx /= com->m;
-        com->vy /= com->m;
-        com->vz /= com->m;
-    }
-}
-
 void rebxtools_get_com(const struct reb_simulation* const sim, const int first_N, struct reb_particle* com){
     struct reb_particle* particles = sim->particles;
     for (int i=0;i<first_N;i++){
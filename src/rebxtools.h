@@ -38,9 +38,27 @@ void rebx_com_force(struct reb_simulation* const sim, struct rebx_force* const f
 
 void rebxtools_com_ptm(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle (*calculate_step) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt), const double dt);
 
+// Same as rebx_com_force and rebxtools_com_ptm, but the callback is also passed the index of p, e.g. for rebx_get_particle_param_double
+void rebx_com_force_indexed(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_vec3d (*calculate_force) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source, const int index), struct reb_particle* const particles, const int N);
+
+void rebxtools_com_ptm_indexed(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle (*calculate_step) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt, const int index), const double dt);
+
 double rebx_Edot(struct reb_particle* const ps, const int N);
 
 void rebx_calculate_jacobi_masses(const struct reb_particle* const ps, double* const m_j, const int N);
+
+// Adds p to, or takes it out of, the center of mass com (mass, position and velocity)
+void rebxtools_update_com_with_particle(struct reb_particle* const com, const struct reb_particle* p);
+
+void rebxtools_update_com_without_particle(struct reb_particle* const com, const struct reb_particle* p);
+
+// Orbital elements of ps[j] about primaries[j] for j < n, one array per element. err[j] is 1 if the primary has no mass and 2 if
+// ps[j] sits on it, and that particle's elements are then NaN.
+void rebx_particles_to_orbits(const double G, const int n, const struct reb_particle* const ps, const struct reb_particle* const primaries, double* restrict const a, double* restrict const e, double* restrict const inc, double* restrict const Omega, double* restrict const omega, double* restrict const f, int* restrict const err);
+
+// Sets the positions and velocities of ps[j] from its elements about primaries[j], keeping its mass. err[j] is set as in
+// rebxtools_orbit_to_particle (e.g. 3 for a > 0 with e > 1), and that particle's positions and velocities are then NaN.
+void rebx_orbits_to_particles(const double G, const int n, struct reb_particle* const ps, const struct reb_particle* const primaries, const double* restrict const a, const double* restrict const e, const double* restrict const inc, const double* restrict const Omega, const double* restrict const omega, const double* restrict const f, int* restrict const err);
 /*
 struct reb_orbit rebxtools_particle_to_orbit_err(double G, struct reb_particle* p, struct reb_particle* primary, int* err);
 
@@ -52,10 +70,6 @@ void rebxtools_orbit_to_particle(double G, struct reb_particle* p, struct reb_pa
 
 void rebxtools_move_to_com(struct reb_simulation* const sim);
 
-void rebxtools_update_com_with_particle(struct reb_particle* const com, const struct reb_particle* p);
-
-void rebxtools_update_com_without_particle(struct reb_particle* const com, const struct reb_particle* p);
-
 void rebxtools_get_com(const struct reb_simulation* const sim, const int first_N, struct reb_particle* com);
 */
 #endif
@@ -0,0 +1,348 @@
+/**
+ * @file    rebxtools_com.h
+ * @brief   Inline center-of-mass loops behind rebx_com_force and rebxtools_com_ptm
+ * @author  Dan Tamayo <tamayo.daniel@gmail.com>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2015 Dan Tamayo, Hanno Rein
+ *
+ * This file is part of reboundx.
+ *
+ * reboundx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * reboundx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* rebx_com_force and rebxtools_com_ptm call the effect through a function pointer for every particle.  An effect can instead generate
+ * its own copy of the loop with REBX_COM_FORCE_KERNEL or REBX_COM_PTM_KERNEL, giving the (static) function that calculates the effect,
+ * or with REBX_COM_PTM_BATCH_KERNEL, which also takes a function that steps many massless particles at once.
+ * The generated function takes the same arguments as rebx_com_force_indexed or rebxtools_com_ptm_indexed without the callback, and
+ * has one loop per coordinate system and back_reactions_inclusive, with the effect inlined.  Custom effects keep using the function pointer versions.
+ */
+
+#ifndef _REBXTOOLS_COM_H
+#define _REBXTOOLS_COM_H
+
+#include <stdio.h>
+#include "rebound.h"
+#include "reboundx.h"
+
+#if defined(__GNUC__)
+#define _REBX_COM_INLINE    static inline __attribute__((always_inline))
+#else
+#define _REBX_COM_INLINE    static inline
+#endif
+
+static inline struct reb_particle rebx_particle_minus(struct reb_particle p1, struct reb_particle p2){
+    struct reb_particle p = {0};
+    p.m = p1.m-p2.m;
+    p.x = p1.x-p2.x;
+    p.y = p1.y-p2.y;
+    p.z = p1.z-p2.z;
+    p.vx = p1.vx-p2.vx;
+    p.vy = p1.vy-p2.vy;
+    p.vz = p1.vz-p2.vz;
+    p.ax = p1.ax-p2.ax;
+    p.ay = p1.ay-p2.ay;
+    p.az = p1.az-p2.az;
+    return p;
+}
+
+static inline void rebx_subtract_posvel(struct reb_particle* p, struct reb_particle* diff, const double massratio){
+    p->x -= massratio*diff->x;
+    p->y -= massratio*diff->y;
+    p->z -= massratio*diff->z;
+    p->vx -= massratio*diff->vx;
+    p->vy -= massratio*diff->vy;
+    p->vz -= massratio*diff->vz;
+}
+
+static inline void rebx_add_posvel(struct reb_particle* sum, struct reb_particle* diff, const double massratio){
+    sum->x += massratio*diff->x;
+    sum->y += massratio*diff->y;
+    sum->z += massratio*diff->z;
+    sum->vx += massratio*diff->vx;
+    sum->vy += massratio*diff->vy;
+    sum->vz += massratio*diff->vz;
+}
+
+// Index of the particle the loop skips (-1 for none), and the starting com.  Only accepts one reference particle if coordinates=REBX_COORDINATES_PARTICLE.
+static inline int rebx_com_reference(struct reb_simulation* const sim, const enum REBX_COORDINATES coordinates, const char* reference_name, struct reb_particle* const particles, const int N, struct reb_particle* const com){
+    *com = reb_get_com(sim); // Start with full com for jacobi and barycentric coordinates.
+    if(coordinates == REBX_COORDINATES_JACOBI){
+        return 0;                               // There is no jacobi coordinate for the 0th particle, so set refindex to skip it in loop below.
+    }
+    if(coordinates == REBX_COORDINATES_PARTICLE){
+        const rebx_param_handle reference_h = rebx_param_resolve(sim->extras, reference_name);
+        for (int i=0; i < N; i++){
+            if (rebx_get_param_h(particles[i].ap, reference_h)){
+                *com = particles[i];
+                return i;
+            }
+        }
+        char str[200];
+        sprintf(str, "Coordinates set to REBX_COORDINATES_PARTICLE, but %s param was not found in any particle.  Need to set parameter.\n", reference_name);
+        reb_error(sim, str);
+    }
+    return -1;
+}
+
+// Exactly one of calculate_force and calculate_force_indexed is set.  Back-reactions of the particles already done are accumulated in S
+// rather than applied to every particle each time.  A particle gets the part of S the pairwise loops would have given it by then before
+// its force is calculated, and the rest at the end.
+_REBX_COM_INLINE void rebx_com_force_loop(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_vec3d (*calculate_force) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source), struct reb_vec3d (*calculate_force_indexed) (struct reb_simulation* const sim, struct rebx_force* const force, struct reb_particle* p, struct reb_particle* source, const int index), struct reb_particle* const particles, const int N){
+    struct reb_particle com;
+    const int refindex = rebx_com_reference(sim, coordinates, reference_name, particles, N, &com);
+
+    struct reb_vec3d S = {0};
+    for(int i=N-1; i>=0; i--){ // Run through backwards so each iteration does not depend on previous ones in Jacobi coordinates.
+        if (i==refindex){
+            continue;
+        }
+        struct reb_particle* p = &particles[i];
+        if (coordinates == REBX_COORDINATES_BARYCENTRIC || coordinates == REBX_COORDINATES_JACOBI){
+            p->ax -= S.x;
+            p->ay -= S.y;
+            p->az -= S.z;
+        }
+        if (coordinates == REBX_COORDINATES_JACOBI){
+            com = reb_get_com_without_particle(com, *p);
+        }
+
+        struct reb_vec3d a = calculate_force_indexed ? calculate_force_indexed(sim, force, p, &com, i) : calculate_force(sim, force, p, &com);
+        p->ax += a.x;
+        p->ay += a.y;
+        p->az += a.z;
+
+        double massratio;
+        switch(coordinates){
+            case REBX_COORDINATES_BARYCENTRIC:
+                massratio = p->m/com.m;
+                p->ax += S.x;                   // all of S is subtracted from every particle below
+                p->ay += S.y;
+                p->az += S.z;
+                S.x += massratio*a.x;
+                S.y += massratio*a.y;
+                S.z += massratio*a.z;
+                break;
+            case REBX_COORDINATES_JACOBI:
+                if(back_reactions_inclusive){
+                    massratio = p->m/(com.m + p->m);
+                    p->ax -= massratio*a.x;
+                    p->ay -= massratio*a.y;
+                    p->az -= massratio*a.z;
+                }
+                else{
+                    massratio = p->m/com.m;
+                }
+                S.x += massratio*a.x;           // acts on all interior particles, which come later in the loop
+                S.y += massratio*a.y;
+                S.z += massratio*a.z;
+                break;
+            case REBX_COORDINATES_PARTICLE:
+                if(back_reactions_inclusive){
+                    massratio = p->m/(com.m + p->m);
+                    p->ax -= massratio*a.x;
+                    p->ay -= massratio*a.y;
+                    p->az -= massratio*a.z;
+                }
+                else{
+                    massratio = p->m/com.m;
+                }
+                particles[refindex].ax -= massratio*a.x;
+                particles[refindex].ay -= massratio*a.y;
+                particles[refindex].az -= massratio*a.z;
+                break;
+            default:
+                reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
+        }
+    }
+
+    if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+        for(int j=0; j < N; j++){
+            particles[j].ax -= S.x;
+            particles[j].ay -= S.y;
+            particles[j].az -= S.z;
+        }
+    }
+    else if (coordinates == REBX_COORDINATES_JACOBI){
+        particles[0].ax -= S.x;
+        particles[0].ay -= S.y;
+        particles[0].az -= S.z;
+    }
+}
+
+#define REBX_COM_BATCH 64    ///< Massless particles handed to the batch callback of a ptm loop at once
+
+// Massless particles waiting in a ptm loop with a batch callback.  They give no back-reactions, so the particles after them see
+// the same state whether or not they have been stepped yet, and their step can wait until the batch is full.
+struct rebx_com_batch {
+    int n;
+    int index[REBX_COM_BATCH];
+    struct reb_particle ps[REBX_COM_BATCH];         // state the step starts from, replaced by the batch callback
+    struct reb_particle sources[REBX_COM_BATCH];
+    struct reb_particle S[REBX_COM_BATCH];          // barycentric: the part of S to add back afterwards
+};
+
+_REBX_COM_INLINE void rebx_com_ptm_flush(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, void (*calculate_batch) (struct reb_simulation* const sim, struct rebx_operator* const operator, const int n, const int* const index, struct reb_particle* const ps, const struct reb_particle* const sources, const double dt), struct rebx_com_batch* const batch, const double dt){
+    calculate_batch(sim, operator, batch->n, batch->index, batch->ps, batch->sources, dt);
+    for (int k=0; k<batch->n; k++){
+        struct reb_particle* const p = &sim->particles[batch->index[k]];
+        p->x = batch->ps[k].x;
+        p->y = batch->ps[k].y;
+        p->z = batch->ps[k].z;
+        p->vx = batch->ps[k].vx;
+        p->vy = batch->ps[k].vy;
+        p->vz = batch->ps[k].vz;
+        if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+            rebx_subtract_posvel(p, &batch->S[k], -1.);
+        }
+    }
+    batch->n = 0;
+}
+
+// Same accumulation of the back-reactions as in rebx_com_force_loop.  With calculate_batch, massless particles are stepped through
+// it, REBX_COM_BATCH at a time, with the same result as stepping them one by one.
+_REBX_COM_INLINE void rebx_com_ptm_loop(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle (*calculate_step) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt), struct reb_particle (*calculate_step_indexed) (struct reb_simulation* const sim, struct rebx_operator* const operator, struct reb_particle* p, struct reb_particle* source, const double dt, const int index), void (*calculate_batch) (struct reb_simulation* const sim, struct rebx_operator* const operator, const int n, const int* const index, struct reb_particle* const ps, const struct reb_particle* const sources, const double dt), const double dt){
+    const int N_real = sim->N - sim->N_var;
+    struct reb_particle com;
+    const int refindex = rebx_com_reference(sim, coordinates, reference_name, sim->particles, N_real, &com);
+
+    struct reb_particle S = {0};
+    struct rebx_com_batch batch;
+    batch.n = 0;
+    for(int i=N_real-1; i>=0; i--){ // Run through backwards so each iteration does not depend on previous ones in Jacobi coordinates.
+        if (i==refindex){
+            continue;
+        }
+        struct reb_particle* p = &sim->particles[i];
+        if (coordinates == REBX_COORDINATES_BARYCENTRIC || coordinates == REBX_COORDINATES_JACOBI){
+            rebx_subtract_posvel(p, &S, 1.);
+        }
+        if (coordinates == REBX_COORDINATES_JACOBI){
+            com = reb_get_com_without_particle(com, *p);
+        }
+        if (calculate_batch != NULL && p->m == 0.){
+            const int k = batch.n++;
+            batch.index[k] = i;
+            batch.ps[k] = *p;
+            batch.sources[k] = com;
+            if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+                batch.S[k] = S;
+            }
+            if (batch.n == REBX_COM_BATCH){
+                rebx_com_ptm_flush(sim, operator, coordinates, calculate_batch, &batch, dt);
+            }
+            continue;
+        }
+
+        struct reb_particle modified_particle = calculate_step_indexed ? calculate_step_indexed(sim, operator, p, &com, dt, i) : calculate_step(sim, operator, p, &com, dt);
+        struct reb_particle diff = rebx_particle_minus(modified_particle, *p);
+        p->x = modified_particle.x;
+        p->y = modified_particle.y;
+        p->z = modified_particle.z;
+        p->vx = modified_particle.vx;
+        p->vy = modified_particle.vy;
+        p->vz = modified_particle.vz;
+
+        double massratio;
+        switch(coordinates){
+            case REBX_COORDINATES_BARYCENTRIC:
+                massratio = p->m/com.m;
+                rebx_subtract_posvel(p, &S, -1.);   // all of S is subtracted from every particle below
+                rebx_add_posvel(&S, &diff, massratio);
+                break;
+            case REBX_COORDINATES_JACOBI:
+                if(back_reactions_inclusive){
+                    massratio = p->m/(com.m + p->m);
+                    rebx_subtract_posvel(p, &diff, massratio);
+                }
+                else{
+                    massratio = p->m/com.m;
+                }
+                rebx_add_posvel(&S, &diff, massratio);
+                break;
+            case REBX_COORDINATES_PARTICLE:
+                if(back_reactions_inclusive){
+                    massratio = p->m/(com.m + p->m);
+                    rebx_subtract_posvel(p, &diff, massratio);
+                }
+                else{
+                    massratio = p->m/com.m;
+                }
+                rebx_subtract_posvel(&sim->particles[refindex], &diff, massratio);
+                break;
+            default:
+                reb_error(sim, "Coordinates not supported in REBOUNDx.\n");
+        }
+    }
+
+    if (calculate_batch != NULL && batch.n > 0){
+        rebx_com_ptm_flush(sim, operator, coordinates, calculate_batch, &batch, dt);
+    }
+
+    if (coordinates == REBX_COORDINATES_BARYCENTRIC){
+        for(int j=0; j < N_real; j++){
+            rebx_subtract_posvel(&sim->particles[j], &S, 1.);
+        }
+    }
+    else if (coordinates == REBX_COORDINATES_JACOBI){
+        rebx_subtract_posvel(&sim->particles[0], &S, 1.);
+    }
+}
+
+// Calls LOOP with coordinates and back_reactions_inclusive as constants, so each combination gets its own copy
+#define _REBX_COM_DISPATCH(LOOP, ...) \
+    switch(coordinates){ \
+        case REBX_COORDINATES_JACOBI: \
+            if (back_reactions_inclusive){ LOOP(REBX_COORDINATES_JACOBI, 1, __VA_ARGS__); } \
+            else{ LOOP(REBX_COORDINATES_JACOBI, 0, __VA_ARGS__); } \
+            break; \
+        case REBX_COORDINATES_BARYCENTRIC: \
+            if (back_reactions_inclusive){ LOOP(REBX_COORDINATES_BARYCENTRIC, 1, __VA_ARGS__); } \
+            else{ LOOP(REBX_COORDINATES_BARYCENTRIC, 0, __VA_ARGS__); } \
+            break; \
+        case REBX_COORDINATES_PARTICLE: \
+            if (back_reactions_inclusive){ LOOP(REBX_COORDINATES_PARTICLE, 1, __VA_ARGS__); } \
+            else{ LOOP(REBX_COORDINATES_PARTICLE, 0, __VA_ARGS__); } \
+            break; \
+        default: \
+            LOOP(coordinates, back_reactions_inclusive, __VA_ARGS__); \
+    }
+
+#define _REBX_COM_FORCE_CALL(COORDINATES, INCLUSIVE, calculate_force_indexed) \
+    rebx_com_force_loop(sim, force, COORDINATES, INCLUSIVE, reference_name, NULL, calculate_force_indexed, particles, N)
+
+#define _REBX_COM_PTM_CALL(COORDINATES, INCLUSIVE, calculate_step_indexed) \
+    rebx_com_ptm_loop(sim, operator, COORDINATES, INCLUSIVE, reference_name, NULL, calculate_step_indexed, NULL, dt)
+
+#define _REBX_COM_PTM_BATCH_CALL(COORDINATES, INCLUSIVE, calculate_step_indexed, calculate_batch) \
+    rebx_com_ptm_loop(sim, operator, COORDINATES, INCLUSIVE, reference_name, NULL, calculate_step_indexed, calculate_batch, dt)
+
+#define REBX_COM_FORCE_KERNEL(name, calculate_force_indexed) \
+static void name(struct reb_simulation* const sim, struct rebx_force* const force, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, struct reb_particle* const particles, const int N){ \
+    _REBX_COM_DISPATCH(_REBX_COM_FORCE_CALL, calculate_force_indexed) \
+}
+
+#define REBX_COM_PTM_KERNEL(name, calculate_step_indexed) \
+static void name(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, const double dt){ \
+    _REBX_COM_DISPATCH(_REBX_COM_PTM_CALL, calculate_step_indexed) \
+}
+
+// Same, with massless particles stepped through calculate_batch (see rebx_com_ptm_loop)
+#define REBX_COM_PTM_BATCH_KERNEL(name, calculate_step_indexed, calculate_batch) \
+static void name(struct reb_simulation* const sim, struct rebx_operator* const operator, const enum REBX_COORDINATES coordinates, const int back_reactions_inclusive, const char* reference_name, const double dt){ \
+    _REBX_COM_DISPATCH(_REBX_COM_PTM_BATCH_CALL, calculate_step_indexed, calculate_batch) \
+}
+
+#endif
@@ -5,6 +5,9 @@
 // https://naif.jpl.nasa.gov/pub/naif/toolkit_docs/C/req/spk.html
 // https://naif.jpl.nasa.gov/pub/naif/toolkit_docs/C/req/naif_ids.html
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // madvise and MAP_ANONYMOUS with -std=c99
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -17,6 +20,7 @@
 #include <unistd.h>
 #include <time.h>
 #include "spk.h"
+#include "chebyshev.h"
 
 
 struct sum_s {
@@ -42,12 +46,13 @@ int spk_free(struct spk_s *pl)
 	if (pl == NULL)
 		return -1;
 
-	for (m = 0; m < pl->num; m++) {
-		free(pl->one[m]);
-		free(pl->two[m]);
-	}
+	for (m = 0; m < pl->num; m++)
+		free(pl->seg[m]);
 
-	munmap(pl->map, pl->len);
+	if (pl->map != NULL)
+		munmap(pl->map, pl->len);
+	if (pl->buf != NULL)
+		munmap(pl->buf, pl->blen);
 	memset(pl, 0, sizeof(struct spk_s));
 	free(pl);
 	return 0;
@@ -63,15 +68,6 @@ int spk_free(struct spk_s *pl)
 static double inline _jul(double eph)
 	{ return 2451545.0 + eph / 86400.0; }
 
-// check for any non-7bit ascii characters
-static int _com(const char *buf)
-{
-	for (int n = 0; n < 1024; n++)
-		{ if (buf[n] < 0) return 0; }
-
-	return 1;
-}
-
 // display output strings to console
 static void _sho(const char *buf)
 {
@@ -82,6 +78,36 @@ static void _sho(const char *buf)
 		n += fprintf(stdout, "%s\n", &buf[n]) - 1;
 }
 
+// decode the segment directories, now that the file is mapped
+static int _seg(struct spk_s *pl, int m, const int *one, const int *two)
+{
+	struct spk_seg *seg;
+	double *val;
+	int n;
+
+	if ((pl->seg[m] = calloc(pl->ind[m], sizeof(struct spk_seg))) == NULL)
+		return -1;
+
+	for (n = 0; n < pl->ind[m]; n++) {
+		seg = &pl->seg[m][n];
+
+		// INIT, INTLEN, RSIZE, N
+		val = (double *)pl->map + (two[n] - 1);
+		seg->beg = _jul(val[-3]);
+		seg->len = val[-2] / 86400.0;
+		seg->rsz = (int)val[-1];
+		seg->cnt = (int)val[0];
+		seg->ncf = (seg->rsz - 2) / 3;
+		seg->one = (size_t)one[n] - 1;
+		seg->end = seg->beg + seg->cnt * seg->len;
+
+		if (seg->ncf < 1 || seg->ncf > _SPK_NCF)
+			return -1;
+	}
+
+	return 0;
+}
+
 struct spk_s * spk_init(const char *path)
 {
 	struct spk_s *pl;
@@ -89,16 +115,20 @@ struct spk_s * spk_init(const char *path)
 	char buf[1024];
 	struct sum_s *sum;
 	double *val;
-	int fd, nd, ni, nc;
+	int fd, nd, ni, nc, fw;
 	int m, n, c, b, B;
 	off_t off;
-	int num;
+	int *one[_SPK_MAX] = {NULL};
+	int *two[_SPK_MAX] = {NULL};
+	int cap[_SPK_MAX] = {0};
+	void *tmp;
 
 	if ((fd = open(path, O_RDONLY)) < 0)
 		return NULL;
 
 	pl = malloc(sizeof(struct spk_s));
 	memset(pl, 0, sizeof(struct spk_s));
+	pl->scl = 1.0 / 149597870.7;
 	val = (double *)buf;
 	sum = (struct sum_s *)buf;
 
@@ -126,17 +156,15 @@ struct spk_s * spk_init(const char *path)
 		goto err;
 	}
 
-	// could check the other headers, but we really don't care
-	// so find the first summary record (after potential comments)
-	off = lseek(fd, 1024, SEEK_SET);
-	read(fd, buf, 1024);
-
-	while (_com(buf) > 0) {
-	//	_sho(buf);
-		off = lseek(fd, 0, SEEK_CUR);
-		read(fd, buf, 1024);
+	// FWARD, the first summary record (after potential comments)
+	if (lseek(fd, 76, SEEK_SET) < 0 || read(fd, &fw, sizeof(int)) != sizeof(int) || fw < 2) {
+		errno = EILSEQ;
+		goto err;
 	}
 
+	off = lseek(fd, (off_t)(fw - 1) * 1024, SEEK_SET);
+	read(fd, buf, 1024);
+
 	// we are at the first summary block, validate
 	if (val[1] != 0.0) {
 		errno = EILSEQ;
@@ -156,20 +184,33 @@ next:	n = (int)val[0] - 1;
 //				sum->ref, sum->ver, sum->one, sum->two);
 
 		// pick out new target!
-		if (sum->tar != pl->tar[m]) {
+		if (sum->tar != pl->tar[m] || pl->num == 0) {
+			if (pl->num == _SPK_MAX) {
+				errno = EOVERFLOW;
+				goto err;
+			}
 			m = pl->num++;
 			pl->tar[m] = sum->tar;
 			pl->cen[m] = sum->cen;
 			pl->beg[m] = _jul(sum->beg);
 			pl->res[m] = _jul(sum->end) - pl->beg[m];
-			pl->one[m] = calloc(32768, sizeof(int));
-			pl->two[m] = calloc(32768, sizeof(int));
 		}
 
-		// add index
+		// add index, growing it as needed
 		c = pl->ind[m]++;
-		pl->one[m][c] = sum->one;
-		pl->two[m][c] = sum->two;
+
+		if (c == cap[m]) {
+			cap[m] = cap[m] ? 2 * cap[m] : 64;
+			if ((tmp = realloc(one[m], cap[m] * sizeof(int))) == NULL)
+				goto err;
+			one[m] = tmp;
+			if ((tmp = realloc(two[m], cap[m] * sizeof(int))) == NULL)
+				goto err;
+			two[m] = tmp;
+		}
+
+		one[m][c] = sum->one;
+		two[m][c] = sum->two;
 	}
 
 	if (n >= 0) {
@@ -183,18 +224,38 @@ next:	n = (int)val[0] - 1;
 	pl->len = sb.st_size;
 	pl->map = mmap(NULL, pl->len, PROT_READ, MAP_SHARED, fd, 0);
 
-	if (pl->map == NULL)
+	if (pl->map == MAP_FAILED) {
+		pl->map = NULL;
 		goto err;
+	}
 
 	if (close(fd) < 0)
 		{ ; }
+	fd = -1;
 	if (madvise(pl->map, pl->len, MADV_RANDOM) < 0)
 		{ ; }
 
+	// segment tables, sized to the data
+	for (m = 0; m < pl->num; m++) {
+		if (_seg(pl, m, one[m], two[m]) < 0) {
+			errno = EILSEQ;
+			goto err;
+		}
+		free(one[m]);
+		free(two[m]);
+		one[m] = two[m] = NULL;
+	}
+
 	return pl;
 
 err:	perror(path);
-	free(pl);
+	if (fd >= 0)
+		close(fd);
+	for (m = 0; m < _SPK_MAX; m++) {
+		free(one[m]);
+		free(two[m]);
+	}
+	spk_free(pl);
 	return NULL;
 }
 
@@ -227,64 +288,482 @@ int spk_find(struct spk_s *pl, int tar)
  *
  */
 
+// find and scale the record of target m covering jde
+static int _rec(struct spk_s *pl, int m, double jde, struct spk_rec *rec)
+{
+	const struct spk_seg *seg;
+	double *val, u;
+	int n, b, p, P;
+
+	// guess the segment from the first one's span, then walk to it
+	n = (int)((jde - pl->beg[m]) / pl->res[m]);
+
+	if (n < 0) n = 0;
+	if (n >= pl->ind[m]) n = pl->ind[m] - 1;
+
+	while (n > 0 && jde < pl->seg[m][n].beg)
+		n--;
+	while (n < pl->ind[m] - 1 && jde > pl->seg[m][n].end)
+		n++;
+
+	seg = &pl->seg[m][n];
+
+	if (jde < seg->beg || jde > seg->end)
+		return -1;
+
+	// pick out the precise record
+	b = (int)((jde - seg->beg) / seg->len);
+	if (b >= seg->cnt) b = seg->cnt - 1;
+
+	if (seg->buf != NULL && b >= seg->b0 && b < seg->b0 + seg->nb)
+		val = (double *)seg->buf + (size_t)(b - seg->b0) * seg->rsz;
+	else
+		val = (double *)pl->map + seg->one + (size_t)b * seg->rsz;
+	P = seg->ncf;
+
+	rec->mid = _jul(val[0]);
+	rec->rad = val[1] / 86400.0;
+	rec->ncf = P;
+
+	// restore units to [AU] once for the whole record
+	u = pl->scl;
+
+	for (n = 0; n < 3; n++)
+		for (p = 0; p < P; p++)
+			rec->c[n][p] = val[2 + n * P + p] * u;
+
+	return 0;
+}
+
+// evaluate a record at jde
+static void _eval(const struct spk_rec *rec, double jde, struct mpos_s *pos)
+{
+	int n;
+
+	pos->jde = jde;
+
+	// scale to interpolation units
+	jde = (jde - rec->mid) / rec->rad;
+
+	cheb_eval3(rec->c[0], _SPK_NCF, rec->ncf, jde, pos->u, pos->v, pos->w);
+
+	// [AU/day], [AU/day^2]
+	for (n = 0; n < 3; n++) {
+		pos->v[n] /= rec->rad;
+		pos->w[n] /= rec->rad * rec->rad;
+	}
+}
+
 int spk_calc(struct spk_s *pl, int m, double jde, struct mpos_s *pos)
 {
-	struct sum_s *sum;
-	int n, b, p, P, R;
-	double T[32], S[32];
-	double *val;
+	struct spk_rec rec;
 
 	if (pl == NULL || pos == NULL)
 		return -1;
 	if (m < 0 || m >= pl->num)
 		return -1;
 
-	pos->jde = jde;
+	if (_rec(pl, m, jde, &rec) < 0)
+		return -1;
 
-	for (n = 0; n < 3; n++)
-		pos->u[n] = pos->v[n] = 0.0;
+	_eval(&rec, jde, pos);
+	return 0;
+}
 
-	// find location of 'directory' describing the data records
-	n = (int)((jde - pl->beg[m]) / pl->res[m]);
-	val = pl->map + sizeof(double) * (pl->two[m][n] - 1);
 
-	// record size and number of coefficients per coordinate
-	R = (int)val[-1];
-	P = (R - 2) / 3; // must be < 32 !!
+/*
+ *  spk_calc_cached
+ *
+ *  Same as spk_calc, reusing the last record of the target while it covers jde.
+ *
+ */
 
-	// pick out the precise record
-	b = (int)((jde - _jul(val[-3])) / (val[-2] / 86400.0));
-	val = pl->map + sizeof(double) * (pl->one[m][n] - 1)
-			+ sizeof(double) * b * R;
+int spk_calc_cached(struct spk_s *pl, struct spk_cache *ch, int m, double jde, struct mpos_s *pos)
+{
+	struct spk_rec *rec;
 
-	// scale to interpolation units
-	jde -= _jul(val[0]);
-	jde /= val[1] / 86400.0;
+	if (ch == NULL)
+		return spk_calc(pl, m, jde, pos);
 
-	// set up Chebyshev polynomials
-	T[0] = 1.0; S[0] = 0.0;
-	T[1] = jde; S[1] = 1.0;
+	if (pl == NULL || pos == NULL)
+		return -1;
+	if (m < 0 || m >= pl->num)
+		return -1;
 
-	for (p = 2; p < P; p++) {
-		T[p] = 2.0 * jde * T[p-1] - T[p-2];
-		S[p] = 2.0 * jde * S[p-1] + 2.0 * T[p-1] - S[p-2];
+	if (ch->pl != pl) {
+		memset(ch, 0, sizeof(struct spk_cache));
+		ch->pl = pl;
 	}
 
-	for (n = 0; n < 3; n++) {
-		b = 2 + n * P;
+	rec = &ch->rec[m];
+
+	if (!ch->ok[m] || fabs(jde - rec->mid) > rec->rad) {
+		ch->ok[m] = 0;
+		if (_rec(pl, m, jde, rec) < 0)
+			return -1;
+		ch->ok[m] = 1;
+	}
+
+	_eval(rec, jde, pos);
+	return 0;
+}
+
+
+
+/*
+ *  spk_calc_all
+ *
+ *  Compute the position and velocity of the first n targets at one epoch.
+ *
+ */
+
+int spk_calc_all(struct spk_s *pl, struct spk_cache *ch, int n, double jde, struct mpos_s *pos)
+{
+	int m;
+
+	if (pl == NULL || pos == NULL)
+		return -1;
+	if (n < 0 || n > pl->num)
+		return -1;
+
+	for (m = 0; m < n; m++)
+		if (spk_calc_cached(pl, ch, m, jde, &pos[m]) < 0)
+			return -1;
+
+	return 0;
+}
+
+
+// records of segment seg within [beg, end], or 0 if none
+static int _win(const struct spk_seg *seg, double beg, double end, int *b0)
+{
+	int b1;
 
-		// sum interpolation stuff
-		for (p = 0; p < P; p++) {
-			pos->u[n] += val[b + p] * T[p];
-			pos->v[n] += val[b + p] * S[p];
+	if (end < seg->beg || beg > seg->end)
+		return 0;
+
+	*b0 = (int)((beg - seg->beg) / seg->len);
+	b1 = (int)((end - seg->beg) / seg->len);
+
+	if (*b0 < 0) *b0 = 0;
+	if (b1 >= seg->cnt) b1 = seg->cnt - 1;
+
+	return (b1 < *b0) ? 0 : b1 - *b0 + 1;
+}
+
+
+/*
+ *  spk_prefetch
+ *
+ *  Page in the records of every target covering [beg, end].
+ *
+ */
+
+int spk_prefetch(struct spk_s *pl, double beg, double end)
+{
+	volatile unsigned char sum = 0;
+	const unsigned char *z;
+	const struct spk_seg *seg;
+	size_t off, len, q;
+	long page;
+	int m, n, b0, nb;
+
+	if (pl == NULL || pl->map == NULL)
+		return -1;
+
+	page = sysconf(_SC_PAGESIZE);
+
+	for (m = 0; m < pl->num; m++) {
+
+		for (n = 0; n < pl->ind[m]; n++) {
+			seg = &pl->seg[m][n];
+
+			// records of the segment within the span
+			if ((nb = _win(seg, beg, end, &b0)) == 0)
+				continue;
+
+			off = sizeof(double) * (seg->one + (size_t)b0 * seg->rsz);
+			len = sizeof(double) * (size_t)nb * seg->rsz;
+			q = off % (size_t)page;
+
+			if (madvise((char *)pl->map + off - q, len + q, MADV_WILLNEED) < 0)
+				{ ; }
+
+			z = (const unsigned char *)pl->map + off;
+			for (q = 0; q < len; q += (size_t)page)
+				sum += z[q];
 		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *  spk_sequential
+ *
+ *  Ask the kernel to read ahead the records covering [beg, end], for runs
+ *  that move forward in time.  Returns without waiting for the reads.
+ *
+ */
+
+int spk_sequential(struct spk_s *pl, double beg, double end)
+{
+	const struct spk_seg *seg;
+	size_t off, len, q;
+	long page;
+	int m, n, b0, nb;
+
+	if (pl == NULL || pl->map == NULL)
+		return -1;
+
+	page = sysconf(_SC_PAGESIZE);
+
+	for (m = 0; m < pl->num; m++) {
+		for (n = 0; n < pl->ind[m]; n++) {
+			seg = &pl->seg[m][n];
+
+			if ((nb = _win(seg, beg, end, &b0)) == 0)
+				continue;
+
+			off = sizeof(double) * (seg->one + (size_t)b0 * seg->rsz);
+			len = sizeof(double) * (size_t)nb * seg->rsz;
+			q = off % (size_t)page;
+
+			if (madvise((char *)pl->map + off - q, len + q, MADV_SEQUENTIAL) < 0)
+				{ ; }
+			if (madvise((char *)pl->map + off - q, len + q, MADV_WILLNEED) < 0)
+				{ ; }
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *  spk_preload
+ *
+ *  Copy the records of every target covering [beg, end] into anonymous
+ *  memory at once, so that lookups in that span never touch the file.
+ *  Lookups outside the span still go to the memory map.
+ *
+ */
+
+// anonymous read-write memory, from huge pages if asked and available
+static void *_anon(size_t *len, int flags)
+{
+	const size_t huge = 2 * 1024 * 1024;
+	void *p = MAP_FAILED;
+
+	if (flags & SPK_LOAD_HUGE) {
+		*len = (*len + huge - 1) / huge * huge;
+#ifdef MAP_HUGETLB
+		p = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	}
 
-		// restore units to [AU] and [AU/day]
-		pos->u[n] /= 149597870.7;
-		pos->v[n] /= 149597870.7 / 86400.0;
-		pos->v[n] /= val[1];
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		// no reserved huge pages, ask for transparent ones instead
+		if ((flags & SPK_LOAD_HUGE) && madvise(p, *len, MADV_HUGEPAGE) < 0)
+			{ ; }
+#endif
 	}
 
+	return p;
+}
+
+int spk_preload(struct spk_s *pl, double beg, double end, int flags)
+{
+	struct spk_seg *seg;
+	size_t tot, len, off, q, page;
+	double *buf, *z;
+	int m, n, b0, nb;
+
+	if (pl == NULL || pl->map == NULL)
+		return -1;
+
+	if (beg > end)
+		{ double x = beg; beg = end; end = x; }
+
+	// size of the window over all targets
+	for (tot = 0, m = 0; m < pl->num; m++)
+		for (n = 0; n < pl->ind[m]; n++)
+			if ((nb = _win(&pl->seg[m][n], beg, end, &b0)) > 0)
+				tot += (size_t)nb * pl->seg[m][n].rsz;
+
+	if (tot == 0)
+		return -1;
+
+	len = tot * sizeof(double);
+
+	if ((buf = _anon(&len, flags)) == NULL)
+		return -1;
+
+	if (pl->buf != NULL)
+		munmap(pl->buf, pl->blen);
+
+	// copy in file order, each run read sequentially
+	page = (size_t)sysconf(_SC_PAGESIZE);
+
+	for (z = buf, m = 0; m < pl->num; m++) {
+		for (n = 0; n < pl->ind[m]; n++) {
+			seg = &pl->seg[m][n];
+			seg->buf = NULL;
+
+			if ((nb = _win(seg, beg, end, &b0)) == 0)
+				continue;
+
+			tot = (size_t)nb * seg->rsz;
+			off = sizeof(double) * (seg->one + (size_t)b0 * seg->rsz);
+			q = off % page;
+
+			if (madvise((char *)pl->map + off - q, sizeof(double) * tot + q, MADV_SEQUENTIAL) < 0)
+				{ ; }
+
+			memcpy(z, (char *)pl->map + off, sizeof(double) * tot);
+
+			seg->buf = z;
+			seg->b0 = b0;
+			seg->nb = nb;
+			z += tot;
+		}
+	}
+
+	if (madvise(pl->map, pl->len, MADV_RANDOM) < 0)
+		{ ; }
+
+	if (mprotect(buf, len, PROT_READ) < 0)
+		{ ; }
+	if ((flags & SPK_LOAD_LOCK) && mlock(buf, len) < 0)
+		{ ; }	// not fatal, e.g. RLIMIT_MEMLOCK
+
+	pl->buf = buf;
+	pl->blen = len;
 	return 0;
 }
 
+
+/*
+ *  spk_write
+ *
+ *  Write n targets as type 2 segments of a DAF/SPK file that spk_init
+ *  (and SPICE) can read, in [km] and seconds past J2000.0.
+ *
+ */
+
+#define _SPK_SUM	25	// summaries per summary record
+
+int spk_write(const char *path, int n, const struct spk_out *out)
+{
+	const union { int i; char c; } end = { 1 };
+	char rec[1024];
+	struct sum_s *sum;
+	double *val, dir[4];
+	FILE *fp;
+	int m, b, p, k, nb, rsz, adr;
+	int nd = 2, ni = 6;
+
+	if (path == NULL || n < 1 || n > _SPK_MAX)
+		return -1;
+
+	for (m = 0; m < n; m++)
+		if (out[m].cnt < 1 || out[m].ncf < 1 || out[m].ncf > _SPK_NCF || !(out[m].len > 0.0))
+			return -1;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		return -1;
+
+	// each summary record is followed by its name record, then the data
+	nb = (n + _SPK_SUM - 1) / _SPK_SUM;
+	adr = (1 + 2 * nb) * 128 + 1;
+
+	for (m = 0; m < n; m++)
+		adr += out[m].cnt * (2 + 3 * out[m].ncf) + 4;
+
+	// LOCIDW, ND, NI, LOCIFN, FWARD, BWARD, FREE, LOCFMT, FTPSTR
+	memset(rec, 0, sizeof(rec));
+	memcpy(rec, "DAF/SPK ", 8);
+	memcpy(rec + 8, &nd, sizeof(int));
+	memcpy(rec + 12, &ni, sizeof(int));
+	memset(rec + 16, ' ', 60);
+	memcpy(rec + 16, "REBOUNDx", 8);
+	k = 2;
+	memcpy(rec + 76, &k, sizeof(int));
+	k = 2 * nb;
+	memcpy(rec + 80, &k, sizeof(int));
+	memcpy(rec + 84, &adr, sizeof(int));
+	memcpy(rec + 88, end.c ? "LTL-IEEE" : "BIG-IEEE", 8);
+	memcpy(rec + 699, "FTPSTR:\r:\n:\r\n:\r\0:\x81:\x10\xce:ENDFTP", 28);
+	fwrite(rec, sizeof(rec), 1, fp);
+
+	adr = (1 + 2 * nb) * 128 + 1;
+	val = (double *)rec;
+
+	for (b = 0; b < nb; b++) {
+
+		// NEXT, PREV, NSUM
+		memset(rec, 0, sizeof(rec));
+		val[0] = (b < nb - 1) ? 2 * b + 4 : 0;
+		val[1] = (b > 0) ? 2 * b : 0;
+		val[2] = 0;
+
+		for (m = b * _SPK_SUM; m < n && m < (b + 1) * _SPK_SUM; m++) {
+			sum = (struct sum_s *)&rec[24 + (int)val[2] * sizeof(struct sum_s)];
+			rsz = 2 + 3 * out[m].ncf;
+
+			sum->beg = (out[m].beg - 2451545.0) * 86400.0;
+			sum->end = sum->beg + out[m].cnt * out[m].len * 86400.0;
+			sum->tar = out[m].tar;
+			sum->cen = out[m].cen;
+			sum->ref = 1;
+			sum->ver = 2;
+			sum->one = adr;
+			sum->two = adr + out[m].cnt * rsz + 3;
+
+			adr = sum->two + 1;
+			val[2]++;
+		}
+		fwrite(rec, sizeof(rec), 1, fp);
+
+		// names
+		memset(rec, ' ', sizeof(rec));
+		fwrite(rec, sizeof(rec), 1, fp);
+	}
+
+	// MID, RADIUS and the coefficients of each record, then INIT, INTLEN, RSIZE, N
+	for (m = 0; m < n; m++) {
+		const double au = 149597870.7;
+		const double s = out[m].len * 86400.0;
+		const int P = out[m].ncf;
+
+		dir[0] = (out[m].beg - 2451545.0) * 86400.0;
+		dir[1] = s;
+		dir[2] = 2 + 3 * P;
+		dir[3] = out[m].cnt;
+
+		for (b = 0; b < out[m].cnt; b++) {
+			val[0] = dir[0] + (b + 0.5) * s;
+			val[1] = 0.5 * s;
+			for (k = 0; k < 3 * P; k++)
+				val[2 + k] = out[m].c[(size_t)b * 3 * P + k] * au;
+			fwrite(val, sizeof(double), 2 + 3 * P, fp);
+		}
+		fwrite(dir, sizeof(double), 4, fp);
+	}
+
+	// whole records
+	memset(rec, 0, sizeof(rec));
+	if ((k = (int)(ftell(fp) % 1024)) > 0)
+		fwrite(rec, 1024 - k, 1, fp);
+
+	p = ferror(fp);
+	if (fclose(fp) != 0 || p)
+		return -1;
+
+	return 0;
+}
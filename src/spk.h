@@ -51,19 +51,70 @@ struct mpos_s {
 	double jde;
 };
 
+// segment of a target, decoded from its directory at init
+struct spk_seg {
+	double beg;			// first record epoch, julian day
+	double end;			// last epoch covered
+	double len;			// record interval [days]
+	size_t one;			// first record, doubles from start of map
+	int rsz;			// record size
+	int cnt;			// number of records
+	int ncf;			// coefficients per coordinate
+	const double *buf;		// preloaded records b0.. b0+nb-1, or NULL
+	int b0, nb;
+};
+
+#define _SPK_NCF	32	// maximum coefficients per coordinate
+
+// one record with the coefficients scaled to [AU]
+struct spk_rec {
+	double mid;			// record midpoint, julian day
+	double rad;			// record half length [days]
+	int ncf;			// coefficients per coordinate
+	double c[3][_SPK_NCF];
+};
+
+// last record used for each target, owned by the caller so that the
+// kernel itself can be shared between threads
+struct spk_cache {
+	const struct spk_s *pl;		// kernel the records belong to
+	int ok[_SPK_MAX];		// record loaded
+	struct spk_rec rec[_SPK_MAX];
+};
+
 struct spk_s {
 
 	int tar[_SPK_MAX];		// target code
 	int cen[_SPK_MAX];		// centre target
 	double beg[_SPK_MAX];		// begin epoch
 	double res[_SPK_MAX];		// epoch step
-	int *one[_SPK_MAX];		// record index
-	int *two[_SPK_MAX];		// ... ditto
-	int ind[_SPK_MAX];		// length of index
+	struct spk_seg *seg[_SPK_MAX];	// segment table
+	int ind[_SPK_MAX];		// length of segment table
 
 	int num;			// number of targets
+	double scl;			// coefficient scale to [AU]
 	void *map;			// memory map
 	size_t len;			// map length
+	void *buf;			// preloaded records, or NULL
+	size_t blen;			// length of buf mapping
+};
+
+// flags for spk_preload
+enum {
+	SPK_LOAD_HUGE		= 1,	// back the copy with huge pages
+	SPK_LOAD_LOCK		= 2,	// mlock the copy
+};
+
+// one target of a file written by spk_write, as a type 2 segment of
+// cnt records of length len tiling [beg, beg + cnt * len]
+struct spk_out {
+	int tar;			// target code
+	int cen;			// centre target
+	double beg;			// julian day
+	double len;			// record interval [days]
+	int cnt;			// number of records
+	int ncf;			// coefficients per coordinate
+	const double *c;		// cnt records of x, y and z coefficients [AU]
 };
 
 
@@ -71,6 +122,12 @@ int spk_free(struct spk_s *pl);
 struct spk_s * spk_init(const char *path);
 int spk_find(struct spk_s *pl, int m);
 int spk_calc(struct spk_s *pl, int tar, double jde, struct mpos_s *pos);
+int spk_calc_cached(struct spk_s *pl, struct spk_cache *ch, int m, double jde, struct mpos_s *pos);
+int spk_calc_all(struct spk_s *pl, struct spk_cache *ch, int n, double jde, struct mpos_s *pos);
+int spk_prefetch(struct spk_s *pl, double beg, double end);
+int spk_sequential(struct spk_s *pl, double beg, double end);
+int spk_preload(struct spk_s *pl, double beg, double end, int flags);
+int spk_write(const char *path, int n, const struct spk_out *out);
 
 #endif // _SPK_H
 
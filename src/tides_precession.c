@@ -42,7 +42,11 @@
  * 
  * **Effect Parameters**
  * 
- * None
+ * ============================ =========== ==================================================================
+ * Field (C type)               Required    Description
+ * ============================ =========== ==================================================================
+ * fused (int)                  No          If nonzero, evaluated in one pass over the particles with the other fused forces
+ * ============================ =========== ==================================================================
  *
  * **Particle Parameters**
  *
@@ -61,17 +65,76 @@
 #include <stdlib.h>
 #include <float.h>
 #include "reboundx.h"
+#include "core.h"
+
+// Indices of the particles with tides_primary, in increasing order.  Kept on the force and rebuilt when
+// rebx->param_generation or the number of particles changes.
+struct rebx_tides_precession_workspace {
+    uint64_t param_generation;
+    int N;
+    int n;
+    int* sources;
+};
+
+void rebx_tides_precession_free_arrays(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_tides_precession_workspace* const ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_tides_precession_workspace));
+    if (ws){
+        free(ws->sources);
+        free(ws);
+    }
+}
+
+static struct rebx_tides_precession_workspace* rebx_tides_precession_workspace_get(struct rebx_extras* const rebx, struct rebx_force* const force){
+    struct rebx_tides_precession_workspace* ws = rebx_get_param_h(force->ap, rebx_default_param(rebx, REBX_PARAM_tides_precession_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        ws->N = -1;
+        rebx_set_param_pointer(rebx, &force->ap, "tides_precession_workspace", ws);
+        rebx_set_param_pointer(rebx, &force->ap, "free_arrays", rebx_tides_precession_free_arrays);
+    }
+    return ws;
+}
+
+static int rebx_tides_precession_build(struct rebx_extras* const rebx, struct rebx_tides_precession_workspace* const ws, const struct reb_particle* const particles, const int N, const rebx_param_handle primary_h){
+    int n = 0;
+    for (int i=0; i<N; i++){
+        n += rebx_get_param_h(particles[i].ap, primary_h) != NULL;
+    }
+    int* const sources = malloc((n > 0 ? n : 1)*sizeof(*sources));
+    if (sources == NULL){
+        return 0;
+    }
+    n = 0;
+    for (int i=0; i<N; i++){
+        if (rebx_get_param_h(particles[i].ap, primary_h) != NULL){
+            sources[n++] = i;
+        }
+    }
+    free(ws->sources);
+    ws->sources = sources;
+    ws->n = n;
+    ws->N = N;
+    ws->param_generation = rebx->param_generation;
+    return 1;
+}
 
 static void rebx_calculate_tides_precession(struct rebx_extras* const rebx, struct reb_simulation* const sim, struct reb_particle* const particles, const int N, const int source_index){
     struct reb_particle* const source = &particles[source_index];
     const double m0 = source->m;
+    const rebx_param_handle R_h = rebx_default_param(rebx, REBX_PARAM_R_tides);
+    const rebx_param_handle k1_h = rebx_default_param(rebx, REBX_PARAM_k1);
+    struct rebx_param_column* const R_column = rebx_get_param_column(rebx, R_h);
+    struct rebx_param_column* const k1_column = rebx_get_param_column(rebx, k1_h);
     double R0 = 0.;
-    double* R = rebx_get_param(rebx, source->ap, "R_tides");
+    double* R = rebx_get_particle_param_double(R_column, source_index, source->ap, R_h);
     if (R){
         R0 = *R;
     }
     double k10 = 0.;
-    double* k1 = rebx_get_param(rebx, source->ap, "k1");
+    double* k1 = rebx_get_particle_param_double(k1_column, source_index, source->ap, k1_h);
     if (k1){
         k10 = *k1;
     }
@@ -89,12 +152,12 @@ static void rebx_calculate_tides_precession(struct rebx_extras* const rebx, stru
         fac += fac0*mratio;
         
         Rp = 0.;
-        R = rebx_get_param(rebx, p->ap, "R_tides");
+        R = rebx_get_particle_param_double(R_column, i, p->ap, R_h);
         if(R){
             Rp = *R;
         }
         k1p = 0.;
-        k1 = rebx_get_param(rebx, p->ap, "k1");
+        k1 = rebx_get_particle_param_double(k1_column, i, p->ap, k1_h);
         if(k1){
             k1p = *k1;
         }
@@ -117,9 +180,16 @@ static void rebx_calculate_tides_precession(struct rebx_extras* const rebx, stru
 
 void rebx_tides_precession(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, const int N){
     struct rebx_extras* const rebx = sim->extras;
+    const rebx_param_handle primary_h = rebx_default_param(rebx, REBX_PARAM_tides_primary);
+    struct rebx_tides_precession_workspace* const ws = rebx_tides_precession_workspace_get(rebx, tides_prec);
+    if (ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_tides_precession_build(rebx, ws, particles, N, primary_h))){
+        reb_error(sim, "REBOUNDx Error: Could not allocate memory for tides_precession.\n");
+        return;
+    }
     int source_found=0;
-    for (int i=0; i<N; i++){
-        if (rebx_get_param(rebx, particles[i].ap, "tides_primary") != NULL){
+    for (int k=0; k<ws->n; k++){
+        const int i = ws->sources[k];
+        if (rebx_get_param_h(particles[i].ap, primary_h) != NULL){  // the list is a superset if an ap was changed behind rebx_set_param, so check again
             source_found = 1;
             rebx_calculate_tides_precession(rebx, sim, particles, N, i);
         }
@@ -129,17 +199,111 @@ void rebx_tides_precession(struct reb_simulation* const sim, struct rebx_force*
     }
 }
 
+struct rebx_tides_precession_state {
+    const struct rebx_tides_precession_workspace* ws;
+    int source_default;         // no listed particle still has tides_primary
+    rebx_param_handle primary_h;
+    rebx_param_handle R_h;
+    rebx_param_handle k1_h;
+    struct rebx_param_column* R_column;
+    struct rebx_param_column* k1_column;
+};
+
+static int rebx_tides_precession_begin(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, const int N, void* const state){
+    struct rebx_extras* const rebx = sim->extras;
+    struct rebx_tides_precession_state* const st = state;
+    st->primary_h = rebx_default_param(rebx, REBX_PARAM_tides_primary);
+    struct rebx_tides_precession_workspace* const ws = rebx_tides_precession_workspace_get(rebx, tides_prec);
+    if (N < 1 || ws == NULL || ((ws->N != N || ws->param_generation != rebx->param_generation) && !rebx_tides_precession_build(rebx, ws, particles, N, st->primary_h))){
+        return 0;   // rebx_tides_precession reports the error
+    }
+    st->ws = ws;
+    st->source_default = 1;
+    for (int k=0; k<ws->n; k++){
+        if (rebx_get_param_h(particles[ws->sources[k]].ap, st->primary_h) != NULL){
+            st->source_default = 0;
+        }
+    }
+    st->R_h = rebx_default_param(rebx, REBX_PARAM_R_tides);
+    st->k1_h = rebx_default_param(rebx, REBX_PARAM_k1);
+    st->R_column = rebx_get_param_column(rebx, st->R_h);
+    st->k1_column = rebx_get_param_column(rebx, st->k1_h);
+    return 1;
+}
+
+static double rebx_tides_precession_fac(const struct rebx_tides_precession_state* const st, struct reb_particle* const particles, const int i){
+    const double* const R = rebx_get_particle_param_double(st->R_column, i, particles[i].ap, st->R_h);
+    const double* const k1 = rebx_get_particle_param_double(st->k1_column, i, particles[i].ap, st->k1_h);
+    const double Rp = R ? *R : 0.;
+    const double k1p = k1 ? *k1 : 0.;
+    return k1p*Rp*Rp*Rp*Rp*Rp;
+}
+
+static void rebx_tides_precession_source_block(struct reb_simulation* const sim, const struct rebx_tides_precession_state* const st, struct reb_particle* const particles, struct rebx_fused_block* const b, const double* const fac_p, const int source_index){
+    struct reb_particle* const source = &particles[source_index];
+    const double m0 = source->m;
+    const double fac0 = rebx_tides_precession_fac(st, particles, source_index);
+    double rx = 0., ry = 0., rz = 0.;
+    for (int k=0; k<b->n; k++){
+        if (b->i0 + k == source_index) continue;
+        const double mratio = b->m[k]/m0;
+        if (mratio < DBL_MIN){ // m1 = 0. Continue to avoid overflow/nan
+            continue;
+        }
+        const double fac = fac0*mratio + fac_p[k]/mratio;
+        const double dx = b->x[k] - source->x; 
+        const double dy = b->y[k] - source->y;
+        const double dz = b->z[k] - source->z;
+        const double dr2 = dx*dx + dy*dy + dz*dz; 
+        const double prefac = -3*sim->G*(m0 + b->m[k])/(dr2*dr2*dr2*dr2)*fac;
+
+        b->ax[k] += prefac*dx;
+        b->ay[k] += prefac*dy;
+        b->az[k] += prefac*dz;
+        rx -= mratio*prefac*dx;
+        ry -= mratio*prefac*dy;
+        rz -= mratio*prefac*dz;
+    }
+    source->ax += rx;
+    source->ay += ry;
+    source->az += rz;
+}
+
+static void rebx_tides_precession_block(struct reb_simulation* const sim, struct rebx_force* const tides_prec, struct reb_particle* const particles, struct rebx_fused_block* const b, void* const state){
+    const struct rebx_tides_precession_state* const st = state;
+    double fac_p[REBX_FUSED_BLOCK];
+    for (int k=0; k<b->n; k++){
+        fac_p[k] = rebx_tides_precession_fac(st, particles, b->i0 + k);
+    }
+    if (st->source_default){    // default source to index 0 if "tides_primary" not found on any particle
+        rebx_tides_precession_source_block(sim, st, particles, b, fac_p, 0);
+        return;
+    }
+    for (int k=0; k<st->ws->n; k++){
+        const int i = st->ws->sources[k];
+        if (rebx_get_param_h(particles[i].ap, st->primary_h) != NULL){
+            rebx_tides_precession_source_block(sim, st, particles, b, fac_p, i);
+        }
+    }
+}
+
+const struct rebx_fused_kernel rebx_tides_precession_fused = {rebx_tides_precession, sizeof(struct rebx_tides_precession_state), rebx_tides_precession_begin, rebx_tides_precession_block};
+
 static double rebx_calculate_tides_precession_potential(struct rebx_extras* const rebx, struct reb_simulation* const sim, const int source_index){
     struct reb_particle* const particles = sim->particles;
     struct reb_particle* const source = &particles[source_index];
     const double m0 = source->m;
+    const rebx_param_handle R_h = rebx_default_param(rebx, REBX_PARAM_R_tides);
+    const rebx_param_handle k1_h = rebx_default_param(rebx, REBX_PARAM_k1);
+    struct rebx_param_column* const R_column = rebx_get_param_column(rebx, R_h);
+    struct rebx_param_column* const k1_column = rebx_get_param_column(rebx, k1_h);
     double R0 = 0.;
-    double* R = rebx_get_param(rebx, source->ap, "R_tides");
+    double* R = rebx_get_particle_param_double(R_column, source_index, source->ap, R_h);
     if (R){
         R0 = *R;
     }
     double k10 = 0.;
-    double* k1 = rebx_get_param(rebx, source->ap, "k1");
+    double* k1 = rebx_get_particle_param_double(k1_column, source_index, source->ap, k1_h);
     if (k1){
         k10 = *k1;
     }
@@ -158,12 +322,12 @@ static double rebx_calculate_tides_precession_potential(struct rebx_extras* cons
         fac += fac0*mratio;
         
         Rp = 0.;
-        R = rebx_get_param(rebx, p->ap, "R_tides");
+        R = rebx_get_particle_param_double(R_column, i, p->ap, R_h);
         if(R){
             Rp = *R;
         }
         k1p = 0.;
-        k1 = rebx_get_param(rebx, p->ap, "k1");
+        k1 = rebx_get_particle_param_double(k1_column, i, p->ap, k1_h);
         if(k1){
             k1p = *k1;
         }
@@ -187,10 +351,11 @@ double rebx_tides_precession_potential(struct rebx_extras* const rebx){
     struct reb_simulation* const sim = rebx->sim;
     const int N_real = sim->N - sim->N_var;
     struct reb_particle* const particles = sim->particles;
+    const rebx_param_handle primary_h = rebx_default_param(rebx, REBX_PARAM_primary);
     int source_found=0;
     double H=0.;
     for (int i=0; i<N_real; i++){
-        if (rebx_get_param(rebx, particles[i].ap, "primary") != NULL){
+        if (rebx_get_param_h(particles[i].ap, primary_h) != NULL){
             source_found = 1;
             H = rebx_calculate_tides_precession_potential(rebx, sim, i);
         }
@@ -38,14 +38,26 @@
  *
  * **Effect Parameters**
  * 
- * *None*
+ * ============================ =========== ==================================================================
+ * Field (C type)               Required    Description
+ * ============================ =========== ==================================================================
+ * min_distance_interpolate     No          If nonzero, also find the closest approach inside each step (see below).
+ * (int)
+ * ============================ =========== ==================================================================
+ * 
+ * By default the distance is only sampled each time the operator runs. With ``min_distance_interpolate`` set, the
+ * relative position since the previous call is modelled by the cubic Hermite polynomial through the positions and
+ * velocities at both ends, and the closest approach on it is found from the roots of r.v = 0. Encounters much shorter
+ * than the step are then still caught, whatever the integrator. The first call after tracking starts, or after particles
+ * are added or removed, only samples.
  * 
  * **Particle Parameters**
  * 
  * Only particles with their ``min_distance`` parameter set initially will track their minimum distance. The effect will
  * update this parameter when the particle gets closer than the value of ``min_distance``, so the user has to set it
  * initially.  By default distance is measured from sim->particles[0], but you can specify a different particle by setting
- * the ``min_distance_from`` parameter to the hash of the target particle.
+ * the ``min_distance_from`` parameter to the hash of the target particle. Hashes are found through a table kept on the
+ * operator, rebuilt only when particles are added, removed or reordered.
  * 
  * ================================ =========== =======================================================
  * Name (C type)                    Required    Description
@@ -62,29 +74,285 @@
 #include <math.h>
 #include "rebound.h"
 #include "reboundx.h"
+#include "core.h"
+
+// Hashes of the particles -> their indices in sim->particles, open addressing.
+// Only a hint: every hit is checked against the particle's hash, and a miss
+// or a stale hit rebuilds the table, at most once per call.
+struct rebx_min_distance_slot {
+    uint32_t hash;
+    int index;                  // -1 if empty
+};
+
+// Relative state of a tracked particle at the end of the previous call.
+struct rebx_min_distance_sample {
+    int valid;
+    uint32_t hash;              // of the tracked particle, to notice reordering
+    int source;                 // index of the particle the distance was measured from
+    double t;
+    double dr[3];
+    double dv[3];
+};
+
+// Kept on the operator between calls.
+struct rebx_min_distance_workspace {
+    int N;                      // sim->N when the table was built
+    int mask;                   // table size - 1, a power of two
+    struct rebx_min_distance_slot* table;
+    int N_alloc;
+    struct rebx_min_distance_sample* samples;   // by particle index, only when interpolating
+};
+
+void rebx_track_min_distance_free_arrays(struct rebx_extras* const rebx, struct rebx_operator* const operator){
+    struct rebx_min_distance_workspace* const ws = rebx_get_param_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_min_distance_workspace));
+    if (ws){
+        free(ws->table);
+        free(ws->samples);
+        free(ws);
+    }
+}
+
+static struct rebx_min_distance_workspace* rebx_track_min_distance_workspace_get(struct rebx_extras* const rebx, struct rebx_operator* const operator){
+    struct rebx_min_distance_workspace* ws = rebx_get_param_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_min_distance_workspace));
+    if (ws == NULL){
+        ws = calloc(1, sizeof(*ws));
+        if (ws == NULL){
+            return NULL;
+        }
+        ws->N = -1;
+        rebx_set_param_pointer(rebx, &operator->ap, "min_distance_workspace", ws);
+        rebx_set_param_pointer(rebx, &operator->ap, "free_arrays", rebx_track_min_distance_free_arrays);
+    }
+    return ws;
+}
+
+static uint32_t rebx_min_distance_slot_of(const uint32_t hash){
+    return hash*2654435761u;    // Knuth's multiplicative hash, hashes are often small consecutive integers
+}
+
+// Returns 1 on success, 0 if out of memory. A table that could not be grown
+// is left empty, and lookups then fall back to reb_get_particle_by_hash.
+static int rebx_min_distance_build_table(struct rebx_min_distance_workspace* const ws, const struct reb_particle* const particles, const int N){
+    int size = 16;
+    while (size < 2*N){
+        size *= 2;
+    }
+    if (size - 1 != ws->mask || ws->table == NULL){
+        free(ws->table);
+        ws->table = malloc(size*sizeof(*ws->table));
+        if (ws->table == NULL){
+            ws->mask = 0;
+            ws->N = -1;
+            return 0;
+        }
+        ws->mask = size - 1;
+    }
+    for (int k=0; k<size; k++){
+        ws->table[k].index = -1;
+    }
+    for (int i=0; i<N; i++){
+        uint32_t k = rebx_min_distance_slot_of(particles[i].hash) & ws->mask;
+        while (ws->table[k].index >= 0 && ws->table[k].hash != particles[i].hash){
+            k = (k + 1) & ws->mask;
+        }
+        if (ws->table[k].index < 0){    // the first of equal hashes wins, as in reb_get_particle_by_hash
+            ws->table[k].hash = particles[i].hash;
+            ws->table[k].index = i;
+        }
+    }
+    ws->N = N;
+    return 1;
+}
+
+static int rebx_min_distance_find(const struct rebx_min_distance_workspace* const ws, const struct reb_particle* const particles, const int N, const uint32_t hash){
+    if (ws->table == NULL){
+        return -1;
+    }
+    for (uint32_t k = rebx_min_distance_slot_of(hash) & ws->mask; ws->table[k].index >= 0; k = (k + 1) & ws->mask){
+        if (ws->table[k].hash == hash){
+            const int i = ws->table[k].index;
+            return (i < N && particles[i].hash == hash) ? i : -1;
+        }
+    }
+    return -1;
+}
+
+// Returns the index of the particle with the given hash, or -1.
+static int rebx_min_distance_lookup(struct rebx_min_distance_workspace* const ws, struct reb_simulation* const sim, const int N, const uint32_t hash, int* const rebuilt){
+    int i = rebx_min_distance_find(ws, sim->particles, N, hash);
+    if (i < 0 && !*rebuilt){
+        *rebuilt = 1;
+        if (rebx_min_distance_build_table(ws, sim->particles, N)){
+            i = rebx_min_distance_find(ws, sim->particles, N, hash);
+        }
+    }
+    if (i < 0 && ws->table == NULL){
+        const struct reb_particle* const source = reb_get_particle_by_hash(sim, hash);
+        if (source != NULL){
+            i = (int)(source - sim->particles);
+        }
+    }
+    return i;
+}
+
+// Cubic Hermite interpolant of one component over s in [0,1], r(s) = a0 + a1 s + a2 s^2 + a3 s^3.
+static void rebx_min_distance_hermite(const double r0, const double v0, const double r1, const double v1, const double h, double* const a){
+    a[0] = r0;
+    a[1] = h*v0;
+    a[2] = 3.*(r1 - r0) - h*(2.*v0 + v1);
+    a[3] = 2.*(r0 - r1) + h*(v0 + v1);
+}
+
+// r.dr/ds, whose roots are the extrema of the distance
+static double rebx_min_distance_rdotv(const double a[3][4], const double s){
+    double g = 0.;
+    for (int k=0; k<3; k++){
+        const double r = a[k][0] + s*(a[k][1] + s*(a[k][2] + s*a[k][3]));
+        const double v = a[k][1] + s*(2.*a[k][2] + 3.*s*a[k][3]);
+        g += r*v;
+    }
+    return g;
+}
+
+// Smallest squared distance at a minimum strictly inside (0,1), or INFINITY
+// if there is none. Sign changes of r.v from - to + are bracketed on a fixed
+// grid, which is fine for a cubic over one step, then bisected.
+static double rebx_min_distance_interior(const double a[3][4], double* const s_min){
+    const int n_grid = 8;
+    double r2_min = INFINITY;
+    double s_prev = 0.;
+    double g_prev = rebx_min_distance_rdotv(a, 0.);
+    for (int m=1; m<=n_grid; m++){
+        const double s_next = (double)m/n_grid;
+        const double g_next = rebx_min_distance_rdotv(a, s_next);
+        if (g_prev < 0. && g_next >= 0.){
+            double lo = s_prev;
+            double hi = s_next;
+            for (int it=0; it<60 && hi - lo > 1e-15; it++){
+                const double mid = 0.5*(lo + hi);
+                if (rebx_min_distance_rdotv(a, mid) < 0.){
+                    lo = mid;
+                }
+                else{
+                    hi = mid;
+                }
+            }
+            const double s = 0.5*(lo + hi);
+            if (s < 1.){
+                double r2 = 0.;
+                for (int k=0; k<3; k++){
+                    const double r = a[k][0] + s*(a[k][1] + s*(a[k][2] + s*a[k][3]));
+                    r2 += r*r;
+                }
+                if (r2 < r2_min){
+                    r2_min = r2;
+                    *s_min = s;
+                }
+            }
+        }
+        s_prev = s_next;
+        g_prev = g_next;
+    }
+    return r2_min;
+}
+
+static void rebx_min_distance_store_orbit(struct reb_simulation* const sim, struct reb_orbit* const orbit, const struct reb_particle* const p, const struct reb_particle* const source, const double* const dr, const double* const dv){
+    struct reb_particle rel = {0};
+    struct reb_particle primary = {0};
+    rel.m = p->m;
+    rel.x = dr[0]; rel.y = dr[1]; rel.z = dr[2];
+    rel.vx = dv[0]; rel.vy = dv[1]; rel.vz = dv[2];
+    primary.m = source->m;
+    *orbit = reb_tools_particle_to_orbit(sim->G, rel, primary);
+}
 
 void rebx_track_min_distance(struct reb_simulation* const sim, struct rebx_operator* const operator, const double dt){
-    const struct rebx_extras* const rebx = sim->extras;
+    struct rebx_extras* const rebx = sim->extras;
     const int N = sim->N - sim->N_var;
+    const rebx_param_handle min_distance_h = rebx_default_param(rebx, REBX_PARAM_min_distance);
+    const rebx_param_handle target_h = rebx_default_param(rebx, REBX_PARAM_min_distance_from);
+    const rebx_param_handle orbit_h = rebx_default_param(rebx, REBX_PARAM_min_distance_orbit);
+    const int* const interpolate_p = rebx_get_param_int_h(operator->ap, rebx_default_param(rebx, REBX_PARAM_min_distance_interpolate));
+    struct rebx_min_distance_workspace* const ws = rebx_track_min_distance_workspace_get(rebx, operator);
+    if (ws == NULL){
+        rebx_error(rebx, "REBOUNDx Error: Could not allocate memory for track_min_distance.\n");
+        return;
+    }
+
+    int rebuilt = 0;
+    if (ws->N != N){
+        rebuilt = 1;
+        rebx_min_distance_build_table(ws, sim->particles, N);
+        for (int i=0; i<ws->N_alloc; i++){
+            ws->samples[i].valid = 0;
+        }
+    }
+
+    struct rebx_min_distance_sample* samples = NULL;
+    if (interpolate_p != NULL && *interpolate_p){
+        if (N > ws->N_alloc){
+            free(ws->samples);
+            ws->samples = calloc(N, sizeof(*ws->samples));
+            ws->N_alloc = ws->samples != NULL ? N : 0;
+        }
+        samples = ws->samples;
+    }
+
     for(int i=0; i<N; i++){
         struct reb_particle* const p = &sim->particles[i];
-        double* min_distance = rebx_get_param(rebx, p->ap, "min_distance");
+        double* min_distance = rebx_get_param_double_h(p->ap, min_distance_h);
         if (min_distance != NULL){
-            const uint32_t* const target = rebx_get_param(rebx, p->ap, "min_distance_from");
-            struct reb_particle* source;
-            if (target == NULL){
-                source = &sim->particles[0];
+            const uint32_t* const target = rebx_get_param_uint32_h(p->ap, target_h);
+            int source_index = 0;
+            if (target != NULL){
+                source_index = rebx_min_distance_lookup(ws, sim, N, *target, &rebuilt);
+                if (source_index < 0){
+                    char str[300];
+                    sprintf(str, "REBOUNDx Error: track_min_distance could not find a particle with hash %u (min_distance_from of particle %d).\n", *target, i);
+                    rebx_error(rebx, str);
+                    continue;
+                }
             }
-            else{
-                source = reb_get_particle_by_hash(sim, *target);
+            const struct reb_particle* const source = &sim->particles[source_index];
+            const double dr[3] = {p->x - source->x, p->y - source->y, p->z - source->z};
+            const double dv[3] = {p->vx - source->vx, p->vy - source->vy, p->vz - source->vz};
+            struct reb_orbit* const orbit = rebx_get_param_h(p->ap, orbit_h);
+
+            if (samples != NULL){
+                struct rebx_min_distance_sample* const prev = &samples[i];
+                const double h = sim->t - prev->t;
+                if (prev->valid && prev->hash == p->hash && prev->source == source_index && h != 0.){
+                    double a[3][4];
+                    for (int k=0; k<3; k++){
+                        rebx_min_distance_hermite(prev->dr[k], prev->dv[k], dr[k], dv[k], h, a[k]);
+                    }
+                    double s = 0.;
+                    const double r2 = rebx_min_distance_interior((const double (*)[4])a, &s);
+                    if (r2 < *min_distance*(*min_distance)){
+                        *min_distance = sqrt(r2);
+                        if (orbit != NULL){
+                            double dr_s[3], dv_s[3];
+                            for (int k=0; k<3; k++){
+                                dr_s[k] = a[k][0] + s*(a[k][1] + s*(a[k][2] + s*a[k][3]));
+                                dv_s[k] = (a[k][1] + s*(2.*a[k][2] + 3.*s*a[k][3]))/h;
+                            }
+                            rebx_min_distance_store_orbit(sim, orbit, p, source, dr_s, dv_s);
+                        }
+                    }
+                }
+                prev->valid = 1;
+                prev->hash = p->hash;
+                prev->source = source_index;
+                prev->t = sim->t;
+                for (int k=0; k<3; k++){
+                    prev->dr[k] = dr[k];
+                    prev->dv[k] = dv[k];
+                }
             }
-            const double dx = p->x-source->x;
-            const double dy = p->y-source->y;
-            const double dz = p->z-source->z;
-            const double r2 = dx*dx + dy*dy + dz*dz;
+
+            const double r2 = dr[0]*dr[0] + dr[1]*dr[1] + dr[2]*dr[2];
             if (r2 < *min_distance*(*min_distance)){
                 *min_distance = sqrt(r2);
-                struct reb_orbit* const orbit = rebx_get_param(rebx, p->ap, "min_distance_orbit");
                 if (orbit != NULL){
                     *orbit = reb_tools_particle_to_orbit(sim->G, *p, *source);
                 }
@@ -92,4 +360,3 @@ void rebx_track_min_distance(struct reb_simulation* const sim, struct rebx_opera
         }
     }
 }
-